@@ -86,9 +86,9 @@ _start:
     or ecx, 0x00000010
     mov cr4, ecx
 
-    ; enable paging
+    ; enable paging, with write protect so ring 0 honours read-only (copy-on-write) pages
     mov ecx, cr0
-    or ecx, 0x80000000
+    or ecx, 0x80010000
     mov cr0, ecx
 
     pop ebx
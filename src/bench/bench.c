@@ -0,0 +1,115 @@
+/**
+ * @file bench/bench.c
+ * @brief Benchmark harness: TSC calibration, reporting and the run list.
+ */
+
+#ifdef KERNEL_BENCHMARKS
+
+#include <bench.h>
+#include <x86.h>
+#include <stdio.h>
+#include <serial.h>
+#include <stdarg.h>
+
+#define BENCH_PIT_FREQUENCY_HZ  1193182u
+#define BENCH_PIT_CHANNEL2_DATA 0x42
+#define BENCH_PIT_COMMAND       0x43
+#define BENCH_PIT_GATE_PORT     0x61
+#define BENCH_CALIBRATE_MS      10u
+
+typedef void (*bench_fn)(void);
+
+/** @brief Benchmarks executed by bench_run_all, in order. */
+static const bench_fn g_benchmarks[] = {
+    bench_fork,
+    bench_fault_around,
+    bench_framebuffer,
+    bench_huge_pages,
+    bench_page_coloring,
+    bench_ide_dma,
+    bench_ide_irq,
+    bench_ide_writes,
+    bench_ide_queue,
+    bench_ide_scheduler,
+    bench_buffer_cache,
+    bench_readahead,
+    bench_ahci_queue_depth,
+    bench_virtio_vs_ide,
+};
+
+/** @brief Calibrated TSC ticks per microsecond. */
+static uint64_t g_cycles_per_us;
+
+void bench_init(void)
+{
+    uint16_t count = (uint16_t)((BENCH_PIT_FREQUENCY_HZ * BENCH_CALIBRATE_MS) / 1000u);
+
+    // Channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count); the
+    // count starts once the gate (port 0x61 bit 0) goes high.
+    uint8_t gate = x86_inb(BENCH_PIT_GATE_PORT);
+    x86_outb(BENCH_PIT_GATE_PORT, (uint8_t)(gate & ~0x03));
+    x86_outb(BENCH_PIT_COMMAND, 0xB0);
+    x86_outb(BENCH_PIT_CHANNEL2_DATA, (uint8_t)(count & 0xFF));
+    x86_outb(BENCH_PIT_CHANNEL2_DATA, (uint8_t)(count >> 8));
+
+    x86_outb(BENCH_PIT_GATE_PORT, (uint8_t)((gate & ~0x02) | 0x01));
+    uint64_t start = x86_read_tsc();
+    while ((x86_inb(BENCH_PIT_GATE_PORT) & 0x20) == 0)
+    {
+    }
+    uint64_t end = x86_read_tsc();
+
+    x86_outb(BENCH_PIT_GATE_PORT, gate);
+
+    g_cycles_per_us = (end - start) / (BENCH_CALIBRATE_MS * 1000u);
+    if (g_cycles_per_us == 0)
+    {
+        g_cycles_per_us = 1;
+    }
+
+    bench_log("BENCH: TSC %llu MHz\n", (unsigned long long)g_cycles_per_us);
+}
+
+uint64_t bench_cycles(void)
+{
+    return x86_read_tsc();
+}
+
+uint64_t bench_cycles_to_us(uint64_t cycles)
+{
+    return cycles / g_cycles_per_us;
+}
+
+uint32_t bench_mb_per_second(uint64_t bytes, uint64_t cycles)
+{
+    uint64_t us = bench_cycles_to_us(cycles);
+    if (us == 0)
+    {
+        return 0;
+    }
+    // bytes per microsecond == MB/s (decimal megabytes)
+    return (uint32_t)(bytes / us);
+}
+
+void bench_log(const char* fmt, ...)
+{
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    kputs(buf);
+    serial_write_string(buf);
+}
+
+void bench_run_all(void)
+{
+    bench_init();
+    for (size_t i = 0; i < sizeof(g_benchmarks) / sizeof(g_benchmarks[0]); ++i)
+    {
+        g_benchmarks[i]();
+    }
+}
+
+#endif
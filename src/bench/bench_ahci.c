@@ -0,0 +1,117 @@
+/**
+ * @file bench/bench_ahci.c
+ * @brief Random 4 KiB reads from a SATA disk at increasing queue depths.
+ */
+
+#ifdef KERNEL_BENCHMARKS
+
+#include <bench.h>
+#include <block_device.h>
+#include <ahci.h>
+
+#define BENCH_AHCI_BLOCK_BYTES 4096u
+#define BENCH_AHCI_READS       2048u                  /**< Reads per queue depth. */
+#define BENCH_AHCI_SPAN_BYTES  (256u * 1024u * 1024u) /**< Reads land anywhere in this much of the disk. */
+
+/** @brief One destination per request in flight; part of the kernel image, so physically contiguous. */
+static uint8_t g_bench_ahci_buffers[BLOCK_MAX_QUEUE_DEPTH][BENCH_AHCI_BLOCK_BYTES] __attribute__((aligned(4096)));
+static block_request_t g_bench_ahci_requests[BLOCK_MAX_QUEUE_DEPTH];
+
+static block_device_t* bench_ahci_find_disk(void)
+{
+    for (size_t i = 0; i < block_device_count(); ++i)
+    {
+        block_device_t* device = block_device_get(i);
+        if (device != NULL && device->name[0] == 's' && device->name[1] == 'd'
+            && device->sector_size == 512 && device->start != NULL)
+        {
+            return device;
+        }
+    }
+    return NULL;
+}
+
+static uint32_t bench_ahci_random(uint32_t* state)
+{
+    // xorshift32: cheap, and the same sequence at every depth.
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/**
+ * @brief Keep depth random reads in flight until BENCH_AHCI_READS have finished.
+ */
+static void bench_ahci_random_reads(block_device_t* disk, uint32_t depth, uint32_t blocks)
+{
+    uint32_t sectors = BENCH_AHCI_BLOCK_BYTES / disk->sector_size;
+    uint32_t seed = 0x2545F491u;
+    const ahci_stats_t* stats = ahci_get_stats();
+    uint32_t interrupts_before = stats->interrupts;
+    uint32_t queued_before = stats->queued_commands;
+    block_device_stats_t before = disk->stats;
+    bool failed = false;
+
+    depth = block_device_set_queue_depth(disk, depth);
+    disk->stats.max_in_flight = 0;
+
+    uint64_t start = bench_cycles();
+    for (uint32_t i = 0; i < BENCH_AHCI_READS + depth; ++i)
+    {
+        block_request_t* request = &g_bench_ahci_requests[i % depth];
+        if (i >= depth && !block_request_wait(request))
+        {
+            failed = true;
+        }
+        if (i < BENCH_AHCI_READS)
+        {
+            uint64_t lba = (uint64_t)(bench_ahci_random(&seed) % blocks) * sectors;
+            block_request_init(request, disk, BLOCK_REQUEST_READ, lba, sectors, g_bench_ahci_buffers[i % depth]);
+            block_request_submit(request);
+        }
+    }
+    uint64_t cycles = bench_cycles() - start;
+    uint64_t us = bench_cycles_to_us(cycles);
+    uint64_t bytes = (uint64_t)BENCH_AHCI_READS * BENCH_AHCI_BLOCK_BYTES;
+    uint32_t dispatched = disk->stats.requests - before.requests;
+
+    bench_log("BENCH: %s random 4 KiB reads QD%u: %llu IOPS, %u MB/s, max in flight %u, "
+              "%u queued commands, %u interrupts, mean queue wait %llu us%s\n",
+              disk->name,
+              depth,
+              (unsigned long long)(us ? (uint64_t)BENCH_AHCI_READS * 1000000u / us : 0),
+              bench_mb_per_second(bytes, cycles),
+              disk->stats.max_in_flight,
+              stats->queued_commands - queued_before,
+              stats->interrupts - interrupts_before,
+              (unsigned long long)(dispatched ? bench_cycles_to_us((disk->stats.wait_cycles - before.wait_cycles) / dispatched) : 0),
+              failed ? " (read failed)" : "");
+}
+
+void bench_ahci_queue_depth(void)
+{
+    block_device_t* disk = bench_ahci_find_disk();
+    uint64_t span = BENCH_AHCI_SPAN_BYTES / 512u;
+    if (disk == NULL || disk->sector_count < BENCH_AHCI_BLOCK_BYTES / 512u)
+    {
+        bench_log("BENCH: AHCI queue depth skipped (no SATA disk)\n");
+        return;
+    }
+
+    if (span > disk->sector_count)
+    {
+        span = disk->sector_count;
+    }
+    uint32_t blocks = (uint32_t)(span / (BENCH_AHCI_BLOCK_BYTES / disk->sector_size));
+
+    for (uint32_t depth = 1; depth <= BLOCK_MAX_QUEUE_DEPTH; depth *= 2)
+    {
+        bench_ahci_random_reads(disk, depth, blocks);
+    }
+    block_device_set_queue_depth(disk, BLOCK_MAX_QUEUE_DEPTH);
+}
+
+#endif
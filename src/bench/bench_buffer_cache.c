@@ -0,0 +1,178 @@
+/**
+ * @file bench/bench_buffer_cache.c
+ * @brief Repeated ext2 path lookups and sequential file reads through the block buffer cache.
+ */
+
+#ifdef KERNEL_BENCHMARKS
+
+#include <bench.h>
+#include <buffer_cache.h>
+#include <filesystem.h>
+#include <stdio.h>
+#include <vfs.h>
+
+#define BENCH_BCACHE_NAMES  8  /**< Root entries looked up each round. */
+#define BENCH_BCACHE_ROUNDS 32
+
+typedef struct {
+    char     names[BENCH_BCACHE_NAMES][64];
+    uint32_t count;
+} bench_bcache_names_t;
+
+static bool bench_bcache_collect(const char* name, uint32_t inode, uint8_t type, void* context)
+{
+    (void)inode;
+    bench_bcache_names_t* names = (bench_bcache_names_t*)context;
+
+    // Regular files only (ext2 file type 1); directories cannot be opened.
+    if (type == 1)
+    {
+        snprintf(names->names[names->count++], sizeof(names->names[0]), "%s", name);
+    }
+    return names->count < BENCH_BCACHE_NAMES;
+}
+
+void bench_buffer_cache(void)
+{
+    filesystem_mount_t* mount = NULL;
+    for (size_t i = 0; i < filesystem_mount_count() && mount == NULL; ++i)
+    {
+        filesystem_mount_t* candidate = filesystem_get_mount(i);
+        if (candidate != NULL && candidate->kind == FILESYSTEM_KIND_EXT2)
+        {
+            mount = candidate;
+        }
+    }
+
+    static bench_bcache_names_t names;
+    names.count = 0;
+    if (mount == NULL || !vfs_list_root(mount->name, bench_bcache_collect, &names) || names.count == 0)
+    {
+        bench_log("BENCH: buffer cache skipped (no ext2 mount with files)\n");
+        return;
+    }
+
+    const buffer_cache_stats_t* stats = buffer_cache_get_stats(mount->device);
+    if (stats == NULL)
+    {
+        bench_log("BENCH: buffer cache skipped (%s does not use it)\n", mount->name);
+        return;
+    }
+    buffer_cache_stats_t before = *stats;
+    uint32_t lookups = 0;
+
+    uint64_t start = bench_cycles();
+    for (uint32_t round = 0; round < BENCH_BCACHE_ROUNDS; ++round)
+    {
+        for (uint32_t i = 0; i < names.count; ++i)
+        {
+            char path[96];
+            snprintf(path, sizeof(path), "%s/%s", mount->name, names.names[i]);
+            vfs_file_t* file = vfs_file_open(path);
+            if (file != NULL)
+            {
+                vfs_file_put(file);
+                lookups++;
+            }
+        }
+    }
+    uint64_t cycles = bench_cycles() - start;
+
+    uint32_t hits = stats->hits - before.hits;
+    uint32_t misses = stats->misses - before.misses;
+    bench_log("BENCH: %s: %u path lookups in %llu us (%llu ns each), %u block hits, %u misses (%u%% hit rate)\n",
+              mount->name,
+              lookups,
+              (unsigned long long)bench_cycles_to_us(cycles),
+              (unsigned long long)(lookups ? bench_cycles_to_us(cycles * 1000u) / lookups : 0),
+              hits,
+              misses,
+              (hits + misses) ? (hits * 100u) / (hits + misses) : 0);
+}
+
+#define BENCH_READAHEAD_CHUNK 1024 /**< Bytes per read, like a filesystem walking its blocks. */
+
+/**
+ * @brief Read the largest file in the root of the first ext2 mount in small sequential chunks.
+ */
+void bench_readahead(void)
+{
+    filesystem_mount_t* mount = NULL;
+    for (size_t i = 0; i < filesystem_mount_count() && mount == NULL; ++i)
+    {
+        filesystem_mount_t* candidate = filesystem_get_mount(i);
+        if (candidate != NULL && candidate->kind == FILESYSTEM_KIND_EXT2)
+        {
+            mount = candidate;
+        }
+    }
+
+    static bench_bcache_names_t names;
+    names.count = 0;
+    if (mount == NULL || !vfs_list_root(mount->name, bench_bcache_collect, &names))
+    {
+        bench_log("BENCH: readahead skipped (no ext2 mount)\n");
+        return;
+    }
+
+    vfs_file_t* largest = NULL;
+    for (uint32_t i = 0; i < names.count; ++i)
+    {
+        char path[96];
+        snprintf(path, sizeof(path), "%s/%s", mount->name, names.names[i]);
+        vfs_file_t* file = vfs_file_open(path);
+        if (file != NULL && (largest == NULL || file->size > largest->size))
+        {
+            if (largest != NULL)
+            {
+                vfs_file_put(largest);
+            }
+            largest = file;
+        }
+        else if (file != NULL)
+        {
+            vfs_file_put(file);
+        }
+    }
+
+    const buffer_cache_stats_t* stats = buffer_cache_get_stats(mount->device);
+    if (largest == NULL || stats == NULL || largest->size == 0)
+    {
+        bench_log("BENCH: readahead skipped (no file to read)\n");
+        if (largest != NULL)
+        {
+            vfs_file_put(largest);
+        }
+        return;
+    }
+
+    static uint8_t chunk[BENCH_READAHEAD_CHUNK];
+    buffer_cache_stats_t before = *stats;
+    uint32_t done = 0;
+
+    uint64_t start = bench_cycles();
+    while (done < largest->size)
+    {
+        uint32_t read = vfs_read(largest, done, chunk, sizeof(chunk));
+        if (read == 0)
+        {
+            break;
+        }
+        done += read;
+    }
+    uint64_t cycles = bench_cycles() - start;
+
+    bench_log("BENCH: %s sequential read: %u KiB in %llu us, %u MB/s, %u misses, %u read ahead, "
+              "%u readahead hits, %u unused\n",
+              mount->name,
+              done / 1024,
+              (unsigned long long)bench_cycles_to_us(cycles),
+              bench_mb_per_second(done, cycles),
+              stats->misses - before.misses,
+              stats->readahead - before.readahead,
+              stats->readahead_hits - before.readahead_hits,
+              stats->readahead_unused - before.readahead_unused);
+    vfs_file_put(largest);
+}
+
+#endif
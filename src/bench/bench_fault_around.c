@@ -0,0 +1,74 @@
+/**
+ * @file bench/bench_fault_around.c
+ * @brief Page faults taken by a sequential scan of never-touched memory.
+ */
+
+#ifdef KERNEL_BENCHMARKS
+
+#include <bench.h>
+#include <address_space.h>
+#include <meminit.h>
+#include <paging.h>
+
+#define BENCH_FAULT_AROUND_BASE  0x10000000u       /**< User address scanned by the benchmark. */
+#define BENCH_FAULT_AROUND_BYTES (16u * 1024u * 1024u)
+
+static void bench_fault_around_window(uint32_t window)
+{
+    address_space_t* previous = address_space_current();
+    address_space_t* space = address_space_create();
+    if (space == NULL)
+    {
+        return;
+    }
+    if (vma_map(space, BENCH_FAULT_AROUND_BASE, BENCH_FAULT_AROUND_BYTES, VMA_READ | VMA_WRITE, VMA_ANONYMOUS) == NULL)
+    {
+        address_space_destroy(space);
+        return;
+    }
+    address_space_switch(space);
+    vmm_set_fault_around_pages(window);
+    vmm_reset_fault_stats();
+
+    uint32_t sum = 0;
+    uint64_t start = bench_cycles();
+    for (uint32_t offset = 0; offset < BENCH_FAULT_AROUND_BYTES; offset += PAGE_SIZE_BYTES)
+    {
+        sum += *(volatile uint32_t*)(BENCH_FAULT_AROUND_BASE + offset);
+    }
+    uint64_t read_cycles = bench_cycles() - start;
+    const vmm_fault_stats_t* stats = vmm_get_fault_stats();
+    uint32_t read_faults = stats->faults;
+
+    start = bench_cycles();
+    for (uint32_t offset = 0; offset < BENCH_FAULT_AROUND_BYTES; offset += PAGE_SIZE_BYTES)
+    {
+        *(volatile uint32_t*)(BENCH_FAULT_AROUND_BASE + offset) = offset;
+    }
+    uint64_t write_cycles = bench_cycles() - start;
+
+    bench_log("BENCH: fault-around %u: read scan %u faults %llu us, write scan %u faults %llu us (sum %u)\n",
+              window,
+              read_faults,
+              (unsigned long long)bench_cycles_to_us(read_cycles),
+              stats->faults - read_faults,
+              (unsigned long long)bench_cycles_to_us(write_cycles),
+              sum);
+
+    address_space_switch(previous);
+    address_space_destroy(space);
+}
+
+void bench_fault_around(void)
+{
+    // Huge pages would populate whole 4 MiB blocks and hide the difference.
+    vmm_set_huge_pages_enabled(false);
+
+    // A window of one page is the old one-fault-per-page behaviour.
+    bench_fault_around_window(1);
+    bench_fault_around_window(16);
+    vmm_set_fault_around_pages(16);
+    vmm_set_huge_pages_enabled(true);
+}
+
+#endif
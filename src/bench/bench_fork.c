@@ -0,0 +1,76 @@
+/**
+ * @file bench/bench_fork.c
+ * @brief Copy-on-write fork latency against resident set size.
+ */
+
+#ifdef KERNEL_BENCHMARKS
+
+#include <bench.h>
+#include <address_space.h>
+#include <meminit.h>
+#include <paging.h>
+
+#define BENCH_FORK_BASE 0x10000000u /**< User address populated by the benchmark. */
+
+static void bench_fork_size(uint32_t megabytes)
+{
+    uint32_t bytes = megabytes * 1024u * 1024u;
+    uint32_t pages = bytes / PAGE_SIZE_BYTES;
+
+    // resident pages + their page tables + the child's page tables and copies
+    if (pmm_free_page_count() < pages + (pages / 512u) + 64u)
+    {
+        bench_log("BENCH: fork %u MiB skipped (not enough memory)\n", megabytes);
+        return;
+    }
+
+    address_space_t* previous = address_space_current();
+    address_space_t* parent = address_space_create();
+    if (parent == NULL)
+    {
+        return;
+    }
+    if (vma_map(parent, BENCH_FORK_BASE, bytes, VMA_READ | VMA_WRITE, VMA_ANONYMOUS) == NULL)
+    {
+        address_space_destroy(parent);
+        return;
+    }
+    address_space_switch(parent);
+
+    for (uint32_t offset = 0; offset < bytes; offset += PAGE_SIZE_BYTES)
+    {
+        *(volatile uint32_t*)(BENCH_FORK_BASE + offset) = offset;
+    }
+
+    uint64_t start = bench_cycles();
+    address_space_t* child = address_space_fork(parent);
+    uint64_t fork_cycles = bench_cycles() - start;
+
+    // First write to each page after the fork pays the deferred copy.
+    start = bench_cycles();
+    for (uint32_t offset = 0; offset < bytes; offset += PAGE_SIZE_BYTES)
+    {
+        *(volatile uint32_t*)(BENCH_FORK_BASE + offset) = ~offset;
+    }
+    uint64_t touch_cycles = bench_cycles() - start;
+
+    bench_log("BENCH: fork %u MiB (%u pages, %u tables): fork %llu us, first-write copy %llu us\n",
+              megabytes,
+              pages,
+              (pages + 1023u) / 1024u,
+              (unsigned long long)bench_cycles_to_us(fork_cycles),
+              (unsigned long long)bench_cycles_to_us(touch_cycles));
+
+    address_space_switch(previous);
+    address_space_destroy(child);
+    address_space_destroy(parent);
+}
+
+void bench_fork(void)
+{
+    bench_fork_size(4);
+    bench_fork_size(16);
+    bench_fork_size(64);
+}
+
+#endif
@@ -0,0 +1,64 @@
+/**
+ * @file bench/bench_framebuffer.c
+ * @brief Framebuffer fill and glyph rates for each memory type.
+ */
+
+#ifdef KERNEL_BENCHMARKS
+
+#include <bench.h>
+#include <framebuffer.h>
+#include <pat.h>
+#include <stddef.h>
+
+#define BENCH_FRAMEBUFFER_CLEARS 8
+#define BENCH_FRAMEBUFFER_GLYPHS 4000
+
+static void bench_framebuffer_mode(enum page_cache_mode_t mode, const char* name)
+{
+    framebuffer_set_cache_mode(mode);
+
+    uint64_t bytes = (uint64_t)g_framebuffer.width * g_framebuffer.height * 4u * BENCH_FRAMEBUFFER_CLEARS;
+    uint64_t start = bench_cycles();
+    for (uint32_t i = 0; i < BENCH_FRAMEBUFFER_CLEARS; ++i)
+    {
+        framebuffer_clear();
+    }
+    uint64_t clear_cycles = bench_cycles() - start;
+
+    uint32_t columns = g_framebuffer.width / 8u;
+    start = bench_cycles();
+    for (uint32_t i = 0; i < BENCH_FRAMEBUFFER_GLYPHS; ++i)
+    {
+        drawchar('A' + (i % 26), (i % columns) * 8u, ((i / columns) * 16u) % (g_framebuffer.height - 16u),
+                 0x00ffff00, 0x002366);
+    }
+    uint64_t glyph_cycles = bench_cycles() - start;
+
+    bench_log("BENCH: framebuffer %s: fill %u MB/s, %u glyphs in %llu us\n",
+              name,
+              bench_mb_per_second(bytes, clear_cycles),
+              BENCH_FRAMEBUFFER_GLYPHS,
+              (unsigned long long)bench_cycles_to_us(glyph_cycles));
+}
+
+void bench_framebuffer(void)
+{
+    if (g_framebuffer.address == NULL || g_framebuffer.bpp != 32 || g_framebuffer.height <= 16u)
+    {
+        bench_log("BENCH: framebuffer skipped (no 32 bpp framebuffer)\n");
+        return;
+    }
+
+    // "default" is the old mapping: PAT entry 0, so VRAM gets whatever the MTRRs say.
+    bench_framebuffer_mode(CACHE_WRITE_BACK, "default");
+    bench_framebuffer_mode(CACHE_UNCACHED, "uncached");
+    if (pat_supported())
+    {
+        bench_framebuffer_mode(CACHE_WRITE_COMBINING, "write-combining");
+    }
+
+    framebuffer_set_cache_mode(CACHE_WRITE_COMBINING);
+    framebuffer_clear();
+}
+
+#endif
@@ -0,0 +1,82 @@
+/**
+ * @file bench/bench_huge_pages.c
+ * @brief Populate and access cost of a large anonymous mapping with and without huge pages.
+ */
+
+#ifdef KERNEL_BENCHMARKS
+
+#include <bench.h>
+#include <address_space.h>
+#include <meminit.h>
+#include <paging.h>
+
+#define BENCH_HUGE_BASE   0x10000000u           /**< 4 MiB aligned user address. */
+#define BENCH_HUGE_BYTES  (32u * 1024u * 1024u)
+#define BENCH_HUGE_STRIDE (PAGE_SIZE_BYTES + 64u) /**< Touch a new page (and line) on every access. */
+#define BENCH_HUGE_ROUNDS 8
+
+static void bench_huge_pages_mode(bool enabled)
+{
+    address_space_t* previous = address_space_current();
+    address_space_t* space = address_space_create();
+    if (space == NULL)
+    {
+        return;
+    }
+    if (vma_map(space, BENCH_HUGE_BASE, BENCH_HUGE_BYTES, VMA_READ | VMA_WRITE, VMA_ANONYMOUS) == NULL)
+    {
+        address_space_destroy(space);
+        return;
+    }
+    address_space_switch(space);
+    vmm_set_huge_pages_enabled(enabled);
+    vmm_reset_fault_stats();
+
+    uint64_t start = bench_cycles();
+    for (uint32_t offset = 0; offset < BENCH_HUGE_BYTES; offset += PAGE_SIZE_BYTES)
+    {
+        *(volatile uint32_t*)(BENCH_HUGE_BASE + offset) = offset;
+    }
+    uint64_t populate_cycles = bench_cycles() - start;
+    const vmm_fault_stats_t* stats = vmm_get_fault_stats();
+    uint32_t populate_faults = stats->faults;
+
+    // Strided reads across the whole buffer mostly measure TLB reach.
+    uint32_t sum = 0;
+    start = bench_cycles();
+    for (uint32_t round = 0; round < BENCH_HUGE_ROUNDS; ++round)
+    {
+        for (uint32_t offset = 0; offset < BENCH_HUGE_BYTES - sizeof(uint32_t); offset += BENCH_HUGE_STRIDE)
+        {
+            sum += *(volatile uint32_t*)(BENCH_HUGE_BASE + offset);
+        }
+    }
+    uint64_t access_cycles = bench_cycles() - start;
+
+    bench_log("BENCH: huge pages %s: populate %u faults %llu us, strided reads %llu us, "
+              "%u huge, %u fallbacks (sum %u)\n",
+              enabled ? "on" : "off",
+              populate_faults,
+              (unsigned long long)bench_cycles_to_us(populate_cycles),
+              (unsigned long long)bench_cycles_to_us(access_cycles),
+              stats->huge_page_faults,
+              stats->huge_page_fallbacks,
+              sum);
+
+    address_space_switch(previous);
+    address_space_destroy(space);
+}
+
+void bench_huge_pages(void)
+{
+    if (pmm_free_page_count() < (BENCH_HUGE_BYTES / PAGE_SIZE_BYTES) + 64u)
+    {
+        bench_log("BENCH: huge pages skipped (not enough memory)\n");
+        return;
+    }
+
+    bench_huge_pages_mode(false);
+    bench_huge_pages_mode(true);
+}
+
+#endif
@@ -0,0 +1,341 @@
+/**
+ * @file bench/bench_ide.c
+ * @brief Sequential disk reads and writes: PIO versus bus-master DMA, polling versus interrupts.
+ */
+
+#ifdef KERNEL_BENCHMARKS
+
+#include <bench.h>
+#include <block_device.h>
+#include <ide.h>
+
+#define BENCH_IDE_REQUEST_BYTES (512u * 1024u)       /**< Four LBA28 commands, or one LBA48 command. */
+#define BENCH_IDE_TOTAL_BYTES   (8u * 1024u * 1024u)
+
+/** @brief Destination of every request; part of the kernel image, so physically contiguous. */
+static uint8_t g_bench_ide_buffer[BENCH_IDE_REQUEST_BYTES] __attribute__((aligned(4096)));
+
+static block_device_t* bench_ide_find_disk(void)
+{
+    for (size_t i = 0; i < block_device_count(); ++i)
+    {
+        block_device_t* device = block_device_get(i);
+        if (device != NULL && device->name[0] == 'h' && device->name[1] == 'd'
+            && device->sector_size == 512 && device->read != NULL)
+        {
+            return device;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Read total bytes in BENCH_IDE_REQUEST_BYTES requests and report the rate.
+ *
+ * CPU time is the elapsed time minus what the driver spent halted on drive
+ * interrupts; a polled transfer keeps the CPU busy throughout.
+ */
+static void bench_ide_read(block_device_t* disk, bool dma, bool irq, uint32_t total)
+{
+    uint32_t sectors = BENCH_IDE_REQUEST_BYTES / disk->sector_size;
+    uint32_t requests = total / BENCH_IDE_REQUEST_BYTES;
+
+    ide_set_dma_enabled(dma);
+    ide_set_irq_enabled(irq);
+    const ide_stats_t* stats = ide_get_stats();
+    uint64_t halted_before = stats->halted_cycles;
+    uint32_t interrupts_before = stats->interrupts;
+    uint32_t commands_before = stats->commands;
+
+    uint64_t start = bench_cycles();
+    uint32_t done = 0;
+    for (; done < requests; ++done)
+    {
+        if (!disk->read(disk, (uint64_t)done * sectors, sectors, g_bench_ide_buffer))
+        {
+            break;
+        }
+    }
+    uint64_t cycles = bench_cycles() - start;
+    uint64_t halted = stats->halted_cycles - halted_before;
+    uint64_t bytes = (uint64_t)done * BENCH_IDE_REQUEST_BYTES;
+    uint32_t megabytes = (uint32_t)(bytes / (1024u * 1024u));
+
+    bench_log("BENCH: %s %s/%s: %u KiB in %llu us, %u MB/s, %llu us CPU per MiB, %u commands, %u irqs%s\n",
+              disk->name,
+              dma ? "DMA" : "PIO",
+              irq ? "irq" : "poll",
+              (uint32_t)(bytes / 1024),
+              (unsigned long long)bench_cycles_to_us(cycles),
+              bench_mb_per_second(bytes, cycles),
+              (unsigned long long)(megabytes ? bench_cycles_to_us(cycles - halted) / megabytes : 0),
+              stats->commands - commands_before,
+              stats->interrupts - interrupts_before,
+              done < requests ? " (read failed)" : "");
+
+    ide_set_dma_enabled(true);
+    ide_set_irq_enabled(true);
+}
+
+/**
+ * @brief Bytes to read from the disk: BENCH_IDE_TOTAL_BYTES or the whole disk if smaller.
+ */
+static uint32_t bench_ide_total(const block_device_t* disk)
+{
+    uint32_t total = BENCH_IDE_TOTAL_BYTES;
+    if (disk->sector_count * disk->sector_size < total)
+    {
+        total = (uint32_t)(disk->sector_count * disk->sector_size) & ~(BENCH_IDE_REQUEST_BYTES - 1);
+    }
+    return total;
+}
+
+void bench_ide_dma(void)
+{
+    block_device_t* disk = bench_ide_find_disk();
+    if (disk == NULL || bench_ide_total(disk) == 0)
+    {
+        bench_log("BENCH: IDE DMA skipped (no ATA disk)\n");
+        return;
+    }
+
+    // Read everything once so both runs see the same host-side caching.
+    uint32_t total = bench_ide_total(disk);
+    bench_ide_read(disk, true, true, total);
+    bench_ide_read(disk, false, true, total);
+    bench_ide_read(disk, true, true, total);
+}
+
+void bench_ide_irq(void)
+{
+    block_device_t* disk = bench_ide_find_disk();
+    if (disk == NULL || bench_ide_total(disk) == 0)
+    {
+        bench_log("BENCH: IDE interrupts skipped (no ATA disk)\n");
+        return;
+    }
+
+    uint32_t total = bench_ide_total(disk);
+    bench_ide_read(disk, false, false, total);
+    bench_ide_read(disk, false, true, total);
+    bench_ide_read(disk, true, false, total);
+    bench_ide_read(disk, true, true, total);
+}
+
+/**
+ * @brief Time rewriting the disk's own contents, then the cache flush.
+ *
+ * Each request is read back untimed and written unchanged, so the disk
+ * image is left as it was even if the run is interrupted.
+ */
+static void bench_ide_write(block_device_t* disk, bool dma, uint32_t total)
+{
+    uint32_t sectors = BENCH_IDE_REQUEST_BYTES / disk->sector_size;
+    uint32_t requests = total / BENCH_IDE_REQUEST_BYTES;
+    uint64_t write_cycles = 0;
+    uint32_t done = 0;
+
+    for (; done < requests; ++done)
+    {
+        uint64_t lba = (uint64_t)done * sectors;
+        ide_set_dma_enabled(true);
+        if (!disk->read(disk, lba, sectors, g_bench_ide_buffer))
+        {
+            break;
+        }
+
+        ide_set_dma_enabled(dma);
+        uint64_t start = bench_cycles();
+        bool written = disk->write(disk, lba, sectors, g_bench_ide_buffer);
+        write_cycles += bench_cycles() - start;
+        if (!written)
+        {
+            break;
+        }
+    }
+
+    uint64_t start = bench_cycles();
+    bool flushed = block_device_flush(disk);
+    uint64_t flush_cycles = bench_cycles() - start;
+    uint64_t bytes = (uint64_t)done * BENCH_IDE_REQUEST_BYTES;
+
+    bench_log("BENCH: %s %s write: %u KiB in %llu us, %u MB/s, flush %llu us%s\n",
+              disk->name,
+              dma ? "DMA" : "PIO",
+              (uint32_t)(bytes / 1024),
+              (unsigned long long)bench_cycles_to_us(write_cycles),
+              bench_mb_per_second(bytes, write_cycles),
+              (unsigned long long)bench_cycles_to_us(flush_cycles),
+              (done < requests || !flushed) ? " (failed)" : "");
+
+    ide_set_dma_enabled(true);
+}
+
+void bench_ide_writes(void)
+{
+    block_device_t* disk = bench_ide_find_disk();
+    if (disk == NULL || disk->write == NULL || bench_ide_total(disk) == 0)
+    {
+        bench_log("BENCH: IDE writes skipped (no writable ATA disk)\n");
+        return;
+    }
+
+    uint32_t total = bench_ide_total(disk);
+    bench_ide_read(disk, false, true, total);
+    bench_ide_write(disk, false, total);
+    bench_ide_read(disk, true, true, total);
+    bench_ide_write(disk, true, total);
+}
+
+#define BENCH_IDE_QUEUE_DEPTH 4 /**< Requests in flight, each a quarter of the buffer. */
+
+/**
+ * @brief Read total bytes keeping BENCH_IDE_QUEUE_DEPTH requests queued, or one at a time.
+ *
+ * The submit time is how long the CPU was held before it could do other
+ * work; with asynchronous completion it covers only queueing and the first
+ * command.
+ */
+static void bench_ide_queue_read(block_device_t* disk, bool queued, uint32_t total)
+{
+    static block_request_t requests[BENCH_IDE_QUEUE_DEPTH];
+    uint32_t bytes_per_request = BENCH_IDE_REQUEST_BYTES / BENCH_IDE_QUEUE_DEPTH;
+    uint32_t sectors = bytes_per_request / disk->sector_size;
+    uint32_t rounds = total / BENCH_IDE_REQUEST_BYTES;
+    uint64_t submit_cycles = 0;
+    bool failed = false;
+
+    uint64_t start = bench_cycles();
+    for (uint32_t round = 0; round < rounds && !failed; ++round)
+    {
+        for (uint32_t i = 0; i < BENCH_IDE_QUEUE_DEPTH; ++i)
+        {
+            uint64_t lba = ((uint64_t)round * BENCH_IDE_QUEUE_DEPTH + i) * sectors;
+            block_request_init(&requests[i], disk, BLOCK_REQUEST_READ, lba, sectors,
+                               g_bench_ide_buffer + i * bytes_per_request);
+
+            uint64_t submit_start = bench_cycles();
+            if (!block_request_submit(&requests[i]))
+            {
+                failed = true;
+            }
+            submit_cycles += bench_cycles() - submit_start;
+
+            if (!queued && !block_request_wait(&requests[i]))
+            {
+                failed = true;
+            }
+        }
+
+        for (uint32_t i = 0; queued && i < BENCH_IDE_QUEUE_DEPTH; ++i)
+        {
+            if (!block_request_wait(&requests[i]))
+            {
+                failed = true;
+            }
+        }
+    }
+    uint64_t cycles = bench_cycles() - start;
+    uint64_t bytes = (uint64_t)rounds * BENCH_IDE_REQUEST_BYTES;
+
+    bench_log("BENCH: %s %s: %u KiB in %llu us, %u MB/s, submit %llu us%s\n",
+              disk->name,
+              queued ? "queued x4" : "one at a time",
+              (uint32_t)(bytes / 1024),
+              (unsigned long long)bench_cycles_to_us(cycles),
+              bench_mb_per_second(bytes, cycles),
+              (unsigned long long)bench_cycles_to_us(submit_cycles),
+              failed ? " (read failed)" : "");
+}
+
+void bench_ide_queue(void)
+{
+    block_device_t* disk = bench_ide_find_disk();
+    if (disk == NULL || bench_ide_total(disk) == 0)
+    {
+        bench_log("BENCH: IDE request queue skipped (no ATA disk)\n");
+        return;
+    }
+
+    uint32_t total = bench_ide_total(disk);
+    bench_ide_read(disk, true, true, total);
+    bench_ide_queue_read(disk, false, total);
+    bench_ide_queue_read(disk, true, total);
+}
+
+#define BENCH_IDE_SCATTER_REQUESTS 64 /**< 8 KiB reads covering the buffer, submitted out of order. */
+
+/**
+ * @brief Read the buffer's worth of disk as shuffled 8 KiB requests and report what the scheduler made of them.
+ */
+static void bench_ide_scatter_read(block_device_t* disk, bool plugged, uint32_t rounds)
+{
+    static block_request_t requests[BENCH_IDE_SCATTER_REQUESTS];
+    uint32_t bytes_per_request = BENCH_IDE_REQUEST_BYTES / BENCH_IDE_SCATTER_REQUESTS;
+    uint32_t sectors = bytes_per_request / disk->sector_size;
+    block_device_stats_t before = disk->stats;
+    bool failed = false;
+
+    uint64_t start = bench_cycles();
+    for (uint32_t round = 0; round < rounds; ++round)
+    {
+        if (plugged)
+        {
+            block_device_plug(disk);
+        }
+        for (uint32_t i = 0; i < BENCH_IDE_SCATTER_REQUESTS; ++i)
+        {
+            // 37 is coprime with the request count, so this visits every slot once.
+            uint32_t slot = (i * 37u) % BENCH_IDE_SCATTER_REQUESTS;
+            uint64_t lba = (uint64_t)round * (BENCH_IDE_REQUEST_BYTES / disk->sector_size) + slot * sectors;
+            block_request_init(&requests[i], disk, BLOCK_REQUEST_READ, lba, sectors,
+                               g_bench_ide_buffer + slot * bytes_per_request);
+            block_request_submit(&requests[i]);
+        }
+        if (plugged)
+        {
+            block_device_unplug(disk);
+        }
+
+        for (uint32_t i = 0; i < BENCH_IDE_SCATTER_REQUESTS; ++i)
+        {
+            if (!block_request_wait(&requests[i]))
+            {
+                failed = true;
+            }
+        }
+    }
+    uint64_t cycles = bench_cycles() - start;
+    uint64_t bytes = (uint64_t)rounds * BENCH_IDE_REQUEST_BYTES;
+    uint32_t dispatched = disk->stats.requests - before.requests;
+
+    bench_log("BENCH: %s shuffled 8 KiB reads%s: %u KiB in %llu us, %u MB/s, %u commands, %u merges, "
+              "max depth %u, mean wait %llu us%s\n",
+              disk->name,
+              plugged ? " (plugged)" : "",
+              (uint32_t)(bytes / 1024),
+              (unsigned long long)bench_cycles_to_us(cycles),
+              bench_mb_per_second(bytes, cycles),
+              disk->stats.commands - before.commands,
+              disk->stats.merges - before.merges,
+              disk->stats.max_queued,
+              (unsigned long long)(dispatched ? bench_cycles_to_us((disk->stats.wait_cycles - before.wait_cycles) / dispatched) : 0),
+              failed ? " (read failed)" : "");
+}
+
+void bench_ide_scheduler(void)
+{
+    block_device_t* disk = bench_ide_find_disk();
+    if (disk == NULL || bench_ide_total(disk) == 0)
+    {
+        bench_log("BENCH: IDE scheduler skipped (no ATA disk)\n");
+        return;
+    }
+
+    uint32_t rounds = bench_ide_total(disk) / BENCH_IDE_REQUEST_BYTES;
+    bench_ide_read(disk, true, true, bench_ide_total(disk));
+    bench_ide_scatter_read(disk, false, rounds);
+    bench_ide_scatter_read(disk, true, rounds);
+}
+
+#endif
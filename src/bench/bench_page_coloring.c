@@ -0,0 +1,152 @@
+/**
+ * @file bench/bench_page_coloring.c
+ * @brief Cache conflict misses of a strided sweep with and without colored frame allocation.
+ */
+
+#ifdef KERNEL_BENCHMARKS
+
+#include <bench.h>
+#include <address_space.h>
+#include <meminit.h>
+#include <paging.h>
+
+#define BENCH_COLOR_BASE       0x10000000u
+#define BENCH_COLOR_LINE       64u       /**< Stride: one access per cache line. */
+#define BENCH_COLOR_ROUNDS     64
+#define BENCH_COLOR_MAX_PAGES  4096u     /**< Working sets above 16 MiB are clamped. */
+#define BENCH_COLOR_HOLES      (BENCH_COLOR_MAX_PAGES * 4u)
+
+/** @brief Frames pinned down to scatter the free list before each run. */
+static uintptr_t g_bench_color_frames[BENCH_COLOR_HOLES];
+
+/**
+ * @brief Leave free frames scattered so lowest-first allocation returns arbitrary colors.
+ *
+ * @return Number of frames still held (released by bench_color_release()).
+ */
+static uint32_t bench_color_fragment(uint32_t frames)
+{
+    uint32_t held = 0;
+    for (uint32_t i = 0; i < frames; ++i)
+    {
+        uintptr_t frame = pmm_allocate_page();
+        if (frame == 0)
+        {
+            break;
+        }
+        g_bench_color_frames[held++] = frame;
+    }
+
+    // Free a pseudo-random half of them (LCG, fixed seed so runs compare).
+    uint32_t seed = 12345u;
+    for (uint32_t i = 0; i < held; ++i)
+    {
+        seed = seed * 1103515245u + 12345u;
+        if ((seed >> 16) & 1u)
+        {
+            pmm_free_page(g_bench_color_frames[i]);
+            g_bench_color_frames[i] = 0;
+        }
+    }
+    return held;
+}
+
+static void bench_color_release(uint32_t held)
+{
+    for (uint32_t i = 0; i < held; ++i)
+    {
+        pmm_free_page(g_bench_color_frames[i]);
+        g_bench_color_frames[i] = 0;
+    }
+}
+
+static void bench_page_coloring_mode(bool colored, uint32_t pages)
+{
+    uint32_t bytes = pages * PAGE_SIZE_BYTES;
+    uint32_t held = bench_color_fragment(pages * 4u);
+
+    address_space_t* previous = address_space_current();
+    address_space_t* space = address_space_create();
+    if (space == NULL || vma_map(space, BENCH_COLOR_BASE, bytes, VMA_READ | VMA_WRITE, VMA_ANONYMOUS) == NULL)
+    {
+        address_space_destroy(space);
+        bench_color_release(held);
+        return;
+    }
+
+    address_space_switch(space);
+    vmm_set_huge_pages_enabled(false);
+    pmm_set_page_coloring(colored);
+    const pmm_color_stats_t* stats = pmm_get_color_stats();
+    uint32_t colored_before = stats->colored;
+    uint32_t fallbacks_before = stats->fallbacks;
+
+    for (uint32_t offset = 0; offset < bytes; offset += PAGE_SIZE_BYTES)
+    {
+        *(volatile uint32_t*)(BENCH_COLOR_BASE + offset) = offset;
+    }
+
+    // Warm the cache once, then time repeated sweeps of the working set.
+    uint32_t sum = 0;
+    for (uint32_t offset = 0; offset < bytes; offset += BENCH_COLOR_LINE)
+    {
+        sum += *(volatile uint32_t*)(BENCH_COLOR_BASE + offset);
+    }
+
+    uint64_t start = bench_cycles();
+    for (uint32_t round = 0; round < BENCH_COLOR_ROUNDS; ++round)
+    {
+        for (uint32_t offset = 0; offset < bytes; offset += BENCH_COLOR_LINE)
+        {
+            sum += *(volatile uint32_t*)(BENCH_COLOR_BASE + offset);
+        }
+    }
+    uint64_t cycles = bench_cycles() - start;
+    uint32_t accesses = (bytes / BENCH_COLOR_LINE) * BENCH_COLOR_ROUNDS;
+
+    bench_log("BENCH: page coloring %s: %u KiB sweep %llu us, %u.%02u cycles/access, "
+              "%u colored, %u fallbacks (sum %u)\n",
+              colored ? "on" : "off",
+              bytes / 1024,
+              (unsigned long long)bench_cycles_to_us(cycles),
+              (uint32_t)(cycles / accesses),
+              (uint32_t)((cycles % accesses) * 100u / accesses),
+              stats->colored - colored_before,
+              stats->fallbacks - fallbacks_before,
+              sum);
+
+    pmm_set_page_coloring(false);
+    vmm_set_huge_pages_enabled(true);
+    address_space_switch(previous);
+    address_space_destroy(space);
+    bench_color_release(held);
+}
+
+void bench_page_coloring(void)
+{
+    uint32_t cache = pmm_cache_size();
+    if (pmm_page_color_count() <= 1 || cache == 0)
+    {
+        bench_log("BENCH: page coloring skipped (cache geometry unknown)\n");
+        return;
+    }
+
+    // Three quarters of the last-level cache: fits when spread evenly over
+    // the colors, overflows the busiest sets when the colors are uneven.
+    uint32_t pages = (cache / PAGE_SIZE_BYTES) * 3u / 4u;
+    if (pages > BENCH_COLOR_MAX_PAGES)
+    {
+        pages = BENCH_COLOR_MAX_PAGES;
+    }
+
+    if (pmm_free_page_count() < pages * 5u + 64u)
+    {
+        bench_log("BENCH: page coloring skipped (not enough memory)\n");
+        return;
+    }
+
+    bench_page_coloring_mode(false, pages);
+    bench_page_coloring_mode(true, pages);
+}
+
+#endif
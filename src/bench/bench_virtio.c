@@ -0,0 +1,187 @@
+/**
+ * @file bench/bench_virtio.c
+ * @brief The same disk image read through IDE PIO, IDE DMA and virtio-blk.
+ *
+ * Run with one image attached twice, e.g. as an IDE disk and as a
+ * virtio-blk disk, so that "hd0" and "vd0" hold the same data.
+ */
+
+#ifdef KERNEL_BENCHMARKS
+
+#include <bench.h>
+#include <block_device.h>
+#include <virtio_blk.h>
+#include <ide.h>
+
+#define BENCH_VIRTIO_CHUNK_BYTES  (256u * 1024u)         /**< Bytes per sequential read. */
+#define BENCH_VIRTIO_SEQ_BYTES    (8u * 1024u * 1024u)   /**< Bytes read sequentially per transport. */
+#define BENCH_VIRTIO_BLOCK_BYTES  4096u
+#define BENCH_VIRTIO_RANDOM_READS 2048u
+#define BENCH_VIRTIO_SPAN_BYTES   (256u * 1024u * 1024u) /**< Random reads land anywhere in this much of the disk. */
+
+/** @brief Part of the kernel image, so physically contiguous. */
+static uint8_t g_bench_virtio_chunk[BENCH_VIRTIO_CHUNK_BYTES] __attribute__((aligned(4096)));
+static uint8_t g_bench_virtio_buffers[BLOCK_MAX_QUEUE_DEPTH][BENCH_VIRTIO_BLOCK_BYTES] __attribute__((aligned(4096)));
+static uint8_t g_bench_virtio_first[2][512];
+static block_request_t g_bench_virtio_requests[BLOCK_MAX_QUEUE_DEPTH];
+
+static block_device_t* bench_virtio_find_disk(char first, char second)
+{
+    for (size_t i = 0; i < block_device_count(); ++i)
+    {
+        block_device_t* device = block_device_get(i);
+        if (device != NULL && device->name[0] == first && device->name[1] == second
+            && device->sector_size == 512 && device->read != NULL)
+        {
+            return device;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Read the first BENCH_VIRTIO_SEQ_BYTES of a disk in large chunks.
+ */
+static void bench_virtio_sequential(block_device_t* disk, const char* label)
+{
+    uint32_t sectors = BENCH_VIRTIO_CHUNK_BYTES / disk->sector_size;
+    uint64_t total = BENCH_VIRTIO_SEQ_BYTES / disk->sector_size;
+    uint64_t bytes = 0;
+    bool failed = false;
+
+    if (total > disk->sector_count)
+    {
+        total = disk->sector_count;
+    }
+
+    uint64_t start = bench_cycles();
+    for (uint64_t lba = 0; lba < total && !failed; lba += sectors)
+    {
+        uint32_t count = (total - lba < sectors) ? (uint32_t)(total - lba) : sectors;
+        failed = !disk->read(disk, lba, count, g_bench_virtio_chunk);
+        bytes += (uint64_t)count * disk->sector_size;
+    }
+    uint64_t cycles = bench_cycles() - start;
+
+    bench_log("BENCH: %s %s sequential %u KiB reads: %llu KiB in %llu us, %u MB/s%s\n",
+              disk->name,
+              label,
+              BENCH_VIRTIO_CHUNK_BYTES / 1024u,
+              (unsigned long long)(bytes / 1024u),
+              (unsigned long long)bench_cycles_to_us(cycles),
+              bench_mb_per_second(bytes, cycles),
+              failed ? " (read failed)" : "");
+}
+
+static bool bench_virtio_same_sector(const uint8_t* a, const uint8_t* b)
+{
+    for (uint32_t i = 0; i < 512; ++i)
+    {
+        if (a[i] != b[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint32_t bench_virtio_random(uint32_t* state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/**
+ * @brief Keep depth random 4 KiB reads in flight until BENCH_VIRTIO_RANDOM_READS have finished.
+ */
+static void bench_virtio_random_reads(block_device_t* disk, uint32_t depth)
+{
+    uint32_t sectors = BENCH_VIRTIO_BLOCK_BYTES / disk->sector_size;
+    uint64_t span = BENCH_VIRTIO_SPAN_BYTES / disk->sector_size;
+    uint32_t seed = 0x2545F491u;
+    const virtio_blk_stats_t* stats = virtio_blk_get_stats();
+    uint32_t interrupts_before = stats->interrupts;
+    uint32_t notifications_before = stats->notifications;
+    bool failed = false;
+
+    if (span > disk->sector_count)
+    {
+        span = disk->sector_count;
+    }
+    uint32_t blocks = (uint32_t)(span / sectors);
+
+    depth = block_device_set_queue_depth(disk, depth);
+    disk->stats.max_in_flight = 0;
+
+    uint64_t start = bench_cycles();
+    for (uint32_t i = 0; i < BENCH_VIRTIO_RANDOM_READS + depth; ++i)
+    {
+        block_request_t* request = &g_bench_virtio_requests[i % depth];
+        if (i >= depth && !block_request_wait(request))
+        {
+            failed = true;
+        }
+        if (i < BENCH_VIRTIO_RANDOM_READS)
+        {
+            uint64_t lba = (uint64_t)(bench_virtio_random(&seed) % blocks) * sectors;
+            block_request_init(request, disk, BLOCK_REQUEST_READ, lba, sectors, g_bench_virtio_buffers[i % depth]);
+            block_request_submit(request);
+        }
+    }
+    uint64_t cycles = bench_cycles() - start;
+    uint64_t us = bench_cycles_to_us(cycles);
+
+    bench_log("BENCH: %s random 4 KiB reads QD%u: %llu IOPS, max in flight %u, "
+              "%u notifications, %u interrupts%s\n",
+              disk->name,
+              depth,
+              (unsigned long long)(us ? (uint64_t)BENCH_VIRTIO_RANDOM_READS * 1000000u / us : 0),
+              disk->stats.max_in_flight,
+              stats->notifications - notifications_before,
+              stats->interrupts - interrupts_before,
+              failed ? " (read failed)" : "");
+}
+
+void bench_virtio_vs_ide(void)
+{
+    block_device_t* ide = bench_virtio_find_disk('h', 'd');
+    block_device_t* virtio = bench_virtio_find_disk('v', 'd');
+    if (virtio == NULL || virtio->sector_count < BENCH_VIRTIO_BLOCK_BYTES / 512u)
+    {
+        bench_log("BENCH: virtio-blk comparison skipped (no virtio disk)\n");
+        return;
+    }
+
+    if (ide != NULL)
+    {
+        bool same = ide->read(ide, 0, 1, g_bench_virtio_first[0])
+                 && virtio->read(virtio, 0, 1, g_bench_virtio_first[1])
+                 && bench_virtio_same_sector(g_bench_virtio_first[0], g_bench_virtio_first[1]);
+        if (!same)
+        {
+            bench_log("BENCH: %s and %s differ in sector 0; they are probably not the same image\n",
+                      ide->name,
+                      virtio->name);
+        }
+
+        ide_set_dma_enabled(false);
+        bench_virtio_sequential(ide, "PIO");
+        ide_set_dma_enabled(true);
+        bench_virtio_sequential(ide, "DMA");
+    }
+    else
+    {
+        bench_log("BENCH: no IDE disk; reporting virtio-blk only\n");
+    }
+
+    bench_virtio_sequential(virtio, "virtio");
+    bench_virtio_random_reads(virtio, 1);
+    bench_virtio_random_reads(virtio, BLOCK_MAX_QUEUE_DEPTH);
+    block_device_set_queue_depth(virtio, BLOCK_MAX_QUEUE_DEPTH);
+}
+
+#endif
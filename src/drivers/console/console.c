@@ -37,7 +37,7 @@ console_backend_t* g_active_console = NULL;
 /**
  * @brief Initialize the console backend based on the reported framebuffer type.
  */
-void console_init(multiboot_info* mbi)
+void KERNEL_INIT console_init(multiboot_info* mbi)
 {
     switch(mbi->framebuffer_type)
     {
@@ -20,10 +20,17 @@ static uint32_t framebuffer_total_pages_required;
 framebuffer_t g_framebuffer = {NULL, 0, 0, 0, 0};
 
 /** @brief Character backing buffer for framebuffer console text. */
-static uint8_t* framebuffer_char_buffer = (uint8_t*)0xc1000000;
+static uint8_t* framebuffer_char_buffer = (uint8_t*)0xd1000000;
 
 static uint32_t framebuffer_columns;
 
+/** @brief Physical base of video memory as reported by the bootloader. */
+static uint8_t* framebuffer_physical_address;
+/** @brief Size of the video memory mapping in 4 MiB pages. */
+static uint8_t framebuffer_large_pages;
+
+#define FRAMEBUFFER_VIRTUAL_ADDRESS 0xe0000000
+
 static int framebuffer_pixel_x = 0;
 static int framebuffer_pixel_y = 0;
 static int console_column = 0;
@@ -35,7 +42,7 @@ static int console_row = 0;
 /**
  * @brief Initialize framebuffer mappings and prepare the console renderer.
  */
-void framebuffer_init(multiboot_info* mbi)
+void KERNEL_INIT framebuffer_init(multiboot_info* mbi)
 {
     g_framebuffer.address = (void*)(uint32_t)mbi->framebuffer_addr;
     g_framebuffer.height = mbi->framebuffer_height;
@@ -48,13 +55,10 @@ void framebuffer_init(multiboot_info* mbi)
     for(int i = 0; i < 4; i++)
     {
         
-        vmm_map_physical_to_virtual((uint8_t*)(uintptr_t)pmm_allocate_page(), framebuffer_char_buffer + i * 4096);
+        vmm_map_physical_to_virtual((uint8_t*)(uintptr_t)pmm_allocate_page(), framebuffer_char_buffer + i * 4096, CACHE_WRITE_BACK);
     }
 
     
-    uintptr_t framebuffer_virtual_address = 0xe0000000;
-
-
     // currently the framebuffer physical address needs to be mapped to
     // a virtual address space.  Convention for x86 is at address 0xe0000000.
 
@@ -74,11 +78,15 @@ void framebuffer_init(multiboot_info* mbi)
     if(framebuffer_total_pages_required % 1024)
         four_mb_pages_required++;
 
-    vmm_map_4mb_physical_to_virtual((uint8_t*)g_framebuffer.address, (uint8_t*)framebuffer_virtual_address, four_mb_pages_required * 4);
+    // Video memory is only ever written by the CPU, so let stores combine
+    // into full bursts instead of going out one uncached pixel at a time.
+    framebuffer_physical_address = (uint8_t*)g_framebuffer.address;
+    framebuffer_large_pages = four_mb_pages_required;
+    framebuffer_set_cache_mode(CACHE_WRITE_COMBINING);
     
     // set the framebuffer address in the framebuffer structure to the virtual address
 
-    g_framebuffer.address = (void*)framebuffer_virtual_address;
+    g_framebuffer.address = (void*)FRAMEBUFFER_VIRTUAL_ADDRESS;
 
     // get the builtin font
     framebuffer_font = psf1_font_load();
@@ -86,6 +94,17 @@ void framebuffer_init(multiboot_info* mbi)
     serial_printf("Font magic: 0x%04x, Mode: %d, Size: %d\n", framebuffer_font.header->magic, framebuffer_font.header->mode, framebuffer_font.header->charsize);
 }
 
+/**
+ * @brief Remap video memory with a different memory type.
+ */
+void framebuffer_set_cache_mode(enum page_cache_mode_t mode)
+{
+    vmm_map_4mb_physical_to_virtual(framebuffer_physical_address,
+                                    (uint8_t*)FRAMEBUFFER_VIRTUAL_ADDRESS,
+                                    framebuffer_large_pages * 4,
+                                    mode);
+}
+
 /**
  * @brief Write a pixel to the framebuffer.
  *
@@ -0,0 +1,1021 @@
+/**
+ * @file drivers/storage/ahci.c
+ * @brief AHCI SATA host controller driver with native command queuing.
+ */
+
+#include <ahci.h>
+#include <x86.h>
+#include <stdio.h>
+#include <memory.h>
+#include <stddef.h>
+#include <block_device.h>
+#include <partition.h>
+#include <meminit.h>
+#include <paging.h>
+#include <pci.h>
+#include <irq.h>
+
+#define AHCI_ABAR_WINDOW 0xd5000000u /**< Kernel mappings of each controller's registers. */
+#define AHCI_ABAR_PAGES  2           /**< Generic registers plus 32 ports of 0x80 bytes. */
+
+#define AHCI_REG_CAP 0x00
+#define AHCI_REG_GHC 0x04
+#define AHCI_REG_IS  0x08
+#define AHCI_REG_PI  0x0C
+#define AHCI_REG_VS  0x10
+
+#define AHCI_CAP_NCS_SHIFT 8
+#define AHCI_CAP_NCS_MASK  0x1F     /**< Command slots per port, minus one. */
+#define AHCI_CAP_SNCQ      (1u << 30)
+
+#define AHCI_GHC_IE (1u << 1)
+#define AHCI_GHC_AE (1u << 31)
+
+#define AHCI_PORT_BASE 0x100
+#define AHCI_PORT_SIZE 0x80
+#define AHCI_MAX_PORTS 32
+
+#define AHCI_PxCLB  0x00
+#define AHCI_PxCLBU 0x04
+#define AHCI_PxFB   0x08
+#define AHCI_PxFBU  0x0C
+#define AHCI_PxIS   0x10
+#define AHCI_PxIE   0x14
+#define AHCI_PxCMD  0x18
+#define AHCI_PxTFD  0x20
+#define AHCI_PxSIG  0x24
+#define AHCI_PxSSTS 0x28
+#define AHCI_PxSCTL 0x2C
+#define AHCI_PxSERR 0x30
+#define AHCI_PxSACT 0x34
+#define AHCI_PxCI   0x38
+
+#define AHCI_PxCMD_ST  (1u << 0)
+#define AHCI_PxCMD_SUD (1u << 1)
+#define AHCI_PxCMD_POD (1u << 2)
+#define AHCI_PxCMD_FRE (1u << 4)
+#define AHCI_PxCMD_FR  (1u << 14)
+#define AHCI_PxCMD_CR  (1u << 15)
+
+#define AHCI_PxIS_DHRS (1u << 0)  /**< Device to host register FIS: a non-queued command ended. */
+#define AHCI_PxIS_SDBS (1u << 3)  /**< Set device bits FIS: queued commands ended. */
+#define AHCI_PxIS_OFS  (1u << 24)
+#define AHCI_PxIS_INFS (1u << 26)
+#define AHCI_PxIS_IFS  (1u << 27)
+#define AHCI_PxIS_HBDS (1u << 28)
+#define AHCI_PxIS_HBFS (1u << 29)
+#define AHCI_PxIS_TFES (1u << 30)
+#define AHCI_PxIS_ERRORS (AHCI_PxIS_OFS | AHCI_PxIS_INFS | AHCI_PxIS_IFS | AHCI_PxIS_HBDS \
+                          | AHCI_PxIS_HBFS | AHCI_PxIS_TFES)
+
+#define AHCI_SSTS_DET_MASK    0x0F
+#define AHCI_SSTS_DET_PRESENT 0x03 /**< Device present and PHY communication established. */
+#define AHCI_SCTL_DET_RESET   0x01
+#define AHCI_SIG_ATA          0x00000101u
+
+#define ATA_SR_ERR 0x01
+#define ATA_SR_DRQ 0x08
+#define ATA_SR_BSY 0x80
+
+#define ATA_CMD_IDENTIFY          0xEC
+#define ATA_CMD_READ_DMA_EXT      0x25
+#define ATA_CMD_WRITE_DMA_EXT     0x35
+#define ATA_CMD_READ_FPDMA_QUEUED 0x60
+#define ATA_CMD_WRITE_FPDMA_QUEUED 0x61
+#define ATA_CMD_FLUSH_CACHE_EXT   0xEA
+
+#define ATA_IDENTIFY_SECTORS_28   60     /**< Words 60-61: LBA28 capacity. */
+#define ATA_IDENTIFY_QUEUE_DEPTH  75     /**< Bits 4:0: NCQ depth minus one. */
+#define ATA_IDENTIFY_SATA_CAPS    76     /**< IDENTIFY word holding the NCQ-supported bit. */
+#define ATA_SATA_CAP_NCQ          0x0100
+#define ATA_IDENTIFY_COMMAND_SETS 83     /**< IDENTIFY word holding the LBA48-supported bit. */
+#define ATA_COMMAND_SET_LBA48     0x0400
+#define ATA_IDENTIFY_SECTORS_48   100    /**< Words 100-103: LBA48 capacity. */
+#define ATA_DEVICE_LBA            0x40
+
+#define AHCI_FIS_REG_H2D     0x27
+#define AHCI_FIS_COMMAND     0x80 /**< Register FIS carries a command, not a control update. */
+#define AHCI_FIS_H2D_DWORDS  5
+#define AHCI_CMD_WRITE       (1u << 6)
+
+#define AHCI_COMMAND_LIST_BYTES 1024
+#define AHCI_PRD_ENTRIES     248        /**< Fills the command table out to one page. */
+#define AHCI_PRD_MAX_BYTES   0x400000u  /**< 22-bit byte count. */
+#define AHCI_MAX_SECTORS     65536u     /**< A count of 0 means 65536. */
+#define AHCI_SPIN_TIMEOUT    1000000    /**< Register polls before a port operation gives up. */
+#define AHCI_RESET_DELAY     1000       /**< I/O waits (about 1 us each) COMRESET is held for. */
+#define AHCI_IRQ_TIMEOUT     256        /**< Wakeups without a completion before the port is reset. */
+
+/**
+ * @brief Entry of a port's command list, one per command slot.
+ */
+typedef struct {
+    uint16_t          flags;          /**< FIS length in dwords, AHCI_CMD_WRITE. */
+    uint16_t          prdt_length;    /**< Entries of the command table's PRD list. */
+    volatile uint32_t prd_byte_count; /**< Bytes transferred, written by the HBA. */
+    uint32_t          table_base;     /**< 128-byte aligned physical address of the command table. */
+    uint32_t          table_base_upper;
+    uint32_t          reserved[4];
+} __attribute__((packed)) ahci_command_header_t;
+
+/**
+ * @brief Physical region descriptor of a command table.
+ */
+typedef struct {
+    uint32_t data_base;       /**< Even physical address of the region. */
+    uint32_t data_base_upper;
+    uint32_t reserved;
+    uint32_t byte_count;      /**< Region length minus one (bit 0 set). */
+} __attribute__((packed)) ahci_prd_t;
+
+/**
+ * @brief Command FIS and scatter list of one command slot.
+ */
+typedef struct {
+    uint8_t    fis[64];
+    uint8_t    atapi[16];
+    uint8_t    reserved[48];
+    ahci_prd_t prd[AHCI_PRD_ENTRIES];
+} __attribute__((packed)) ahci_command_table_t;
+
+typedef struct ahci_controller ahci_controller_t;
+
+/**
+ * @brief Progress of the block command occupying one slot.
+ *
+ * A command larger than one ATA command (or than the PRD list can describe)
+ * is reissued in the same slot until it is done.
+ */
+typedef struct {
+    block_request_t* request;  /**< Command in the slot, or NULL if it is free. */
+    uint32_t         segment;  /**< Segment the next ATA command starts in. */
+    uint32_t         skip;     /**< Sectors of that segment already transferred. */
+    uint64_t         lba;      /**< First sector of the ATA command in flight. */
+    uint32_t         chunk;    /**< Sectors in it. */
+} ahci_slot_t;
+
+typedef struct {
+    bool                   present;
+    bool                   failed;        /**< The port could not be restarted after an error. */
+    ahci_controller_t*     controller;
+    uint8_t                index;         /**< Port number on the HBA. */
+    uint32_t               unit_number;
+    uintptr_t              registers;     /**< Virtual address of the port's register block. */
+    ahci_command_header_t* command_list;
+    uint32_t               command_list_physical;
+    uint32_t               received_fis_physical;
+    ahci_command_table_t*  tables[AHCI_MAX_PORTS];    /**< One per command slot. */
+    uint32_t               slot_count;    /**< Slots handed to the block layer. */
+    bool                   ncq;
+    bool                   lba48;
+    uint64_t               total_sectors;
+    char                   model[41];
+    uint32_t               outstanding;   /**< Slots issued to the HBA. */
+    uint32_t               in_flight;     /**< Bits set in outstanding. */
+    uint32_t               polls;         /**< Block layer polls since the last completion. */
+    ahci_slot_t            slots[AHCI_MAX_PORTS];
+    block_command_t        commands[AHCI_MAX_PORTS];
+    block_device_t         block;
+} ahci_port_t;
+
+struct ahci_controller {
+    bool         in_use;
+    uint8_t      bus;
+    uint8_t      device;
+    uint8_t      function;
+    uint16_t     vendor_id;
+    uint16_t     device_id;
+    uintptr_t    registers;     /**< Virtual address of the HBA registers. */
+    uint32_t     capabilities;
+    uint8_t      irq;
+    bool         irq_enabled;   /**< A handler is installed for irq. */
+    ahci_port_t* ports[AHCI_MAX_PORTS];
+};
+
+static ahci_controller_t g_ahci_controllers[AHCI_MAX_CONTROLLERS];
+static uint8_t g_ahci_controller_count;
+static ahci_port_t g_ahci_drives[AHCI_MAX_DRIVES];
+static uint32_t g_ahci_drive_count;
+/** @brief IDENTIFY DEVICE data, in the direct-mapped kernel image. */
+static uint16_t g_ahci_identify[256] __attribute__((aligned(512)));
+static ahci_stats_t g_ahci_stats;
+
+static uint32_t ahci_read(const ahci_controller_t* ctrl, uint32_t reg)
+{
+    return *(volatile uint32_t*)(ctrl->registers + reg);
+}
+
+static void ahci_write(const ahci_controller_t* ctrl, uint32_t reg, uint32_t value)
+{
+    *(volatile uint32_t*)(ctrl->registers + reg) = value;
+}
+
+static uint32_t ahci_port_read(const ahci_port_t* port, uint32_t reg)
+{
+    return *(volatile uint32_t*)(port->registers + reg);
+}
+
+static void ahci_port_write(const ahci_port_t* port, uint32_t reg, uint32_t value)
+{
+    *(volatile uint32_t*)(port->registers + reg) = value;
+}
+
+/**
+ * @brief Poll a port register until the masked bits read as expected.
+ */
+static bool ahci_port_wait(const ahci_port_t* port, uint32_t reg, uint32_t mask, uint32_t expected)
+{
+    for (uint32_t i = 0; i < AHCI_SPIN_TIMEOUT; ++i)
+    {
+        if ((ahci_port_read(port, reg) & mask) == expected)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Stop command processing and FIS reception.
+ */
+static bool ahci_port_stop(ahci_port_t* port)
+{
+    uint32_t cmd = ahci_port_read(port, AHCI_PxCMD);
+    ahci_port_write(port, AHCI_PxCMD, cmd & ~AHCI_PxCMD_ST);
+    if (!ahci_port_wait(port, AHCI_PxCMD, AHCI_PxCMD_CR, 0))
+    {
+        return false;
+    }
+
+    cmd = ahci_port_read(port, AHCI_PxCMD);
+    ahci_port_write(port, AHCI_PxCMD, cmd & ~AHCI_PxCMD_FRE);
+    return ahci_port_wait(port, AHCI_PxCMD, AHCI_PxCMD_FR, 0);
+}
+
+/**
+ * @brief Reset the SATA link (COMRESET); the device answers with a fresh register FIS.
+ */
+static bool ahci_port_comreset(ahci_port_t* port)
+{
+    uint32_t sctl = ahci_port_read(port, AHCI_PxSCTL) & ~0x0Fu;
+    ahci_port_write(port, AHCI_PxSCTL, sctl | AHCI_SCTL_DET_RESET);
+    for (uint32_t i = 0; i < AHCI_RESET_DELAY; ++i)
+    {
+        x86_iowait();
+    }
+    ahci_port_write(port, AHCI_PxSCTL, sctl);
+
+    bool linked = ahci_port_wait(port, AHCI_PxSSTS, AHCI_SSTS_DET_MASK, AHCI_SSTS_DET_PRESENT);
+    ahci_port_write(port, AHCI_PxSERR, 0xFFFFFFFFu);
+    return linked;
+}
+
+/**
+ * @brief Enable FIS reception and, once the device is idle, command processing.
+ */
+static bool ahci_port_start(ahci_port_t* port)
+{
+    ahci_port_write(port, AHCI_PxCMD, ahci_port_read(port, AHCI_PxCMD) | AHCI_PxCMD_FRE);
+
+    // A device still busy from before (or from an error) needs a link reset first.
+    if (!ahci_port_wait(port, AHCI_PxTFD, ATA_SR_BSY | ATA_SR_DRQ, 0)
+        && (!ahci_port_comreset(port) || !ahci_port_wait(port, AHCI_PxTFD, ATA_SR_BSY | ATA_SR_DRQ, 0)))
+    {
+        return false;
+    }
+
+    ahci_port_write(port, AHCI_PxCMD, ahci_port_read(port, AHCI_PxCMD) | AHCI_PxCMD_ST);
+    return true;
+}
+
+/**
+ * @brief Describe a scatter list position in a command table without copying it.
+ *
+ * Pages are translated one at a time and physically adjacent pages are
+ * merged, across segment boundaries too, up to 4 MiB per entry. If the
+ * table fills up, only a prefix is described.
+ *
+ * @param skip    Sectors at the start of segments[0] already transferred.
+ * @param sectors Sectors wanted from there on.
+ * @param entries Receives the number of PRD entries used.
+ * @return Bytes described (a multiple of sector_size), or 0 if a buffer is
+ *         misaligned or unmapped.
+ */
+static uint32_t ahci_build_prd(ahci_command_table_t* table,
+                               const block_segment_t* segments,
+                               uint32_t skip,
+                               uint32_t sectors,
+                               uint32_t sector_size,
+                               uint16_t* entries_out)
+{
+    ahci_prd_t* prd = table->prd;
+    uint32_t entries = 0;
+    uint32_t described = 0;
+    uint32_t bytes = sectors * sector_size;
+    bool full = false;
+
+    for (const block_segment_t* segment = segments; described < bytes && !full; ++segment, skip = 0)
+    {
+        uint32_t address = (uint32_t)segment->buffer + skip * sector_size;
+        uint32_t end = described + (segment->sector_count - skip) * sector_size;
+        if (end > bytes)
+        {
+            end = bytes;
+        }
+
+        if ((address & 1) != 0)
+        {
+            return 0;
+        }
+
+        while (described < end)
+        {
+            uint32_t physical = (uint32_t)virt_to_phys((const void*)address);
+            if (physical == 0)
+            {
+                return 0;
+            }
+
+            uint32_t length = PAGE_SIZE_BYTES - (address & (PAGE_SIZE_BYTES - 1));
+            if (length > end - described)
+            {
+                length = end - described;
+            }
+
+            ahci_prd_t* last = (entries > 0) ? &prd[entries - 1] : NULL;
+            uint32_t run_length = (last != NULL) ? last->byte_count + 1 : 0;
+            if (last != NULL
+                && last->data_base + run_length == physical
+                && run_length + length <= AHCI_PRD_MAX_BYTES)
+            {
+                last->byte_count = run_length + length - 1;
+            }
+            else
+            {
+                if (entries == AHCI_PRD_ENTRIES)
+                {
+                    full = true;
+                    break;
+                }
+                last = &prd[entries++];
+                last->data_base = physical;
+                last->data_base_upper = 0;
+                last->reserved = 0;
+                last->byte_count = length - 1;
+            }
+
+            address += length;
+            described += length;
+        }
+    }
+
+    // The command's sector count must match the list exactly.
+    uint32_t excess = described % sector_size;
+    described -= excess;
+    while (excess > 0)
+    {
+        uint32_t length = prd[entries - 1].byte_count + 1;
+        if (length > excess)
+        {
+            prd[entries - 1].byte_count = length - excess - 1;
+            break;
+        }
+        excess -= length;
+        entries--;
+    }
+
+    *entries_out = (uint16_t)entries;
+    return described;
+}
+
+/**
+ * @brief Fill in a host-to-device register FIS.
+ *
+ * @param queued READ/WRITE FPDMA QUEUED: the count goes in the feature
+ *               field and the tag in the count field.
+ */
+static void ahci_build_command_fis(uint8_t* fis, uint8_t command, uint64_t lba, uint32_t count, bool queued, uint32_t tag)
+{
+    memset(fis, 0, 20);
+    fis[0] = AHCI_FIS_REG_H2D;
+    fis[1] = AHCI_FIS_COMMAND;
+    fis[2] = command;
+    fis[4] = (uint8_t)lba;
+    fis[5] = (uint8_t)(lba >> 8);
+    fis[6] = (uint8_t)(lba >> 16);
+    fis[7] = ATA_DEVICE_LBA;
+    fis[8] = (uint8_t)(lba >> 24);
+    fis[9] = (uint8_t)(lba >> 32);
+    fis[10] = (uint8_t)(lba >> 40);
+
+    // A count of 65536 truncates to 0, which is what the command expects.
+    if (queued)
+    {
+        fis[3] = (uint8_t)count;
+        fis[11] = (uint8_t)(count >> 8);
+        fis[12] = (uint8_t)(tag << 3);
+    }
+    else
+    {
+        fis[12] = (uint8_t)count;
+        fis[13] = (uint8_t)(count >> 8);
+    }
+}
+
+/**
+ * @brief Step a scatter list position forward, skipping finished and empty segments.
+ */
+static void ahci_segment_advance(const block_request_t* request, uint32_t* segment, uint32_t* skip, uint32_t sectors)
+{
+    *skip += sectors;
+    while (*segment < request->segment_count && *skip >= request->segments[*segment].sector_count)
+    {
+        *skip -= request->segments[*segment].sector_count;
+        (*segment)++;
+    }
+}
+
+/**
+ * @brief Issue the next ATA command of the block command in a slot.
+ *
+ * Called with interrupts disabled.
+ *
+ * @return false if the buffers cannot be described to the HBA.
+ */
+static bool ahci_slot_issue(ahci_port_t* port, uint32_t tag)
+{
+    ahci_slot_t* slot = &port->slots[tag];
+    block_request_t* request = slot->request;
+    ahci_command_table_t* table = port->tables[tag];
+    ahci_command_header_t* header = &port->command_list[tag];
+    bool write = request->op == BLOCK_REQUEST_WRITE;
+    bool queued = false;
+    uint16_t entries = 0;
+    uint8_t command = ATA_CMD_FLUSH_CACHE_EXT;
+
+    slot->chunk = 0;
+    if (request->op != BLOCK_REQUEST_FLUSH)
+    {
+        uint32_t remaining = (uint32_t)(request->lba + request->sector_count - slot->lba);
+        uint32_t chunk = remaining > AHCI_MAX_SECTORS ? AHCI_MAX_SECTORS : remaining;
+
+        // A fragmented buffer may need more entries than the table has; the
+        // command then covers just the part that fits.
+        uint32_t bytes = ahci_build_prd(table, &request->segments[slot->segment], slot->skip, chunk,
+                                        port->block.sector_size, &entries);
+        if (bytes == 0)
+        {
+            kprintf("AHCI: %s buffer at lba %u cannot be used for DMA\n",
+                    port->block.name,
+                    (uint32_t)slot->lba);
+            return false;
+        }
+        slot->chunk = bytes / port->block.sector_size;
+
+        queued = port->ncq;
+        if (queued)
+        {
+            command = write ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED;
+        }
+        else
+        {
+            command = write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+        }
+        g_ahci_stats.commands++;
+        if (queued)
+        {
+            g_ahci_stats.queued_commands++;
+        }
+    }
+
+    ahci_build_command_fis(table->fis, command, slot->lba, slot->chunk, queued, tag);
+    header->flags = (uint16_t)(AHCI_FIS_H2D_DWORDS | (write ? AHCI_CMD_WRITE : 0));
+    header->prdt_length = entries;
+    header->prd_byte_count = 0;
+
+    uint32_t bit = 1u << tag;
+    if ((port->outstanding & bit) == 0)
+    {
+        port->outstanding |= bit;
+        if (++port->in_flight > g_ahci_stats.max_outstanding)
+        {
+            g_ahci_stats.max_outstanding = port->in_flight;
+        }
+    }
+
+    // The tag must be marked active before the command can complete.
+    if (queued)
+    {
+        ahci_port_write(port, AHCI_PxSACT, bit);
+    }
+    ahci_port_write(port, AHCI_PxCI, bit);
+    return true;
+}
+
+/**
+ * @brief An ATA command of a slot ended: issue the next one or complete the block command.
+ */
+static void ahci_slot_finished(ahci_port_t* port, uint32_t tag, bool success)
+{
+    ahci_slot_t* slot = &port->slots[tag];
+    block_request_t* request = slot->request;
+
+    if (success && request->op != BLOCK_REQUEST_FLUSH)
+    {
+        slot->lba += slot->chunk;
+        ahci_segment_advance(request, &slot->segment, &slot->skip, slot->chunk);
+        if (slot->segment < request->segment_count)
+        {
+            if (ahci_slot_issue(port, tag))
+            {
+                return;
+            }
+            success = false;
+        }
+    }
+
+    port->outstanding &= ~(1u << tag);
+    port->in_flight--;
+    slot->request = NULL;
+    block_request_complete(request, success);
+}
+
+/**
+ * @brief Restart a port after an error or timeout, failing every command in flight.
+ *
+ * An NCQ error aborts the whole queue, so no attempt is made to find the
+ * command at fault; callers see the failure and may retry.
+ */
+static void ahci_port_recover(ahci_port_t* port, const char* reason)
+{
+    g_ahci_stats.errors++;
+    kprintf("AHCI: %s %s (tfd=0x%08x serr=0x%08x), restarting port\n",
+            port->block.name,
+            reason,
+            ahci_port_read(port, AHCI_PxTFD),
+            ahci_port_read(port, AHCI_PxSERR));
+
+    ahci_port_stop(port);
+    ahci_port_write(port, AHCI_PxSERR, 0xFFFFFFFFu);
+    ahci_port_write(port, AHCI_PxIS, 0xFFFFFFFFu);
+    if (!ahci_port_start(port))
+    {
+        kprintf("AHCI: %s did not come back, failing further requests\n", port->block.name);
+        port->failed = true;
+    }
+
+    uint32_t failed = port->outstanding;
+    port->polls = 0;
+    for (uint32_t tag = 0; failed != 0; ++tag)
+    {
+        if (failed & (1u << tag))
+        {
+            failed &= ~(1u << tag);
+            ahci_slot_finished(port, tag, false);
+        }
+    }
+}
+
+/**
+ * @brief Acknowledge a port's interrupt status and complete the commands that have ended.
+ *
+ * A queued command has ended once its bit has left both PxSACT (cleared
+ * by the device's set device bits FIS) and PxCI; a non-queued one only
+ * ever appears in PxCI.
+ */
+static void ahci_port_service(ahci_port_t* port)
+{
+    uint32_t status = ahci_port_read(port, AHCI_PxIS);
+    ahci_port_write(port, AHCI_PxIS, status);
+
+    if (status & AHCI_PxIS_ERRORS)
+    {
+        ahci_port_recover(port, "error");
+        return;
+    }
+
+    uint32_t active = ahci_port_read(port, AHCI_PxSACT) | ahci_port_read(port, AHCI_PxCI);
+    uint32_t completed = port->outstanding & ~active;
+    if (completed != 0)
+    {
+        port->polls = 0;
+    }
+
+    for (uint32_t tag = 0; completed != 0; ++tag)
+    {
+        if (completed & (1u << tag))
+        {
+            // The slot may be reused for a new command while completing, so
+            // each bit is handled once from this snapshot.
+            completed &= ~(1u << tag);
+            ahci_slot_finished(port, tag, true);
+        }
+    }
+}
+
+static void ahci_irq_handler(Registers* regs)
+{
+    uint32_t line = regs->interrupt - IRQ_BASE_VECTOR;
+
+    for (uint8_t c = 0; c < g_ahci_controller_count; ++c)
+    {
+        ahci_controller_t* ctrl = &g_ahci_controllers[c];
+        if (!ctrl->irq_enabled || ctrl->irq != line)
+        {
+            continue;
+        }
+
+        uint32_t pending = ahci_read(ctrl, AHCI_REG_IS);
+        for (uint32_t i = 0; i < AHCI_MAX_PORTS; ++i)
+        {
+            if ((pending & (1u << i)) != 0 && ctrl->ports[i] != NULL)
+            {
+                g_ahci_stats.interrupts++;
+                ahci_port_service(ctrl->ports[i]);
+            }
+        }
+        // Port status first, then the summary, or the line stays asserted.
+        ahci_write(ctrl, AHCI_REG_IS, pending);
+    }
+}
+
+/**
+ * @brief Block layer entry point: start a command in the slot the block layer chose.
+ *
+ * The HBA keeps up to slot_count commands in flight (queued with NCQ);
+ * the interrupt handler completes them in whatever order the disk finishes.
+ */
+static bool ahci_block_device_start(block_device_t* device, block_request_t* request)
+{
+    ahci_port_t* port = (ahci_port_t*)device->driver_data;
+    ahci_slot_t* slot = &port->slots[request->tag];
+
+    slot->request = request;
+    slot->segment = 0;
+    slot->skip = 0;
+    slot->lba = request->lba;
+    ahci_segment_advance(request, &slot->segment, &slot->skip, 0);
+
+    bool interrupts = x86_interrupts_enabled();
+    x86_disable_interrupts();
+    bool issued = !port->failed && ahci_slot_issue(port, request->tag);
+    if (issued && port->in_flight == 1)
+    {
+        port->polls = 0;
+    }
+    if (interrupts)
+    {
+        x86_enable_interrupts();
+    }
+
+    if (!issued)
+    {
+        slot->request = NULL;
+        block_request_complete(request, false);
+    }
+    return true;
+}
+
+/**
+ * @brief Block layer hook: pick up completions whose interrupt never arrived.
+ */
+static void ahci_block_device_poll(block_device_t* device)
+{
+    ahci_port_t* port = (ahci_port_t*)device->driver_data;
+    if (port->outstanding == 0)
+    {
+        return;
+    }
+
+    ahci_port_service(port);
+
+    // Each poll follows a wakeup, so a stuck queue is given up on after a few seconds of ticks.
+    if (port->outstanding != 0 && ++port->polls >= AHCI_IRQ_TIMEOUT)
+    {
+        ahci_port_recover(port, "timed out");
+    }
+}
+
+/**
+ * @brief Run IDENTIFY DEVICE in slot 0, polling for the result.
+ */
+static bool KERNEL_INIT ahci_port_identify(ahci_port_t* port)
+{
+    block_segment_t segment = { g_ahci_identify, 1 };
+    uint16_t entries = 0;
+
+    if (ahci_build_prd(port->tables[0], &segment, 0, 1, 512, &entries) != 512)
+    {
+        return false;
+    }
+
+    ahci_build_command_fis(port->tables[0]->fis, ATA_CMD_IDENTIFY, 0, 0, false, 0);
+    port->tables[0]->fis[7] = 0;
+    port->command_list[0].flags = AHCI_FIS_H2D_DWORDS;
+    port->command_list[0].prdt_length = entries;
+    port->command_list[0].prd_byte_count = 0;
+
+    ahci_port_write(port, AHCI_PxIS, 0xFFFFFFFFu);
+    ahci_port_write(port, AHCI_PxCI, 1);
+
+    for (uint32_t i = 0; i < AHCI_SPIN_TIMEOUT; ++i)
+    {
+        if (ahci_port_read(port, AHCI_PxIS) & AHCI_PxIS_ERRORS)
+        {
+            break;
+        }
+        if ((ahci_port_read(port, AHCI_PxCI) & 1) == 0)
+        {
+            ahci_port_write(port, AHCI_PxIS, 0xFFFFFFFFu);
+            return (ahci_port_read(port, AHCI_PxTFD) & ATA_SR_ERR) == 0;
+        }
+    }
+
+    ahci_port_stop(port);
+    ahci_port_write(port, AHCI_PxSERR, 0xFFFFFFFFu);
+    ahci_port_write(port, AHCI_PxIS, 0xFFFFFFFFu);
+    ahci_port_start(port);
+    return false;
+}
+
+static void KERNEL_INIT ahci_extract_model(const uint16_t* identify_words, char* out, size_t out_len)
+{
+    size_t idx = 0;
+    for (int word = 27; word <= 46 && idx + 2 < out_len; ++word)
+    {
+        out[idx++] = (char)(identify_words[word] >> 8);
+        out[idx++] = (char)(identify_words[word] & 0xFF);
+    }
+    out[idx] = '\0';
+
+    while (idx > 0 && (out[idx - 1] == ' ' || out[idx - 1] == '\0'))
+    {
+        out[--idx] = '\0';
+    }
+}
+
+/**
+ * @brief Give a port its command list, received-FIS area and one command table per slot.
+ *
+ * Everything comes from direct-mapped frames so the HBA and the CPU can
+ * both reach it: the 1 KiB command list and the 256-byte FIS area share
+ * one page, and each 4 KiB command table gets its own.
+ */
+static bool KERNEL_INIT ahci_port_allocate(ahci_port_t* port, uint32_t slots)
+{
+    uintptr_t frame = pmm_allocate_page();
+    uint8_t* page = frame ? (uint8_t*)phys_to_virt(frame) : NULL;
+    if (page == NULL)
+    {
+        return false;
+    }
+    memset(page, 0, PAGE_SIZE_BYTES);
+    port->command_list = (ahci_command_header_t*)page;
+    port->command_list_physical = (uint32_t)frame;
+    port->received_fis_physical = (uint32_t)frame + AHCI_COMMAND_LIST_BYTES;
+
+    for (uint32_t tag = 0; tag < slots; ++tag)
+    {
+        frame = pmm_allocate_page();
+        ahci_command_table_t* table = frame ? (ahci_command_table_t*)phys_to_virt(frame) : NULL;
+        if (table == NULL)
+        {
+            return false;
+        }
+        memset(table, 0, sizeof(*table));
+        port->tables[tag] = table;
+        port->command_list[tag].table_base = (uint32_t)frame;
+        port->command_list[tag].table_base_upper = 0;
+    }
+    port->slot_count = slots;
+    return true;
+}
+
+static void KERNEL_INIT ahci_register_port(ahci_port_t* port)
+{
+    snprintf(port->block.name, sizeof(port->block.name), "sd%u", port->unit_number);
+    port->block.sector_size   = 512;
+    port->block.sector_count  = port->total_sectors;
+    port->block.read          = block_device_queued_read;
+    port->block.write         = block_device_queued_write;
+    port->block.flush         = block_device_queued_flush;
+    port->block.start         = ahci_block_device_start;
+    port->block.poll          = ahci_block_device_poll;
+    port->block.driver_data   = port;
+    port->block.commands      = port->commands;
+    port->block.command_slots = port->slot_count;
+
+    if (!block_device_register(&port->block))
+    {
+        kprintf("AHCI: failed to register block interface for port %u\n", port->index);
+        port->present = false;
+        return;
+    }
+
+    partition_scan_device(&port->block);
+}
+
+static void KERNEL_INIT ahci_probe_port(ahci_controller_t* ctrl, uint8_t index)
+{
+    uintptr_t registers = ctrl->registers + AHCI_PORT_BASE + index * AHCI_PORT_SIZE;
+    uint32_t ssts = *(volatile uint32_t*)(registers + AHCI_PxSSTS);
+    if ((ssts & AHCI_SSTS_DET_MASK) != AHCI_SSTS_DET_PRESENT)
+    {
+        return;
+    }
+
+    uint32_t signature = *(volatile uint32_t*)(registers + AHCI_PxSIG);
+    if (signature != AHCI_SIG_ATA)
+    {
+        kprintf("AHCI: %02x:%02x.%u port %u signature 0x%08x ignored (not an ATA disk)\n",
+                ctrl->bus, ctrl->device, ctrl->function, index, signature);
+        return;
+    }
+
+    if (g_ahci_drive_count >= AHCI_MAX_DRIVES)
+    {
+        kprintf("AHCI: ignoring port %u -> drive list full\n", index);
+        return;
+    }
+
+    ahci_port_t* port = &g_ahci_drives[g_ahci_drive_count];
+    memset(port, 0, sizeof(*port));
+    port->controller = ctrl;
+    port->index = index;
+    port->registers = registers;
+
+    if (!ahci_port_stop(port))
+    {
+        kprintf("AHCI: port %u did not stop\n", index);
+        return;
+    }
+
+    bool hba_ncq = (ctrl->capabilities & AHCI_CAP_SNCQ) != 0;
+    uint32_t hba_slots = ((ctrl->capabilities >> AHCI_CAP_NCS_SHIFT) & AHCI_CAP_NCS_MASK) + 1;
+    if (!ahci_port_allocate(port, hba_ncq ? hba_slots : 1))
+    {
+        kprintf("AHCI: out of memory for port %u\n", index);
+        return;
+    }
+
+    ahci_port_write(port, AHCI_PxCLB, port->command_list_physical);
+    ahci_port_write(port, AHCI_PxCLBU, 0);
+    ahci_port_write(port, AHCI_PxFB, port->received_fis_physical);
+    ahci_port_write(port, AHCI_PxFBU, 0);
+    ahci_port_write(port, AHCI_PxSERR, 0xFFFFFFFFu);
+    ahci_port_write(port, AHCI_PxIS, 0xFFFFFFFFu);
+    ahci_port_write(port, AHCI_PxIE, 0);
+    ahci_port_write(port, AHCI_PxCMD, ahci_port_read(port, AHCI_PxCMD) | AHCI_PxCMD_SUD | AHCI_PxCMD_POD);
+
+    if (!ahci_port_start(port) || !ahci_port_identify(port))
+    {
+        kprintf("AHCI: port %u IDENTIFY failed\n", index);
+        ahci_port_stop(port);
+        return;
+    }
+
+    const uint16_t* words = g_ahci_identify;
+    port->lba48 = (words[ATA_IDENTIFY_COMMAND_SETS] & ATA_COMMAND_SET_LBA48) != 0;
+    uint64_t sectors_28 = ((uint64_t)words[ATA_IDENTIFY_SECTORS_28 + 1] << 16) | words[ATA_IDENTIFY_SECTORS_28];
+    uint64_t sectors_48 = ((uint64_t)words[ATA_IDENTIFY_SECTORS_48 + 3] << 48)
+                        | ((uint64_t)words[ATA_IDENTIFY_SECTORS_48 + 2] << 32)
+                        | ((uint64_t)words[ATA_IDENTIFY_SECTORS_48 + 1] << 16)
+                        | (uint64_t)words[ATA_IDENTIFY_SECTORS_48];
+    port->total_sectors = (port->lba48 && sectors_48 > sectors_28) ? sectors_48 : sectors_28;
+    ahci_extract_model(words, port->model, sizeof(port->model));
+
+    // The disk's queue may be shallower than the HBA's; extra tables are simply unused.
+    port->ncq = hba_ncq && port->lba48 && (words[ATA_IDENTIFY_SATA_CAPS] & ATA_SATA_CAP_NCQ) != 0;
+    if (port->ncq)
+    {
+        uint32_t depth = (words[ATA_IDENTIFY_QUEUE_DEPTH] & 0x1F) + 1;
+        if (depth < port->slot_count)
+        {
+            port->slot_count = depth;
+        }
+    }
+    else
+    {
+        port->slot_count = 1;
+    }
+
+    kprintf("AHCI: %02x:%02x.%u port %u ATA model=\"%s\" sectors=%llu%s queue depth %u\n",
+            ctrl->bus,
+            ctrl->device,
+            ctrl->function,
+            index,
+            port->model[0] != '\0' ? port->model : "unknown",
+            (unsigned long long)port->total_sectors,
+            port->ncq ? " ncq" : "",
+            port->slot_count);
+
+    if (!port->lba48)
+    {
+        // READ/WRITE DMA EXT are the only transfer commands this driver issues.
+        kprintf("AHCI: port %u has no LBA48 support, ignored\n", index);
+        ahci_port_stop(port);
+        return;
+    }
+
+    port->present = true;
+    port->unit_number = g_ahci_drive_count++;
+    ctrl->ports[index] = port;
+    ahci_port_write(port, AHCI_PxIS, 0xFFFFFFFFu);
+    ahci_port_write(port, AHCI_PxIE, AHCI_PxIS_DHRS | AHCI_PxIS_SDBS | AHCI_PxIS_ERRORS);
+
+    ahci_register_port(port);
+}
+
+void KERNEL_INIT ahci_controller_init_from_pci(const ahci_pci_descriptor_t* desc)
+{
+    if (desc == NULL)
+    {
+        return;
+    }
+
+    if (g_ahci_controller_count >= AHCI_MAX_CONTROLLERS)
+    {
+        kprintf("AHCI: ignoring %02x:%02x.%u -> controller list full\n",
+                desc->bus,
+                desc->device,
+                desc->function);
+        return;
+    }
+
+    uint32_t abar = desc->abar & ~0x0Fu;
+    if ((desc->abar & 0x01) != 0 || abar == 0)
+    {
+        kprintf("AHCI: %02x:%02x.%u has no memory BAR5\n", desc->bus, desc->device, desc->function);
+        return;
+    }
+
+    uint8_t index = g_ahci_controller_count;
+    uint8_t* window = (uint8_t*)(AHCI_ABAR_WINDOW + index * AHCI_ABAR_PAGES * PAGE_SIZE_BYTES);
+    for (uint32_t page = 0; page < AHCI_ABAR_PAGES; ++page)
+    {
+        if (!vmm_map_kernel_page(PAGE_ALIGN_DOWN(abar) + page * PAGE_SIZE_BYTES,
+                                 window + page * PAGE_SIZE_BYTES,
+                                 CACHE_UNCACHED))
+        {
+            kprintf("AHCI: cannot map registers of %02x:%02x.%u\n", desc->bus, desc->device, desc->function);
+            return;
+        }
+    }
+
+    ahci_controller_t* ctrl = &g_ahci_controllers[g_ahci_controller_count++];
+    ctrl->in_use    = true;
+    ctrl->bus       = desc->bus;
+    ctrl->device    = desc->device;
+    ctrl->function  = desc->function;
+    ctrl->vendor_id = desc->vendor_id;
+    ctrl->device_id = desc->device_id;
+    ctrl->registers = (uintptr_t)window + (abar & (PAGE_SIZE_BYTES - 1));
+
+    pci_enable_memory_space(ctrl->bus, ctrl->device, ctrl->function);
+    pci_enable_bus_master(ctrl->bus, ctrl->device, ctrl->function);
+
+    ahci_write(ctrl, AHCI_REG_GHC, ahci_read(ctrl, AHCI_REG_GHC) | AHCI_GHC_AE);
+    ctrl->capabilities = ahci_read(ctrl, AHCI_REG_CAP);
+    uint32_t implemented = ahci_read(ctrl, AHCI_REG_PI);
+    uint32_t version = ahci_read(ctrl, AHCI_REG_VS);
+
+    // Legacy INTx through the PIC; MSI would need the local APIC, which stays off.
+    ctrl->irq = desc->interrupt_line;
+    ctrl->irq_enabled = ctrl->irq != 0 && ctrl->irq < 16;
+
+    kprintf("AHCI: initializing controller %02x:%02x.%u vendor=%04x device=%04x version %u.%u "
+            "ports=0x%08x slots=%u%s irq=%u\n",
+            ctrl->bus,
+            ctrl->device,
+            ctrl->function,
+            ctrl->vendor_id,
+            ctrl->device_id,
+            version >> 16,
+            (version >> 8) & 0xFF,
+            implemented,
+            ((ctrl->capabilities >> AHCI_CAP_NCS_SHIFT) & AHCI_CAP_NCS_MASK) + 1,
+            (ctrl->capabilities & AHCI_CAP_SNCQ) ? " ncq" : "",
+            ctrl->irq);
+
+    // Ports only raise interrupts once their PxIE is set, after IDENTIFY;
+    // without an IRQ the block layer's poll hook completes commands instead.
+    ahci_write(ctrl, AHCI_REG_IS, 0xFFFFFFFFu);
+    if (ctrl->irq_enabled)
+    {
+        irq_register_handler(ctrl->irq, ahci_irq_handler);
+        ahci_write(ctrl, AHCI_REG_GHC, ahci_read(ctrl, AHCI_REG_GHC) | AHCI_GHC_IE);
+    }
+
+    for (uint8_t i = 0; i < AHCI_MAX_PORTS; ++i)
+    {
+        if (implemented & (1u << i))
+        {
+            ahci_probe_port(ctrl, i);
+        }
+    }
+}
+
+const ahci_stats_t* ahci_get_stats(void)
+{
+    return &g_ahci_stats;
+}
@@ -10,11 +10,21 @@
 #include <stddef.h>
 #include <block_device.h>
 #include <partition.h>
+#include <meminit.h>
+#include <paging.h>
+#include <pci.h>
+#include <irq.h>
 
 #define IDE_CHANNEL_PRIMARY   0
 #define IDE_CHANNEL_SECONDARY 1
 #define IDE_CHANNEL_COUNT     2
 
+#define IDE_PROG_IF_PRIMARY_NATIVE   0x01 /**< Primary channel uses the PCI interrupt line. */
+#define IDE_PROG_IF_SECONDARY_NATIVE 0x04 /**< Secondary channel uses the PCI interrupt line. */
+#define IDE_LEGACY_IRQ_PRIMARY       14
+#define IDE_LEGACY_IRQ_SECONDARY     15
+#define IDE_IRQ_TIMEOUT              256  /**< Wakeups (any IRQ, at least the timer) before giving up. */
+
 #define ATA_CTL_SRST 0x04 /**< Soft-reset controllers when set. */
 #define ATA_CTL_nIEN 0x02 /**< Disable interrupts when set. */
 
@@ -27,6 +37,20 @@
 #define ATA_CMD_IDENTIFY         0xEC
 #define ATA_CMD_IDENTIFY_PACKET  0xA1
 #define ATA_CMD_READ_SECTORS     0x20
+#define ATA_CMD_WRITE_SECTORS    0x30
+#define ATA_CMD_READ_DMA         0xC8
+#define ATA_CMD_WRITE_DMA        0xCA
+#define ATA_CMD_READ_SECTORS_EXT 0x24
+#define ATA_CMD_WRITE_SECTORS_EXT 0x34
+#define ATA_CMD_READ_DMA_EXT     0x25
+#define ATA_CMD_WRITE_DMA_EXT    0x35
+#define ATA_CMD_READ_MULTIPLE    0xC4
+#define ATA_CMD_WRITE_MULTIPLE   0xC5
+#define ATA_CMD_SET_MULTIPLE     0xC6
+#define ATA_CMD_FLUSH_CACHE      0xE7
+#define ATA_CMD_FLUSH_CACHE_EXT  0xEA
+#define ATA_CMD_READ_MULTIPLE_EXT  0x29
+#define ATA_CMD_WRITE_MULTIPLE_EXT 0x39
 
 #define ATA_REG_DATA          0x00
 #define ATA_REG_ERROR         0x01
@@ -38,6 +62,45 @@
 #define ATA_REG_STATUS        0x07
 #define ATA_REG_COMMAND       0x07
 
+#define ATA_IDENTIFY_MAX_MULTIPLE 47     /**< Low byte: most sectors per DRQ block for READ/WRITE MULTIPLE. */
+#define ATA_IDENTIFY_CAPABILITIES 49     /**< IDENTIFY word holding the DMA-supported bit. */
+#define ATA_CAPABILITY_DMA        0x0100
+#define ATA_IDENTIFY_SECTORS_28   60     /**< Words 60-61: LBA28 capacity. */
+#define ATA_IDENTIFY_COMMAND_SETS 83     /**< IDENTIFY word holding the LBA48-supported bit. */
+#define ATA_COMMAND_SET_LBA48     0x0400
+#define ATA_IDENTIFY_SECTORS_48   100    /**< Words 100-103: LBA48 capacity. */
+
+#define ATA_LBA28_LIMIT       (1ull << 28)
+#define ATA_LBA48_LIMIT       (1ull << 48)
+#define ATA_LBA28_MAX_SECTORS 256u       /**< A count of 0 means 256. */
+#define ATA_LBA48_MAX_SECTORS 65536u     /**< A count of 0 means 65536. */
+
+#define IDE_BM_REG_COMMAND 0x00
+#define IDE_BM_REG_STATUS  0x02
+#define IDE_BM_REG_PRDT    0x04
+
+#define IDE_BM_CMD_START 0x01 /**< Start/stop the bus master. */
+#define IDE_BM_CMD_READ  0x08 /**< Transfer direction: device to memory. */
+
+#define IDE_BM_SR_ACTIVE     0x01
+#define IDE_BM_SR_ERR        0x02
+#define IDE_BM_SR_IRQ        0x04
+#define IDE_BM_SR_DRIVE0_DMA 0x20
+#define IDE_BM_SR_DRIVE1_DMA 0x40
+
+#define IDE_PRD_ENTRIES     512     /**< One page-aligned 4 KiB table, so it never crosses a 64 KiB boundary. */
+#define IDE_PRD_END         0x8000  /**< Last entry of the table. */
+#define IDE_DMA_TIMEOUT     1000000
+
+/**
+ * @brief Physical region descriptor consumed by the bus master.
+ */
+typedef struct {
+    uint32_t physical;   /**< Even physical address of the region. */
+    uint16_t byte_count; /**< Region length, 0 meaning 64 KiB. */
+    uint16_t flags;      /**< IDE_PRD_END on the final entry. */
+} __attribute__((packed)) ide_prd_t;
+
 typedef enum {
     IDE_DEVICE_NONE = 0,
     IDE_DEVICE_ATA,
@@ -50,11 +113,24 @@ typedef struct {
     uint16_t bus_master_base;
     uint8_t  irq;
     bool     present;
+    ide_prd_t* prd_table;    /**< Scatter/gather list handed to the bus master. */
+    uint32_t   prd_physical; /**< Physical address of prd_table. */
+    bool       irq_enabled;  /**< A handler is installed for irq. */
+    volatile bool    irq_pending; /**< Set by the handler, cleared by the waiter. */
+    volatile uint8_t irq_status;  /**< Status register read by the handler. */
+    bool             busy;        /**< A queued request owns the channel. */
+    block_request_t* request;     /**< Request completing from the interrupt handler, or NULL. */
+    struct ide_drive_info* request_drive;
+    uint32_t         request_segment; /**< Segment being transferred. */
+    uint32_t         request_done;    /**< Sectors of that segment already transferred. */
+    uint32_t         request_chunk;   /**< Sectors in the command in flight. */
+    uint64_t         request_lba;     /**< First sector of the command in flight. */
+    uint32_t         request_polls;   /**< Block layer polls since the command was issued. */
 } ide_channel_t;
 
 typedef struct ide_controller ide_controller_t;
 
-typedef struct {
+typedef struct ide_drive_info {
     bool              present;
     ide_device_type_t type;
     uint8_t           channel_index;
@@ -66,6 +142,9 @@ typedef struct {
     block_device_t    block;
     uint64_t          total_sectors;
     uint32_t          sector_size;
+    bool              dma;
+    bool              lba48;
+    uint16_t          multiple_sectors; /**< Sectors per DRQ block in multiple mode, 0 if off. */
 } ide_drive_info_t;
 
 struct ide_controller {
@@ -83,20 +162,31 @@ struct ide_controller {
 static ide_controller_t g_ide_controllers[IDE_MAX_CONTROLLERS];
 static uint8_t g_ide_controller_count;
 static uint32_t g_ide_drive_count;
-
-static bool ide_block_device_read(block_device_t* device,
-                                  uint64_t lba,
-                                  uint32_t sector_count,
-                                  void* buffer);
+/** @brief One PRD table per channel, in the direct-mapped kernel image. */
+static ide_prd_t g_ide_prd_tables[IDE_MAX_CONTROLLERS][IDE_CHANNEL_COUNT][IDE_PRD_ENTRIES]
+    __attribute__((aligned(IDE_PRD_ENTRIES * sizeof(ide_prd_t))));
+/** @brief Use bus-master DMA on drives that support it. */
+static bool g_ide_dma_enabled = true;
+/** @brief Sleep until the channel interrupts instead of polling its status. */
+static bool g_ide_irq_enabled = true;
+static ide_stats_t g_ide_stats;
+/** @brief Set while the interrupt handler runs: waits there must poll, not halt. */
+static bool g_ide_in_interrupt;
 
 static bool ide_pio_read(ide_drive_info_t* drive,
                          uint64_t lba,
                          uint32_t sector_count,
                          void* buffer);
 
+static bool ide_pio_write(ide_drive_info_t* drive,
+                          uint64_t lba,
+                          uint32_t sector_count,
+                          const void* buffer);
+
 static bool ide_wait_not_busy(uint16_t io_base);
 static bool ide_wait_for_drq(uint16_t io_base);
-static void ide_select_drive(uint16_t io_base, uint16_t control_base, uint8_t drive);
+static void ide_select_drive(uint16_t io_base, uint16_t control_base, uint8_t drive, bool interrupts);
+static void ide_irq_handler(Registers* regs);
 
 static uint16_t ide_default_command_base(uint8_t channel)
 {
@@ -144,7 +234,7 @@ static uint16_t ide_decode_bus_master_bar(uint32_t bar_value, uint8_t channel)
     return (uint16_t)(base + (channel == IDE_CHANNEL_SECONDARY ? 8 : 0));
 }
 
-static void ide_soft_reset_channel(const ide_channel_t* channel)
+static void KERNEL_INIT ide_soft_reset_channel(const ide_channel_t* channel)
 {
     if (!channel->present || channel->control_base == 0) {
         return;
@@ -159,7 +249,7 @@ static void ide_soft_reset_channel(const ide_channel_t* channel)
     }
 }
 
-static void ide_configure_channel(ide_controller_t* ctrl,
+static void KERNEL_INIT ide_configure_channel(ide_controller_t* ctrl,
                                   uint8_t channel,
                                   uint32_t bar_cmd,
                                   uint32_t bar_ctl,
@@ -172,6 +262,13 @@ static void ide_configure_channel(ide_controller_t* ctrl,
     ch->bus_master_base = ide_decode_bus_master_bar(bar_busmaster, channel);
     ch->irq             = irq;
     ch->present         = true;
+    ch->prd_table       = g_ide_prd_tables[ctrl - g_ide_controllers][channel];
+    ch->prd_physical    = (uint32_t)virt_to_phys(ch->prd_table);
+    ch->irq_enabled     = irq != 0 && irq < 16;
+
+    if (ch->irq_enabled) {
+        irq_register_handler(irq, ide_irq_handler);
+    }
 
     ide_soft_reset_channel(ch);
 
@@ -219,6 +316,531 @@ static void ide_format_drive_name(char* buffer, size_t length, uint32_t index)
     buffer[pos] = '\0';
 }
 
+static bool ide_irq_available(const ide_channel_t* channel)
+{
+    return g_ide_irq_enabled && channel->irq_enabled;
+}
+
+/**
+ * @brief Whether a synchronous wait on the channel can halt until its interrupt.
+ */
+static bool ide_irq_usable(const ide_channel_t* channel)
+{
+    return ide_irq_available(channel) && !g_ide_in_interrupt;
+}
+
+/**
+ * @brief Halt until the channel's interrupt handler has run.
+ *
+ * Interrupts are enabled while halted, even when called from a syscall or
+ * fault handler: IRQs taken in kernel mode never reschedule, so this only
+ * lets the CPU idle. The previous interrupt state is restored afterwards.
+ *
+ * @param channel Channel whose command was issued after irq_pending was cleared.
+ * @param status  Receives the status register read by the handler.
+ * @return false if no interrupt arrived within IDE_IRQ_TIMEOUT wakeups.
+ */
+static bool ide_wait_irq(ide_channel_t* channel, uint8_t* status)
+{
+    bool interrupts = x86_interrupts_enabled();
+    bool completed = false;
+
+    for (uint32_t i = 0; i < IDE_IRQ_TIMEOUT; ++i)
+    {
+        x86_disable_interrupts();
+        if (channel->irq_pending)
+        {
+            completed = true;
+            break;
+        }
+
+        uint64_t start = x86_read_tsc();
+        x86_wait_for_interrupt();
+        g_ide_stats.halted_cycles += x86_read_tsc() - start;
+    }
+
+    x86_disable_interrupts();
+    channel->irq_pending = false;
+    *status = channel->irq_status;
+    if (interrupts)
+    {
+        x86_enable_interrupts();
+    }
+    return completed;
+}
+
+/**
+ * @brief Wait until the drive has a data block ready (DRQ) for a PIO transfer.
+ */
+static bool ide_wait_data(ide_channel_t* channel)
+{
+    if (ide_irq_usable(channel))
+    {
+        uint8_t status = 0;
+        return ide_wait_irq(channel, &status)
+            && (status & (ATA_SR_ERR | ATA_SR_DF)) == 0
+            && (status & ATA_SR_DRQ) != 0;
+    }
+
+    return ide_wait_not_busy(channel->command_base) && ide_wait_for_drq(channel->command_base);
+}
+
+/**
+ * @brief Wait until the drive has finished a command and check it succeeded.
+ */
+static bool ide_wait_complete(ide_channel_t* channel)
+{
+    uint8_t status = 0;
+    if (ide_irq_usable(channel))
+    {
+        if (!ide_wait_irq(channel, &status))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        if (!ide_wait_not_busy(channel->command_base))
+        {
+            return false;
+        }
+        status = x86_inb(channel->command_base + ATA_REG_STATUS);
+    }
+
+    return (status & (ATA_SR_ERR | ATA_SR_DF)) == 0;
+}
+
+static uint32_t ide_max_sectors(const ide_drive_info_t* drive)
+{
+    return drive->lba48 ? ATA_LBA48_MAX_SECTORS : ATA_LBA28_MAX_SECTORS;
+}
+
+static bool ide_range_valid(const ide_drive_info_t* drive, uint64_t lba, uint32_t count)
+{
+    return lba + count <= (drive->lba48 ? ATA_LBA48_LIMIT : ATA_LBA28_LIMIT);
+}
+
+/**
+ * @brief Load an address and sector count into the task file and issue a command.
+ *
+ * The 48-bit form is used only when the request needs it (beyond LBA28's
+ * reach or more than 256 sectors); it costs four extra register writes.
+ *
+ * @param count     Sectors to transfer, at most ide_max_sectors().
+ * @param command28 Command for the LBA28 form.
+ * @param command48 EXT command for the LBA48 form.
+ */
+static void ide_issue_command(const ide_drive_info_t* drive,
+                              uint64_t lba,
+                              uint32_t count,
+                              uint8_t command28,
+                              uint8_t command48)
+{
+    uint16_t io_base = drive->channel->command_base;
+    bool lba48 = drive->lba48 && (lba + count > ATA_LBA28_LIMIT || count > ATA_LBA28_MAX_SECTORS);
+
+    // Armed before the command so a fast completion is not missed.
+    drive->channel->irq_pending = false;
+    g_ide_stats.commands++;
+
+    if (lba48)
+    {
+        // Each register is a two-deep FIFO: high-order bytes first, then low.
+        x86_outb(io_base + ATA_REG_SECTOR_COUNT, (uint8_t)((count >> 8) & 0xFF));
+        x86_outb(io_base + ATA_REG_LBA_LOW,  (uint8_t)((lba >> 24) & 0xFF));
+        x86_outb(io_base + ATA_REG_LBA_MID,  (uint8_t)((lba >> 32) & 0xFF));
+        x86_outb(io_base + ATA_REG_LBA_HIGH, (uint8_t)((lba >> 40) & 0xFF));
+        x86_outb(io_base + ATA_REG_SECTOR_COUNT, (uint8_t)(count & 0xFF));
+        x86_outb(io_base + ATA_REG_LBA_LOW,  (uint8_t)(lba & 0xFF));
+        x86_outb(io_base + ATA_REG_LBA_MID,  (uint8_t)((lba >> 8) & 0xFF));
+        x86_outb(io_base + ATA_REG_LBA_HIGH, (uint8_t)((lba >> 16) & 0xFF));
+        x86_outb(io_base + ATA_REG_DRIVE_HEAD, (uint8_t)(0x40 | (drive->drive_select << 4)));
+        x86_outb(io_base + ATA_REG_COMMAND, command48);
+        return;
+    }
+
+    x86_outb(io_base + ATA_REG_SECTOR_COUNT, (uint8_t)(count & 0xFF));
+    x86_outb(io_base + ATA_REG_LBA_LOW,  (uint8_t)(lba & 0xFF));
+    x86_outb(io_base + ATA_REG_LBA_MID,  (uint8_t)((lba >> 8) & 0xFF));
+    x86_outb(io_base + ATA_REG_LBA_HIGH, (uint8_t)((lba >> 16) & 0xFF));
+    x86_outb(io_base + ATA_REG_DRIVE_HEAD,
+             (uint8_t)(0xE0 | (drive->drive_select << 4) | ((lba >> 24) & 0x0F)));
+    x86_outb(io_base + ATA_REG_COMMAND, command28);
+}
+
+static uint32_t ide_prd_length(const ide_prd_t* prd)
+{
+    return prd->byte_count ? prd->byte_count : 0x10000u;
+}
+
+/**
+ * @brief Describe a scatter list to the bus master without copying it.
+ *
+ * Pages are translated one at a time and physically adjacent pages are
+ * merged, across segment boundaries too, as long as an entry stays inside
+ * one 64 KiB region. If the table fills up, only a prefix is described.
+ *
+ * @param segments    Buffers in transfer order.
+ * @param skip        Sectors at the start of segments[0] already transferred.
+ * @param sectors     Sectors wanted from there on.
+ * @param sector_size The described prefix is trimmed to whole sectors.
+ * @return Bytes described (a multiple of sector_size), or 0 if a buffer is
+ *         misaligned or unmapped.
+ */
+static uint32_t ide_dma_build_prd(ide_channel_t* channel,
+                                  const block_segment_t* segments,
+                                  uint32_t skip,
+                                  uint32_t sectors,
+                                  uint32_t sector_size)
+{
+    ide_prd_t* prd = channel->prd_table;
+    uint32_t entries = 0;
+    uint32_t run_length = 0;
+    uint32_t described = 0;
+    uint32_t bytes = sectors * sector_size;
+    bool full = false;
+
+    if (prd == NULL || channel->prd_physical == 0)
+    {
+        return 0;
+    }
+
+    for (const block_segment_t* segment = segments; described < bytes && !full; ++segment, skip = 0)
+    {
+        uint32_t address = (uint32_t)segment->buffer + skip * sector_size;
+        uint32_t end = described + (segment->sector_count - skip) * sector_size;
+        if (end > bytes)
+        {
+            end = bytes;
+        }
+
+        if ((address & 1) != 0)
+        {
+            return 0;
+        }
+
+        while (described < end)
+        {
+            uint32_t physical = (uint32_t)virt_to_phys((const void*)address);
+            if (physical == 0)
+            {
+                return 0;
+            }
+
+            uint32_t length = PAGE_SIZE_BYTES - (address & (PAGE_SIZE_BYTES - 1));
+            if (length > end - described)
+            {
+                length = end - described;
+            }
+
+            ide_prd_t* last = (entries > 0) ? &prd[entries - 1] : NULL;
+            if (last != NULL
+                && last->physical + run_length == physical
+                && ((last->physical ^ (physical + length - 1)) & 0xFFFF0000u) == 0)
+            {
+                run_length += length;
+            }
+            else
+            {
+                if (entries == IDE_PRD_ENTRIES)
+                {
+                    full = true;
+                    break;
+                }
+                last = &prd[entries++];
+                last->physical = physical;
+                run_length = length;
+            }
+            last->byte_count = (uint16_t)run_length; // 0x10000 wraps to 0, meaning 64 KiB
+            last->flags = 0;
+
+            address += length;
+            described += length;
+        }
+    }
+
+    // The command's sector count must match the table exactly.
+    uint32_t excess = described % sector_size;
+    described -= excess;
+    while (excess > 0)
+    {
+        uint32_t length = ide_prd_length(&prd[entries - 1]);
+        if (length > excess)
+        {
+            prd[entries - 1].byte_count = (uint16_t)(length - excess);
+            break;
+        }
+        excess -= length;
+        entries--;
+    }
+
+    if (described == 0)
+    {
+        return 0;
+    }
+
+    prd[entries - 1].flags = IDE_PRD_END;
+    return described;
+}
+
+/**
+ * @brief Program the bus master and the drive for one DMA command and start it.
+ *
+ * @param segments     Scatter list position to transfer from or to.
+ * @param skip         Sectors of segments[0] already transferred.
+ * @param sector_count Sectors left in the scatter list.
+ * @param interrupts   Let the drive raise its IRQ at the end of the command.
+ * @return Sectors covered by the command (a prefix of sector_count), or 0 if
+ *         the buffers cannot be described to the bus master or the drive
+ *         stayed busy.
+ */
+static uint32_t ide_dma_start(ide_drive_info_t* drive,
+                              uint64_t lba,
+                              const block_segment_t* segments,
+                              uint32_t skip,
+                              uint32_t sector_count,
+                              bool write,
+                              bool interrupts)
+{
+    ide_channel_t* channel = drive->channel;
+    uint16_t bm = channel->bus_master_base;
+    uint8_t direction = write ? 0 : IDE_BM_CMD_READ;
+    uint32_t chunk = (sector_count > ide_max_sectors(drive)) ? ide_max_sectors(drive) : sector_count;
+
+    // A fragmented buffer may need more entries than the table has; the
+    // command then covers just the part that fits.
+    uint32_t bytes = ide_dma_build_prd(channel, segments, skip, chunk, drive->sector_size);
+    if (bytes == 0)
+    {
+        return 0;
+    }
+    chunk = bytes / drive->sector_size;
+
+    x86_outb(bm + IDE_BM_REG_COMMAND, direction);
+    x86_outl(bm + IDE_BM_REG_PRDT, channel->prd_physical);
+    x86_outb(bm + IDE_BM_REG_STATUS,
+             (uint8_t)(x86_inb(bm + IDE_BM_REG_STATUS) | IDE_BM_SR_ERR | IDE_BM_SR_IRQ));
+
+    ide_select_drive(channel->command_base, channel->control_base, drive->drive_select, interrupts);
+
+    if (!ide_wait_not_busy(channel->command_base))
+    {
+        return 0;
+    }
+
+    if (write)
+    {
+        ide_issue_command(drive, lba, chunk, ATA_CMD_WRITE_DMA, ATA_CMD_WRITE_DMA_EXT);
+    }
+    else
+    {
+        ide_issue_command(drive, lba, chunk, ATA_CMD_READ_DMA, ATA_CMD_READ_DMA_EXT);
+    }
+    x86_outb(bm + IDE_BM_REG_COMMAND, (uint8_t)(direction | IDE_BM_CMD_START));
+    return chunk;
+}
+
+/**
+ * @brief Stop the bus master after a DMA command and check how it ended.
+ */
+static bool ide_dma_finish(ide_drive_info_t* drive, uint64_t lba, bool write)
+{
+    ide_channel_t* channel = drive->channel;
+    uint16_t bm = channel->bus_master_base;
+
+    uint8_t bm_status = x86_inb(bm + IDE_BM_REG_STATUS);
+    x86_outb(bm + IDE_BM_REG_COMMAND, write ? 0 : IDE_BM_CMD_READ);
+
+    bool drive_idle = ide_wait_not_busy(channel->command_base);
+    uint8_t status = x86_inb(channel->command_base + ATA_REG_STATUS);
+    if (!drive_idle || (bm_status & (IDE_BM_SR_ACTIVE | IDE_BM_SR_ERR)) != 0
+        || (status & (ATA_SR_ERR | ATA_SR_DF)) != 0)
+    {
+        kprintf("IDE: %s DMA %s failed at lba %u (status=0x%02x bm=0x%02x)\n",
+                drive->block.name,
+                write ? "write" : "read",
+                (uint32_t)lba,
+                status,
+                bm_status);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Step a scatter list position forward, skipping finished and empty segments.
+ */
+static void ide_segment_advance(const block_request_t* request, uint32_t* segment, uint32_t* skip, uint32_t sectors)
+{
+    *skip += sectors;
+    while (*segment < request->segment_count && *skip >= request->segments[*segment].sector_count)
+    {
+        *skip -= request->segments[*segment].sector_count;
+        (*segment)++;
+    }
+}
+
+/**
+ * @brief Move a request's sectors between the drive and memory with bus-master DMA, waiting for each command.
+ *
+ * The CPU only programs the PRD table and the task file, then sleeps on the
+ * interrupt (or polls); no data passes through it. A merged request whose
+ * segments fit in the PRD table goes out as a single command.
+ *
+ * @return false if a buffer cannot be described to the bus master or the
+ *         transfer failed (the caller falls back to PIO).
+ */
+static bool ide_dma_transfer(ide_drive_info_t* drive, const block_request_t* request)
+{
+    ide_channel_t* channel = drive->channel;
+    if (channel == NULL || !channel->present || channel->bus_master_base == 0)
+    {
+        return false;
+    }
+
+    if (!ide_range_valid(drive, request->lba, request->sector_count))
+    {
+        return false;
+    }
+
+    bool write = request->op == BLOCK_REQUEST_WRITE;
+    uint64_t lba = request->lba;
+    uint32_t remaining = request->sector_count;
+    uint32_t segment = 0;
+    uint32_t skip = 0;
+    ide_segment_advance(request, &segment, &skip, 0);
+
+    while (remaining > 0)
+    {
+        bool interrupts = ide_irq_usable(channel);
+        uint32_t chunk = ide_dma_start(drive, lba, &request->segments[segment], skip, remaining, write, interrupts);
+        if (chunk == 0)
+        {
+            return false;
+        }
+
+        if (interrupts)
+        {
+            uint8_t irq_status = 0;
+            if (!ide_wait_irq(channel, &irq_status))
+            {
+                // The bus master may still be moving data; stop it before failing.
+                kprintf("IDE: %s DMA %s timed out at lba %u\n",
+                        drive->block.name,
+                        write ? "write" : "read",
+                        (uint32_t)lba);
+                x86_outb(channel->bus_master_base + IDE_BM_REG_COMMAND, 0);
+                return false;
+            }
+        }
+        else
+        {
+            for (uint32_t i = 0; i < IDE_DMA_TIMEOUT; ++i)
+            {
+                uint8_t bm_status = x86_inb(channel->bus_master_base + IDE_BM_REG_STATUS);
+                if ((bm_status & IDE_BM_SR_ACTIVE) == 0 || (bm_status & IDE_BM_SR_ERR) != 0)
+                {
+                    break;
+                }
+            }
+        }
+
+        if (!ide_dma_finish(drive, lba, write))
+        {
+            return false;
+        }
+
+        ide_segment_advance(request, &segment, &skip, chunk);
+        remaining -= chunk;
+        lba += chunk;
+    }
+
+    return true;
+}
+
+static bool ide_dma_usable(const ide_drive_info_t* drive)
+{
+    return g_ide_dma_enabled && drive->dma && drive->sector_size == 512
+        && drive->channel != NULL && drive->channel->bus_master_base != 0;
+}
+
+void ide_set_dma_enabled(bool enabled)
+{
+    g_ide_dma_enabled = enabled;
+}
+
+void ide_set_irq_enabled(bool enabled)
+{
+    g_ide_irq_enabled = enabled;
+}
+
+const ide_stats_t* ide_get_stats(void)
+{
+    return &g_ide_stats;
+}
+
+static void ide_async_interrupt(ide_channel_t* channel);
+
+/**
+ * @brief Acknowledge a channel's interrupt if it has one outstanding.
+ *
+ * Reading the status register deasserts INTRQ. In native mode both channels
+ * share the PCI line, so the bus-master interrupt bit tells them apart.
+ */
+static void ide_service_channel(ide_channel_t* channel)
+{
+    if (channel->bus_master_base != 0)
+    {
+        uint8_t bm_status = x86_inb(channel->bus_master_base + IDE_BM_REG_STATUS);
+        if ((bm_status & IDE_BM_SR_IRQ) == 0)
+        {
+            return;
+        }
+        // Write-one-to-clear; leave the error bit for the waiter to see.
+        x86_outb(channel->bus_master_base + IDE_BM_REG_STATUS,
+                 (uint8_t)((bm_status & (IDE_BM_SR_DRIVE0_DMA | IDE_BM_SR_DRIVE1_DMA)) | IDE_BM_SR_IRQ));
+    }
+
+    channel->irq_status = x86_inb(channel->command_base + ATA_REG_STATUS);
+    g_ide_stats.interrupts++;
+
+    if (channel->request != NULL)
+    {
+        ide_async_interrupt(channel);
+    }
+    else
+    {
+        channel->irq_pending = true;
+    }
+}
+
+static void ide_irq_handler(Registers* regs)
+{
+    uint32_t line = regs->interrupt - IRQ_BASE_VECTOR;
+
+    g_ide_in_interrupt = true;
+    for (uint8_t c = 0; c < g_ide_controller_count; ++c)
+    {
+        for (uint8_t i = 0; i < IDE_CHANNEL_COUNT; ++i)
+        {
+            ide_channel_t* channel = &g_ide_controllers[c].channels[i];
+            if (channel->present && channel->irq_enabled && channel->irq == line)
+            {
+                ide_service_channel(channel);
+            }
+        }
+    }
+    g_ide_in_interrupt = false;
+}
+
+/**
+ * @brief Sectors in the next DRQ block of a READ/WRITE MULTIPLE command.
+ */
+static uint32_t ide_pio_block(const ide_drive_info_t* drive, uint32_t remaining)
+{
+    return (remaining > drive->multiple_sectors) ? drive->multiple_sectors : remaining;
+}
+
 static bool ide_pio_read(ide_drive_info_t* drive,
                          uint64_t lba,
                          uint32_t sector_count,
@@ -239,7 +861,7 @@ static bool ide_pio_read(ide_drive_info_t* drive,
         return false;
     }
 
-    if ((lba + sector_count) >= (1ull << 28))
+    if (!ide_range_valid(drive, lba, sector_count))
     {
         return false;
     }
@@ -250,47 +872,125 @@ static bool ide_pio_read(ide_drive_info_t* drive,
         return false;
     }
 
-    uint16_t* target = (uint16_t*)buffer;
+    uint8_t* target = (uint8_t*)buffer;
+    bool multiple = drive->multiple_sectors > 1;
 
     while (sector_count > 0)
     {
-        uint8_t chunk = (sector_count > 127) ? 127 : (uint8_t)sector_count;
-        if (chunk == 0)
-        {
-            chunk = 1;
-        }
+        uint32_t chunk = (sector_count > ide_max_sectors(drive)) ? ide_max_sectors(drive) : sector_count;
 
-        ide_select_drive(channel->command_base, channel->control_base, drive->drive_select);
+        ide_select_drive(channel->command_base, channel->control_base, drive->drive_select,
+                         ide_irq_usable(channel));
 
         if (!ide_wait_not_busy(channel->command_base))
         {
             return false;
         }
 
-        x86_outb(channel->command_base + ATA_REG_SECTOR_COUNT, chunk);
-        x86_outb(channel->command_base + ATA_REG_LBA_LOW,  (uint8_t)(lba & 0xFF));
-        x86_outb(channel->command_base + ATA_REG_LBA_MID,  (uint8_t)((lba >> 8) & 0xFF));
-        x86_outb(channel->command_base + ATA_REG_LBA_HIGH, (uint8_t)((lba >> 16) & 0xFF));
-        x86_outb(channel->command_base + ATA_REG_DRIVE_HEAD,
-                 (uint8_t)(0xE0 | (drive->drive_select << 4) | ((lba >> 24) & 0x0F)));
-        x86_outb(channel->command_base + ATA_REG_COMMAND, ATA_CMD_READ_SECTORS);
+        if (multiple)
+        {
+            ide_issue_command(drive, lba, chunk, ATA_CMD_READ_MULTIPLE, ATA_CMD_READ_MULTIPLE_EXT);
+        }
+        else
+        {
+            ide_issue_command(drive, lba, chunk, ATA_CMD_READ_SECTORS, ATA_CMD_READ_SECTORS_EXT);
+        }
 
-        for (uint8_t s = 0; s < chunk; ++s)
+        for (uint32_t s = 0; s < chunk;)
         {
-            if (!ide_wait_not_busy(channel->command_base))
+            uint32_t block = multiple ? ide_pio_block(drive, chunk - s) : 1;
+
+            // The drive interrupts once per DRQ block as each becomes readable.
+            if (!ide_wait_data(channel))
             {
                 return false;
             }
 
-            if (!ide_wait_for_drq(channel->command_base))
+            // PCI IDE controllers split 32-bit data port reads into two 16-bit cycles.
+            x86_insl(channel->command_base + ATA_REG_DATA, target, block * (drive->sector_size / 4));
+            target += block * drive->sector_size;
+            s += block;
+        }
+
+        sector_count -= chunk;
+        lba += chunk;
+    }
+
+    return true;
+}
+
+static bool ide_pio_write(ide_drive_info_t* drive,
+                          uint64_t lba,
+                          uint32_t sector_count,
+                          const void* buffer)
+{
+    if (drive == NULL || buffer == NULL || sector_count == 0)
+    {
+        return false;
+    }
+
+    if (drive->type != IDE_DEVICE_ATA || drive->sector_size != 512)
+    {
+        return false;
+    }
+
+    if (!ide_range_valid(drive, lba, sector_count))
+    {
+        return false;
+    }
+
+    ide_channel_t* channel = drive->channel;
+    if (channel == NULL || !channel->present)
+    {
+        return false;
+    }
+
+    const uint8_t* source = (const uint8_t*)buffer;
+    bool multiple = drive->multiple_sectors > 1;
+
+    while (sector_count > 0)
+    {
+        uint32_t chunk = (sector_count > ide_max_sectors(drive)) ? ide_max_sectors(drive) : sector_count;
+
+        ide_select_drive(channel->command_base, channel->control_base, drive->drive_select,
+                         ide_irq_usable(channel));
+
+        if (!ide_wait_not_busy(channel->command_base))
+        {
+            return false;
+        }
+
+        if (multiple)
+        {
+            ide_issue_command(drive, lba, chunk, ATA_CMD_WRITE_MULTIPLE, ATA_CMD_WRITE_MULTIPLE_EXT);
+        }
+        else
+        {
+            ide_issue_command(drive, lba, chunk, ATA_CMD_WRITE_SECTORS, ATA_CMD_WRITE_SECTORS_EXT);
+        }
+
+        for (uint32_t s = 0; s < chunk;)
+        {
+            uint32_t block = multiple ? ide_pio_block(drive, chunk - s) : 1;
+
+            // No interrupt precedes the first block; later ones follow each block written.
+            bool ready = (s == 0)
+                ? ide_wait_not_busy(channel->command_base) && ide_wait_for_drq(channel->command_base)
+                : ide_wait_data(channel);
+            if (!ready)
             {
                 return false;
             }
 
-            for (int word = 0; word < 256; ++word)
-            {
-                *target++ = x86_inw(channel->command_base + ATA_REG_DATA);
-            }
+            x86_outsw(channel->command_base + ATA_REG_DATA, source, block * (drive->sector_size / 2));
+            source += block * drive->sector_size;
+            s += block;
+        }
+
+        // The drive stays busy until the last sector has been committed.
+        if (!ide_wait_complete(channel))
+        {
+            return false;
         }
 
         sector_count -= chunk;
@@ -300,32 +1000,252 @@ static bool ide_pio_read(ide_drive_info_t* drive,
     return true;
 }
 
-static bool ide_block_device_read(block_device_t* device,
-                                  uint64_t lba,
-                                  uint32_t sector_count,
-                                  void* buffer)
+static bool ide_flush(ide_drive_info_t* drive)
+{
+    ide_channel_t* channel = drive->channel;
+
+    ide_select_drive(channel->command_base, channel->control_base, drive->drive_select,
+                     ide_irq_usable(channel));
+
+    if (!ide_wait_not_busy(channel->command_base))
+    {
+        return false;
+    }
+
+    // The EXT form is mandatory with LBA48 and covers caches beyond 128 GiB.
+    channel->irq_pending = false;
+    x86_outb(channel->command_base + ATA_REG_COMMAND,
+             drive->lba48 ? ATA_CMD_FLUSH_CACHE_EXT : ATA_CMD_FLUSH_CACHE);
+
+    if (!ide_wait_complete(channel))
+    {
+        kprintf("IDE: %s cache flush failed\n", drive->block.name);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Carry out a queued request from start to finish on the calling CPU.
+ */
+static bool ide_execute(ide_drive_info_t* drive, block_request_t* request)
+{
+    if (request->op == BLOCK_REQUEST_FLUSH)
+    {
+        return ide_flush(drive);
+    }
+
+    if (ide_dma_usable(drive) && ide_dma_transfer(drive, request))
+    {
+        return true;
+    }
+
+    uint64_t lba = request->lba;
+    for (uint32_t i = 0; i < request->segment_count; ++i)
+    {
+        block_segment_t* segment = &request->segments[i];
+        if (segment->sector_count == 0)
+        {
+            continue;
+        }
+
+        bool ok = (request->op == BLOCK_REQUEST_WRITE)
+            ? ide_pio_write(drive, lba, segment->sector_count, segment->buffer)
+            : ide_pio_read(drive, lba, segment->sector_count, segment->buffer);
+        if (!ok)
+        {
+            return false;
+        }
+        lba += segment->sector_count;
+    }
+    return true;
+}
+
+/**
+ * @brief Give up the channel, report the request and restart both drives' queues.
+ */
+static void ide_release_channel(ide_drive_info_t* drive, block_request_t* request, bool success)
+{
+    ide_channel_t* channel = drive->channel;
+    channel->request = NULL;
+    channel->busy = false;
+
+    block_request_complete(request, success);
+
+    // The other drive on the cable may have requests waiting for the channel.
+    ide_drive_info_t* sibling = &drive->controller->drives[drive->channel_index][drive->drive_select ^ 1];
+    if (sibling->present && sibling->type == IDE_DEVICE_ATA)
+    {
+        block_device_kick(&sibling->block);
+    }
+}
+
+/**
+ * @brief Skip over finished segments of the channel's asynchronous request.
+ *
+ * @return true once every segment has been transferred.
+ */
+static bool ide_async_finished(ide_channel_t* channel)
 {
-    if (device == NULL || buffer == NULL || sector_count == 0)
+    block_request_t* request = channel->request;
+    ide_segment_advance(request, &channel->request_segment, &channel->request_done, 0);
+    return channel->request_segment == request->segment_count;
+}
+
+/**
+ * @brief Start the next DMA command of the channel's asynchronous request.
+ */
+static bool ide_async_issue(ide_channel_t* channel)
+{
+    ide_drive_info_t* drive = channel->request_drive;
+    block_request_t* request = channel->request;
+
+    channel->request_polls = 0;
+    channel->request_chunk = ide_dma_start(drive,
+                                           channel->request_lba,
+                                           &request->segments[channel->request_segment],
+                                           channel->request_done,
+                                           (uint32_t)(request->lba + request->sector_count - channel->request_lba),
+                                           request->op == BLOCK_REQUEST_WRITE,
+                                           true);
+    return channel->request_chunk != 0;
+}
+
+/**
+ * @brief A DMA command of the asynchronous request ended: issue the next one or complete it.
+ */
+static void ide_async_interrupt(ide_channel_t* channel)
+{
+    ide_drive_info_t* drive = channel->request_drive;
+    block_request_t* request = channel->request;
+
+    bool success = ide_dma_finish(drive, channel->request_lba, request->op == BLOCK_REQUEST_WRITE);
+    if (success)
+    {
+        channel->request_lba += channel->request_chunk;
+        ide_segment_advance(request, &channel->request_segment, &channel->request_done, channel->request_chunk);
+        if (!ide_async_finished(channel))
+        {
+            if (ide_async_issue(channel))
+            {
+                return;
+            }
+            success = false;
+        }
+    }
+
+    ide_release_channel(drive, request, success);
+}
+
+/**
+ * @brief Block layer entry point: run a queued request on the drive.
+ *
+ * Reads and writes that can use DMA with interrupts are started here and
+ * finished by the interrupt handler, which chains the next command (and the
+ * next queued request) without waking the submitter. Everything else runs
+ * to completion before returning.
+ */
+static bool ide_block_device_start(block_device_t* device, block_request_t* request)
+{
+    ide_drive_info_t* drive = (ide_drive_info_t*)device->driver_data;
+    ide_channel_t* channel = drive->channel;
+
+    bool interrupts = x86_interrupts_enabled();
+    x86_disable_interrupts();
+    bool claimed = !channel->busy;
+    channel->busy = true;
+    if (interrupts)
+    {
+        x86_enable_interrupts();
+    }
+
+    if (!claimed)
     {
         return false;
     }
 
+    if (request->op != BLOCK_REQUEST_FLUSH && ide_dma_usable(drive) && ide_irq_available(channel)
+        && ide_range_valid(drive, request->lba, request->sector_count))
+    {
+        channel->request_drive = drive;
+        channel->request_segment = 0;
+        channel->request_done = 0;
+        channel->request_lba = request->lba;
+        channel->request = request;
+        if (!ide_async_finished(channel) && ide_async_issue(channel))
+        {
+            return true;
+        }
+        channel->request = NULL;
+    }
+
+    ide_release_channel(drive, request, ide_execute(drive, request));
+    return true;
+}
+
+/**
+ * @brief Block layer hook: pick up a finished DMA command whose interrupt never arrived.
+ */
+static void ide_block_device_poll(block_device_t* device)
+{
     ide_drive_info_t* drive = (ide_drive_info_t*)device->driver_data;
-    if (drive == NULL || !drive->present || drive->type != IDE_DEVICE_ATA)
+    ide_channel_t* channel = drive->channel;
+
+    if (channel->request == NULL)
+    {
+        return;
+    }
+
+    g_ide_in_interrupt = true;
+    ide_service_channel(channel);
+
+    // Each poll follows a wakeup, so this gives up after as long as a synchronous wait would.
+    if (channel->request != NULL && ++channel->request_polls >= IDE_IRQ_TIMEOUT)
+    {
+        kprintf("IDE: %s DMA timed out at lba %u\n",
+                channel->request_drive->block.name,
+                (uint32_t)channel->request_lba);
+        x86_outb(channel->bus_master_base + IDE_BM_REG_COMMAND, 0);
+        ide_release_channel(channel->request_drive, channel->request, false);
+    }
+    g_ide_in_interrupt = false;
+}
+
+/**
+ * @brief Have the drive transfer several sectors per DRQ block in READ/WRITE MULTIPLE.
+ */
+static bool KERNEL_INIT ide_set_multiple_mode(ide_drive_info_t* drive, uint16_t sectors)
+{
+    ide_channel_t* channel = drive->channel;
+
+    ide_select_drive(channel->command_base, channel->control_base, drive->drive_select, false);
+    if (!ide_wait_not_busy(channel->command_base))
     {
         return false;
     }
 
-    return ide_pio_read(drive, lba, sector_count, buffer);
+    x86_outb(channel->command_base + ATA_REG_SECTOR_COUNT, (uint8_t)sectors);
+    x86_outb(channel->command_base + ATA_REG_COMMAND, ATA_CMD_SET_MULTIPLE);
+
+    if (!ide_wait_not_busy(channel->command_base))
+    {
+        return false;
+    }
+
+    return (x86_inb(channel->command_base + ATA_REG_STATUS) & (ATA_SR_ERR | ATA_SR_DF)) == 0;
 }
 
-static void ide_register_drive(ide_controller_t* ctrl,
+static void KERNEL_INIT ide_register_drive(ide_controller_t* ctrl,
                                ide_channel_t* channel,
                                uint8_t channel_index,
                                uint8_t drive_select,
                                ide_device_type_t type,
                                const char* model,
-                               uint64_t total_sectors)
+                               uint64_t total_sectors,
+                               bool dma,
+                               bool lba48,
+                               uint16_t multiple)
 {
     if (ctrl == NULL || channel == NULL)
     {
@@ -344,6 +1264,23 @@ static void ide_register_drive(ide_controller_t* ctrl,
     drive->unit_number   = g_ide_drive_count++;
     drive->total_sectors = total_sectors;
     drive->sector_size   = 512;
+    drive->dma           = dma && channel->bus_master_base != 0;
+    drive->lba48         = lba48;
+
+    if (multiple > 1 && ide_set_multiple_mode(drive, multiple))
+    {
+        drive->multiple_sectors = multiple;
+        kprintf("IDE: drive %u transfers %u sectors per PIO block\n", drive->unit_number, multiple);
+    }
+
+    if (drive->dma)
+    {
+        // Advertise the drive as DMA capable, as firmware would have done.
+        uint8_t capable = (drive_select == 0) ? IDE_BM_SR_DRIVE0_DMA : IDE_BM_SR_DRIVE1_DMA;
+        uint8_t bm_status = x86_inb(channel->bus_master_base + IDE_BM_REG_STATUS);
+        x86_outb(channel->bus_master_base + IDE_BM_REG_STATUS,
+                 (uint8_t)((bm_status & (IDE_BM_SR_DRIVE0_DMA | IDE_BM_SR_DRIVE1_DMA)) | capable));
+    }
 
     if (model != NULL)
     {
@@ -358,7 +1295,11 @@ static void ide_register_drive(ide_controller_t* ctrl,
     ide_format_drive_name(drive->block.name, sizeof(drive->block.name), drive->unit_number);
     drive->block.sector_size  = drive->sector_size;
     drive->block.sector_count = drive->total_sectors;
-    drive->block.read         = ide_block_device_read;
+    drive->block.read         = block_device_queued_read;
+    drive->block.write        = block_device_queued_write;
+    drive->block.flush        = block_device_queued_flush;
+    drive->block.start        = ide_block_device_start;
+    drive->block.poll         = ide_block_device_poll;
     drive->block.driver_data  = drive;
 
     if (!block_device_register(&drive->block))
@@ -406,10 +1347,10 @@ static bool ide_wait_for_drq(uint16_t io_base)
     return false;
 }
 
-static void ide_select_drive(uint16_t io_base, uint16_t control_base, uint8_t drive)
+static void ide_select_drive(uint16_t io_base, uint16_t control_base, uint8_t drive, bool interrupts)
 {
     if (control_base != 0) {
-        x86_outb(control_base, ATA_CTL_nIEN);
+        x86_outb(control_base, interrupts ? 0 : ATA_CTL_nIEN);
     }
 
     x86_outb(io_base + 6, (uint8_t)(0xA0 | (drive << 4)));
@@ -418,13 +1359,13 @@ static void ide_select_drive(uint16_t io_base, uint16_t control_base, uint8_t dr
     }
 }
 
-static bool ide_issue_identify(uint16_t io_base,
+static bool KERNEL_INIT ide_issue_identify(uint16_t io_base,
                                uint16_t control_base,
                                uint8_t drive,
                                uint8_t command,
                                uint16_t* buffer)
 {
-    ide_select_drive(io_base, control_base, drive);
+    ide_select_drive(io_base, control_base, drive, false);
 
     x86_outb(io_base + 1, 0x00);
     x86_outb(io_base + 2, 0x00);
@@ -455,14 +1396,12 @@ static bool ide_issue_identify(uint16_t io_base,
         return false;
     }
 
-    for (int i = 0; i < 256; ++i) {
-        buffer[i] = x86_inw(io_base);
-    }
+    x86_insw(io_base, buffer, 256);
 
     return true;
 }
 
-static void ide_extract_model(const uint16_t* identify_words, char* out, size_t out_len)
+static void KERNEL_INIT ide_extract_model(const uint16_t* identify_words, char* out, size_t out_len)
 {
     if (out_len == 0) {
         return;
@@ -497,11 +1436,14 @@ static void ide_extract_model(const uint16_t* identify_words, char* out, size_t
     }
 }
 
-static ide_device_type_t ide_identify_device(const ide_channel_t* channel,
+static ide_device_type_t KERNEL_INIT ide_identify_device(const ide_channel_t* channel,
                                              uint8_t drive,
                                              char* model,
                                              size_t model_len,
-                                             uint64_t* total_sectors_out)
+                                             uint64_t* total_sectors_out,
+                                             bool* dma_out,
+                                             bool* lba48_out,
+                                             uint16_t* multiple_out)
 {
     if (model_len > 0) {
         model[0] = '\0';
@@ -511,6 +1453,18 @@ static ide_device_type_t ide_identify_device(const ide_channel_t* channel,
         *total_sectors_out = 0;
     }
 
+    if (dma_out != NULL) {
+        *dma_out = false;
+    }
+
+    if (lba48_out != NULL) {
+        *lba48_out = false;
+    }
+
+    if (multiple_out != NULL) {
+        *multiple_out = 0;
+    }
+
     if (channel == NULL || !channel->present || channel->command_base == 0) {
         return IDE_DEVICE_NONE;
     }
@@ -525,12 +1479,31 @@ static ide_device_type_t ide_identify_device(const ide_channel_t* channel,
                            identify_words))
     {
         ide_extract_model(identify_words, model, model_len);
+        bool lba48 = (identify_words[ATA_IDENTIFY_COMMAND_SETS] & ATA_COMMAND_SET_LBA48) != 0;
         if (total_sectors_out != NULL)
         {
             uint64_t sectors_28 =
-                ((uint64_t)identify_words[61] << 16) |
-                (uint64_t)identify_words[60];
-            *total_sectors_out = sectors_28;
+                ((uint64_t)identify_words[ATA_IDENTIFY_SECTORS_28 + 1] << 16) |
+                (uint64_t)identify_words[ATA_IDENTIFY_SECTORS_28];
+            uint64_t sectors_48 =
+                ((uint64_t)identify_words[ATA_IDENTIFY_SECTORS_48 + 3] << 48) |
+                ((uint64_t)identify_words[ATA_IDENTIFY_SECTORS_48 + 2] << 32) |
+                ((uint64_t)identify_words[ATA_IDENTIFY_SECTORS_48 + 1] << 16) |
+                (uint64_t)identify_words[ATA_IDENTIFY_SECTORS_48];
+            // Words 60-61 saturate at 0x0FFFFFFF on drives larger than 128 GiB.
+            *total_sectors_out = (lba48 && sectors_48 > sectors_28) ? sectors_48 : sectors_28;
+        }
+        if (lba48_out != NULL)
+        {
+            *lba48_out = lba48;
+        }
+        if (multiple_out != NULL)
+        {
+            *multiple_out = identify_words[ATA_IDENTIFY_MAX_MULTIPLE] & 0xFF;
+        }
+        if (dma_out != NULL)
+        {
+            *dma_out = (identify_words[ATA_IDENTIFY_CAPABILITIES] & ATA_CAPABILITY_DMA) != 0;
         }
         return IDE_DEVICE_ATA;
     }
@@ -553,7 +1526,7 @@ static ide_device_type_t ide_identify_device(const ide_channel_t* channel,
     return IDE_DEVICE_NONE;
 }
 
-static void ide_probe_drive(ide_controller_t* ctrl,
+static void KERNEL_INIT ide_probe_drive(ide_controller_t* ctrl,
                             ide_channel_t* channel,
                             uint8_t channel_index,
                             uint8_t drive)
@@ -564,11 +1537,17 @@ static void ide_probe_drive(ide_controller_t* ctrl,
 
     char model[41];
     uint64_t total_sectors = 0;
+    bool dma = false;
+    bool lba48 = false;
+    uint16_t multiple = 0;
     ide_device_type_t type = ide_identify_device(channel,
                                                  drive,
                                                  model,
                                                  sizeof(model),
-                                                 &total_sectors);
+                                                 &total_sectors,
+                                                 &dma,
+                                                 &lba48,
+                                                 &multiple);
     const char* chan_name = ide_channel_name(channel_index);
     const char* drive_name = ide_drive_name(drive);
 
@@ -585,19 +1564,21 @@ static void ide_probe_drive(ide_controller_t* ctrl,
     const char* type_str = (type == IDE_DEVICE_ATAPI) ? "ATAPI" : "ATA";
     const char* model_str = (model[0] != '\0') ? model : "unknown";
 
-    kprintf("IDE: %02x:%02x.%u %s %s %s model=\"%s\"\n",
+    kprintf("IDE: %02x:%02x.%u %s %s %s model=\"%s\"%s%s\n",
             ctrl->bus,
             ctrl->device,
             ctrl->function,
             chan_name,
             drive_name,
             type_str,
-            model_str);
+            model_str,
+            (dma && channel->bus_master_base != 0) ? " dma" : "",
+            lba48 ? " lba48" : "");
 
-    ide_register_drive(ctrl, channel, channel_index, drive, type, model, total_sectors);
+    ide_register_drive(ctrl, channel, channel_index, drive, type, model, total_sectors, dma, lba48, multiple);
 }
 
-static void ide_scan_devices(ide_controller_t* ctrl)
+static void KERNEL_INIT ide_scan_devices(ide_controller_t* ctrl)
 {
     for (uint8_t channel = 0; channel < IDE_CHANNEL_COUNT; ++channel) {
         ide_probe_drive(ctrl, &ctrl->channels[channel], channel, 0);
@@ -605,7 +1586,7 @@ static void ide_scan_devices(ide_controller_t* ctrl)
     }
 }
 
-void ide_controller_init_from_pci(const ide_pci_descriptor_t* desc)
+void KERNEL_INIT ide_controller_init_from_pci(const ide_pci_descriptor_t* desc)
 {
     if (desc == NULL) {
         return;
@@ -636,19 +1617,26 @@ void ide_controller_init_from_pci(const ide_pci_descriptor_t* desc)
             ctrl->device_id,
             ctrl->prog_if);
 
+    if (ide_mask_io_bar(desc->bar[4]) != 0) {
+        pci_enable_bus_master(ctrl->bus, ctrl->device, ctrl->function);
+    }
+
+    // Channels in compatibility mode keep the ISA IRQs regardless of the PCI line.
     ide_configure_channel(ctrl,
                           IDE_CHANNEL_PRIMARY,
                           desc->bar[0],
                           desc->bar[1],
                           desc->bar[4],
-                          desc->interrupt_line);
+                          (desc->prog_if & IDE_PROG_IF_PRIMARY_NATIVE) ? desc->interrupt_line
+                                                                       : IDE_LEGACY_IRQ_PRIMARY);
 
     ide_configure_channel(ctrl,
                           IDE_CHANNEL_SECONDARY,
                           desc->bar[2],
                           desc->bar[3],
                           desc->bar[4],
-                          desc->interrupt_line);
+                          (desc->prog_if & IDE_PROG_IF_SECONDARY_NATIVE) ? desc->interrupt_line
+                                                                         : IDE_LEGACY_IRQ_SECONDARY);
 
     kprintf("IDE: controller ready %02x:%02x.%u vendor=%04x device=%04x\n",
             ctrl->bus,
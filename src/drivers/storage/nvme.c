@@ -0,0 +1,952 @@
+/**
+ * @file drivers/storage/nvme.c
+ * @brief NVMe driver: admin queue, one I/O queue pair and PRP-described transfers.
+ */
+
+#include <nvme.h>
+#include <x86.h>
+#include <stdio.h>
+#include <memory.h>
+#include <stddef.h>
+#include <block_device.h>
+#include <partition.h>
+#include <meminit.h>
+#include <paging.h>
+#include <pci.h>
+#include <irq.h>
+
+#define NVME_REG_WINDOW 0xd5030000u /**< Kernel mappings of each controller's registers. */
+#define NVME_REG_PAGES  4           /**< Controller registers plus the doorbells of two queue pairs. */
+
+#define NVME_REG_CAP   0x00 /**< 64-bit. */
+#define NVME_REG_VS    0x08
+#define NVME_REG_INTMS 0x0C
+#define NVME_REG_INTMC 0x10
+#define NVME_REG_CC    0x14
+#define NVME_REG_CSTS  0x1C
+#define NVME_REG_AQA   0x24
+#define NVME_REG_ASQ   0x28 /**< 64-bit. */
+#define NVME_REG_ACQ   0x30 /**< 64-bit. */
+#define NVME_REG_DOORBELLS 0x1000
+
+#define NVME_CAP_MQES_MASK   0xFFFFu /**< Largest queue, minus one. */
+#define NVME_CAP_TO_SHIFT    24      /**< Ready timeout in 500 ms units. */
+#define NVME_CAP_DSTRD_SHIFT 32      /**< Doorbell stride is 4 << DSTRD bytes. */
+#define NVME_CAP_MPSMIN_SHIFT 48
+
+#define NVME_CC_ENABLE  (1u << 0)
+#define NVME_CC_IOSQES  (6u << 16) /**< 64-byte submission entries. */
+#define NVME_CC_IOCQES  (4u << 20) /**< 16-byte completion entries. */
+#define NVME_CSTS_READY (1u << 0)
+#define NVME_CSTS_FATAL (1u << 1)
+
+#define NVME_ADMIN_CREATE_SQ 0x01
+#define NVME_ADMIN_CREATE_CQ 0x05
+#define NVME_ADMIN_IDENTIFY  0x06
+#define NVME_ADMIN_SET_FEATURES 0x09
+#define NVME_FEATURE_QUEUES  0x07
+#define NVME_IDENTIFY_NAMESPACE  0
+#define NVME_IDENTIFY_CONTROLLER 1
+#define NVME_QUEUE_CONTIGUOUS 0x01
+#define NVME_QUEUE_IRQ_ENABLE 0x02
+
+#define NVME_CMD_FLUSH 0x00
+#define NVME_CMD_WRITE 0x01
+#define NVME_CMD_READ  0x02
+
+#define NVME_IDENTIFY_SERIAL    4   /**< Controller: 20 ASCII bytes. */
+#define NVME_IDENTIFY_MODEL     24  /**< Controller: 40 ASCII bytes. */
+#define NVME_IDENTIFY_MDTS      77  /**< Controller: largest transfer, as a power of two of the page size. */
+#define NVME_IDENTIFY_NN        516 /**< Controller: number of namespaces. */
+#define NVME_IDENTIFY_VWC       525 /**< Controller: bit 0 set if there is a volatile write cache. */
+#define NVME_IDENTIFY_NSZE      0   /**< Namespace: size in logical blocks. */
+#define NVME_IDENTIFY_FLBAS     26  /**< Namespace: bits 3:0 select the LBA format in use. */
+#define NVME_IDENTIFY_LBAF      128 /**< Namespace: LBA format dwords; bits 23:16 are log2 of the block size. */
+
+#define NVME_ADMIN_ENTRIES    64    /**< Admin queues of one page. */
+#define NVME_IO_ENTRIES       64    /**< I/O submission queue of one page. */
+#define NVME_IO_QUEUE         1
+#define NVME_PRP_LIST_ENTRIES 512   /**< PRP list of one page. */
+#define NVME_MAX_BLOCKS       65536u /**< The block count field holds count - 1. */
+#define NVME_SPIN_TIMEOUT     1000000 /**< Completion polls before an admin command gives up. */
+#define NVME_READY_DELAY      500000  /**< I/O waits (about 1 us each) per CAP.TO unit. */
+
+/**
+ * @brief Submission queue entry.
+ */
+typedef struct {
+    uint8_t  opcode;
+    uint8_t  flags;
+    uint16_t command_id;
+    uint32_t namespace_id;
+    uint64_t reserved;
+    uint64_t metadata;
+    uint64_t prp1;
+    uint64_t prp2;
+    uint32_t cdw[6];    /**< Command dwords 10 to 15. */
+} __attribute__((packed)) nvme_command_t;
+
+/**
+ * @brief Completion queue entry.
+ */
+typedef struct {
+    uint32_t result;
+    uint32_t reserved;
+    uint16_t sq_head;
+    uint16_t sq_id;
+    uint16_t command_id;
+    uint16_t status;    /**< Bit 0 is the phase tag, bits 15:1 the status. */
+} __attribute__((packed)) nvme_completion_t;
+
+/**
+ * @brief Progress of the block command occupying one slot; the slot number is the command identifier.
+ *
+ * A command larger than one NVMe command (or than one PRP list can
+ * describe) is reissued from the same slot until it is done.
+ */
+typedef struct {
+    block_request_t* request;  /**< Command in the slot, or NULL if it is free. */
+    uint32_t         segment;  /**< Segment the next NVMe command starts in. */
+    uint32_t         skip;     /**< Blocks of that segment already transferred. */
+    uint64_t         lba;      /**< First block of the NVMe command in flight. */
+    uint32_t         chunk;    /**< Blocks in it. */
+} nvme_slot_t;
+
+/**
+ * @brief Submission queue and the completion queue paired with it.
+ */
+typedef struct {
+    nvme_command_t*             submissions;
+    volatile nvme_completion_t* completions;
+    uint32_t                    submission_physical;
+    uint32_t                    completion_physical;
+    uint16_t                    entries;
+    uint16_t                    tail;    /**< Next submission entry to fill. */
+    uint16_t                    head;    /**< Next completion entry to look at. */
+    uint16_t                    phase;   /**< Phase tag of new completions. */
+    volatile uint32_t*          tail_doorbell;
+    volatile uint32_t*          head_doorbell;
+} nvme_queue_t;
+
+typedef struct {
+    bool          present;
+    bool          failed;        /**< Fatal status seen; further requests fail. */
+    uint8_t       bus;
+    uint8_t       device;
+    uint8_t       function;
+    uint32_t      unit_number;
+    uint8_t*      registers;     /**< Virtual address of the controller registers. */
+    uint64_t      capabilities;
+    uint32_t      doorbell_stride;
+    uint8_t       irq;
+    bool          irq_enabled;   /**< A handler is installed for irq. */
+    nvme_queue_t  admin;
+    nvme_queue_t  io;
+    uint8_t*      identify;      /**< Page receiving identify data. */
+    uint32_t      identify_physical;
+    char          model[41];
+    uint32_t      namespace_id;
+    uint64_t      total_blocks;
+    uint32_t      block_size;
+    bool          write_cache;
+    uint32_t      max_blocks;    /**< Blocks per NVMe command. */
+    uint64_t*     prp_lists[BLOCK_MAX_QUEUE_DEPTH];
+    uint32_t      prp_list_physical[BLOCK_MAX_QUEUE_DEPTH];
+    uint32_t      slot_count;
+    uint32_t      in_flight;
+    nvme_slot_t   slots[BLOCK_MAX_QUEUE_DEPTH];
+    block_command_t commands[BLOCK_MAX_QUEUE_DEPTH];
+    block_device_t  block;
+} nvme_controller_t;
+
+static nvme_controller_t g_nvme_controllers[NVME_MAX_CONTROLLERS];
+static uint32_t g_nvme_controller_count;
+static nvme_stats_t g_nvme_stats;
+
+static uint32_t nvme_read(const nvme_controller_t* ctrl, uint32_t reg)
+{
+    return *(volatile uint32_t*)(ctrl->registers + reg);
+}
+
+static void nvme_write(const nvme_controller_t* ctrl, uint32_t reg, uint32_t value)
+{
+    *(volatile uint32_t*)(ctrl->registers + reg) = value;
+}
+
+/**
+ * @brief Write a 64-bit register as two dwords, low half first.
+ */
+static void nvme_write64(const nvme_controller_t* ctrl, uint32_t reg, uint64_t value)
+{
+    nvme_write(ctrl, reg, (uint32_t)value);
+    nvme_write(ctrl, reg + 4, (uint32_t)(value >> 32));
+}
+
+/**
+ * @brief Keep the compiler from moving queue accesses across this point.
+ */
+static inline void nvme_barrier(void)
+{
+    __asm__ volatile("" ::: "memory");
+}
+
+/**
+ * @brief Copy a command to the tail of a submission queue and ring its doorbell.
+ */
+static void nvme_submit(nvme_queue_t* queue, const nvme_command_t* command)
+{
+    memcpy(&queue->submissions[queue->tail], command, sizeof(*command));
+    if (++queue->tail == queue->entries)
+    {
+        queue->tail = 0;
+    }
+    nvme_barrier();
+    *queue->tail_doorbell = queue->tail;
+}
+
+/**
+ * @brief Take the next completion entry if the controller has posted one.
+ *
+ * @return false if the queue is empty.
+ */
+static bool nvme_next_completion(nvme_queue_t* queue, uint16_t* command_id, uint16_t* status)
+{
+    volatile nvme_completion_t* entry = &queue->completions[queue->head];
+    if ((entry->status & 1) != queue->phase)
+    {
+        return false;
+    }
+
+    nvme_barrier();
+    *command_id = entry->command_id;
+    *status = (uint16_t)(entry->status >> 1);
+    if (++queue->head == queue->entries)
+    {
+        queue->head = 0;
+        queue->phase ^= 1;
+    }
+    return true;
+}
+
+/**
+ * @brief Run an admin command, polling for its completion.
+ */
+static bool KERNEL_INIT nvme_admin_command(nvme_controller_t* ctrl, nvme_command_t* command)
+{
+    uint16_t command_id = 0;
+    uint16_t status = 0;
+
+    command->command_id = ctrl->admin.tail;
+    nvme_submit(&ctrl->admin, command);
+
+    for (uint32_t i = 0; i < NVME_SPIN_TIMEOUT; ++i)
+    {
+        if (nvme_next_completion(&ctrl->admin, &command_id, &status))
+        {
+            *ctrl->admin.head_doorbell = ctrl->admin.head;
+            if (status != 0)
+            {
+                kprintf("NVME: admin command 0x%02x failed status=0x%04x\n", command->opcode, status);
+            }
+            return status == 0;
+        }
+    }
+
+    kprintf("NVME: admin command 0x%02x timed out\n", command->opcode);
+    return false;
+}
+
+/**
+ * @brief Describe a scatter list position as a PRP entry plus a PRP list, without copying it.
+ *
+ * The first entry may start anywhere; every later one must start a page,
+ * and each but the last must run to the end of its page. Pages are
+ * translated one at a time; a buffer that breaks those rules, or more pages
+ * than the list holds, ends the command early and the rest goes in the
+ * next one.
+ *
+ * @param skip    Blocks at the start of segments[0] already transferred.
+ * @param blocks  Blocks wanted from there on.
+ * @param first   Receives the first entry.
+ * @param list    Receives the entries after it.
+ * @param entries_out Receives the number of entries used.
+ * @return Bytes described (a multiple of block_size), or 0 if a buffer is
+ *         misaligned or unmapped.
+ */
+static uint32_t nvme_build_prp(const block_segment_t* segments,
+                               uint32_t skip,
+                               uint32_t blocks,
+                               uint32_t block_size,
+                               uint64_t* first,
+                               uint64_t* list,
+                               uint32_t* entries_out)
+{
+    uint32_t entries = 0;
+    uint32_t described = 0;
+    uint32_t bytes = blocks * block_size;
+    uint32_t end_physical = 0;
+    bool full = false;
+
+    for (const block_segment_t* segment = segments; described < bytes && !full; ++segment, skip = 0)
+    {
+        uint32_t address = (uint32_t)segment->buffer + skip * block_size;
+        uint32_t end = described + (segment->sector_count - skip) * block_size;
+        if (end > bytes)
+        {
+            end = bytes;
+        }
+
+        if ((address & 3) != 0)
+        {
+            return 0;
+        }
+
+        while (described < end)
+        {
+            uint32_t physical = (uint32_t)virt_to_phys((const void*)address);
+            if (physical == 0)
+            {
+                return 0;
+            }
+
+            uint32_t offset = physical & (PAGE_SIZE_BYTES - 1);
+            uint32_t length = PAGE_SIZE_BYTES - offset;
+            if (length > end - described)
+            {
+                length = end - described;
+            }
+
+            if (entries > 0 && physical == end_physical && offset != 0)
+            {
+                // More of the page the last entry is in.
+            }
+            else if (entries == 0 || ((end_physical & (PAGE_SIZE_BYTES - 1)) == 0 && offset == 0))
+            {
+                if (entries == 1 + NVME_PRP_LIST_ENTRIES)
+                {
+                    full = true;
+                    break;
+                }
+                if (entries == 0)
+                {
+                    *first = physical;
+                }
+                else
+                {
+                    list[entries - 1] = physical;
+                }
+                entries++;
+            }
+            else
+            {
+                full = true;
+                break;
+            }
+
+            end_physical = physical + length;
+            address += length;
+            described += length;
+        }
+    }
+
+    // The command's block count must match the entries exactly.
+    described -= described % block_size;
+    if (described == 0)
+    {
+        return 0;
+    }
+
+    uint32_t first_length = PAGE_SIZE_BYTES - (uint32_t)(*first & (PAGE_SIZE_BYTES - 1));
+    *entries_out = (described <= first_length)
+                 ? 1
+                 : 1 + (described - first_length + PAGE_SIZE_BYTES - 1) / PAGE_SIZE_BYTES;
+    return described;
+}
+
+/**
+ * @brief Step a scatter list position forward, skipping finished and empty segments.
+ */
+static void nvme_segment_advance(const block_request_t* request, uint32_t* segment, uint32_t* skip, uint32_t blocks)
+{
+    *skip += blocks;
+    while (*segment < request->segment_count && *skip >= request->segments[*segment].sector_count)
+    {
+        *skip -= request->segments[*segment].sector_count;
+        (*segment)++;
+    }
+}
+
+/**
+ * @brief Submit the next NVMe command of a slot on the I/O queue.
+ *
+ * Called with interrupts disabled. The queue has more entries than there
+ * are slots, so it cannot overflow.
+ *
+ * @return false if the buffers cannot be described to the controller.
+ */
+static bool nvme_slot_issue(nvme_controller_t* ctrl, uint32_t tag)
+{
+    nvme_slot_t* slot = &ctrl->slots[tag];
+    block_request_t* request = slot->request;
+    nvme_command_t command;
+
+    memset(&command, 0, sizeof(command));
+    command.opcode = NVME_CMD_FLUSH;
+    command.command_id = (uint16_t)tag;
+    command.namespace_id = ctrl->namespace_id;
+
+    slot->chunk = 0;
+    if (request->op != BLOCK_REQUEST_FLUSH)
+    {
+        uint32_t remaining = (uint32_t)(request->lba + request->sector_count - slot->lba);
+        uint32_t chunk = remaining > ctrl->max_blocks ? ctrl->max_blocks : remaining;
+        uint32_t entries = 0;
+        uint64_t first = 0;
+        uint32_t bytes = nvme_build_prp(&request->segments[slot->segment], slot->skip, chunk, ctrl->block_size,
+                                        &first, ctrl->prp_lists[tag], &entries);
+        if (bytes == 0)
+        {
+            kprintf("NVME: %s buffer at lba %u cannot be used for DMA\n",
+                    ctrl->block.name,
+                    (uint32_t)slot->lba);
+            return false;
+        }
+        slot->chunk = bytes / ctrl->block_size;
+
+        command.prp1 = first;
+        if (entries == 2)
+        {
+            command.prp2 = ctrl->prp_lists[tag][0];
+        }
+        else if (entries > 2)
+        {
+            command.prp2 = ctrl->prp_list_physical[tag];
+            g_nvme_stats.prp_lists++;
+        }
+
+        command.opcode = (request->op == BLOCK_REQUEST_WRITE) ? NVME_CMD_WRITE : NVME_CMD_READ;
+        command.cdw[0] = (uint32_t)slot->lba;
+        command.cdw[1] = (uint32_t)(slot->lba >> 32);
+        command.cdw[2] = slot->chunk - 1;
+        g_nvme_stats.commands++;
+    }
+
+    nvme_submit(&ctrl->io, &command);
+    return true;
+}
+
+/**
+ * @brief An NVMe command of a slot ended: issue the next one or complete the block command.
+ */
+static void nvme_slot_finished(nvme_controller_t* ctrl, uint32_t tag, bool success)
+{
+    nvme_slot_t* slot = &ctrl->slots[tag];
+    block_request_t* request = slot->request;
+
+    if (success && request->op != BLOCK_REQUEST_FLUSH)
+    {
+        slot->lba += slot->chunk;
+        nvme_segment_advance(request, &slot->segment, &slot->skip, slot->chunk);
+        if (slot->segment < request->segment_count)
+        {
+            if (nvme_slot_issue(ctrl, tag))
+            {
+                return;
+            }
+            success = false;
+        }
+    }
+
+    ctrl->in_flight--;
+    slot->request = NULL;
+    block_request_complete(request, success);
+}
+
+/**
+ * @brief Complete every command the controller has posted to the I/O completion queue.
+ *
+ * @return true if there was at least one.
+ */
+static bool nvme_service(nvme_controller_t* ctrl)
+{
+    uint16_t command_id = 0;
+    uint16_t status = 0;
+    bool found = false;
+
+    while (nvme_next_completion(&ctrl->io, &command_id, &status))
+    {
+        found = true;
+        if (command_id >= ctrl->slot_count || ctrl->slots[command_id].request == NULL)
+        {
+            continue;
+        }
+        if (status != 0)
+        {
+            g_nvme_stats.errors++;
+            kprintf("NVME: %s command %u failed status=0x%04x\n", ctrl->block.name, command_id, status);
+        }
+        nvme_slot_finished(ctrl, command_id, status == 0);
+    }
+
+    // Releasing the entries also lets the controller drop its interrupt.
+    if (found)
+    {
+        *ctrl->io.head_doorbell = ctrl->io.head;
+    }
+    return found;
+}
+
+/**
+ * @brief Fail every command in flight after the controller reported a fatal error.
+ */
+static void nvme_fail_all(nvme_controller_t* ctrl)
+{
+    kprintf("NVME: %s controller fatal status, failing further requests\n", ctrl->block.name);
+    ctrl->failed = true;
+    for (uint32_t tag = 0; tag < ctrl->slot_count; ++tag)
+    {
+        if (ctrl->slots[tag].request != NULL)
+        {
+            block_request_t* request = ctrl->slots[tag].request;
+            ctrl->slots[tag].request = NULL;
+            ctrl->in_flight--;
+            block_request_complete(request, false);
+        }
+    }
+}
+
+static void nvme_irq_handler(Registers* regs)
+{
+    uint32_t line = regs->interrupt - IRQ_BASE_VECTOR;
+
+    for (uint32_t c = 0; c < g_nvme_controller_count; ++c)
+    {
+        nvme_controller_t* ctrl = &g_nvme_controllers[c];
+        if (ctrl->present && ctrl->irq_enabled && ctrl->irq == line && nvme_service(ctrl))
+        {
+            g_nvme_stats.interrupts++;
+        }
+    }
+}
+
+/**
+ * @brief Block layer entry point: submit a command with the slot the block layer chose as its identifier.
+ */
+static bool nvme_block_device_start(block_device_t* device, block_request_t* request)
+{
+    nvme_controller_t* ctrl = (nvme_controller_t*)device->driver_data;
+    nvme_slot_t* slot = &ctrl->slots[request->tag];
+
+    slot->request = request;
+    slot->segment = 0;
+    slot->skip = 0;
+    slot->lba = request->lba;
+    nvme_segment_advance(request, &slot->segment, &slot->skip, 0);
+
+    bool interrupts = x86_interrupts_enabled();
+    x86_disable_interrupts();
+    bool issued = !ctrl->failed && nvme_slot_issue(ctrl, request->tag);
+    if (issued && ++ctrl->in_flight > g_nvme_stats.max_outstanding)
+    {
+        g_nvme_stats.max_outstanding = ctrl->in_flight;
+    }
+    if (interrupts)
+    {
+        x86_enable_interrupts();
+    }
+
+    if (!issued)
+    {
+        slot->request = NULL;
+        block_request_complete(request, false);
+    }
+    return true;
+}
+
+/**
+ * @brief Block layer hook: pick up completions whose interrupt never arrived.
+ */
+static void nvme_block_device_poll(block_device_t* device)
+{
+    nvme_controller_t* ctrl = (nvme_controller_t*)device->driver_data;
+    if (ctrl->in_flight == 0)
+    {
+        return;
+    }
+
+    nvme_service(ctrl);
+    if (ctrl->in_flight != 0 && (nvme_read(ctrl, NVME_REG_CSTS) & NVME_CSTS_FATAL) != 0)
+    {
+        nvme_fail_all(ctrl);
+    }
+}
+
+/**
+ * @brief Wait for CSTS.RDY to reach the given value, for at most the controller's own timeout.
+ */
+static bool KERNEL_INIT nvme_wait_ready(const nvme_controller_t* ctrl, bool ready)
+{
+    uint32_t units = (uint32_t)((ctrl->capabilities >> NVME_CAP_TO_SHIFT) & 0xFF) + 1;
+    for (uint32_t unit = 0; unit < units; ++unit)
+    {
+        for (uint32_t i = 0; i < NVME_READY_DELAY; ++i)
+        {
+            uint32_t status = nvme_read(ctrl, NVME_REG_CSTS);
+            if ((status & NVME_CSTS_FATAL) != 0)
+            {
+                return false;
+            }
+            if (((status & NVME_CSTS_READY) != 0) == ready)
+            {
+                return true;
+            }
+            x86_iowait();
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Give a queue pair one page for each of its queues and point it at its doorbells.
+ */
+static bool KERNEL_INIT nvme_queue_allocate(nvme_controller_t* ctrl, nvme_queue_t* queue, uint16_t id, uint16_t entries)
+{
+    uintptr_t submission = pmm_allocate_page();
+    uintptr_t completion = pmm_allocate_page();
+    queue->submissions = submission ? (nvme_command_t*)phys_to_virt(submission) : NULL;
+    queue->completions = completion ? (volatile nvme_completion_t*)phys_to_virt(completion) : NULL;
+    if (queue->submissions == NULL || queue->completions == NULL)
+    {
+        return false;
+    }
+
+    memset(queue->submissions, 0, PAGE_SIZE_BYTES);
+    memset((void*)queue->completions, 0, PAGE_SIZE_BYTES);
+    queue->submission_physical = (uint32_t)submission;
+    queue->completion_physical = (uint32_t)completion;
+    queue->entries = entries;
+    queue->tail = 0;
+    queue->head = 0;
+    queue->phase = 1;
+    queue->tail_doorbell = (volatile uint32_t*)(ctrl->registers + NVME_REG_DOORBELLS + (2u * id) * ctrl->doorbell_stride);
+    queue->head_doorbell = (volatile uint32_t*)(ctrl->registers + NVME_REG_DOORBELLS + (2u * id + 1) * ctrl->doorbell_stride);
+    return true;
+}
+
+/**
+ * @brief Reset the controller and bring it back up with an admin queue pair.
+ */
+static bool KERNEL_INIT nvme_enable(nvme_controller_t* ctrl)
+{
+    nvme_write(ctrl, NVME_REG_CC, nvme_read(ctrl, NVME_REG_CC) & ~NVME_CC_ENABLE);
+    if (!nvme_wait_ready(ctrl, false))
+    {
+        kprintf("NVME: controller did not stop\n");
+        return false;
+    }
+
+    if (!nvme_queue_allocate(ctrl, &ctrl->admin, 0, NVME_ADMIN_ENTRIES))
+    {
+        kprintf("NVME: out of memory for the admin queue\n");
+        return false;
+    }
+
+    // Admin commands are polled; interrupts stay masked until the I/O queue exists.
+    nvme_write(ctrl, NVME_REG_INTMS, 0xFFFFFFFFu);
+    nvme_write(ctrl, NVME_REG_AQA, ((uint32_t)(NVME_ADMIN_ENTRIES - 1) << 16) | (NVME_ADMIN_ENTRIES - 1));
+    nvme_write64(ctrl, NVME_REG_ASQ, ctrl->admin.submission_physical);
+    nvme_write64(ctrl, NVME_REG_ACQ, ctrl->admin.completion_physical);
+    nvme_write(ctrl, NVME_REG_CC, NVME_CC_IOSQES | NVME_CC_IOCQES | NVME_CC_ENABLE);
+    if (!nvme_wait_ready(ctrl, true))
+    {
+        kprintf("NVME: controller did not become ready (csts=0x%08x)\n", nvme_read(ctrl, NVME_REG_CSTS));
+        return false;
+    }
+    return true;
+}
+
+static bool KERNEL_INIT nvme_identify(nvme_controller_t* ctrl, uint32_t cns, uint32_t namespace_id)
+{
+    nvme_command_t command;
+    memset(&command, 0, sizeof(command));
+    command.opcode = NVME_ADMIN_IDENTIFY;
+    command.namespace_id = namespace_id;
+    command.prp1 = ctrl->identify_physical;
+    command.cdw[0] = cns;
+    return nvme_admin_command(ctrl, &command);
+}
+
+static void KERNEL_INIT nvme_extract_model(const uint8_t* identify, char* out, size_t out_len)
+{
+    size_t idx = 0;
+    for (size_t i = 0; i < 40 && idx + 1 < out_len; ++i)
+    {
+        out[idx++] = (char)identify[NVME_IDENTIFY_MODEL + i];
+    }
+    out[idx] = '\0';
+
+    while (idx > 0 && (out[idx - 1] == ' ' || out[idx - 1] == '\0'))
+    {
+        out[--idx] = '\0';
+    }
+}
+
+/**
+ * @brief Read the controller and namespace identify data this driver needs.
+ */
+static bool KERNEL_INIT nvme_identify_all(nvme_controller_t* ctrl)
+{
+    if (!nvme_identify(ctrl, NVME_IDENTIFY_CONTROLLER, 0))
+    {
+        return false;
+    }
+
+    const uint8_t* id = ctrl->identify;
+    nvme_extract_model(id, ctrl->model, sizeof(ctrl->model));
+    ctrl->write_cache = (id[NVME_IDENTIFY_VWC] & 1) != 0;
+
+    // MDTS is in memory pages (CC.MPS is left at 4 KiB); one PRP list bounds it too.
+    uint32_t max_bytes = PAGE_SIZE_BYTES * NVME_PRP_LIST_ENTRIES;
+    uint8_t mdts = id[NVME_IDENTIFY_MDTS];
+    if (mdts != 0 && mdts < 9)
+    {
+        max_bytes = PAGE_SIZE_BYTES << mdts;
+    }
+    uint32_t namespaces = *(const uint32_t*)(id + NVME_IDENTIFY_NN);
+
+    // Namespace identifiers start at 1; the first active one is used.
+    for (uint32_t nsid = 1; nsid <= namespaces && nsid <= 16; ++nsid)
+    {
+        if (!nvme_identify(ctrl, NVME_IDENTIFY_NAMESPACE, nsid))
+        {
+            return false;
+        }
+
+        uint64_t blocks = *(const uint64_t*)(id + NVME_IDENTIFY_NSZE);
+        if (blocks == 0)
+        {
+            continue;
+        }
+
+        uint32_t format = id[NVME_IDENTIFY_FLBAS] & 0x0F;
+        uint32_t shift = (*(const uint32_t*)(id + NVME_IDENTIFY_LBAF + format * 4) >> 16) & 0xFF;
+        if (shift < 9 || shift > 12)
+        {
+            kprintf("NVME: namespace %u has unsupported block size 2^%u\n", nsid, shift);
+            continue;
+        }
+
+        ctrl->namespace_id = nsid;
+        ctrl->total_blocks = blocks;
+        ctrl->block_size = 1u << shift;
+        ctrl->max_blocks = max_bytes / ctrl->block_size;
+        if (ctrl->max_blocks > NVME_MAX_BLOCKS)
+        {
+            ctrl->max_blocks = NVME_MAX_BLOCKS;
+        }
+        return true;
+    }
+
+    kprintf("NVME: no usable namespace\n");
+    return false;
+}
+
+/**
+ * @brief Create the I/O completion queue, then the submission queue that posts to it.
+ */
+static bool KERNEL_INIT nvme_create_io_queues(nvme_controller_t* ctrl)
+{
+    uint32_t largest = (uint32_t)(ctrl->capabilities & NVME_CAP_MQES_MASK) + 1;
+    uint16_t entries = (uint16_t)(largest < NVME_IO_ENTRIES ? largest : NVME_IO_ENTRIES);
+    if (!nvme_queue_allocate(ctrl, &ctrl->io, NVME_IO_QUEUE, entries))
+    {
+        kprintf("NVME: out of memory for the I/O queues\n");
+        return false;
+    }
+
+    nvme_command_t command;
+    memset(&command, 0, sizeof(command));
+    command.opcode = NVME_ADMIN_SET_FEATURES;
+    command.cdw[0] = NVME_FEATURE_QUEUES;
+    command.cdw[1] = 0; // One queue of each kind (zero-based counts).
+    if (!nvme_admin_command(ctrl, &command))
+    {
+        return false;
+    }
+
+    memset(&command, 0, sizeof(command));
+    command.opcode = NVME_ADMIN_CREATE_CQ;
+    command.prp1 = ctrl->io.completion_physical;
+    command.cdw[0] = ((uint32_t)(entries - 1) << 16) | NVME_IO_QUEUE;
+    command.cdw[1] = NVME_QUEUE_IRQ_ENABLE | NVME_QUEUE_CONTIGUOUS; // Interrupt vector 0: the INTx pin.
+    if (!nvme_admin_command(ctrl, &command))
+    {
+        return false;
+    }
+
+    memset(&command, 0, sizeof(command));
+    command.opcode = NVME_ADMIN_CREATE_SQ;
+    command.prp1 = ctrl->io.submission_physical;
+    command.cdw[0] = ((uint32_t)(entries - 1) << 16) | NVME_IO_QUEUE;
+    command.cdw[1] = ((uint32_t)NVME_IO_QUEUE << 16) | NVME_QUEUE_CONTIGUOUS;
+    if (!nvme_admin_command(ctrl, &command))
+    {
+        return false;
+    }
+
+    // One entry stays free so a full queue is distinguishable from an empty one.
+    ctrl->slot_count = entries - 1u;
+    if (ctrl->slot_count > BLOCK_MAX_QUEUE_DEPTH)
+    {
+        ctrl->slot_count = BLOCK_MAX_QUEUE_DEPTH;
+    }
+
+    for (uint32_t tag = 0; tag < ctrl->slot_count; ++tag)
+    {
+        uintptr_t frame = pmm_allocate_page();
+        uint64_t* list = frame ? (uint64_t*)phys_to_virt(frame) : NULL;
+        if (list == NULL)
+        {
+            kprintf("NVME: out of memory for PRP lists\n");
+            return false;
+        }
+        memset(list, 0, PAGE_SIZE_BYTES);
+        ctrl->prp_lists[tag] = list;
+        ctrl->prp_list_physical[tag] = (uint32_t)frame;
+    }
+    return true;
+}
+
+static void KERNEL_INIT nvme_register(nvme_controller_t* ctrl)
+{
+    snprintf(ctrl->block.name, sizeof(ctrl->block.name), "nvme%un1", ctrl->unit_number);
+    ctrl->block.sector_size   = ctrl->block_size;
+    ctrl->block.sector_count  = ctrl->total_blocks;
+    ctrl->block.read          = block_device_queued_read;
+    ctrl->block.write         = block_device_queued_write;
+    ctrl->block.flush         = ctrl->write_cache ? block_device_queued_flush : NULL;
+    ctrl->block.start         = nvme_block_device_start;
+    ctrl->block.poll          = nvme_block_device_poll;
+    ctrl->block.driver_data   = ctrl;
+    ctrl->block.commands      = ctrl->commands;
+    ctrl->block.command_slots = ctrl->slot_count;
+
+    if (!block_device_register(&ctrl->block))
+    {
+        kprintf("NVME: failed to register block interface for %s\n", ctrl->block.name);
+        ctrl->present = false;
+        return;
+    }
+
+    partition_scan_device(&ctrl->block);
+}
+
+void KERNEL_INIT nvme_controller_init_from_pci(const nvme_pci_descriptor_t* desc)
+{
+    if (desc == NULL)
+    {
+        return;
+    }
+
+    if (g_nvme_controller_count >= NVME_MAX_CONTROLLERS)
+    {
+        kprintf("NVME: ignoring %02x:%02x.%u -> controller list full\n",
+                desc->bus,
+                desc->device,
+                desc->function);
+        return;
+    }
+
+    // A 64-bit BAR placed above 4 GiB cannot be reached without PAE.
+    uint32_t base = desc->bar0 & ~0x0Fu;
+    bool wide = (desc->bar0 & 0x06) == 0x04;
+    if ((desc->bar0 & 0x01) != 0 || base == 0 || (wide && desc->bar1 != 0))
+    {
+        kprintf("NVME: %02x:%02x.%u has no usable memory BAR0\n", desc->bus, desc->device, desc->function);
+        return;
+    }
+
+    uint32_t index = g_nvme_controller_count;
+    nvme_controller_t* ctrl = &g_nvme_controllers[index];
+    memset(ctrl, 0, sizeof(*ctrl));
+    ctrl->bus = desc->bus;
+    ctrl->device = desc->device;
+    ctrl->function = desc->function;
+    ctrl->registers = (uint8_t*)(NVME_REG_WINDOW + index * NVME_REG_PAGES * PAGE_SIZE_BYTES);
+
+    for (uint32_t page = 0; page < NVME_REG_PAGES; ++page)
+    {
+        if (!vmm_map_kernel_page(PAGE_ALIGN_DOWN(base) + page * PAGE_SIZE_BYTES,
+                                 ctrl->registers + page * PAGE_SIZE_BYTES,
+                                 CACHE_UNCACHED))
+        {
+            kprintf("NVME: cannot map registers of %02x:%02x.%u\n", desc->bus, desc->device, desc->function);
+            return;
+        }
+    }
+
+    pci_enable_memory_space(ctrl->bus, ctrl->device, ctrl->function);
+    pci_enable_bus_master(ctrl->bus, ctrl->device, ctrl->function);
+
+    ctrl->capabilities = ((uint64_t)nvme_read(ctrl, NVME_REG_CAP + 4) << 32) | nvme_read(ctrl, NVME_REG_CAP);
+    ctrl->doorbell_stride = 4u << ((ctrl->capabilities >> NVME_CAP_DSTRD_SHIFT) & 0x0F);
+    uint32_t min_page_shift = 12 + (uint32_t)((ctrl->capabilities >> NVME_CAP_MPSMIN_SHIFT) & 0x0F);
+    if (min_page_shift != 12
+        || NVME_REG_DOORBELLS + (2u * NVME_IO_QUEUE + 2) * ctrl->doorbell_stride > NVME_REG_PAGES * PAGE_SIZE_BYTES)
+    {
+        kprintf("NVME: %02x:%02x.%u needs pages of 2^%u or a doorbell stride of %u, unsupported\n",
+                desc->bus, desc->device, desc->function, min_page_shift, ctrl->doorbell_stride);
+        return;
+    }
+
+    uintptr_t frame = pmm_allocate_page();
+    ctrl->identify = frame ? (uint8_t*)phys_to_virt(frame) : NULL;
+    ctrl->identify_physical = (uint32_t)frame;
+    if (ctrl->identify == NULL)
+    {
+        kprintf("NVME: out of memory\n");
+        return;
+    }
+
+    if (!nvme_enable(ctrl) || !nvme_identify_all(ctrl) || !nvme_create_io_queues(ctrl))
+    {
+        kprintf("NVME: %02x:%02x.%u setup failed\n", desc->bus, desc->device, desc->function);
+        nvme_write(ctrl, NVME_REG_CC, 0);
+        return;
+    }
+
+    uint32_t version = nvme_read(ctrl, NVME_REG_VS);
+    ctrl->present = true;
+    ctrl->unit_number = g_nvme_controller_count++;
+
+    // Pin-based interrupts: every completion queue shares the INTx line (vector 0).
+    ctrl->irq = desc->interrupt_line;
+    ctrl->irq_enabled = ctrl->irq != 0 && ctrl->irq < 16;
+    if (ctrl->irq_enabled)
+    {
+        irq_register_handler(ctrl->irq, nvme_irq_handler);
+        nvme_write(ctrl, NVME_REG_INTMC, 1);
+    }
+
+    kprintf("NVME: %02x:%02x.%u v%u.%u model=\"%s\" nsid=%u blocks=%llu block=%u queue=%u slots=%u%s irq=%u\n",
+            ctrl->bus,
+            ctrl->device,
+            ctrl->function,
+            version >> 16,
+            (version >> 8) & 0xFF,
+            ctrl->model[0] != '\0' ? ctrl->model : "unknown",
+            ctrl->namespace_id,
+            (unsigned long long)ctrl->total_blocks,
+            ctrl->block_size,
+            ctrl->io.entries,
+            ctrl->slot_count,
+            ctrl->write_cache ? " write-cache" : "",
+            ctrl->irq);
+
+    nvme_register(ctrl);
+}
+
+const nvme_stats_t* nvme_get_stats(void)
+{
+    return &g_nvme_stats;
+}
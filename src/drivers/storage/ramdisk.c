@@ -0,0 +1,280 @@
+/**
+ * @file drivers/storage/ramdisk.c
+ * @brief Block devices backed by boot modules or by freshly allocated memory.
+ */
+
+#include <ramdisk.h>
+#include <stdio.h>
+#include <memory.h>
+#include <stddef.h>
+#include <partition.h>
+#include <meminit.h>
+#include <paging.h>
+#include <kerndef.h>
+
+#define RAMDISK_SECTOR_SIZE 512
+#define RAMDISK_CHUNK_BYTES (4u * 1024u * 1024u) /**< One pmm_allocate_large_page() run. */
+#define RAMDISK_MAX_CHUNKS  64                   /**< 256 MiB: all the direct map reaches. */
+#define RAMDISK_SIZE_OPTION "ramdisk_size="
+
+/**
+ * @brief A RAM disk: one contiguous module image, or a list of 4 MiB runs.
+ */
+typedef struct {
+    bool           present;
+    bool           from_module;
+    uint8_t*       chunks[RAMDISK_MAX_CHUNKS];
+    uint32_t       chunk_count;
+    uint32_t       chunk_bytes;  /**< Bytes per chunk; a module is a single chunk. */
+    uint32_t       bytes;
+    uint32_t       unit_number;
+    block_device_t block;
+} ramdisk_t;
+
+static ramdisk_t g_ramdisks[RAMDISK_MAX_DEVICES];
+static uint32_t g_ramdisk_count;
+
+/**
+ * @brief Copy between a buffer and the disk, a chunk at a time.
+ */
+static void ramdisk_copy(const ramdisk_t* disk, uint32_t offset, uint8_t* buffer, uint32_t bytes, bool write)
+{
+    while (bytes > 0)
+    {
+        uint32_t chunk = offset / disk->chunk_bytes;
+        uint32_t within = offset % disk->chunk_bytes;
+        uint32_t length = disk->chunk_bytes - within;
+        if (length > bytes)
+        {
+            length = bytes;
+        }
+
+        if (write)
+        {
+            memcpy(disk->chunks[chunk] + within, buffer, length);
+        }
+        else
+        {
+            memcpy(buffer, disk->chunks[chunk] + within, length);
+        }
+
+        offset += length;
+        buffer += length;
+        bytes -= length;
+    }
+}
+
+static bool ramdisk_in_range(const ramdisk_t* disk, uint64_t lba, uint32_t sector_count)
+{
+    return lba <= disk->block.sector_count && sector_count <= disk->block.sector_count - lba;
+}
+
+static bool ramdisk_read(block_device_t* device, uint64_t lba, uint32_t sector_count, void* buffer)
+{
+    ramdisk_t* disk = (ramdisk_t*)device->driver_data;
+    if (buffer == NULL || !ramdisk_in_range(disk, lba, sector_count))
+    {
+        return false;
+    }
+
+    ramdisk_copy(disk, (uint32_t)lba * RAMDISK_SECTOR_SIZE, (uint8_t*)buffer, sector_count * RAMDISK_SECTOR_SIZE, false);
+    return true;
+}
+
+static bool ramdisk_write(block_device_t* device, uint64_t lba, uint32_t sector_count, const void* buffer)
+{
+    ramdisk_t* disk = (ramdisk_t*)device->driver_data;
+    if (buffer == NULL || !ramdisk_in_range(disk, lba, sector_count))
+    {
+        return false;
+    }
+
+    ramdisk_copy(disk, (uint32_t)lba * RAMDISK_SECTOR_SIZE, (uint8_t*)buffer, sector_count * RAMDISK_SECTOR_SIZE, true);
+    return true;
+}
+
+/**
+ * @brief Take the next free device slot.
+ */
+static ramdisk_t* ramdisk_allocate(void)
+{
+    if (g_ramdisk_count >= RAMDISK_MAX_DEVICES)
+    {
+        kprintf("RAMDISK: device list full\n");
+        return NULL;
+    }
+
+    ramdisk_t* disk = &g_ramdisks[g_ramdisk_count];
+    memset(disk, 0, sizeof(*disk));
+    return disk;
+}
+
+/**
+ * @brief Register a filled-in disk and look for partitions (or a bare filesystem) on it.
+ *
+ * Reads and writes are plain copies, so there is no start callback and the
+ * block layer runs queued requests through read and write directly.
+ */
+static bool KERNEL_INIT ramdisk_register(ramdisk_t* disk)
+{
+    disk->unit_number = g_ramdisk_count++;
+    disk->present = true;
+
+    snprintf(disk->block.name, sizeof(disk->block.name), "rd%u", disk->unit_number);
+    disk->block.sector_size  = RAMDISK_SECTOR_SIZE;
+    disk->block.sector_count = disk->bytes / RAMDISK_SECTOR_SIZE;
+    disk->block.read         = ramdisk_read;
+    disk->block.write        = ramdisk_write;
+    disk->block.flush        = NULL;
+    disk->block.start        = NULL;
+    disk->block.poll         = NULL;
+    disk->block.driver_data  = disk;
+
+    kprintf("RAMDISK: %s %u KiB (%s)\n",
+            disk->block.name,
+            disk->bytes / 1024u,
+            disk->from_module ? "boot module" : "empty");
+
+    if (!block_device_register(&disk->block))
+    {
+        kprintf("RAMDISK: failed to register block interface for %s\n", disk->block.name);
+        disk->present = false;
+        return false;
+    }
+
+    partition_scan_device(&disk->block);
+    return true;
+}
+
+/**
+ * @brief Wrap a boot module in a RAM disk, using the loaded image in place.
+ */
+static void KERNEL_INIT ramdisk_from_module(const multiboot_module* module)
+{
+    uint32_t bytes = (module->end - module->start) & ~(uint32_t)(RAMDISK_SECTOR_SIZE - 1);
+    uint8_t* first = (uint8_t*)phys_to_virt(module->start);
+    uint8_t* last = (uint8_t*)phys_to_virt(module->end - 1);
+    ramdisk_t* disk = NULL;
+
+    // Only modules inside the direct map can be reached without a mapping of their own.
+    if (bytes == 0 || first == NULL || last == NULL || (disk = ramdisk_allocate()) == NULL)
+    {
+        kprintf("RAMDISK: module at 0x%08x-0x%08x \"%s\" not usable, releasing it\n",
+                module->start,
+                module->end,
+                module->cmdline);
+        pmm_free_boot_range(module->start, module->end);
+        return;
+    }
+
+    disk->from_module = true;
+    disk->chunks[0] = first;
+    disk->chunk_count = 1;
+    disk->chunk_bytes = bytes;
+    disk->bytes = bytes;
+    ramdisk_register(disk);
+}
+
+/**
+ * @brief Register an empty, zero-filled RAM disk.
+ *
+ * Boot time only, like the partition scan it runs.
+ *
+ * @param bytes Size wanted; rounded up to whole 4 MiB runs of frames.
+ * @return The new device, or NULL if memory or device slots ran out.
+ */
+static block_device_t* KERNEL_INIT ramdisk_create(uint64_t bytes)
+{
+    uint64_t chunks = (bytes + RAMDISK_CHUNK_BYTES - 1) / RAMDISK_CHUNK_BYTES;
+    if (chunks == 0 || chunks > RAMDISK_MAX_CHUNKS)
+    {
+        kprintf("RAMDISK: cannot create a disk of %llu bytes\n", (unsigned long long)bytes);
+        return NULL;
+    }
+
+    ramdisk_t* disk = ramdisk_allocate();
+    if (disk == NULL)
+    {
+        return NULL;
+    }
+
+    disk->chunk_bytes = RAMDISK_CHUNK_BYTES;
+    for (uint32_t i = 0; i < (uint32_t)chunks; ++i)
+    {
+        uintptr_t frame = pmm_allocate_large_page();
+        uint8_t* chunk = frame ? (uint8_t*)phys_to_virt(frame) : NULL;
+        if (chunk == NULL)
+        {
+            kprintf("RAMDISK: out of memory after %u KiB\n", i * (RAMDISK_CHUNK_BYTES / 1024u));
+            if (frame != 0)
+            {
+                pmm_free_large_page(frame);
+            }
+            for (uint32_t j = 0; j < disk->chunk_count; ++j)
+            {
+                pmm_free_large_page(virt_to_phys(disk->chunks[j]));
+            }
+            return NULL;
+        }
+        memset(chunk, 0, RAMDISK_CHUNK_BYTES);
+        disk->chunks[disk->chunk_count++] = chunk;
+    }
+
+    disk->bytes = disk->chunk_count * RAMDISK_CHUNK_BYTES;
+    return ramdisk_register(disk) ? &disk->block : NULL;
+}
+
+/**
+ * @brief Find ramdisk_size=<KiB> on the command line.
+ *
+ * @return The size in KiB, or 0 if the option is absent.
+ */
+static uint32_t KERNEL_INIT ramdisk_size_option(const char* cmdline)
+{
+    const char* option = RAMDISK_SIZE_OPTION;
+
+    for (const char* word = cmdline; *word != '\0'; ++word)
+    {
+        if (word != cmdline && word[-1] != ' ')
+        {
+            continue;
+        }
+
+        size_t i = 0;
+        while (option[i] != '\0' && word[i] == option[i])
+        {
+            ++i;
+        }
+        if (option[i] != '\0')
+        {
+            continue;
+        }
+
+        uint32_t kib = 0;
+        for (const char* digit = word + i; *digit >= '0' && *digit <= '9'; ++digit)
+        {
+            kib = kib * 10u + (uint32_t)(*digit - '0');
+        }
+        return kib;
+    }
+    return 0;
+}
+
+void KERNEL_INIT ramdisk_init_from_multiboot(const multiboot_info* info)
+{
+    if (info == NULL)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < info->module_count; ++i)
+    {
+        ramdisk_from_module(&info->modules[i]);
+    }
+
+    uint32_t kib = ramdisk_size_option(info->cmdline);
+    if (kib != 0)
+    {
+        ramdisk_create((uint64_t)kib * 1024u);
+    }
+}
@@ -0,0 +1,918 @@
+/**
+ * @file drivers/storage/virtio_blk.c
+ * @brief virtio block driver over the legacy and modern PCI transports.
+ */
+
+#include <virtio_blk.h>
+#include <x86.h>
+#include <stdio.h>
+#include <memory.h>
+#include <stddef.h>
+#include <block_device.h>
+#include <partition.h>
+#include <meminit.h>
+#include <paging.h>
+#include <pci.h>
+#include <irq.h>
+
+#define VIRTIO_WINDOW       0xd5010000u /**< Kernel mappings of each device's modern registers. */
+#define VIRTIO_WINDOW_PAGES 8           /**< Pages of mappings available to one device. */
+
+#define VIRTIO_LEGACY_HOST_FEATURES  0x00
+#define VIRTIO_LEGACY_GUEST_FEATURES 0x04
+#define VIRTIO_LEGACY_QUEUE_PFN      0x08
+#define VIRTIO_LEGACY_QUEUE_SIZE     0x0C
+#define VIRTIO_LEGACY_QUEUE_SELECT   0x0E
+#define VIRTIO_LEGACY_QUEUE_NOTIFY   0x10
+#define VIRTIO_LEGACY_STATUS         0x12
+#define VIRTIO_LEGACY_ISR            0x13
+#define VIRTIO_LEGACY_CONFIG         0x14 /**< Device configuration while MSI-X is off. */
+
+#define VIRTIO_COMMON_DEVICE_FEATURE_SELECT 0x00
+#define VIRTIO_COMMON_DEVICE_FEATURE        0x04
+#define VIRTIO_COMMON_DRIVER_FEATURE_SELECT 0x08
+#define VIRTIO_COMMON_DRIVER_FEATURE        0x0C
+#define VIRTIO_COMMON_STATUS                0x14
+#define VIRTIO_COMMON_QUEUE_SELECT          0x16
+#define VIRTIO_COMMON_QUEUE_SIZE            0x18
+#define VIRTIO_COMMON_QUEUE_ENABLE          0x1C
+#define VIRTIO_COMMON_QUEUE_NOTIFY_OFF      0x1E
+#define VIRTIO_COMMON_QUEUE_DESC            0x20
+#define VIRTIO_COMMON_QUEUE_DRIVER          0x28
+#define VIRTIO_COMMON_QUEUE_DEVICE          0x30
+
+#define PCI_STATUS_REGISTER     0x04  /**< Dword holding the status register in its high half. */
+#define PCI_STATUS_CAPABILITIES 0x00100000u
+#define PCI_CAPABILITY_POINTER  0x34
+#define PCI_CAPABILITY_VENDOR   0x09
+
+#define VIRTIO_PCI_CAP_COMMON 1
+#define VIRTIO_PCI_CAP_NOTIFY 2
+#define VIRTIO_PCI_CAP_ISR    3
+#define VIRTIO_PCI_CAP_DEVICE 4
+
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+#define VIRTIO_STATUS_DRIVER      0x02
+#define VIRTIO_STATUS_DRIVER_OK   0x04
+#define VIRTIO_STATUS_FEATURES_OK 0x08
+#define VIRTIO_STATUS_FAILED      0x80
+
+#define VIRTIO_BLK_F_SIZE_MAX       (1ull << 1)
+#define VIRTIO_BLK_F_SEG_MAX        (1ull << 2)
+#define VIRTIO_BLK_F_RO             (1ull << 5)
+#define VIRTIO_BLK_F_FLUSH          (1ull << 9)
+#define VIRTIO_RING_F_INDIRECT_DESC (1ull << 28)
+#define VIRTIO_F_VERSION_1          (1ull << 32)
+
+#define VIRTIO_BLK_CONFIG_CAPACITY 0  /**< 64-bit, in 512-byte sectors. */
+#define VIRTIO_BLK_CONFIG_SIZE_MAX 8
+#define VIRTIO_BLK_CONFIG_SEG_MAX  12
+
+#define VIRTIO_BLK_T_IN    0
+#define VIRTIO_BLK_T_OUT   1
+#define VIRTIO_BLK_T_FLUSH 4
+#define VIRTIO_BLK_S_OK    0
+#define VIRTIO_BLK_SECTOR_SIZE 512
+
+#define VIRTQ_DESC_F_NEXT     1
+#define VIRTQ_DESC_F_WRITE    2 /**< The device writes this buffer. */
+#define VIRTQ_DESC_F_INDIRECT 4
+#define VIRTQ_USED_F_NO_NOTIFY 1
+#define VIRTIO_ISR_QUEUE      0x01
+
+#define VIRTIO_QUEUE_MAX     256  /**< Largest virtqueue the static rings hold. */
+#define VIRTIO_QUEUE_ALIGN   4096 /**< Used ring alignment of the legacy layout. */
+#define VIRTIO_RING_BYTES    (3 * 4096) /**< Descriptors, available ring, padding and used ring of VIRTIO_QUEUE_MAX entries. */
+#define VIRTIO_TABLE_ENTRIES 256  /**< Indirect table of one page. */
+#define VIRTIO_DIRECT_DESCRIPTORS 16 /**< Ring descriptors each slot owns without indirect tables. */
+#define VIRTIO_MAX_SEGMENT_BYTES  0x400000u
+
+/**
+ * @brief Split virtqueue descriptor.
+ */
+typedef struct {
+    uint64_t address;
+    uint32_t length;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed)) virtq_desc_t;
+
+typedef struct {
+    uint16_t flags;
+    volatile uint16_t index;
+    uint16_t ring[];
+} __attribute__((packed)) virtq_avail_t;
+
+typedef struct {
+    uint32_t id;     /**< Head descriptor of the finished chain. */
+    uint32_t length; /**< Bytes the device wrote. */
+} __attribute__((packed)) virtq_used_elem_t;
+
+typedef struct {
+    volatile uint16_t flags;
+    volatile uint16_t index;
+    volatile virtq_used_elem_t ring[];
+} __attribute__((packed)) virtq_used_t;
+
+/**
+ * @brief Request header read by the device ahead of the data.
+ */
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} __attribute__((packed)) virtio_blk_header_t;
+
+/**
+ * @brief Progress of the block command occupying one slot.
+ *
+ * A command with more pieces than a descriptor chain can hold is sent as
+ * several virtio requests from the same slot, one after another.
+ */
+typedef struct {
+    block_request_t* request;  /**< Command in the slot, or NULL if it is free. */
+    uint32_t         segment;  /**< Segment the next virtio request starts in. */
+    uint32_t         skip;     /**< Sectors of that segment already transferred. */
+    uint64_t         lba;      /**< First sector of the virtio request in flight. */
+    uint32_t         chunk;    /**< Sectors in it. */
+} virtio_blk_slot_t;
+
+typedef struct {
+    bool                present;
+    bool                modern;
+    uint8_t             bus;
+    uint8_t             device;
+    uint8_t             function;
+    uint32_t            unit_number;
+    uint16_t            io_base;         /**< Legacy transport registers. */
+    volatile uint8_t*   common;          /**< Modern transport registers... */
+    volatile uint8_t*   isr;
+    volatile uint8_t*   config;
+    volatile uint8_t*   notify_base;
+    uint32_t            notify_multiplier;
+    volatile uint16_t*  notify;          /**< ...and the doorbell of queue 0. */
+    uint8_t*            window;
+    uint32_t            window_pages;    /**< Pages of window already mapped. */
+    uint8_t             irq;
+    bool                irq_enabled;     /**< A handler is installed for irq. */
+    uint64_t            features;        /**< Negotiated feature bits. */
+    uint16_t            queue_size;
+    virtq_desc_t*       desc;
+    virtq_avail_t*      avail;
+    virtq_used_t*       used;
+    uint16_t            avail_index;     /**< Next free available ring entry (free-running). */
+    uint16_t            used_index;      /**< Next used ring entry to look at (free-running). */
+    bool                indirect;
+    uint32_t            descriptors_per_slot; /**< Ring descriptors each slot owns (1 with indirect tables). */
+    uint32_t            max_data;        /**< Data descriptors per virtio request. */
+    uint32_t            max_segment;     /**< Bytes per data descriptor. */
+    virtq_desc_t*       tables[BLOCK_MAX_QUEUE_DEPTH];
+    uint32_t            table_physical[BLOCK_MAX_QUEUE_DEPTH];
+    virtio_blk_header_t headers[BLOCK_MAX_QUEUE_DEPTH];
+    volatile uint8_t    statuses[BLOCK_MAX_QUEUE_DEPTH];
+    uint32_t            slot_count;
+    uint32_t            in_flight;
+    virtio_blk_slot_t   slots[BLOCK_MAX_QUEUE_DEPTH];
+    block_command_t     commands[BLOCK_MAX_QUEUE_DEPTH];
+    block_device_t      block;
+} virtio_blk_device_t;
+
+static virtio_blk_device_t g_virtio_blk_devices[VIRTIO_BLK_MAX_DEVICES];
+static uint32_t g_virtio_blk_count;
+/** @brief Virtqueue rings, in the direct-mapped (physically contiguous) kernel image. */
+static uint8_t g_virtio_rings[VIRTIO_BLK_MAX_DEVICES][VIRTIO_RING_BYTES] __attribute__((aligned(VIRTIO_QUEUE_ALIGN)));
+static virtio_blk_stats_t g_virtio_blk_stats;
+
+/**
+ * @brief Keep the compiler from moving ring accesses across this point.
+ *
+ * x86 does not reorder stores with stores or loads with loads, so this is
+ * all the device needs to see descriptors before the index that publishes them.
+ */
+static inline void virtio_barrier(void)
+{
+    __asm__ volatile("" ::: "memory");
+}
+
+static uint8_t virtio_get_status(const virtio_blk_device_t* dev)
+{
+    return dev->modern ? dev->common[VIRTIO_COMMON_STATUS] : x86_inb(dev->io_base + VIRTIO_LEGACY_STATUS);
+}
+
+static void virtio_set_status(const virtio_blk_device_t* dev, uint8_t status)
+{
+    if (dev->modern)
+    {
+        dev->common[VIRTIO_COMMON_STATUS] = status;
+    }
+    else
+    {
+        x86_outb(dev->io_base + VIRTIO_LEGACY_STATUS, status);
+    }
+}
+
+static void virtio_common_write32(const virtio_blk_device_t* dev, uint32_t offset, uint32_t value)
+{
+    *(volatile uint32_t*)(dev->common + offset) = value;
+}
+
+static uint32_t virtio_common_read32(const virtio_blk_device_t* dev, uint32_t offset)
+{
+    return *(volatile uint32_t*)(dev->common + offset);
+}
+
+static void virtio_common_write16(const virtio_blk_device_t* dev, uint32_t offset, uint16_t value)
+{
+    *(volatile uint16_t*)(dev->common + offset) = value;
+}
+
+static uint16_t virtio_common_read16(const virtio_blk_device_t* dev, uint32_t offset)
+{
+    return *(volatile uint16_t*)(dev->common + offset);
+}
+
+static uint64_t virtio_device_features(const virtio_blk_device_t* dev)
+{
+    if (!dev->modern)
+    {
+        return x86_inl(dev->io_base + VIRTIO_LEGACY_HOST_FEATURES);
+    }
+
+    virtio_common_write32(dev, VIRTIO_COMMON_DEVICE_FEATURE_SELECT, 0);
+    uint64_t low = virtio_common_read32(dev, VIRTIO_COMMON_DEVICE_FEATURE);
+    virtio_common_write32(dev, VIRTIO_COMMON_DEVICE_FEATURE_SELECT, 1);
+    uint64_t high = virtio_common_read32(dev, VIRTIO_COMMON_DEVICE_FEATURE);
+    return (high << 32) | low;
+}
+
+/**
+ * @brief Tell the device which features the driver uses.
+ *
+ * @return false if a modern device refused the set.
+ */
+static bool virtio_set_driver_features(const virtio_blk_device_t* dev, uint64_t features)
+{
+    if (!dev->modern)
+    {
+        x86_outl(dev->io_base + VIRTIO_LEGACY_GUEST_FEATURES, (uint32_t)features);
+        return true;
+    }
+
+    virtio_common_write32(dev, VIRTIO_COMMON_DRIVER_FEATURE_SELECT, 0);
+    virtio_common_write32(dev, VIRTIO_COMMON_DRIVER_FEATURE, (uint32_t)features);
+    virtio_common_write32(dev, VIRTIO_COMMON_DRIVER_FEATURE_SELECT, 1);
+    virtio_common_write32(dev, VIRTIO_COMMON_DRIVER_FEATURE, (uint32_t)(features >> 32));
+
+    virtio_set_status(dev, (uint8_t)(virtio_get_status(dev) | VIRTIO_STATUS_FEATURES_OK));
+    return (virtio_get_status(dev) & VIRTIO_STATUS_FEATURES_OK) != 0;
+}
+
+static uint32_t virtio_config_read32(const virtio_blk_device_t* dev, uint32_t offset)
+{
+    if (dev->modern)
+    {
+        return *(volatile uint32_t*)(dev->config + offset);
+    }
+    return x86_inl(dev->io_base + VIRTIO_LEGACY_CONFIG + offset);
+}
+
+/**
+ * @brief Read (and thereby clear) the interrupt status, which deasserts INTx.
+ */
+static uint8_t virtio_read_isr(const virtio_blk_device_t* dev)
+{
+    return dev->modern ? *dev->isr : x86_inb(dev->io_base + VIRTIO_LEGACY_ISR);
+}
+
+static void virtio_notify(const virtio_blk_device_t* dev)
+{
+    if (dev->modern)
+    {
+        *dev->notify = 0;
+    }
+    else
+    {
+        x86_outw(dev->io_base + VIRTIO_LEGACY_QUEUE_NOTIFY, 0);
+    }
+}
+
+/**
+ * @brief Describe a scatter list position as data descriptors without copying it.
+ *
+ * Pages are translated one at a time and physically adjacent pages are
+ * merged, across segment boundaries too, up to max_segment bytes per
+ * descriptor. If the chain fills up, only a prefix is described.
+ *
+ * @param descriptors Where the data descriptors go.
+ * @param count       Receives the number of descriptors used.
+ * @return Bytes described (whole sectors), or 0 if a buffer is unmapped.
+ */
+static uint32_t virtio_blk_build_data(const virtio_blk_device_t* dev,
+                                      virtq_desc_t* descriptors,
+                                      uint32_t* count,
+                                      const block_segment_t* segments,
+                                      uint32_t skip,
+                                      uint32_t sectors)
+{
+    uint32_t entries = 0;
+    uint32_t described = 0;
+    uint32_t bytes = sectors * VIRTIO_BLK_SECTOR_SIZE;
+    bool full = false;
+
+    for (const block_segment_t* segment = segments; described < bytes && !full; ++segment, skip = 0)
+    {
+        uint32_t address = (uint32_t)segment->buffer + skip * VIRTIO_BLK_SECTOR_SIZE;
+        uint32_t end = described + (segment->sector_count - skip) * VIRTIO_BLK_SECTOR_SIZE;
+        if (end > bytes)
+        {
+            end = bytes;
+        }
+
+        while (described < end)
+        {
+            uint32_t physical = (uint32_t)virt_to_phys((const void*)address);
+            if (physical == 0)
+            {
+                return 0;
+            }
+
+            uint32_t length = PAGE_SIZE_BYTES - (address & (PAGE_SIZE_BYTES - 1));
+            if (length > end - described)
+            {
+                length = end - described;
+            }
+
+            virtq_desc_t* last = (entries > 0) ? &descriptors[entries - 1] : NULL;
+            if (last != NULL
+                && (uint32_t)last->address + last->length == physical
+                && last->length + length <= dev->max_segment)
+            {
+                last->length += length;
+            }
+            else
+            {
+                if (entries == dev->max_data)
+                {
+                    full = true;
+                    break;
+                }
+                last = &descriptors[entries++];
+                last->address = physical;
+                last->length = length;
+            }
+
+            address += length;
+            described += length;
+        }
+    }
+
+    // Requests are made of whole sectors.
+    uint32_t excess = described % VIRTIO_BLK_SECTOR_SIZE;
+    described -= excess;
+    while (excess > 0)
+    {
+        if (descriptors[entries - 1].length > excess)
+        {
+            descriptors[entries - 1].length -= excess;
+            break;
+        }
+        excess -= descriptors[entries - 1].length;
+        entries--;
+    }
+
+    *count = entries;
+    return described;
+}
+
+/**
+ * @brief Step a scatter list position forward, skipping finished and empty segments.
+ */
+static void virtio_blk_segment_advance(const block_request_t* request, uint32_t* segment, uint32_t* skip, uint32_t sectors)
+{
+    *skip += sectors;
+    while (*segment < request->segment_count && *skip >= request->segments[*segment].sector_count)
+    {
+        *skip -= request->segments[*segment].sector_count;
+        (*segment)++;
+    }
+}
+
+/**
+ * @brief Put the next virtio request of a slot on the available ring.
+ *
+ * The chain is header, data, status. With indirect descriptors it lives in
+ * the slot's own table and takes one ring descriptor (number tag);
+ * otherwise the slot owns VIRTIO_DIRECT_DESCRIPTORS ring descriptors.
+ * Called with interrupts disabled.
+ *
+ * @return false if the buffers cannot be described to the device.
+ */
+static bool virtio_blk_slot_issue(virtio_blk_device_t* dev, uint32_t tag)
+{
+    virtio_blk_slot_t* slot = &dev->slots[tag];
+    block_request_t* request = slot->request;
+    virtio_blk_header_t* header = &dev->headers[tag];
+    uint16_t head = (uint16_t)(tag * dev->descriptors_per_slot);
+    uint16_t base = dev->indirect ? 0 : head;
+    virtq_desc_t* chain = dev->indirect ? dev->tables[tag] : &dev->desc[head];
+    uint32_t data = 0;
+
+    slot->chunk = 0;
+    header->reserved = 0;
+    header->sector = 0;
+    header->type = VIRTIO_BLK_T_FLUSH;
+    if (request->op != BLOCK_REQUEST_FLUSH)
+    {
+        uint32_t remaining = (uint32_t)(request->lba + request->sector_count - slot->lba);
+        uint32_t bytes = virtio_blk_build_data(dev, &chain[1], &data,
+                                               &request->segments[slot->segment], slot->skip, remaining);
+        if (bytes == 0)
+        {
+            kprintf("VIRTIO: %s buffer at lba %u cannot be used for DMA\n",
+                    dev->block.name,
+                    (uint32_t)slot->lba);
+            return false;
+        }
+        slot->chunk = bytes / VIRTIO_BLK_SECTOR_SIZE;
+        header->type = (request->op == BLOCK_REQUEST_WRITE) ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+        header->sector = slot->lba;
+    }
+
+    uint16_t data_flags = (uint16_t)(VIRTQ_DESC_F_NEXT
+        | (request->op == BLOCK_REQUEST_READ ? VIRTQ_DESC_F_WRITE : 0));
+    chain[0].address = (uint32_t)virt_to_phys(header);
+    chain[0].length = sizeof(*header);
+    chain[0].flags = VIRTQ_DESC_F_NEXT;
+    chain[0].next = (uint16_t)(base + 1);
+    for (uint32_t i = 1; i <= data; ++i)
+    {
+        chain[i].flags = data_flags;
+        chain[i].next = (uint16_t)(base + i + 1);
+    }
+    dev->statuses[tag] = 0xFF;
+    chain[data + 1].address = (uint32_t)virt_to_phys((const void*)&dev->statuses[tag]);
+    chain[data + 1].length = 1;
+    chain[data + 1].flags = VIRTQ_DESC_F_WRITE;
+    chain[data + 1].next = 0;
+
+    if (dev->indirect)
+    {
+        dev->desc[head].address = dev->table_physical[tag];
+        dev->desc[head].length = (data + 2) * sizeof(virtq_desc_t);
+        dev->desc[head].flags = VIRTQ_DESC_F_INDIRECT;
+        dev->desc[head].next = 0;
+    }
+
+    dev->avail->ring[dev->avail_index % dev->queue_size] = head;
+    virtio_barrier();
+    dev->avail->index = ++dev->avail_index;
+    virtio_barrier();
+
+    g_virtio_blk_stats.requests++;
+    if (dev->in_flight > g_virtio_blk_stats.max_outstanding)
+    {
+        g_virtio_blk_stats.max_outstanding = dev->in_flight;
+    }
+
+    // The device may be polling the ring already and ask not to be told.
+    if ((dev->used->flags & VIRTQ_USED_F_NO_NOTIFY) == 0)
+    {
+        g_virtio_blk_stats.notifications++;
+        virtio_notify(dev);
+    }
+    return true;
+}
+
+/**
+ * @brief A virtio request of a slot ended: send the next one or complete the block command.
+ */
+static void virtio_blk_slot_finished(virtio_blk_device_t* dev, uint32_t tag, bool success)
+{
+    virtio_blk_slot_t* slot = &dev->slots[tag];
+    block_request_t* request = slot->request;
+
+    if (success && request->op != BLOCK_REQUEST_FLUSH)
+    {
+        slot->lba += slot->chunk;
+        virtio_blk_segment_advance(request, &slot->segment, &slot->skip, slot->chunk);
+        if (slot->segment < request->segment_count)
+        {
+            if (virtio_blk_slot_issue(dev, tag))
+            {
+                return;
+            }
+            success = false;
+        }
+    }
+
+    dev->in_flight--;
+    slot->request = NULL;
+    block_request_complete(request, success);
+}
+
+/**
+ * @brief Complete every chain the device has returned on the used ring.
+ */
+static void virtio_blk_service(virtio_blk_device_t* dev)
+{
+    while (dev->used_index != dev->used->index)
+    {
+        virtio_barrier();
+        uint32_t head = dev->used->ring[dev->used_index % dev->queue_size].id;
+        uint32_t tag = head / dev->descriptors_per_slot;
+        dev->used_index++;
+
+        if (tag < dev->slot_count && dev->slots[tag].request != NULL)
+        {
+            virtio_blk_slot_finished(dev, tag, dev->statuses[tag] == VIRTIO_BLK_S_OK);
+        }
+    }
+}
+
+static void virtio_blk_irq_handler(Registers* regs)
+{
+    uint32_t line = regs->interrupt - IRQ_BASE_VECTOR;
+
+    for (uint32_t i = 0; i < g_virtio_blk_count; ++i)
+    {
+        virtio_blk_device_t* dev = &g_virtio_blk_devices[i];
+        if (dev->present && dev->irq_enabled && dev->irq == line
+            && (virtio_read_isr(dev) & VIRTIO_ISR_QUEUE) != 0)
+        {
+            g_virtio_blk_stats.interrupts++;
+            virtio_blk_service(dev);
+        }
+    }
+}
+
+/**
+ * @brief Block layer entry point: put a command on the virtqueue in the slot the block layer chose.
+ */
+static bool virtio_blk_start(block_device_t* device, block_request_t* request)
+{
+    virtio_blk_device_t* dev = (virtio_blk_device_t*)device->driver_data;
+    virtio_blk_slot_t* slot = &dev->slots[request->tag];
+
+    slot->request = request;
+    slot->segment = 0;
+    slot->skip = 0;
+    slot->lba = request->lba;
+    virtio_blk_segment_advance(request, &slot->segment, &slot->skip, 0);
+
+    bool interrupts = x86_interrupts_enabled();
+    x86_disable_interrupts();
+    dev->in_flight++;
+    bool issued = virtio_blk_slot_issue(dev, request->tag);
+    if (!issued)
+    {
+        dev->in_flight--;
+    }
+    if (interrupts)
+    {
+        x86_enable_interrupts();
+    }
+
+    if (!issued)
+    {
+        slot->request = NULL;
+        block_request_complete(request, false);
+    }
+    return true;
+}
+
+/**
+ * @brief Block layer hook: pick up chains returned without an interrupt.
+ */
+static void virtio_blk_poll(block_device_t* device)
+{
+    virtio_blk_device_t* dev = (virtio_blk_device_t*)device->driver_data;
+    if (dev->in_flight != 0)
+    {
+        virtio_blk_service(dev);
+    }
+}
+
+/**
+ * @brief Map part of a memory BAR into the device's register window.
+ *
+ * @return Kernel address of offset within the BAR, or NULL if the BAR is
+ *         not a memory BAR below 4 GiB or the window is full.
+ */
+static volatile uint8_t* KERNEL_INIT virtio_map_region(virtio_blk_device_t* dev,
+                                                       const virtio_pci_descriptor_t* desc,
+                                                       uint8_t bar,
+                                                       uint32_t offset,
+                                                       uint32_t length)
+{
+    if (bar > 5 || (desc->bar[bar] & 0x01) != 0)
+    {
+        return NULL;
+    }
+
+    // A 64-bit BAR placed above 4 GiB cannot be reached without PAE.
+    if ((desc->bar[bar] & 0x06) == 0x04 && (bar == 5 || desc->bar[bar + 1] != 0))
+    {
+        return NULL;
+    }
+
+    uint32_t physical = (desc->bar[bar] & ~0x0Fu) + offset;
+    uint32_t first = PAGE_ALIGN_DOWN(physical);
+    uint32_t pages = (physical + length - first + PAGE_SIZE_BYTES - 1) / PAGE_SIZE_BYTES;
+    if ((desc->bar[bar] & ~0x0Fu) == 0 || dev->window_pages + pages > VIRTIO_WINDOW_PAGES)
+    {
+        return NULL;
+    }
+
+    uint8_t* virtual = dev->window + dev->window_pages * PAGE_SIZE_BYTES;
+    for (uint32_t page = 0; page < pages; ++page)
+    {
+        if (!vmm_map_kernel_page(first + page * PAGE_SIZE_BYTES, virtual + page * PAGE_SIZE_BYTES, CACHE_UNCACHED))
+        {
+            return NULL;
+        }
+    }
+    dev->window_pages += pages;
+    return virtual + (physical - first);
+}
+
+/**
+ * @brief Locate the modern transport's register blocks through the vendor capabilities.
+ */
+static bool KERNEL_INIT virtio_find_modern(virtio_blk_device_t* dev, const virtio_pci_descriptor_t* desc)
+{
+    if ((pci_read_config_dword(desc->bus, desc->device, desc->function, PCI_STATUS_REGISTER)
+         & PCI_STATUS_CAPABILITIES) == 0)
+    {
+        return false;
+    }
+
+    uint8_t pointer = pci_read_config_byte(desc->bus, desc->device, desc->function, PCI_CAPABILITY_POINTER) & ~0x03;
+    for (uint32_t guard = 0; pointer != 0 && guard < 48; ++guard)
+    {
+        uint8_t id = pci_read_config_byte(desc->bus, desc->device, desc->function, pointer);
+        uint8_t next = pci_read_config_byte(desc->bus, desc->device, desc->function, (uint8_t)(pointer + 1));
+
+        if (id == PCI_CAPABILITY_VENDOR)
+        {
+            uint8_t type = pci_read_config_byte(desc->bus, desc->device, desc->function, (uint8_t)(pointer + 3));
+            uint8_t bar = pci_read_config_byte(desc->bus, desc->device, desc->function, (uint8_t)(pointer + 4));
+            uint32_t offset = pci_read_config_dword(desc->bus, desc->device, desc->function, (uint8_t)(pointer + 8));
+            uint32_t length = pci_read_config_dword(desc->bus, desc->device, desc->function, (uint8_t)(pointer + 12));
+
+            // The first capability of each type is the preferred one.
+            volatile uint8_t** target = NULL;
+            switch (type)
+            {
+                case VIRTIO_PCI_CAP_COMMON: target = &dev->common; break;
+                case VIRTIO_PCI_CAP_NOTIFY: target = &dev->notify_base; break;
+                case VIRTIO_PCI_CAP_ISR:    target = &dev->isr; break;
+                case VIRTIO_PCI_CAP_DEVICE: target = &dev->config; break;
+                default: break;
+            }
+
+            if (target != NULL && *target == NULL)
+            {
+                *target = virtio_map_region(dev, desc, bar, offset, length);
+                if (type == VIRTIO_PCI_CAP_NOTIFY)
+                {
+                    dev->notify_multiplier = pci_read_config_dword(desc->bus, desc->device, desc->function,
+                                                                   (uint8_t)(pointer + 16));
+                }
+            }
+        }
+        pointer = next & ~0x03;
+    }
+
+    return dev->common != NULL && dev->notify_base != NULL && dev->isr != NULL && dev->config != NULL;
+}
+
+/**
+ * @brief Lay out queue 0 in the device's static ring area and hand it to the device.
+ */
+static bool KERNEL_INIT virtio_setup_queue(virtio_blk_device_t* dev, uint8_t* ring)
+{
+    uint16_t size;
+    if (dev->modern)
+    {
+        virtio_common_write16(dev, VIRTIO_COMMON_QUEUE_SELECT, 0);
+        size = virtio_common_read16(dev, VIRTIO_COMMON_QUEUE_SIZE);
+        if (size > VIRTIO_QUEUE_MAX)
+        {
+            size = VIRTIO_QUEUE_MAX;
+            virtio_common_write16(dev, VIRTIO_COMMON_QUEUE_SIZE, size);
+        }
+    }
+    else
+    {
+        // The legacy transport cannot shrink a queue.
+        x86_outw(dev->io_base + VIRTIO_LEGACY_QUEUE_SELECT, 0);
+        size = x86_inw(dev->io_base + VIRTIO_LEGACY_QUEUE_SIZE);
+        if (size > VIRTIO_QUEUE_MAX)
+        {
+            kprintf("VIRTIO: queue of %u entries is larger than the %u supported\n", size, VIRTIO_QUEUE_MAX);
+            return false;
+        }
+    }
+
+    if (size == 0)
+    {
+        return false;
+    }
+
+    // Legacy layout, which the modern transport accepts too.
+    uint32_t avail_offset = size * sizeof(virtq_desc_t);
+    uint32_t used_offset = (avail_offset + sizeof(uint16_t) * (3 + size) + VIRTIO_QUEUE_ALIGN - 1)
+                         & ~(VIRTIO_QUEUE_ALIGN - 1);
+    memset(ring, 0, VIRTIO_RING_BYTES);
+    dev->queue_size = size;
+    dev->desc = (virtq_desc_t*)ring;
+    dev->avail = (virtq_avail_t*)(ring + avail_offset);
+    dev->used = (virtq_used_t*)(ring + used_offset);
+    dev->avail_index = 0;
+    dev->used_index = 0;
+
+    uint32_t physical = (uint32_t)virt_to_phys(ring);
+    if (dev->modern)
+    {
+        virtio_common_write32(dev, VIRTIO_COMMON_QUEUE_DESC, physical);
+        virtio_common_write32(dev, VIRTIO_COMMON_QUEUE_DESC + 4, 0);
+        virtio_common_write32(dev, VIRTIO_COMMON_QUEUE_DRIVER, physical + avail_offset);
+        virtio_common_write32(dev, VIRTIO_COMMON_QUEUE_DRIVER + 4, 0);
+        virtio_common_write32(dev, VIRTIO_COMMON_QUEUE_DEVICE, physical + used_offset);
+        virtio_common_write32(dev, VIRTIO_COMMON_QUEUE_DEVICE + 4, 0);
+        uint16_t notify_off = virtio_common_read16(dev, VIRTIO_COMMON_QUEUE_NOTIFY_OFF);
+        dev->notify = (volatile uint16_t*)(dev->notify_base + notify_off * dev->notify_multiplier);
+        virtio_common_write16(dev, VIRTIO_COMMON_QUEUE_ENABLE, 1);
+    }
+    else
+    {
+        x86_outl(dev->io_base + VIRTIO_LEGACY_QUEUE_PFN, physical / VIRTIO_QUEUE_ALIGN);
+    }
+    return true;
+}
+
+/**
+ * @brief Decide how many requests can be in flight and give each slot its indirect table.
+ */
+static bool KERNEL_INIT virtio_setup_slots(virtio_blk_device_t* dev)
+{
+    uint32_t descriptors = dev->indirect ? VIRTIO_TABLE_ENTRIES : VIRTIO_DIRECT_DESCRIPTORS;
+    dev->descriptors_per_slot = dev->indirect ? 1 : VIRTIO_DIRECT_DESCRIPTORS;
+    dev->slot_count = dev->queue_size / dev->descriptors_per_slot;
+    if (dev->slot_count > BLOCK_MAX_QUEUE_DEPTH)
+    {
+        dev->slot_count = BLOCK_MAX_QUEUE_DEPTH;
+    }
+    if (dev->slot_count == 0)
+    {
+        return false;
+    }
+
+    // Every chain needs the header and status descriptors around the data.
+    dev->max_data = descriptors - 2;
+    if (dev->features & VIRTIO_BLK_F_SEG_MAX)
+    {
+        uint32_t seg_max = virtio_config_read32(dev, VIRTIO_BLK_CONFIG_SEG_MAX);
+        if (seg_max != 0 && seg_max < dev->max_data)
+        {
+            dev->max_data = seg_max;
+        }
+    }
+    dev->max_segment = VIRTIO_MAX_SEGMENT_BYTES;
+    if (dev->features & VIRTIO_BLK_F_SIZE_MAX)
+    {
+        uint32_t size_max = virtio_config_read32(dev, VIRTIO_BLK_CONFIG_SIZE_MAX) & ~(VIRTIO_BLK_SECTOR_SIZE - 1);
+        if (size_max != 0 && size_max < dev->max_segment)
+        {
+            dev->max_segment = size_max;
+        }
+    }
+
+    for (uint32_t tag = 0; dev->indirect && tag < dev->slot_count; ++tag)
+    {
+        uintptr_t frame = pmm_allocate_page();
+        virtq_desc_t* table = frame ? (virtq_desc_t*)phys_to_virt(frame) : NULL;
+        if (table == NULL)
+        {
+            return false;
+        }
+        memset(table, 0, PAGE_SIZE_BYTES);
+        dev->tables[tag] = table;
+        dev->table_physical[tag] = (uint32_t)frame;
+    }
+    return true;
+}
+
+void KERNEL_INIT virtio_blk_init_from_pci(const virtio_pci_descriptor_t* desc)
+{
+    if (desc == NULL)
+    {
+        return;
+    }
+
+    if (g_virtio_blk_count >= VIRTIO_BLK_MAX_DEVICES)
+    {
+        kprintf("VIRTIO: ignoring %02x:%02x.%u -> device list full\n",
+                desc->bus,
+                desc->device,
+                desc->function);
+        return;
+    }
+
+    uint32_t index = g_virtio_blk_count;
+    virtio_blk_device_t* dev = &g_virtio_blk_devices[index];
+    memset(dev, 0, sizeof(*dev));
+    dev->bus = desc->bus;
+    dev->device = desc->device;
+    dev->function = desc->function;
+    dev->window = (uint8_t*)(VIRTIO_WINDOW + index * VIRTIO_WINDOW_PAGES * PAGE_SIZE_BYTES);
+
+    pci_enable_memory_space(dev->bus, dev->device, dev->function);
+    pci_enable_bus_master(dev->bus, dev->device, dev->function);
+
+    dev->modern = virtio_find_modern(dev, desc);
+    if (!dev->modern)
+    {
+        if ((desc->bar[0] & 0x01) == 0)
+        {
+            kprintf("VIRTIO: %02x:%02x.%u has no usable transport\n", desc->bus, desc->device, desc->function);
+            return;
+        }
+        dev->io_base = (uint16_t)(desc->bar[0] & ~0x03u);
+    }
+
+    virtio_set_status(dev, 0);
+    for (uint32_t i = 0; i < 1000000 && virtio_get_status(dev) != 0; ++i)
+    {
+    }
+    virtio_set_status(dev, VIRTIO_STATUS_ACKNOWLEDGE);
+    virtio_set_status(dev, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    uint64_t wanted = VIRTIO_BLK_F_SIZE_MAX | VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_RO | VIRTIO_BLK_F_FLUSH
+                    | VIRTIO_RING_F_INDIRECT_DESC | (dev->modern ? VIRTIO_F_VERSION_1 : 0);
+    dev->features = virtio_device_features(dev) & wanted;
+    dev->indirect = (dev->features & VIRTIO_RING_F_INDIRECT_DESC) != 0;
+
+    if ((dev->modern && (dev->features & VIRTIO_F_VERSION_1) == 0)
+        || !virtio_set_driver_features(dev, dev->features)
+        || !virtio_setup_queue(dev, g_virtio_rings[index])
+        || !virtio_setup_slots(dev))
+    {
+        kprintf("VIRTIO: %02x:%02x.%u setup failed\n", desc->bus, desc->device, desc->function);
+        virtio_set_status(dev, VIRTIO_STATUS_FAILED);
+        return;
+    }
+
+    uint64_t capacity = ((uint64_t)virtio_config_read32(dev, VIRTIO_BLK_CONFIG_CAPACITY + 4) << 32)
+                      | virtio_config_read32(dev, VIRTIO_BLK_CONFIG_CAPACITY);
+
+    // Legacy INTx; MSI-X stays disabled, which also fixes the legacy config offset.
+    dev->irq = desc->interrupt_line;
+    dev->irq_enabled = dev->irq != 0 && dev->irq < 16;
+    if (dev->irq_enabled)
+    {
+        irq_register_handler(dev->irq, virtio_blk_irq_handler);
+    }
+
+    virtio_set_status(dev, (uint8_t)(virtio_get_status(dev) | VIRTIO_STATUS_DRIVER_OK));
+    dev->present = true;
+    dev->unit_number = g_virtio_blk_count++;
+
+    kprintf("VIRTIO: %02x:%02x.%u block %s transport sectors=%llu queue=%u slots=%u%s%s irq=%u\n",
+            dev->bus,
+            dev->device,
+            dev->function,
+            dev->modern ? "modern" : "legacy",
+            (unsigned long long)capacity,
+            dev->queue_size,
+            dev->slot_count,
+            dev->indirect ? " indirect" : "",
+            (dev->features & VIRTIO_BLK_F_RO) ? " read-only" : "",
+            dev->irq);
+
+    snprintf(dev->block.name, sizeof(dev->block.name), "vd%u", dev->unit_number);
+    dev->block.sector_size   = VIRTIO_BLK_SECTOR_SIZE;
+    dev->block.sector_count  = capacity;
+    dev->block.read          = block_device_queued_read;
+    dev->block.write         = (dev->features & VIRTIO_BLK_F_RO) ? NULL : block_device_queued_write;
+    dev->block.flush         = (dev->features & VIRTIO_BLK_F_FLUSH) ? block_device_queued_flush : NULL;
+    dev->block.start         = virtio_blk_start;
+    dev->block.poll          = virtio_blk_poll;
+    dev->block.driver_data   = dev;
+    dev->block.commands      = dev->commands;
+    dev->block.command_slots = dev->slot_count;
+
+    if (!block_device_register(&dev->block))
+    {
+        kprintf("VIRTIO: failed to register block interface for %s\n", dev->block.name);
+        dev->present = false;
+        return;
+    }
+
+    partition_scan_device(&dev->block);
+}
+
+const virtio_blk_stats_t* virtio_blk_get_stats(void)
+{
+    return &g_virtio_blk_stats;
+}
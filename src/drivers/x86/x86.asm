@@ -57,6 +57,42 @@ x86_inl:
     in eax, dx
     ret
 
+;void        ASMCALL x86_insw(uint16_t port, void* buffer, uint32_t count)
+global x86_insw
+x86_insw:
+    push edi
+    mov dx, [esp + 8]
+    mov edi, [esp + 12]
+    mov ecx, [esp + 16]
+    cld
+    rep insw
+    pop edi
+    ret
+
+;void        ASMCALL x86_insl(uint16_t port, void* buffer, uint32_t count)
+global x86_insl
+x86_insl:
+    push edi
+    mov dx, [esp + 8]
+    mov edi, [esp + 12]
+    mov ecx, [esp + 16]
+    cld
+    rep insd
+    pop edi
+    ret
+
+;void        ASMCALL x86_outsw(uint16_t port, const void* buffer, uint32_t count)
+global x86_outsw
+x86_outsw:
+    push esi
+    mov dx, [esp + 8]
+    mov esi, [esp + 12]
+    mov ecx, [esp + 16]
+    cld
+    rep outsw
+    pop esi
+    ret
+
 ;void        ASMCALL x86_panic()
 global x86_panic
 x86_panic:
@@ -76,8 +112,24 @@ x86_disable_interrupts:
     cli
     ret
 
+;bool        ASMCALL x86_interrupts_enabled()
+global x86_interrupts_enabled
+x86_interrupts_enabled:
+    pushfd
+    pop eax
+    shr eax, 9                  ; EFLAGS.IF
+    and eax, 1
+    ret
+
+;void        ASMCALL x86_wait_for_interrupt()
+global x86_wait_for_interrupt
+x86_wait_for_interrupt:
+    sti                         ; the interrupt shadow keeps a pending IRQ from
+    hlt                         ; being taken before hlt, so no wakeup is lost
+    ret
+
 
-;void        ASMCALL x86_invalidate_page(uint8_t page)
+;void        ASMCALL x86_invalidate_page(void* page)
 global x86_invalidate_page
 x86_invalidate_page:
     mov eax, [esp + 4]
@@ -95,6 +147,89 @@ x86_reload_page_directory:
     ret
 
 
+;void        ASMCALL x86_load_page_directory(uint32_t physical_address)
+global x86_load_page_directory
+x86_load_page_directory:
+    mov eax, [esp + 4]
+    mov cr3, eax
+    ret
+
+
+;uint32_t    ASMCALL x86_read_cr3()
+global x86_read_cr3
+x86_read_cr3:
+    mov eax, cr3
+    ret
+
+
+;void        ASMCALL x86_cpuid(uint32_t leaf, uint32_t* registers)
+global x86_cpuid
+x86_cpuid:
+    push ebx
+    push edi
+    mov eax, [esp + 12]
+    xor ecx, ecx
+    cpuid
+    mov edi, [esp + 16]
+    mov [edi], eax
+    mov [edi + 4], ebx
+    mov [edi + 8], ecx
+    mov [edi + 12], edx
+    pop edi
+    pop ebx
+    ret
+
+
+;void        ASMCALL x86_cpuid_count(uint32_t leaf, uint32_t subleaf, uint32_t* registers)
+global x86_cpuid_count
+x86_cpuid_count:
+    push ebx
+    push edi
+    mov eax, [esp + 12]
+    mov ecx, [esp + 16]
+    cpuid
+    mov edi, [esp + 20]
+    mov [edi], eax
+    mov [edi + 4], ebx
+    mov [edi + 8], ecx
+    mov [edi + 12], edx
+    pop edi
+    pop ebx
+    ret
+
+
+;uint64_t    ASMCALL x86_read_msr(uint32_t msr)
+global x86_read_msr
+x86_read_msr:
+    mov ecx, [esp + 4]
+    rdmsr               ; result already in edx:eax
+    ret
+
+
+;void        ASMCALL x86_write_msr(uint32_t msr, uint64_t value)
+global x86_write_msr
+x86_write_msr:
+    mov ecx, [esp + 4]
+    mov eax, [esp + 8]
+    mov edx, [esp + 12]
+    wrmsr
+    ret
+
+
+;void        ASMCALL x86_flush_caches()
+global x86_flush_caches
+x86_flush_caches:
+    wbinvd
+    ret
+
+
+;uint64_t    ASMCALL x86_read_tsc()
+global x86_read_tsc
+x86_read_tsc:
+    rdtsc               ; result already in edx:eax
+    ret
+
+
 ;uint32_t    ASMCALL x86_read_cr2()
 global x86_read_cr2
 x86_read_cr2:
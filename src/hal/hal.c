@@ -9,11 +9,12 @@
 #include <idt.h>
 #include <isr.h>
 #include <irq.h>
+#include <kerndef.h>
 
 /**
  * @brief Initialize core processor structures and interrupt plumbing.
  */
-void hal_init()
+void KERNEL_INIT hal_init()
 {
     gdt_init();
     idt_init();
@@ -0,0 +1,95 @@
+/**
+ * @file include/address_space.h
+ * @brief Per-process address spaces sharing the kernel half.
+ * @copyright Copyright 2025 Chris Nicholson <chris@cnick.org.uk>
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <paging.h>
+#include <vma.h>
+
+#define ADDRESS_SPACE_MAX 64 /**< Maximum number of live address spaces (including the kernel's). */
+
+/**
+ * @brief A page directory together with the bookkeeping needed to edit it.
+ *
+ * PDEs 768-1022 are copies of the kernel's master directory and are kept in
+ * sync by address_space_set_kernel_pde(); PDE 1023 maps the directory onto
+ * itself so the recursive window works for whichever space is active.
+ */
+typedef struct address_space {
+    bool             in_use;                  /**< Slot is allocated. */
+    uint32_t         id;                      /**< Slot index, 0 is the kernel space. */
+    uintptr_t        page_directory_physical; /**< Value loaded into CR3. */
+    page_directory_t page_directory;          /**< Kernel virtual mapping of the directory. */
+    vma_t*           vma_root;                /**< Valid user regions, AVL tree by start address. */
+    uint32_t         vma_count;               /**< Number of regions in the tree. */
+    uint16_t         page_table_entries[KERNEL_PAGE_TABLE_NUMBER]; /**< Non-empty PTEs in each user page table. */
+} address_space_t;
+
+/**
+ * @brief Adopt the boot page directory as the kernel address space.
+ */
+void address_space_init(void);
+
+/**
+ * @brief The kernel address space built from the boot page directory.
+ */
+address_space_t* address_space_kernel(void);
+
+/**
+ * @brief The address space currently loaded in CR3.
+ */
+address_space_t* address_space_current(void);
+
+/**
+ * @brief Look up an address space by slot index.
+ *
+ * @return Address space or NULL if the slot is unused.
+ */
+address_space_t* address_space_get(uint32_t id);
+
+/**
+ * @brief Create an empty user address space that shares the kernel half.
+ *
+ * @return New address space or NULL if no slot or frame is available.
+ */
+address_space_t* address_space_create(void);
+
+/**
+ * @brief Release an address space along with its regions, user page tables and frames.
+ *
+ * @param space Address space to destroy (must not be active).
+ */
+void address_space_destroy(address_space_t* space);
+
+/**
+ * @brief Duplicate the active address space with copy-on-write sharing.
+ *
+ * Only regions and page tables are copied: every present user page is shared with the
+ * child, writable pages become read-only copy-on-write in both spaces, and
+ * the frame reference counts are raised. The cost is proportional to the
+ * number of user page tables, not to resident memory.
+ *
+ * @param parent Address space to duplicate (must be the active one).
+ * @return Child address space or NULL on failure.
+ */
+address_space_t* address_space_fork(address_space_t* parent);
+
+/**
+ * @brief Make an address space active by loading its directory into CR3.
+ *
+ * @param space Address space to activate.
+ */
+void address_space_switch(address_space_t* space);
+
+/**
+ * @brief Install a kernel-half PDE in every address space.
+ *
+ * @param index PDE index (768-1022).
+ * @param pde   Entry value.
+ */
+void address_space_set_kernel_pde(uint32_t index, uint32_t pde);
@@ -0,0 +1,56 @@
+/**
+ * @file include/ahci.h
+ * @brief AHCI (SATA) host controller discovery/initialization interfaces.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Maximum number of AHCI controllers the kernel tracks concurrently.
+ */
+#define AHCI_MAX_CONTROLLERS 2
+
+/**
+ * @brief Maximum number of SATA disks registered across all controllers.
+ */
+#define AHCI_MAX_DRIVES 8
+
+/**
+ * @brief Descriptor describing an AHCI function discovered on the PCI bus.
+ */
+typedef struct {
+    uint8_t  bus;            /**< PCI bus number. */
+    uint8_t  device;         /**< PCI device number. */
+    uint8_t  function;       /**< PCI function number. */
+    uint16_t vendor_id;      /**< PCI vendor identifier. */
+    uint16_t device_id;      /**< PCI device identifier. */
+    uint32_t abar;           /**< Raw BAR5 value: the HBA's memory registers. */
+    uint8_t  interrupt_line; /**< Routed IRQ line reported by PCI config space. */
+} ahci_pci_descriptor_t;
+
+/**
+ * @brief Driver counters.
+ */
+typedef struct {
+    uint32_t interrupts;      /**< Port interrupts acknowledged. */
+    uint32_t commands;        /**< Read/write commands issued to disks. */
+    uint32_t queued_commands; /**< Of which READ/WRITE FPDMA QUEUED. */
+    uint32_t max_outstanding; /**< Most commands one port has had in flight. */
+    uint32_t errors;          /**< Port errors that forced a restart. */
+} ahci_stats_t;
+
+/**
+ * @brief Initialize an AHCI controller described by a PCI function and
+ *        register a block device ("sd0", "sd1", ...) per attached SATA disk.
+ *
+ * @param desc Descriptor populated during PCI enumeration.
+ */
+void ahci_controller_init_from_pci(const ahci_pci_descriptor_t* desc);
+
+/**
+ * @brief Counters of every AHCI port.
+ */
+const ahci_stats_t* ahci_get_stats(void);
@@ -0,0 +1,108 @@
+/**
+ * @file include/bench.h
+ * @brief Boot-time micro-benchmarks (built with `make BENCH=1`).
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Calibrate the TSC against the PIT so cycle counts can be reported in time.
+ */
+void bench_init(void);
+
+/**
+ * @brief Current TSC value.
+ */
+uint64_t bench_cycles(void);
+
+/**
+ * @brief Convert a TSC delta into microseconds.
+ */
+uint64_t bench_cycles_to_us(uint64_t cycles);
+
+/**
+ * @brief Throughput in MB/s for a byte count moved in a TSC delta.
+ */
+uint32_t bench_mb_per_second(uint64_t bytes, uint64_t cycles);
+
+/**
+ * @brief Printf-style output to both the console and the serial port.
+ */
+void bench_log(const char* fmt, ...);
+
+/**
+ * @brief Run every registered benchmark in turn.
+ */
+void bench_run_all(void);
+
+/**
+ * @brief Fork latency for a process with 4, 16 and 64 MiB of resident memory.
+ */
+void bench_fork(void);
+
+/**
+ * @brief Fault counts for a sequential read/write scan with and without fault-around.
+ */
+void bench_fault_around(void);
+
+/**
+ * @brief Framebuffer fill rate (MB/s) and glyph drawing time per memory type.
+ */
+void bench_framebuffer(void);
+
+/**
+ * @brief Populate faults and strided access time for 32 MiB with 4 KiB versus 4 MiB pages.
+ */
+void bench_huge_pages(void);
+
+/**
+ * @brief Strided sweep of 3/4 of the last-level cache with lowest-first versus colored frames.
+ */
+void bench_page_coloring(void);
+
+/**
+ * @brief Sequential 512 KiB reads from the first IDE disk with PIO versus bus-master DMA.
+ */
+void bench_ide_dma(void);
+
+/**
+ * @brief CPU time per MiB read from the first IDE disk when polling versus sleeping on IRQs.
+ */
+void bench_ide_irq(void);
+
+/**
+ * @brief Read versus write throughput (PIO and DMA) on the first IDE disk, plus cache flush time.
+ */
+void bench_ide_writes(void);
+
+/**
+ * @brief 128 KiB reads kept four deep in the block request queue versus submitted one at a time.
+ */
+void bench_ide_queue(void);
+
+/**
+ * @brief Shuffled 8 KiB reads from the first IDE disk with and without a plug: commands, merges and queue wait.
+ */
+void bench_ide_scheduler(void);
+
+/**
+ * @brief Time and buffer cache hit rate of repeated ext2 path lookups.
+ */
+void bench_buffer_cache(void);
+
+/**
+ * @brief Sequential 1 KiB reads of a file: throughput and readahead counters.
+ */
+void bench_readahead(void);
+
+/**
+ * @brief Random 4 KiB reads from a SATA disk at queue depths 1 to 32.
+ */
+void bench_ahci_queue_depth(void);
+
+/**
+ * @brief One disk image read through IDE PIO, IDE DMA and virtio-blk.
+ */
+void bench_virtio_vs_ide(void);
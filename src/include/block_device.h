@@ -11,7 +11,78 @@
 
 #define BLOCK_DEVICE_MAX_NAME 12 /**< Maximum length for block device identifiers. */
 
+#define BLOCK_MERGE_SEGMENTS     32   /**< Scatter entries in one merged command. */
+#define BLOCK_MERGE_SECTORS      1024 /**< Largest merged command, in sectors. */
+#define BLOCK_READ_EXPIRE        8    /**< Commands a read may be passed over by before it must be served. */
+#define BLOCK_WRITE_EXPIRE       32   /**< Same for writes, which nobody is usually waiting on. */
+#define BLOCK_MAX_QUEUE_DEPTH    32   /**< Commands one device can have in flight. */
+
 typedef struct block_device block_device_t;
+typedef struct block_request block_request_t;
+
+/**
+ * @brief What a queued request asks the device to do.
+ */
+typedef enum {
+    BLOCK_REQUEST_READ = 0,
+    BLOCK_REQUEST_WRITE,
+    BLOCK_REQUEST_FLUSH,
+} block_request_op_t;
+
+/**
+ * @brief Progress of a queued request.
+ */
+typedef enum {
+    BLOCK_REQUEST_PENDING = 0, /**< Queued or in flight. */
+    BLOCK_REQUEST_DONE,        /**< Finished successfully. */
+    BLOCK_REQUEST_FAILED,      /**< Rejected or finished with an error. */
+} block_request_status_t;
+
+/**
+ * @brief One contiguous kernel buffer of a scatter list.
+ */
+typedef struct {
+    void*    buffer;       /**< Kernel virtual address of the data. */
+    uint32_t sector_count; /**< Sectors held at buffer. */
+} block_segment_t;
+
+/**
+ * @brief Completion callback; runs in interrupt context for asynchronous drivers.
+ */
+typedef void (*block_request_done_fn)(block_request_t* request);
+
+/**
+ * @brief A read, write or flush queued on a block device.
+ *
+ * The sectors starting at lba map onto the segments in order. The request
+ * belongs to the block layer from block_request_submit() until its status
+ * leaves BLOCK_REQUEST_PENDING; the callback (if any) runs just after that.
+ */
+struct block_request {
+    block_device_t*                 device;
+    block_request_op_t              op;
+    uint64_t                        lba;
+    uint32_t                        sector_count;  /**< Sum over the segments. */
+    block_segment_t*                segments;
+    uint32_t                        segment_count;
+    block_segment_t                 single;        /**< Storage for segments when one buffer is used. */
+    block_request_done_fn           done;          /**< Optional completion callback. */
+    void*                           context;       /**< Caller data for done. */
+    volatile block_request_status_t status;
+    block_request_t*                next;          /**< Device queue link, then link within a merged command. */
+    uint32_t                        deadline;      /**< Dispatch sequence number by which it must be started. */
+    uint64_t                        submit_cycles; /**< TSC at submission, for the queue wait statistics. */
+    uint32_t                        tag;           /**< Command slot, for drivers with several commands in flight. */
+};
+
+/**
+ * @brief A command slot: what the driver's start callback is handed.
+ */
+typedef struct {
+    block_request_t  request;                        /**< request.tag is the slot index. */
+    block_segment_t  segments[BLOCK_MERGE_SEGMENTS];
+    block_request_t* requests;                       /**< Requests carried, or NULL if the slot is free. */
+} block_command_t;
 
 /**
  * @brief Block device read callback signature.
@@ -27,12 +98,88 @@ typedef bool (*block_device_read_fn)(block_device_t* device,
                                      uint32_t sector_count,
                                      void* buffer);
 
+/**
+ * @brief Block device write callback signature.
+ *
+ * @param device       Target block device.
+ * @param lba          Starting logical block address.
+ * @param sector_count Number of sectors to write.
+ * @param buffer       Input buffer (holds sector_count * sector_size bytes).
+ * @return true if the write succeeded, false otherwise.
+ */
+typedef bool (*block_device_write_fn)(block_device_t* device,
+                                      uint64_t lba,
+                                      uint32_t sector_count,
+                                      const void* buffer);
+
+/**
+ * @brief Begin a command built from the device queue.
+ *
+ * The command is a read or write over a scatter list (possibly several
+ * merged requests) or a flush. The driver calls block_request_complete()
+ * once it has finished, either before returning or later from its
+ * interrupt handler. A device with several command slots may be handed a
+ * new command while others are in flight; request->tag names its slot.
+ *
+ * @param device  Target block device.
+ * @param request Command to start.
+ * @return false if the hardware is busy; the command is offered again when
+ *         the driver calls block_device_kick().
+ */
+typedef bool (*block_device_start_fn)(block_device_t* device, block_request_t* request);
+
+/**
+ * @brief Check for a completion whose interrupt was lost (called while a waiter idles).
+ */
+typedef void (*block_device_poll_fn)(block_device_t* device);
+
+/**
+ * @brief Block device cache flush callback signature.
+ *
+ * @param device Target block device.
+ * @return true once every completed write is on stable storage.
+ */
+typedef bool (*block_device_flush_fn)(block_device_t* device);
+
+/**
+ * @brief Scheduler counters of one device.
+ */
+typedef struct {
+    uint32_t requests;        /**< Requests dispatched. */
+    uint32_t commands;        /**< Merged commands handed to the driver. */
+    uint32_t merges;          /**< Requests that joined another's command. */
+    uint32_t expired;         /**< Commands started out of elevator order because a deadline passed. */
+    uint32_t queued;          /**< Requests waiting now. */
+    uint32_t in_flight;       /**< Commands the driver holds now. */
+    uint32_t max_in_flight;   /**< Most commands the driver has held at once. */
+    uint32_t max_queued;      /**< Deepest the queue has been. */
+    uint64_t wait_cycles;     /**< TSC cycles requests spent queued, in total. */
+    uint64_t max_wait_cycles; /**< Longest single wait. */
+} block_device_stats_t;
+
 struct block_device {
     char                   name[BLOCK_DEVICE_MAX_NAME];
     uint32_t               sector_size;
     uint64_t               sector_count;
     block_device_read_fn   read;
+    block_device_write_fn  write;        /**< NULL for read-only devices. */
+    block_device_flush_fn  flush;        /**< NULL if writes are never cached. */
+    block_device_start_fn  start;        /**< NULL: queued requests are run through read/write/flush. */
+    block_device_poll_fn   poll;         /**< Optional. */
     void*                  driver_data;
+    block_request_t*       queue_head;   /**< Waiting requests, oldest first. */
+    block_request_t*       queue_tail;
+    block_command_t        command;      /**< Command slot used when commands is NULL. */
+    block_command_t*       commands;     /**< Driver-provided slots for several commands in flight, or NULL. */
+    uint32_t               command_slots; /**< Entries in commands. */
+    uint32_t               queue_depth;  /**< Commands handed out at once (0: every slot). */
+    block_command_t*       prepared;     /**< Built but refused by the driver, offered again on the next kick. */
+    uint64_t               head_position; /**< Sector after the last command: where the elevator resumes. */
+    uint32_t               sequence;     /**< Commands dispatched; request deadlines count these. */
+    uint32_t               plugged;      /**< Nesting depth of block_device_plug(). */
+    bool                   dispatching;  /**< block_device_kick() is running. */
+    bool                   redispatch;   /**< A kick arrived while dispatching. */
+    block_device_stats_t   stats;
 };
 
 /**
@@ -57,3 +204,115 @@ block_device_t* block_device_get(size_t index);
  * @return Count of devices currently registered.
  */
 size_t block_device_count(void);
+
+/**
+ * @brief Commit any writes the device is still caching.
+ *
+ * @param device Target block device.
+ * @return true if the data is durable (always true for devices without a cache).
+ */
+bool block_device_flush(block_device_t* device);
+
+/**
+ * @brief Prepare a request over a single buffer.
+ *
+ * @param request      Request to fill in (done and context are cleared).
+ * @param device       Target block device.
+ * @param op           Read, write or flush.
+ * @param lba          First sector.
+ * @param sector_count Sectors to transfer (0 for a flush).
+ * @param buffer       Data buffer (NULL for a flush).
+ */
+void block_request_init(block_request_t* request,
+                        block_device_t* device,
+                        block_request_op_t op,
+                        uint64_t lba,
+                        uint32_t sector_count,
+                        void* buffer);
+
+/**
+ * @brief Prepare a request over a scatter list.
+ *
+ * @param segments      Buffers filled or drained in order; must outlive the request.
+ * @param segment_count Number of segments.
+ */
+void block_request_init_segments(block_request_t* request,
+                                 block_device_t* device,
+                                 block_request_op_t op,
+                                 uint64_t lba,
+                                 block_segment_t* segments,
+                                 uint32_t segment_count);
+
+/**
+ * @brief Queue a request on its device and start it if the device is idle.
+ *
+ * Waiting requests are served in one-way elevator order (ascending LBA,
+ * wrapping to the lowest), except that a request passed over for longer
+ * than BLOCK_READ_EXPIRE / BLOCK_WRITE_EXPIRE commands goes next. Queued
+ * requests of the same kind that continue one another are merged into one
+ * driver command. A request never overtakes an older one it conflicts with
+ * (overlapping ranges with a write involved, or any flush).
+ *
+ * @return false if the request was invalid; it is then marked failed
+ *         without calling done.
+ */
+bool block_request_submit(block_request_t* request);
+
+/**
+ * @brief Idle until a submitted request has finished.
+ *
+ * @return true if it completed successfully.
+ */
+bool block_request_wait(block_request_t* request);
+
+/**
+ * @brief Hold back dispatching so a batch of submissions can be sorted and merged first.
+ *
+ * Plugs nest. Waiting on a request of a plugged device dispatches anyway,
+ * so a caller cannot deadlock on its own plug.
+ */
+void block_device_plug(block_device_t* device);
+
+/**
+ * @brief Undo one block_device_plug(); the last one starts the queued requests.
+ */
+void block_device_unplug(block_device_t* device);
+
+/**
+ * @brief Limit how many commands the device is handed at once.
+ *
+ * @param depth Commands in flight, clamped to 1 .. the driver's slot count.
+ * @return The depth now in effect.
+ */
+uint32_t block_device_set_queue_depth(block_device_t* device, uint32_t depth);
+
+/**
+ * @brief Driver side: the command handed to the start callback has finished.
+ *
+ * Starts the next command before completing the requests it carried and
+ * running their callbacks, so the device is not left idle while callers react.
+ *
+ * @param request Command handed to the driver's start callback.
+ * @param success Whether the transfer succeeded.
+ */
+void block_request_complete(block_request_t* request, bool success);
+
+/**
+ * @brief Driver side: try again to start queued requests (the hardware became free).
+ */
+void block_device_kick(block_device_t* device);
+
+/**
+ * @brief read callback for queue-based drivers: submit a request and wait for it.
+ */
+bool block_device_queued_read(block_device_t* device, uint64_t lba, uint32_t sector_count, void* buffer);
+
+/**
+ * @brief write callback for queue-based drivers: submit a request and wait for it.
+ */
+bool block_device_queued_write(block_device_t* device, uint64_t lba, uint32_t sector_count, const void* buffer);
+
+/**
+ * @brief flush callback for queue-based drivers: submit a request and wait for it.
+ */
+bool block_device_queued_flush(block_device_t* device);
@@ -0,0 +1,125 @@
+/**
+ * @file include/buffer_cache.h
+ * @brief Block device contents cached in RAM, keyed by (device, block).
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <block_device.h>
+
+#define BUFFER_CACHE_BLOCK_SIZE  4096 /**< Bytes per cached block, aligned on the device. */
+#define BUFFER_CACHE_MAX_BUFFERS 256  /**< Cached blocks (1 MiB). */
+
+#define BUFFER_CACHE_STREAMS       8   /**< Sequential readers tracked at once. */
+#define BUFFER_CACHE_READAHEAD_MIN 4   /**< Initial readahead window in blocks (16 KiB). */
+#define BUFFER_CACHE_READAHEAD_MAX 128 /**< Largest readahead window in blocks (512 KiB). */
+#define BUFFER_CACHE_READS_IN_FLIGHT 64 /**< Readahead stops while this many block reads are outstanding. */
+
+/**
+ * @brief One cached block of a device.
+ *
+ * A buffer stays in the cache while it is referenced; unreferenced buffers
+ * are kept in least-recently-released order and reused from the cold end.
+ */
+typedef struct buffer_head {
+    block_device_t*     device;
+    uint64_t            block;       /**< Device offset / BUFFER_CACHE_BLOCK_SIZE. */
+    uint8_t*            data;        /**< BUFFER_CACHE_BLOCK_SIZE bytes. */
+    uintptr_t           frame;       /**< Physical page behind data. */
+    uint32_t            references;
+    bool                in_use;      /**< Holds a block of some device. */
+    bool                valid;       /**< data matches (or is newer than) the device. */
+    bool                dirty;       /**< data must be written back. */
+    bool                reading;     /**< request is filling data. */
+    bool                readahead;   /**< Read ahead of a stream and not used yet. */
+    block_request_t     request;     /**< Read or write-back of this block. */
+    struct buffer_head* hash_next;
+    struct buffer_head* lru_prev;    /**< Towards more recently used. */
+    struct buffer_head* lru_next;    /**< Towards less recently used. */
+} buffer_head_t;
+
+/**
+ * @brief Per-device buffer cache counters.
+ */
+typedef struct {
+    uint32_t hits;       /**< Blocks found in the cache. */
+    uint32_t misses;     /**< Blocks read from the device. */
+    uint32_t evictions;  /**< Buffers reused for another block. */
+    uint32_t writebacks; /**< Dirty blocks written to the device. */
+    uint32_t readahead;        /**< Blocks read ahead of a sequential stream. */
+    uint32_t readahead_hits;   /**< Read-ahead blocks that were then asked for. */
+    uint32_t readahead_unused; /**< Read-ahead blocks evicted before anyone asked for them. */
+} buffer_cache_stats_t;
+
+/**
+ * @brief Reset the cache.
+ */
+void buffer_cache_init(void);
+
+/**
+ * @brief Find or read one block of a device.
+ *
+ * @param device Block device.
+ * @param block  Block number in BUFFER_CACHE_BLOCK_SIZE units. A block
+ *               running past the end of the device reads as zero there.
+ * @return Referenced buffer, or NULL on I/O error or if every buffer is in use.
+ */
+buffer_head_t* buffer_cache_get(block_device_t* device, uint64_t block);
+
+/**
+ * @brief Drop a reference taken by buffer_cache_get().
+ */
+void buffer_cache_release(buffer_head_t* buffer);
+
+/**
+ * @brief Note that a referenced buffer was modified; it is written back on sync or eviction.
+ */
+void buffer_cache_mark_dirty(buffer_head_t* buffer);
+
+/**
+ * @brief Start reading the blocks covering a byte range without waiting for them.
+ *
+ * Call inside block_device_plug()/unplug() to let the scheduler merge the reads.
+ */
+void buffer_cache_prefetch(block_device_t* device, uint64_t offset, uint32_t length);
+
+/**
+ * @brief Copy a byte range of a device out of the cache.
+ *
+ * Reads are matched against up to BUFFER_CACHE_STREAMS streams. A read
+ * that continues a stream doubles its readahead window (up to
+ * BUFFER_CACHE_READAHEAD_MAX blocks) and tops it up asynchronously, one
+ * that skips forward within the window halves it, and any other read
+ * starts a new stream with no readahead until it proves sequential.
+ * Readahead across all streams is held to BUFFER_CACHE_READS_IN_FLIGHT
+ * outstanding reads, so it never ties up the whole cache.
+ *
+ * @param offset Byte offset from the start of the device.
+ * @return false if a block could not be read.
+ */
+bool buffer_cache_read(block_device_t* device, uint64_t offset, uint32_t length, void* destination);
+
+/**
+ * @brief Copy bytes into the cache, marking the blocks dirty.
+ *
+ * @param offset Byte offset from the start of the device.
+ * @return false if the device is read-only or a block could not be read.
+ */
+bool buffer_cache_write(block_device_t* device, uint64_t offset, uint32_t length, const void* source);
+
+/**
+ * @brief Write back every dirty block of a device and flush its cache.
+ *
+ * @param device Device to sync, or NULL for every device.
+ * @return true if everything reached stable storage.
+ */
+bool buffer_cache_sync(block_device_t* device);
+
+/**
+ * @brief Cache counters of one device.
+ *
+ * @return Counters, or NULL if the device has never used the cache.
+ */
+const buffer_cache_stats_t* buffer_cache_get_stats(const block_device_t* device);
@@ -15,4 +15,9 @@ bool ext2_list_root(const filesystem_mount_t* mount,
                     vfs_dir_entry_callback_t callback,
                     void* context);
 
+/**
+ * @brief Whether an open file is a regular file on an ext2 mount.
+ */
+bool ext2_is_regular_file(const vfs_file_t* file);
+
 extern const vfs_filesystem_ops_t g_ext2_vfs_ops;
@@ -85,6 +85,9 @@ size_t filesystem_mount_count(void);
 /**
  * @brief Read an arbitrary byte range from a block device partition.
  *
+ * The data comes through the buffer cache unless the device's sector size
+ * does not divide BUFFER_CACHE_BLOCK_SIZE.
+ *
  * @param device       Target block device.
  * @param lba_start    Partition starting LBA.
  * @param byte_offset  Offset from the start of the partition in bytes.
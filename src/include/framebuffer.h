@@ -7,6 +7,7 @@
 #pragma once
 #include <stdint.h>
 #include <multiboot.h>
+#include <paging.h>
 
 /**
  * @brief Runtime description of the linear framebuffer.
@@ -28,6 +29,18 @@ extern framebuffer_t g_framebuffer;
  */
 void framebuffer_init(multiboot_info* mbi);
 
+/**
+ * @brief Remap video memory with a different memory type.
+ *
+ * @param mode Cache mode for the whole framebuffer (write-combining by default).
+ */
+void framebuffer_set_cache_mode(enum page_cache_mode_t mode);
+
+/**
+ * @brief Draw a single glyph at a pixel position.
+ */
+void drawchar(char c, uint32_t x, uint32_t y, uint32_t fg_color, uint32_t bg_color);
+
 /**
  * @brief Clear the framebuffer using the default background colour.
  */
@@ -27,9 +27,37 @@ typedef struct {
     uint8_t  interrupt_line; /**< Routed IRQ line reported by PCI config space. */
 } ide_pci_descriptor_t;
 
+/**
+ * @brief Driver counters.
+ */
+typedef struct {
+    uint64_t halted_cycles; /**< TSC cycles spent halted waiting for a drive. */
+    uint32_t interrupts;    /**< Channel interrupts acknowledged. */
+    uint32_t commands;      /**< Read/write commands issued to drives. */
+} ide_stats_t;
+
 /**
  * @brief Initialize an IDE controller described by a PCI function.
  *
  * @param desc Descriptor populated during PCI enumeration.
  */
 void ide_controller_init_from_pci(const ide_pci_descriptor_t* desc);
+
+/**
+ * @brief Allow or forbid bus-master DMA; transfers use PIO while it is off.
+ *
+ * @param enabled true to use DMA on drives and channels that support it.
+ */
+void ide_set_dma_enabled(bool enabled);
+
+/**
+ * @brief Choose between sleeping until a drive interrupts and polling its status.
+ *
+ * @param enabled true to wait for IRQs on channels that have one.
+ */
+void ide_set_irq_enabled(bool enabled);
+
+/**
+ * @brief Counters describing how long callers slept on drive interrupts.
+ */
+const ide_stats_t* ide_get_stats(void);
@@ -7,6 +7,9 @@
 #pragma once
 #include <isr.h>
 
+#define IRQ_BASE_VECTOR 0x20 /**< Interrupt vector of IRQ 0 once the PIC is remapped. */
+#define IRQ_MAX_SHARED  4    /**< Handlers one (PCI, shared) IRQ line can have. */
+
 typedef void (*IRQHandler)(Registers* regs);
 
 /**
@@ -17,6 +20,9 @@ void irq_init(void);
 /**
  * @brief Register a high-level handler for a hardware IRQ.
  *
+ * A line can carry up to IRQ_MAX_SHARED handlers, all called on each
+ * interrupt; registering the same handler twice has no effect.
+ *
  * @param irq      IRQ line number (0-15).
  * @param handler  Callback to execute when the IRQ fires.
  */
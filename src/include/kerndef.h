@@ -10,3 +10,13 @@
  * @brief Kernel-wide definitions and attributes.
  */
 #define KERNEL_CDECL __attribute__((cdecl))
+
+/**
+ * @brief Code only run during boot; its frames are freed by memory_free_init().
+ */
+#define KERNEL_INIT __attribute__((section(".init.text")))
+
+/**
+ * @brief Data only used during boot; its frames are freed by memory_free_init().
+ */
+#define KERNEL_INIT_DATA __attribute__((section(".init.data")))
@@ -11,12 +11,22 @@
 #include <isr.h>
 #include <stdio.h>
 #include <paging.h>
+#include <kerndef.h>
 
 /**
  * @brief Cache the Multiboot memory map and make it accessible.
  */
 void memory_init(multiboot_info* mbi);
 
+/**
+ * @brief Release memory only needed during boot.
+ *
+ * Frees the init sections, the unused tail of the static PMM bitmap and the
+ * Multiboot information, then reports how much was reclaimed. Nothing marked
+ * KERNEL_INIT may run afterwards.
+ */
+void memory_free_init(void);
+
 /**
  * @brief Retrieve the number of entries in the cached memory map.
  */
@@ -27,12 +37,59 @@ uint32_t memory_get_mmap_count();
  */
 multiboot_mmap_entry* memory_get_mmap();
 
+/**
+ * @brief Page fault counters maintained by the VMM.
+ */
+typedef struct {
+    uint32_t faults;               /**< Page faults taken. */
+    uint32_t zero_page_maps;       /**< Read faults satisfied by the shared zero page. */
+    uint32_t fault_around_pages;   /**< Neighbouring PTEs populated by fault-around. */
+    uint32_t anonymous_pages;      /**< Private zero-filled user frames handed out. */
+    uint32_t cow_copies;           /**< Copy-on-write faults that copied a frame. */
+    uint32_t cow_reuses;           /**< Copy-on-write faults where the last owner kept the frame. */
+    uint32_t huge_page_faults;     /**< 4 MiB blocks populated with a PSE page at fault time. */
+    uint32_t huge_page_promotions; /**< Full page tables collapsed into a PSE page. */
+    uint32_t huge_page_fallbacks;  /**< Eligible blocks that fell back to 4 KiB pages (no contiguous memory). */
+    uint32_t huge_page_splits;     /**< PSE pages split back into page tables (fork). */
+    uint32_t page_table_pool_hits;   /**< New page tables taken pre-zeroed from the pool. */
+    uint32_t page_table_pool_misses; /**< New page tables allocated and zeroed on the spot. */
+    uint32_t page_tables_reclaimed;  /**< Emptied user page tables unlinked and recycled. */
+} vmm_fault_stats_t;
+
+/**
+ * @brief Colored allocation counters.
+ */
+typedef struct {
+    uint32_t colored;   /**< Frames handed out with the requested color. */
+    uint32_t fallbacks; /**< Requests no free frame of the color could satisfy. */
+} pmm_color_stats_t;
+
+struct vma;
+
 // Physical Memory manager interface functions (implemented in pmm.c)
 
 uint32_t pmm_init_allocator(uint32_t memsize);
 uintptr_t pmm_allocate_page();
+uintptr_t pmm_allocate_page_reclaim(void);
 void pmm_mark_page_reserved(uint32_t page_number);
 void pmm_mark_page_free(uint32_t page_number);
+void pmm_free_page(uintptr_t physical_address);
+uint32_t pmm_free_page_count(void);
+void pmm_init_reference_counts(void);
+void pmm_page_add_reference(uintptr_t physical_address);
+uint32_t pmm_page_reference_count(uintptr_t physical_address);
+void pmm_page_release(uintptr_t physical_address);
+void pmm_page_pin(uintptr_t physical_address);
+uintptr_t pmm_allocate_large_page(void);
+void pmm_free_large_page(uintptr_t physical_address);
+uint32_t pmm_free_boot_range(uintptr_t physical_start, uintptr_t physical_end);
+uint32_t pmm_bitmap_bytes(void);
+void pmm_init_page_colors(void);
+uint32_t pmm_page_color_count(void);
+uint32_t pmm_cache_size(void);
+void pmm_set_page_coloring(bool enabled);
+uintptr_t pmm_allocate_colored_page(uint32_t virtual_address);
+const pmm_color_stats_t* pmm_get_color_stats(void);
 
 page_directory_t vmm_initialize_kernel_page_directory();
 
@@ -55,6 +112,30 @@ uint32_t vmm_make_page_table_entry(void* physical_address,
 uint32_t vmm_count_present_pages(page_directory_t page_directory);
 void* vmm_page_table_virtual_address(uint16_t page_table_number);
 
+page_directory_t vmm_active_page_directory(void);
+
+void vmm_initialize_direct_map(uint32_t memory_bytes);
+void vmm_revoke_user_low_memory(uintptr_t physical_start, uintptr_t physical_end);
+void* phys_to_virt(uintptr_t physical_address);
+uintptr_t virt_to_phys(const void* virtual_address);
+
 void vmm_page_fault_handler(Registers* regs);
-bool vmm_map_physical_to_virtual(uint8_t* physical_address, uint8_t* virtual_address);
-bool vmm_map_4mb_physical_to_virtual(uint8_t* physical_address, uint8_t* virtual_address, size_t size);
+bool vmm_map_physical_to_virtual(uint8_t* physical_address, uint8_t* virtual_address, enum page_cache_mode_t cache_mode);
+bool vmm_map_kernel_page(uintptr_t physical_address, uint8_t* virtual_address, enum page_cache_mode_t cache_mode);
+uintptr_t vmm_unmap_virtual(uint8_t* virtual_address);
+void* vmm_temp_map(uintptr_t physical_address);
+void vmm_temp_unmap(void* virtual_address);
+
+bool vmm_fault_anonymous(const struct vma* vma, uint32_t address, uint32_t error);
+bool vmm_split_huge_page(uint32_t directory_entry);
+void vmm_collapse_huge_pages(void);
+void vmm_set_huge_pages_enabled(bool enabled);
+void vmm_refill_page_table_pool(void);
+bool vmm_map_user_page(uint32_t address, uintptr_t frame, bool writable);
+void vmm_unmap_user_range(uint32_t start, uint32_t end);
+bool vmm_map_user_device_page(uint32_t address, uintptr_t physical, bool writable, enum page_cache_mode_t cache_mode);
+
+void vmm_set_fault_around_pages(uint32_t pages);
+const vmm_fault_stats_t* vmm_get_fault_stats(void);
+void vmm_reset_fault_stats(void);
+bool vmm_map_4mb_physical_to_virtual(uint8_t* physical_address, uint8_t* virtual_address, size_t size, enum page_cache_mode_t cache_mode);
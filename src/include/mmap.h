@@ -0,0 +1,46 @@
+/**
+ * @file include/mmap.h
+ * @brief Mapping files into user address spaces.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <vfs.h>
+
+#define PROT_READ     0x1     /**< Pages may be read. */
+#define PROT_WRITE    0x2     /**< Pages may be written (not supported for files yet). */
+#define PROT_EXEC     0x4     /**< Pages may be executed. */
+
+#define MAP_SHARED    0x01    /**< Share the file's pages with other mappers. */
+#define MAP_PRIVATE   0x02    /**< Private mapping (identical to shared while read-only). */
+#define MAP_POPULATE  0x8000  /**< Fault every page in before returning. */
+
+#define MMAP_FAILED   0xffffffffu /**< Error return of mmap_file(). */
+#define MMAP_BASE     0x40000000u /**< Lowest address handed out for mappings. */
+
+/**
+ * @brief Map part of a file into the current address space, read-only.
+ *
+ * Pages come from the page cache on first access, so every process mapping
+ * the same file shares the same frames.
+ *
+ * @param file   Open ext2 regular file; the mapping takes its own reference.
+ * @param offset Page-aligned byte offset within the file.
+ * @param length Bytes to map (rounded up to whole pages).
+ * @param prot   PROT_* bits; PROT_WRITE is rejected.
+ * @param flags  MAP_* bits.
+ * @return User address of the mapping, or MMAP_FAILED.
+ */
+uint32_t mmap_file(vfs_file_t* file, uint32_t offset, uint32_t length, uint32_t prot, uint32_t flags);
+
+/**
+ * @brief Remove a whole mapping created by mmap_file().
+ *
+ * @param address Start of the region.
+ * @param length  Length of the region.
+ * @return true if a file mapping exactly matching the range was removed;
+ *         false for any other region (the stack included).
+ */
+bool mmap_unmap(uint32_t address, uint32_t length);
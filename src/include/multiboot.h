@@ -11,6 +11,7 @@
 #define MULTIBOOT_TAG_TYPE_END                   0
 #define MULTIBOOT_TAG_TYPE_CMDLINE               1
 #define MULTIBOOT_TAG_TYPE_BOOT_LOADER_NAME      2
+#define MULTIBOOT_TAG_TYPE_MODULE                3
 #define MULTIBOOT_TAG_TYPE_BASIC_MEMINFO         4
 #define MULTIBOOT_TAG_TYPE_MMAP                  6
 #define MULTIBOOT_TAG_TYPE_FRAMEBUFFER           8
@@ -21,12 +22,32 @@
 #define MULTIBOOT_MEMORY_NVS                     4
 #define MULTIBOOT_MEMORY_BADRAM                  5
 
+#define MULTIBOOT_MAX_MODULES                    4
+#define MULTIBOOT_MODULE_CMDLINE_MAX             64
+#define MULTIBOOT_CMDLINE_MAX                    128
+
 typedef struct
 {
     uint32_t type;
     uint32_t size;
 } multiboot_tag;
 
+typedef struct
+{
+    uint32_t type;
+    uint32_t size;
+    char string[];
+} multiboot_tag_string;
+
+typedef struct
+{
+    uint32_t type;
+    uint32_t size;
+    uint32_t mod_start;
+    uint32_t mod_end;
+    char cmdline[];
+} multiboot_tag_module;
+
 typedef struct
 {
     uint32_t type;
@@ -64,6 +85,16 @@ typedef struct
     uint16_t reserved;
 } multiboot_tag_framebuffer;
 
+/**
+ * @brief Module loaded by the boot loader (GRUB module2).
+ */
+typedef struct
+{
+    uint32_t start; /**< Physical address of the first byte. */
+    uint32_t end;   /**< Physical address one past the last byte. */
+    char cmdline[MULTIBOOT_MODULE_CMDLINE_MAX]; /**< Arguments after the file name, truncated. */
+} multiboot_module;
+
 /**
  * @brief Cached Multiboot information used by the kernel.
  */
@@ -79,6 +110,11 @@ typedef struct
     uint32_t framebuffer_height;
     uint8_t framebuffer_bpp;
     uint8_t framebuffer_type;
+    uint32_t tags_addr; /**< Physical address of the boot information tags (released after init). */
+    uint32_t tags_size; /**< Size of the boot information in bytes. */
+    char cmdline[MULTIBOOT_CMDLINE_MAX]; /**< Kernel command line, truncated. */
+    multiboot_module modules[MULTIBOOT_MAX_MODULES];
+    uint32_t module_count;
 } multiboot_info;
 
 multiboot_info* multiboot_get_info(void);
@@ -0,0 +1,52 @@
+/**
+ * @file include/nvme.h
+ * @brief NVMe controller discovery/initialization interfaces.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Maximum number of NVMe controllers the kernel tracks concurrently.
+ */
+#define NVME_MAX_CONTROLLERS 2
+
+/**
+ * @brief Descriptor describing an NVMe function discovered on the PCI bus.
+ */
+typedef struct {
+    uint8_t  bus;            /**< PCI bus number. */
+    uint8_t  device;         /**< PCI device number. */
+    uint8_t  function;       /**< PCI function number. */
+    uint16_t vendor_id;      /**< PCI vendor identifier. */
+    uint16_t device_id;      /**< PCI device identifier. */
+    uint32_t bar0;           /**< Raw BAR0 value: the controller's registers. */
+    uint32_t bar1;           /**< Raw BAR1 value: upper half of a 64-bit BAR0. */
+    uint8_t  interrupt_line; /**< Routed IRQ line reported by PCI config space. */
+} nvme_pci_descriptor_t;
+
+/**
+ * @brief Driver counters.
+ */
+typedef struct {
+    uint32_t interrupts;      /**< Interrupts that found completions. */
+    uint32_t commands;        /**< I/O commands submitted. */
+    uint32_t prp_lists;       /**< Of which needed a PRP list. */
+    uint32_t max_outstanding; /**< Most commands one controller has had in flight. */
+    uint32_t errors;          /**< Commands completed with an error status. */
+} nvme_stats_t;
+
+/**
+ * @brief Initialize an NVMe controller described by a PCI function and
+ *        register its first namespace as "nvme0n1", "nvme1n1", ...
+ *
+ * @param desc Descriptor populated during PCI enumeration.
+ */
+void nvme_controller_init_from_pci(const nvme_pci_descriptor_t* desc);
+
+/**
+ * @brief Counters of every NVMe controller.
+ */
+const nvme_stats_t* nvme_get_stats(void);
@@ -0,0 +1,52 @@
+/**
+ * @file include/page_cache.h
+ * @brief Physical pages holding file contents, shared by every mapper.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <vfs.h>
+
+#define PAGE_CACHE_MAX_PAGES 1024 /**< Cached file pages (4 MiB). */
+
+/**
+ * @brief Page cache counters.
+ */
+typedef struct {
+    uint32_t hits;      /**< Lookups satisfied from the cache. */
+    uint32_t misses;    /**< Lookups that read the page from the filesystem. */
+    uint32_t evictions; /**< Unmapped pages dropped to make room. */
+} page_cache_stats_t;
+
+/**
+ * @brief Reset the cache.
+ */
+void page_cache_init(void);
+
+/**
+ * @brief Find or read the frame holding one page of a file.
+ *
+ * The returned frame carries an extra reference for the caller, released
+ * with pmm_page_release() (address_space_destroy() does this for mappings).
+ * Bytes past the end of the file read as zero.
+ *
+ * @param file       Open file.
+ * @param page_index Page number within the file.
+ * @return Physical address of the page, or 0 on I/O error or exhaustion.
+ */
+uintptr_t page_cache_get(vfs_file_t* file, uint32_t page_index);
+
+/**
+ * @brief Drop cached pages that no address space maps, returning their frames.
+ *
+ * @param pages Number of frames wanted.
+ * @return Number of frames actually released.
+ */
+uint32_t page_cache_shrink(uint32_t pages);
+
+/**
+ * @brief Current page cache counters.
+ */
+const page_cache_stats_t* page_cache_get_stats(void);
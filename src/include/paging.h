@@ -12,6 +12,33 @@
 #define PAGE_SIZE_BYTES 4096
 #define PAGE_OFFSET_BITS 12
 #define KERNEL_PAGE_TABLE_NUMBER 768
+#define KERNEL_VIRTUAL_BASE 0xc0000000u
+#define RECURSIVE_PAGE_TABLE_NUMBER 1023
+#define DIRECT_MAP_BASE KERNEL_VIRTUAL_BASE  /**< Physical address 0 in the kernel's linear map. */
+#define DIRECT_MAP_MAX_BYTES 0x10000000u     /**< Linear map stops below the heap at 0xd0000000. */
+
+#define PAGE_PRESENT        0x001u  /**< Entry maps a page or page table. */
+#define PAGE_WRITABLE       0x002u  /**< Writes permitted. */
+#define PAGE_USER           0x004u  /**< Accessible from ring 3. */
+#define PAGE_WRITE_THROUGH  0x008u  /**< PWT cache attribute. */
+#define PAGE_CACHE_DISABLED 0x010u  /**< PCD cache attribute. */
+#define PAGE_ACCESSED       0x020u  /**< Set by the CPU on access. */
+#define PAGE_DIRTY          0x040u  /**< Set by the CPU on write. */
+#define PAGE_LARGE          0x080u  /**< PDE maps a 4 MiB page. */
+#define PAGE_GLOBAL         0x100u  /**< Not flushed on CR3 reload. */
+#define PAGE_COPY_ON_WRITE  0x200u  /**< Software bit: read-only share, copy on first write. */
+#define PAGE_DEVICE         0x400u  /**< Software bit: frame is not RAM and is never reference counted. */
+#define PAGE_SWAPPED        0x800u  /**< Software bit (not present): frame field holds a swap slot. */
+#define PAGE_FRAME_MASK     0xfffff000u
+#define PAGE_TABLE_COVERAGE 0x400000u   /**< Bytes mapped by one page table. */
+
+#define PAGE_FAULT_PRESENT  0x1u   /**< Error code: fault on a present page. */
+#define PAGE_FAULT_WRITE    0x2u   /**< Error code: faulting access was a write. */
+#define PAGE_FAULT_USER     0x4u   /**< Error code: fault raised in ring 3. */
+
+#define PAGE_ALIGN_DOWN(address) ((uint32_t)(address) & PAGE_FRAME_MASK)
+#define PAGE_DIRECTORY_INDEX(address) ((uint32_t)(address) >> 22)
+#define PAGE_TABLE_INDEX(address) (((uint32_t)(address) >> PAGE_OFFSET_BITS) & 0x3ff)
 
 typedef uint32_t* page_directory_t;
 typedef uint32_t* page_table_t;
@@ -19,6 +46,7 @@ typedef uint32_t* page_table_t;
 enum page_permissions_t {READ_ONLY, READ_WRITE};
 enum page_privilege_t {SUPERVISOR, USER};
 enum page_size_t {FOUR_KB, FOUR_MB};
+enum page_cache_mode_t {CACHE_WRITE_BACK, CACHE_WRITE_THROUGH, CACHE_UNCACHED, CACHE_WRITE_COMBINING};
 
 extern void * PageDirectoryVirtualAddress;
 extern void * PageDirectoryPhysicalAddress;
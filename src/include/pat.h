@@ -0,0 +1,33 @@
+/**
+ * @file include/pat.h
+ * @brief Page Attribute Table setup and per-mapping cache modes.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <paging.h>
+
+/**
+ * @brief Program the PAT MSR so that every cache mode has a PTE encoding.
+ *
+ * Entries 0-3 keep their power-on values (WB, WT, UC-, UC); entry 4 becomes
+ * write-combining. Must run before anything is mapped with CACHE_WRITE_COMBINING.
+ */
+void pat_init(void);
+
+/**
+ * @brief Whether the CPU has a PAT (write-combining is available).
+ */
+bool pat_supported(void);
+
+/**
+ * @brief PWT/PCD/PAT bits selecting a cache mode in a 4 KiB PTE.
+ */
+uint32_t pat_page_table_flags(enum page_cache_mode_t mode);
+
+/**
+ * @brief PWT/PCD/PAT bits selecting a cache mode in a 4 MiB PDE.
+ */
+uint32_t pat_large_page_flags(enum page_cache_mode_t mode);
@@ -8,6 +8,9 @@
 
 #include <stdint.h>
 
+#define PCI_COMMAND_BUS_MASTER 0x0004 /**< Command register: function may initiate DMA. */
+#define PCI_COMMAND_MEMORY     0x0002 /**< Command register: function decodes its memory BARs. */
+
 typedef struct {
     uint8_t  bus;
     uint8_t  device;
@@ -41,3 +44,43 @@ const char* pci_subclass_name(uint8_t class_code, uint8_t subclass, uint8_t prog
  * @brief Enumerate all PCI buses and log discovered functions.
  */
 void pci_enumerate(void);
+
+/**
+ * @brief Read a 32-bit value from PCI configuration space.
+ *
+ * @param bus      Target PCI bus number.
+ * @param device   Target device number on the bus.
+ * @param function Target function number within the device.
+ * @param offset   DWORD-aligned register offset.
+ * @return 32-bit value read from configuration space.
+ */
+uint32_t pci_read_config_dword(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset);
+
+/**
+ * @brief Read an 8-bit value from PCI configuration space.
+ *
+ * @param bus      Target PCI bus number.
+ * @param device   Target device number on the bus.
+ * @param function Target function number within the device.
+ * @param offset   Register offset.
+ * @return 8-bit value read from configuration space.
+ */
+uint8_t pci_read_config_byte(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset);
+
+/**
+ * @brief Allow a PCI function to master the bus (required before it can DMA).
+ *
+ * @param bus      PCI bus number.
+ * @param device   Device number on the bus.
+ * @param function Function number within the device.
+ */
+void pci_enable_bus_master(uint8_t bus, uint8_t device, uint8_t function);
+
+/**
+ * @brief Let a PCI function decode its memory BARs (required before MMIO).
+ *
+ * @param bus      PCI bus number.
+ * @param device   Device number on the bus.
+ * @param function Function number within the device.
+ */
+void pci_enable_memory_space(uint8_t bus, uint8_t device, uint8_t function);
@@ -0,0 +1,115 @@
+/**
+ * @file include/process.h
+ * @brief User process table and context switching.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <isr.h>
+#include <address_space.h>
+#include <vfs.h>
+
+#define PROCESS_MAX 32 /**< Maximum number of concurrently live processes. */
+#define PROCESS_STACK_INITIAL_SIZE (16u * 4096u) /**< Stack region created with a process; it grows on demand. */
+
+#define PROCESS_SIGNAL_SEGV 11 /**< Invalid memory access. */
+
+#define PROCESS_MAX_FILES   16 /**< Descriptors per process. */
+#define PROCESS_FIRST_FILE  3  /**< 0-2 are the console. */
+
+typedef enum {
+    PROCESS_UNUSED = 0,
+    PROCESS_READY,
+    PROCESS_RUNNING,
+} process_state_t;
+
+/**
+ * @brief A user-mode process: its address space and saved register frame.
+ */
+typedef struct process {
+    uint32_t         pid;            /**< Process identifier (never 0). */
+    uint32_t         parent_pid;     /**< Identifier of the creating process. */
+    process_state_t  state;          /**< Scheduling state. */
+    address_space_t* address_space;  /**< Page directory used while running. */
+    Registers        context;        /**< User frame restored on the next switch-in. */
+    vfs_file_t*      files[PROCESS_MAX_FILES]; /**< Open file objects indexed by descriptor. */
+} process_t;
+
+/**
+ * @brief Reset the process table.
+ */
+void process_init(void);
+
+/**
+ * @brief Create a process with a fresh address space.
+ *
+ * @param entry     User-mode entry point.
+ * @param stack_top Initial user stack pointer.
+ * @return New process in the READY state, or NULL on failure.
+ */
+process_t* process_create(uint32_t entry, uint32_t stack_top);
+
+/**
+ * @brief Duplicate the current process with a copy-on-write address space.
+ *
+ * @param regs User frame of the calling process; the child resumes from it
+ *             with eax set to 0.
+ * @return Child process in the READY state, or NULL on failure.
+ */
+process_t* process_fork(const Registers* regs);
+
+/**
+ * @brief Terminate the current process and resume the next runnable one.
+ *
+ * Must be called from an interrupt raised in user mode; the frame is
+ * rewritten with the next process's context.
+ *
+ * @param regs   Interrupt frame of the process being killed.
+ * @param signal Signal number reported for the termination.
+ */
+void process_kill_current(Registers* regs, uint32_t signal);
+
+/**
+ * @brief Give a file object a descriptor in a process.
+ *
+ * @param process Owning process.
+ * @param file    File object; the descriptor takes over the caller's reference.
+ * @return Descriptor number or -1 if the table is full.
+ */
+int32_t process_install_file(process_t* process, vfs_file_t* file);
+
+/**
+ * @brief File object behind a descriptor (NULL if not open).
+ */
+vfs_file_t* process_get_file(process_t* process, uint32_t fd);
+
+/**
+ * @brief Close a descriptor, dropping its reference to the file object.
+ *
+ * @return true if the descriptor was open.
+ */
+bool process_close_file(process_t* process, uint32_t fd);
+
+/**
+ * @brief The process whose address space is currently loaded.
+ */
+process_t* process_current(void);
+
+/**
+ * @brief Mark a process as running and switch to its address space.
+ *
+ * @param process Process to activate.
+ */
+void process_activate(process_t* process);
+
+/**
+ * @brief Round-robin context switch driven from the timer interrupt.
+ *
+ * Only switches when the interrupt arrived from user mode, so the single
+ * kernel stack never holds more than one process's state.
+ *
+ * @param regs Interrupt frame, rewritten with the next process's context.
+ */
+void process_schedule(Registers* regs);
@@ -0,0 +1,25 @@
+/**
+ * @file include/ramdisk.h
+ * @brief Memory-backed block devices.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <multiboot.h>
+
+/**
+ * @brief Maximum number of RAM disks the kernel tracks concurrently.
+ */
+#define RAMDISK_MAX_DEVICES 4
+
+/**
+ * @brief Register a RAM disk ("rd0", "rd1", ...) for every boot module, and
+ *        an empty one if the command line asks for it with ramdisk_size=<KiB>.
+ *
+ * Module images are used in place, so writes change the loaded copy only.
+ *
+ * @param info Cached Multiboot information (modules and command line).
+ */
+void ramdisk_init_from_multiboot(const multiboot_info* info);
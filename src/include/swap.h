@@ -0,0 +1,86 @@
+/**
+ * @file include/swap.h
+ * @brief Anonymous page reclaim to a swap partition.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <block_device.h>
+#include <paging.h>
+
+#define SWAP_PARTITION_TYPE 0x82         /**< MBR partition type of a Linux swap partition. */
+#define SWAP_MAX_SLOTS      65536        /**< Largest swap area used (256 MiB). */
+#define SWAP_CLUSTER_PAGES  8            /**< Slots read together on a swap-in. */
+#define SWAP_RECLAIM_BATCH  16           /**< Frames reclaimed when an allocation finds none free. */
+
+/**
+ * @brief Swap counters.
+ */
+typedef struct {
+    uint32_t pages_out;     /**< Pages written to swap and unmapped. */
+    uint32_t pages_in;      /**< Pages read back on a fault. */
+    uint32_t prefetched;    /**< Neighbouring pages restored by a clustered read. */
+    uint32_t cluster_reads; /**< Clustered reads issued. */
+    uint32_t scanned;       /**< PTEs inspected by the clock. */
+    uint32_t slots_used;    /**< Slots currently holding a page. */
+    uint32_t slots_total;   /**< Usable slots in the swap area. */
+} swap_stats_t;
+
+/**
+ * @brief Whether a PTE refers to a page in swap rather than a frame.
+ */
+static inline bool swap_is_entry(uint32_t pte)
+{
+    return (pte & (PAGE_PRESENT | PAGE_SWAPPED)) == PAGE_SWAPPED;
+}
+
+/**
+ * @brief Adopt a partition as the swap area if it carries a swap signature.
+ *
+ * @param device       Block device holding the partition.
+ * @param lba_start    First sector of the partition.
+ * @param sector_count Length of the partition in sectors.
+ * @return true if the partition is now used for swap.
+ */
+bool swap_probe_partition(block_device_t* device, uint64_t lba_start, uint64_t sector_count);
+
+/**
+ * @brief Whether a swap area is active.
+ */
+bool swap_enabled(void);
+
+/**
+ * @brief Free page frames by dropping clean cache pages and swapping out cold anonymous pages.
+ *
+ * Anonymous pages are chosen by a clock over the user PTEs of every address
+ * space: a set accessed bit buys the page a second chance.
+ *
+ * @param pages Number of frames wanted.
+ * @return Number of frames released.
+ */
+uint32_t swap_reclaim(uint32_t pages);
+
+/**
+ * @brief Bring a swapped page of the active address space back in.
+ *
+ * @param address Faulting user address.
+ * @return true if the PTE was a swap entry and now maps a frame.
+ */
+bool swap_fault(uint32_t address);
+
+/**
+ * @brief Record another PTE referring to a swap entry (fork).
+ */
+void swap_entry_duplicate(uint32_t pte);
+
+/**
+ * @brief Drop a PTE's reference to its swap slot.
+ */
+void swap_entry_free(uint32_t pte);
+
+/**
+ * @brief Current swap counters.
+ */
+const swap_stats_t* swap_get_stats(void);
@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <isr.h>
 
 #define SYSCALL_INTERRUPT_VECTOR 0x80
 #define SYSCALL_MAX              512
@@ -25,6 +26,8 @@ typedef uint32_t (*syscall_handler_t)(uint32_t arg0,
 #define SYSCALL_NR_CLOSE       6
 #define SYSCALL_NR_GETPID     20
 #define SYSCALL_NR_GETPPID    64
+#define SYSCALL_NR_MMAP       90
+#define SYSCALL_NR_MUNMAP     91
 #define SYSCALL_NR_STAT       106
 #define SYSCALL_NR_LSTAT      107
 #define SYSCALL_NR_FSTAT      108
@@ -34,3 +37,8 @@ void syscall_init(void);
 bool syscall_register(uint32_t number,
                       syscall_handler_t handler,
                       const char* name);
+
+/**
+ * @brief Register frame of the system call being serviced (NULL outside one).
+ */
+Registers* syscall_current_frame(void);
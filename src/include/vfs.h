@@ -16,6 +16,8 @@ typedef bool (*vfs_dir_entry_callback_t)(const char* name,
                                          uint8_t type,
                                          void* context);
 
+#define VFS_MAX_OPEN_FILES 64 /**< Reference-counted file objects shared by descriptors and mappings. */
+
 struct vfs_file;
 typedef struct vfs_file vfs_file_t;
 
@@ -28,6 +30,10 @@ typedef struct {
                  const char* path,
                  vfs_file_t* file);
     void (*close)(vfs_file_t* file);
+    uint32_t (*read)(vfs_file_t* file,
+                     uint32_t offset,
+                     void* buffer,
+                     uint32_t length);
 } vfs_filesystem_ops_t;
 
 struct vfs_file {
@@ -36,6 +42,7 @@ struct vfs_file {
     uint32_t                      size;
     uint32_t                      position;
     uint32_t                      inode;
+    uint32_t                      references;
     void*                         fs_private;
 };
 
@@ -50,4 +57,32 @@ bool vfs_open(const char* mount_name,
               const char* path,
               vfs_file_t* file);
 void vfs_close(vfs_file_t* file);
+
+/**
+ * @brief Read from a file at an absolute offset.
+ *
+ * @return Number of bytes read (short at end of file, 0 on error).
+ */
+uint32_t vfs_read(vfs_file_t* file,
+                  uint32_t offset,
+                  void* buffer,
+                  uint32_t length);
+
+/**
+ * @brief Open a "mount/path" into a shared, reference-counted file object.
+ *
+ * @param path Mount name, a slash, then the path inside the mount.
+ * @return File object holding one reference, or NULL.
+ */
+vfs_file_t* vfs_file_open(const char* path);
+
+/**
+ * @brief Take another reference to a shared file object.
+ */
+void vfs_file_get(vfs_file_t* file);
+
+/**
+ * @brief Drop a reference, closing the file when the last one goes.
+ */
+void vfs_file_put(vfs_file_t* file);
 void vfs_print_mounts(void);
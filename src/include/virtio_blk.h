@@ -0,0 +1,56 @@
+/**
+ * @file include/virtio_blk.h
+ * @brief virtio block device (PCI transport) discovery/initialization interfaces.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define VIRTIO_PCI_VENDOR_ID          0x1AF4
+#define VIRTIO_PCI_DEVICE_BLK_LEGACY  0x1001 /**< Transitional block device (legacy and modern). */
+#define VIRTIO_PCI_DEVICE_BLK_MODERN  0x1042 /**< Modern-only block device. */
+
+/**
+ * @brief Maximum number of virtio block devices the kernel tracks concurrently.
+ */
+#define VIRTIO_BLK_MAX_DEVICES 4
+
+/**
+ * @brief Descriptor describing a virtio block function discovered on the PCI bus.
+ */
+typedef struct {
+    uint8_t  bus;            /**< PCI bus number. */
+    uint8_t  device;         /**< PCI device number. */
+    uint8_t  function;       /**< PCI function number. */
+    uint16_t vendor_id;      /**< PCI vendor identifier. */
+    uint16_t device_id;      /**< PCI device identifier. */
+    uint32_t bar[6];         /**< Raw BAR values from configuration space. */
+    uint8_t  interrupt_line; /**< Routed IRQ line reported by PCI config space. */
+} virtio_pci_descriptor_t;
+
+/**
+ * @brief Driver counters.
+ */
+typedef struct {
+    uint32_t interrupts;      /**< Queue interrupts acknowledged. */
+    uint32_t requests;        /**< Requests placed on the virtqueue. */
+    uint32_t notifications;   /**< Requests the device had to be told about. */
+    uint32_t max_outstanding; /**< Most requests one device has had in flight. */
+} virtio_blk_stats_t;
+
+/**
+ * @brief Initialize a virtio block function and register it as "vd0", "vd1", ...
+ *
+ * The modern (virtio 1.0) transport is used when its registers are
+ * reachable, the legacy I/O port transport otherwise.
+ *
+ * @param desc Descriptor populated during PCI enumeration.
+ */
+void virtio_blk_init_from_pci(const virtio_pci_descriptor_t* desc);
+
+/**
+ * @brief Counters of every virtio block device.
+ */
+const virtio_blk_stats_t* virtio_blk_get_stats(void);
@@ -0,0 +1,155 @@
+/**
+ * @file include/vma.h
+ * @brief Virtual memory areas describing the valid parts of a user address space.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <paging.h>
+
+struct address_space;
+
+#define VMA_MAX 1024 /**< Regions available across all address spaces. */
+
+#define VMA_READ  0x1 /**< Region may be read. */
+#define VMA_WRITE 0x2 /**< Region may be written. */
+#define VMA_EXEC  0x4 /**< Region may be executed (not enforced without NX). */
+
+#define VMA_STACK_GROW_LIMIT (8u * 1024u * 1024u) /**< Default maximum size of an auto-growing stack. */
+
+/**
+ * @brief What backs the pages of a region.
+ */
+typedef enum {
+    VMA_ANONYMOUS = 0, /**< Zero-filled private memory. */
+    VMA_FILE,          /**< Pages supplied by a file pager. */
+    VMA_DEVICE,        /**< Fixed physical range (MMIO, frame buffers). */
+    VMA_STACK,         /**< Anonymous memory that grows down on faults below it. */
+} vma_kind_t;
+
+typedef struct vma vma_t;
+
+/**
+ * @brief Per-kind operations on a region.
+ */
+typedef struct vma_ops {
+    const char* name;
+    /**
+     * @brief Resolve a fault inside the region.
+     *
+     * @param vma     Region containing the address (protections already checked).
+     * @param address Faulting virtual address.
+     * @param error   Page fault error code.
+     * @return true if the access can be retried.
+     */
+    bool (*fault)(vma_t* vma, uint32_t address, uint32_t error);
+    /** @brief Optional: a copy of the region was made (fork). */
+    void (*open)(vma_t* vma);
+    /** @brief Optional: the region is going away. */
+    void (*close)(vma_t* vma);
+} vma_ops_t;
+
+/**
+ * @brief A page-aligned [start, end) range of one address space.
+ *
+ * Regions of an address space are kept in an AVL tree ordered by start
+ * address; they never overlap.
+ */
+struct vma {
+    uint32_t               start;      /**< First byte of the region. */
+    uint32_t               end;        /**< One past the last byte. */
+    uint32_t               prot;       /**< VMA_READ / VMA_WRITE / VMA_EXEC. */
+    vma_kind_t             kind;       /**< Backing kind. */
+    const vma_ops_t*       ops;        /**< Fault routine for this kind. */
+    uintptr_t              physical;   /**< VMA_DEVICE: physical address mapped at start. */
+    void*                  file;       /**< VMA_FILE: pager-private file handle. */
+    uint32_t               offset;     /**< VMA_FILE: byte offset of start within the file. */
+    uint32_t               grow_limit; /**< VMA_STACK: lowest address start may grow down to. */
+    enum page_cache_mode_t cache_mode; /**< VMA_DEVICE: memory type of the mapping (uncached by default). */
+    vma_t*                 left;       /**< Regions below this one. */
+    vma_t*                 right;      /**< Regions above this one. */
+    int32_t                height;     /**< AVL subtree height. */
+    bool                   in_use;     /**< Pool slot is allocated. */
+};
+
+/**
+ * @brief Reset the region pool.
+ */
+void vma_init(void);
+
+/**
+ * @brief Add a region to an address space.
+ *
+ * @param space  Address space to extend.
+ * @param start  Page-aligned start address (user half only).
+ * @param length Length in bytes, rounded up to whole pages.
+ * @param prot   VMA_READ / VMA_WRITE / VMA_EXEC.
+ * @param kind   Backing kind; the default fault routine for it is installed.
+ * @return New region or NULL if it overlaps another region or the pool is exhausted.
+ */
+vma_t* vma_map(struct address_space* space, uint32_t start, uint32_t length, uint32_t prot, vma_kind_t kind);
+
+/**
+ * @brief Remove a region from an address space's tree.
+ *
+ * Pages already faulted in are left to the caller (or to address_space_destroy()).
+ *
+ * @param space Address space owning the region.
+ * @param vma   Region to remove.
+ */
+void vma_unmap(struct address_space* space, vma_t* vma);
+
+/**
+ * @brief Find a free, page-aligned range of the user half.
+ *
+ * @param space  Address space to search.
+ * @param base   Lowest acceptable start address.
+ * @param length Bytes required (rounded up to whole pages).
+ * @return Start of the first gap at or above base that fits, or 0 if none.
+ */
+uint32_t vma_find_free(struct address_space* space, uint32_t base, uint32_t length);
+
+/**
+ * @brief Find the region containing an address in O(log n).
+ *
+ * @return Region or NULL if the address is not mapped.
+ */
+vma_t* vma_find(struct address_space* space, uint32_t address);
+
+/**
+ * @brief Find the region for a faulting address, growing a stack down to it if needed.
+ *
+ * @return Region or NULL if the access is outside every region.
+ */
+vma_t* vma_find_for_fault(struct address_space* space, uint32_t address);
+
+/**
+ * @brief Whether a page fault error code is allowed by a region's protections.
+ */
+bool vma_access_permitted(const vma_t* vma, uint32_t error);
+
+/**
+ * @brief Whether every byte of a user range lies in regions allowing the access.
+ *
+ * Lets the kernel check a pointer handed in by user mode before touching it;
+ * a kernel-mode fault outside every region is fatal. A stack is grown down
+ * to the range, as a fault would.
+ *
+ * @param write Check for write access rather than read access.
+ * @return false if any part of the range is unmapped, protected, or in the kernel half.
+ */
+bool vma_range_permitted(struct address_space* space, uint32_t start, uint32_t length, bool write);
+
+/**
+ * @brief Copy every region of one address space into another (used by fork).
+ *
+ * @return false if the pool ran out; the destination then holds a partial copy.
+ */
+bool vma_clone(struct address_space* destination, const struct address_space* source);
+
+/**
+ * @brief Release every region of an address space.
+ */
+void vma_destroy_all(struct address_space* space);
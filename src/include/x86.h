@@ -58,6 +58,33 @@ uint16_t KERNEL_CDECL x86_inw(uint16_t port);
  */
 uint32_t KERNEL_CDECL x86_inl(uint16_t port);
 
+/**
+ * @brief Read a block of 16-bit values from an I/O port (rep insw).
+ *
+ * @param port   Source I/O port number.
+ * @param buffer Destination for count words.
+ * @param count  Number of 16-bit reads.
+ */
+void KERNEL_CDECL x86_insw(uint16_t port, void* buffer, uint32_t count);
+
+/**
+ * @brief Read a block of 32-bit values from an I/O port (rep insd).
+ *
+ * @param port   Source I/O port number.
+ * @param buffer Destination for count dwords.
+ * @param count  Number of 32-bit reads.
+ */
+void KERNEL_CDECL x86_insl(uint16_t port, void* buffer, uint32_t count);
+
+/**
+ * @brief Write a block of 16-bit values to an I/O port (rep outsw).
+ *
+ * @param port   Target I/O port number.
+ * @param buffer Source of count words.
+ * @param count  Number of 16-bit writes.
+ */
+void KERNEL_CDECL x86_outsw(uint16_t port, const void* buffer, uint32_t count);
+
 /**
  * @brief Halt the CPU after disabling interrupts.
  */
@@ -68,13 +95,72 @@ void KERNEL_CDECL x86_panic(void);
  *
  * @param page Virtual page address to invalidate.
  */
-void KERNEL_CDECL x86_invalidate_page(uint8_t page);
+void KERNEL_CDECL x86_invalidate_page(void* page);
 
 /**
  * @brief Reload the current page directory (flushes the entire TLB).
  */
 void KERNEL_CDECL x86_reload_page_directory(void);
 
+/**
+ * @brief Load a new page directory into CR3 (flushes non-global TLB entries).
+ *
+ * @param physical_address Physical address of the page directory.
+ */
+void KERNEL_CDECL x86_load_page_directory(uint32_t physical_address);
+
+/**
+ * @brief Read the physical address of the active page directory from CR3.
+ *
+ * @return Current value of CR3.
+ */
+uint32_t KERNEL_CDECL x86_read_cr3(void);
+
+/**
+ * @brief Execute CPUID.
+ *
+ * @param leaf      Value loaded into EAX (ECX is zeroed).
+ * @param registers Receives EAX, EBX, ECX and EDX in that order.
+ */
+void KERNEL_CDECL x86_cpuid(uint32_t leaf, uint32_t* registers);
+
+/**
+ * @brief Execute CPUID for a leaf that takes a sub-leaf index in ECX.
+ *
+ * @param leaf      Value loaded into EAX.
+ * @param subleaf   Value loaded into ECX.
+ * @param registers Receives EAX, EBX, ECX and EDX in that order.
+ */
+void KERNEL_CDECL x86_cpuid_count(uint32_t leaf, uint32_t subleaf, uint32_t* registers);
+
+/**
+ * @brief Read a model-specific register.
+ *
+ * @param msr Register number.
+ * @return Register contents.
+ */
+uint64_t KERNEL_CDECL x86_read_msr(uint32_t msr);
+
+/**
+ * @brief Write a model-specific register.
+ *
+ * @param msr   Register number.
+ * @param value New contents.
+ */
+void KERNEL_CDECL x86_write_msr(uint32_t msr, uint64_t value);
+
+/**
+ * @brief Write back and invalidate every cache line (WBINVD).
+ */
+void KERNEL_CDECL x86_flush_caches(void);
+
+/**
+ * @brief Read the CPU time-stamp counter.
+ *
+ * @return Current value of the TSC.
+ */
+uint64_t KERNEL_CDECL x86_read_tsc(void);
+
 /**
  * @brief Enable CPU interrupts and return previous flags state.
  *
@@ -89,6 +175,20 @@ uint8_t KERNEL_CDECL x86_enable_interrupts(void);
  */
 uint8_t KERNEL_CDECL x86_disable_interrupts(void);
 
+/**
+ * @brief Whether maskable interrupts are currently enabled (EFLAGS.IF).
+ */
+bool KERNEL_CDECL x86_interrupts_enabled(void);
+
+/**
+ * @brief Enable interrupts and halt until the next one arrives.
+ *
+ * Call with interrupts disabled after checking the wakeup condition; an IRQ
+ * that is already pending is taken straight after the halt, not lost.
+ * Returns with interrupts enabled.
+ */
+void KERNEL_CDECL x86_wait_for_interrupt(void);
+
 /**
  * @brief Retrieve the faulting address from CR2 (used in page faults).
  *
@@ -23,6 +23,13 @@
 #include <syscall.h>
 #include <tss.h>
 #include <usermode.h>
+#include <address_space.h>
+#include <process.h>
+#include <bench.h>
+#include <pat.h>
+#include <page_cache.h>
+#include <buffer_cache.h>
+#include <ramdisk.h>
 
 extern uint8_t stack_top[];
 extern void user_program_start(void);
@@ -30,6 +37,7 @@ extern void user_program_start(void);
 void timer(Registers* regs)
 {
     //kprintf(".");
+    process_schedule(regs);
 }
 
 void kmain(uint32_t eax, uint32_t ebx)
@@ -61,8 +69,17 @@ void kmain(uint32_t eax, uint32_t ebx)
     pmm_init_allocator(multiboot_get_info()->mem_upper + 1024);
     page_directory_t pd = vmm_initialize_kernel_page_directory();
     x86_reload_page_directory();
+    vma_init();
+    address_space_init();
+    vmm_initialize_direct_map((multiboot_get_info()->mem_upper + 1024) * 1024);
+    pmm_init_reference_counts();
+    pat_init();
+    pmm_init_page_colors();
+    process_init();
     console_init(multiboot_get_info());
     vfs_init();
+    page_cache_init();
+    buffer_cache_init();
     syscall_init();
     tss_init((uint32_t)stack_top);
 
@@ -86,8 +103,13 @@ void kmain(uint32_t eax, uint32_t ebx)
     kprintf("Framebuffer height: %d\n", multiboot_get_info()->framebuffer_height);
     kprintf("framebuffer type: %d\n", multiboot_get_info()->framebuffer_type);
 
+    ramdisk_init_from_multiboot(multiboot_get_info());
     pci_enumerate();
     vfs_print_mounts();
+#ifdef KERNEL_BENCHMARKS
+    bench_run_all();
+#endif
+    memory_free_init();
     usermode_enter(user_program_start);
 
 
@@ -9,11 +9,17 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <ide.h>
+#include <ahci.h>
+#include <virtio_blk.h>
+#include <nvme.h>
 
 #define PCI_CONFIG_ADDRESS 0xCF8   /**< PCI configuration address register */
 #define PCI_CONFIG_DATA    0xCFC   /**< PCI configuration data register */
 #define PCI_CLASS_MASS_STORAGE 0x01
 #define PCI_SUBCLASS_IDE       0x01
+#define PCI_SUBCLASS_SATA      0x06
+#define PCI_PROG_IF_AHCI       0x01
+#define PCI_SUBCLASS_NVM       0x08
 
 /**
  * @brief Build the configuration address used with PCI configuration mechanism #1.
@@ -36,23 +42,34 @@ static inline uint32_t pci_make_address(uint8_t bus,
          | (offset & 0xFC);
 }
 
+uint32_t pci_read_config_dword(uint8_t bus,
+                               uint8_t device,
+                               uint8_t function,
+                               uint8_t offset)
+{
+    uint32_t address = pci_make_address(bus, device, function, offset);
+    x86_outl(PCI_CONFIG_ADDRESS, address);
+    return x86_inl(PCI_CONFIG_DATA);
+}
+
 /**
- * @brief Read a 32-bit value from PCI configuration space.
+ * @brief Write a 32-bit value to PCI configuration space.
  *
  * @param bus      Target PCI bus number.
  * @param device   Target device number on the bus.
  * @param function Target function number within the device.
  * @param offset   DWORD-aligned register offset.
- * @return 32-bit value read from configuration space.
+ * @param value    Value to store.
  */
-static uint32_t pci_read_config_dword(uint8_t bus,
-                                      uint8_t device,
-                                      uint8_t function,
-                                      uint8_t offset)
+static void pci_write_config_dword(uint8_t bus,
+                                   uint8_t device,
+                                   uint8_t function,
+                                   uint8_t offset,
+                                   uint32_t value)
 {
     uint32_t address = pci_make_address(bus, device, function, offset);
     x86_outl(PCI_CONFIG_ADDRESS, address);
-    return x86_inl(PCI_CONFIG_DATA);
+    x86_outl(PCI_CONFIG_DATA, value);
 }
 
 /**
@@ -71,22 +88,33 @@ static uint16_t pci_read_config_word(uint8_t bus, uint8_t device,
     return (uint16_t)(value >> ((offset & 0x2) * 8));
 }
 
-/**
- * @brief Read an 8-bit value from PCI configuration space.
- *
- * @param bus      Target PCI bus number.
- * @param device   Target device number on the bus.
- * @param function Target function number within the device.
- * @param offset   Register offset.
- * @return 8-bit value read from configuration space.
- */
-static uint8_t pci_read_config_byte(uint8_t bus, uint8_t device,
-                                    uint8_t function, uint8_t offset)
+uint8_t pci_read_config_byte(uint8_t bus, uint8_t device,
+                             uint8_t function, uint8_t offset)
 {
     uint32_t value = pci_read_config_dword(bus, device, function, offset & ~0x3);
     return (uint8_t)(value >> ((offset & 0x3) * 8));
 }
 
+void KERNEL_INIT pci_enable_bus_master(uint8_t bus, uint8_t device, uint8_t function)
+{
+    // Command is the low half of dword 0x04; the status half is write-one-to-clear,
+    // so write zeroes there to leave it untouched.
+    uint32_t value = pci_read_config_dword(bus, device, function, 0x04) & 0xFFFFu;
+    if ((value & PCI_COMMAND_BUS_MASTER) == 0)
+    {
+        pci_write_config_dword(bus, device, function, 0x04, value | PCI_COMMAND_BUS_MASTER);
+    }
+}
+
+void KERNEL_INIT pci_enable_memory_space(uint8_t bus, uint8_t device, uint8_t function)
+{
+    uint32_t value = pci_read_config_dword(bus, device, function, 0x04) & 0xFFFFu;
+    if ((value & PCI_COMMAND_MEMORY) == 0)
+    {
+        pci_write_config_dword(bus, device, function, 0x04, value | PCI_COMMAND_MEMORY);
+    }
+}
+
 /**
  * @brief Emit a human-readable description of a PCI function, if present.
  *
@@ -94,7 +122,7 @@ static uint8_t pci_read_config_byte(uint8_t bus, uint8_t device,
  * @param device   Target device number on the bus.
  * @param function Target function number within the device.
  */
-static void pci_log_function(uint8_t bus, uint8_t device, uint8_t function)
+static void KERNEL_INIT pci_log_function(uint8_t bus, uint8_t device, uint8_t function)
 {
     pci_device_t dev = {
         .bus        = bus,
@@ -123,7 +151,26 @@ static void pci_log_function(uint8_t bus, uint8_t device, uint8_t function)
                 dev.vendor_id, dev.device_id,
                 class_str, subclass_str, dev.prog_if);
 
-        if (dev.class_code == PCI_CLASS_MASS_STORAGE && dev.subclass == PCI_SUBCLASS_IDE)
+        if (dev.vendor_id == VIRTIO_PCI_VENDOR_ID
+            && (dev.device_id == VIRTIO_PCI_DEVICE_BLK_LEGACY || dev.device_id == VIRTIO_PCI_DEVICE_BLK_MODERN))
+        {
+            virtio_pci_descriptor_t virtio_desc = {
+                .bus            = dev.bus,
+                .device         = dev.device,
+                .function       = dev.function,
+                .vendor_id      = dev.vendor_id,
+                .device_id      = dev.device_id,
+                .interrupt_line = pci_read_config_byte(bus, device, function, 0x3C),
+            };
+
+            for (uint8_t bar = 0; bar < 6; ++bar)
+            {
+                virtio_desc.bar[bar] = pci_read_config_dword(bus, device, function, (uint8_t)(0x10 + (bar * 4)));
+            }
+
+            virtio_blk_init_from_pci(&virtio_desc);
+        }
+        else if (dev.class_code == PCI_CLASS_MASS_STORAGE && dev.subclass == PCI_SUBCLASS_IDE)
         {
             ide_pci_descriptor_t ide_desc = {
                 .bus           = dev.bus,
@@ -142,6 +189,36 @@ static void pci_log_function(uint8_t bus, uint8_t device, uint8_t function)
 
             ide_controller_init_from_pci(&ide_desc);
         }
+        else if (dev.class_code == PCI_CLASS_MASS_STORAGE && dev.subclass == PCI_SUBCLASS_SATA
+                 && dev.prog_if == PCI_PROG_IF_AHCI)
+        {
+            ahci_pci_descriptor_t ahci_desc = {
+                .bus            = dev.bus,
+                .device         = dev.device,
+                .function       = dev.function,
+                .vendor_id      = dev.vendor_id,
+                .device_id      = dev.device_id,
+                .abar           = pci_read_config_dword(bus, device, function, 0x24),
+                .interrupt_line = pci_read_config_byte(bus, device, function, 0x3C),
+            };
+
+            ahci_controller_init_from_pci(&ahci_desc);
+        }
+        else if (dev.class_code == PCI_CLASS_MASS_STORAGE && dev.subclass == PCI_SUBCLASS_NVM)
+        {
+            nvme_pci_descriptor_t nvme_desc = {
+                .bus            = dev.bus,
+                .device         = dev.device,
+                .function       = dev.function,
+                .vendor_id      = dev.vendor_id,
+                .device_id      = dev.device_id,
+                .bar0           = pci_read_config_dword(bus, device, function, 0x10),
+                .bar1           = pci_read_config_dword(bus, device, function, 0x14),
+                .interrupt_line = pci_read_config_byte(bus, device, function, 0x3C),
+            };
+
+            nvme_controller_init_from_pci(&nvme_desc);
+        }
     }
 }
 
@@ -151,7 +228,7 @@ static void pci_log_function(uint8_t bus, uint8_t device, uint8_t function)
  * @param bus    Target PCI bus number.
  * @param device Device number on the bus to probe.
  */
-static void pci_scan_device(uint8_t bus, uint8_t device)
+static void KERNEL_INIT pci_scan_device(uint8_t bus, uint8_t device)
 {
     uint8_t header = pci_read_config_byte(bus, device, 0, 0x0E);
     bool multi_function = (header & 0x80) != 0;
@@ -167,7 +244,7 @@ static void pci_scan_device(uint8_t bus, uint8_t device)
 /**
  * @brief Enumerate the full PCI bus hierarchy and log discovered devices.
  */
-void pci_enumerate(void)
+void KERNEL_INIT pci_enumerate(void)
 {
     for (uint16_t bus = 0; bus < 256; bus++)
         for (uint8_t device = 0; device < 32; device++)
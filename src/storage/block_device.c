@@ -4,7 +4,9 @@
  */
 
 #include <block_device.h>
+#include <memory.h>
 #include <stdio.h>
+#include <x86.h>
 
 #define BLOCK_DEVICE_MAX_COUNT 16
 
@@ -48,3 +50,616 @@ size_t block_device_count(void)
 {
     return g_block_device_count;
 }
+
+bool block_device_flush(block_device_t* device)
+{
+    if (device == NULL)
+    {
+        return false;
+    }
+
+    if (device->flush == NULL)
+    {
+        return true;
+    }
+
+    return device->flush(device);
+}
+
+void block_request_init(block_request_t* request,
+                        block_device_t* device,
+                        block_request_op_t op,
+                        uint64_t lba,
+                        uint32_t sector_count,
+                        void* buffer)
+{
+    request->single.buffer = buffer;
+    request->single.sector_count = sector_count;
+    block_request_init_segments(request, device, op, lba, &request->single, buffer != NULL ? 1 : 0);
+}
+
+void block_request_init_segments(block_request_t* request,
+                                 block_device_t* device,
+                                 block_request_op_t op,
+                                 uint64_t lba,
+                                 block_segment_t* segments,
+                                 uint32_t segment_count)
+{
+    request->device = device;
+    request->op = op;
+    request->lba = lba;
+    request->segments = segments;
+    request->segment_count = segment_count;
+    request->sector_count = 0;
+    for (uint32_t i = 0; i < segment_count; ++i)
+    {
+        request->sector_count += segments[i].sector_count;
+    }
+    request->done = NULL;
+    request->context = NULL;
+    request->status = BLOCK_REQUEST_PENDING;
+    request->next = NULL;
+}
+
+/**
+ * @brief Run a request through the device's synchronous callbacks.
+ */
+static bool block_request_execute(block_device_t* device, block_request_t* request)
+{
+    if (request->op == BLOCK_REQUEST_FLUSH)
+    {
+        return device->flush == NULL || device->flush(device);
+    }
+
+    uint64_t lba = request->lba;
+    for (uint32_t i = 0; i < request->segment_count; ++i)
+    {
+        block_segment_t* segment = &request->segments[i];
+        bool ok = (request->op == BLOCK_REQUEST_READ)
+            ? device->read(device, lba, segment->sector_count, segment->buffer)
+            : device->write(device, lba, segment->sector_count, segment->buffer);
+        if (!ok)
+        {
+            return false;
+        }
+        lba += segment->sector_count;
+    }
+    return true;
+}
+
+/**
+ * @brief Whether younger must not be started before older.
+ */
+static bool block_request_conflicts(const block_request_t* older, const block_request_t* younger)
+{
+    if (older->op == BLOCK_REQUEST_FLUSH || younger->op == BLOCK_REQUEST_FLUSH)
+    {
+        return true;
+    }
+
+    if (older->op == BLOCK_REQUEST_READ && younger->op == BLOCK_REQUEST_READ)
+    {
+        return false;
+    }
+
+    return older->lba < younger->lba + younger->sector_count
+        && younger->lba < older->lba + older->sector_count;
+}
+
+/**
+ * @brief Oldest queued request that a queued request has to wait for, or NULL.
+ */
+static block_request_t* block_queue_oldest_conflict(const block_device_t* device, const block_request_t* request)
+{
+    for (block_request_t* older = device->queue_head; older != request; older = older->next)
+    {
+        if (block_request_conflicts(older, request))
+        {
+            return older;
+        }
+    }
+    return NULL;
+}
+
+static void block_queue_remove(block_device_t* device, block_request_t* request)
+{
+    block_request_t* previous = NULL;
+    for (block_request_t* current = device->queue_head; current != request; current = current->next)
+    {
+        previous = current;
+    }
+
+    if (previous == NULL)
+    {
+        device->queue_head = request->next;
+    }
+    else
+    {
+        previous->next = request->next;
+    }
+    if (device->queue_tail == request)
+    {
+        device->queue_tail = previous;
+    }
+    request->next = NULL;
+    device->stats.queued--;
+}
+
+static block_command_t* block_command_slot(block_device_t* device, uint32_t tag)
+{
+    return device->commands != NULL ? &device->commands[tag] : &device->command;
+}
+
+static uint32_t block_device_slot_count(const block_device_t* device)
+{
+    return device->commands != NULL ? device->command_slots : 1;
+}
+
+static uint32_t block_device_depth(const block_device_t* device)
+{
+    uint32_t slots = block_device_slot_count(device);
+    return (device->queue_depth == 0 || device->queue_depth > slots) ? slots : device->queue_depth;
+}
+
+/**
+ * @brief Whether a queued request has to wait for a command the driver holds.
+ */
+static bool block_request_conflicts_in_flight(block_device_t* device, const block_request_t* request)
+{
+    uint32_t slots = block_device_slot_count(device);
+    for (uint32_t tag = 0; tag < slots; ++tag)
+    {
+        for (const block_request_t* active = block_command_slot(device, tag)->requests;
+             active != NULL;
+             active = active->next)
+        {
+            if (block_request_conflicts(active, request))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Pick the request the next command starts with.
+ *
+ * @return NULL if it would overtake a command still in flight.
+ */
+static block_request_t* block_queue_select(block_device_t* device)
+{
+    block_request_t* oldest = device->queue_head;
+    block_request_t* selected = NULL;
+    bool expired = (int32_t)(device->sequence - oldest->deadline) >= 0;
+    if (expired)
+    {
+        selected = oldest;
+    }
+    else
+    {
+        // One-way elevator: the lowest LBA at or past the head, else wrap around
+        // to the lowest overall, so a busy region cannot hold the head forever.
+        block_request_t* lowest = NULL;
+        for (block_request_t* request = oldest; request != NULL; request = request->next)
+        {
+            if (request->lba >= device->head_position && (selected == NULL || request->lba < selected->lba))
+            {
+                selected = request;
+            }
+            if (lowest == NULL || request->lba < lowest->lba)
+            {
+                lowest = request;
+            }
+        }
+        if (selected == NULL)
+        {
+            selected = lowest;
+        }
+
+        for (block_request_t* conflict = block_queue_oldest_conflict(device, selected);
+             conflict != NULL;
+             conflict = block_queue_oldest_conflict(device, selected))
+        {
+            selected = conflict;
+        }
+    }
+
+    if (block_request_conflicts_in_flight(device, selected))
+    {
+        return NULL;
+    }
+    if (expired)
+    {
+        device->stats.expired++;
+    }
+    return selected;
+}
+
+/**
+ * @brief Whether a queued request can join the command being built.
+ */
+static bool block_command_can_merge(block_device_t* device, const block_request_t* command, const block_request_t* request)
+{
+    return request->op == command->op
+        && command->sector_count + request->sector_count <= BLOCK_MERGE_SECTORS
+        && command->segment_count + request->segment_count <= BLOCK_MERGE_SEGMENTS
+        && block_queue_oldest_conflict(device, request) == NULL
+        && !block_request_conflicts_in_flight(device, request);
+}
+
+/**
+ * @brief Build the next command from the queue in a free slot: the selected
+ *        request plus every queued request that extends it at either end.
+ *
+ * @return The slot, or NULL if the next request must wait for commands in flight.
+ */
+static block_command_t* block_command_prepare(block_device_t* device)
+{
+    block_request_t* first = block_queue_select(device);
+    if (first == NULL)
+    {
+        return NULL;
+    }
+
+    block_command_t* slot = NULL;
+    uint32_t slots = block_device_slot_count(device);
+    for (uint32_t tag = 0; tag < slots && slot == NULL; ++tag)
+    {
+        if (block_command_slot(device, tag)->requests == NULL)
+        {
+            slot = block_command_slot(device, tag);
+            slot->request.tag = tag;
+        }
+    }
+    if (slot == NULL)
+    {
+        return NULL;
+    }
+
+    block_queue_remove(device, first);
+
+    block_request_t* command = &slot->request;
+    command->device = device;
+    command->op = first->op;
+    command->lba = first->lba;
+    command->sector_count = first->sector_count;
+    command->done = NULL;
+    command->context = NULL;
+    command->status = BLOCK_REQUEST_PENDING;
+    command->next = NULL;
+
+    block_request_t* requests = first;
+
+    if (first->segment_count > BLOCK_MERGE_SEGMENTS)
+    {
+        // Too long a scatter list to copy; the request goes out on its own.
+        command->segments = first->segments;
+        command->segment_count = first->segment_count;
+    }
+    else
+    {
+        command->segments = slot->segments;
+        command->segment_count = first->segment_count;
+        memcpy(command->segments, first->segments, first->segment_count * sizeof(block_segment_t));
+
+        bool merged = first->op != BLOCK_REQUEST_FLUSH;
+        while (merged)
+        {
+            merged = false;
+            for (block_request_t* request = device->queue_head; request != NULL; request = request->next)
+            {
+                if (!block_command_can_merge(device, command, request))
+                {
+                    continue;
+                }
+
+                uint32_t count = request->segment_count;
+                if (request->lba == command->lba + command->sector_count)
+                {
+                    memcpy(&command->segments[command->segment_count], request->segments,
+                           count * sizeof(block_segment_t));
+                }
+                else if (request->lba + request->sector_count == command->lba)
+                {
+                    for (uint32_t i = command->segment_count; i > 0; --i)
+                    {
+                        command->segments[i - 1 + count] = command->segments[i - 1];
+                    }
+                    memcpy(command->segments, request->segments, count * sizeof(block_segment_t));
+                    command->lba = request->lba;
+                }
+                else
+                {
+                    continue;
+                }
+
+                command->segment_count += count;
+                command->sector_count += request->sector_count;
+                block_queue_remove(device, request);
+                request->next = requests;
+                requests = request;
+                device->stats.merges++;
+                merged = true;
+                break;
+            }
+        }
+    }
+
+    uint64_t now = x86_read_tsc();
+    for (block_request_t* request = requests; request != NULL; request = request->next)
+    {
+        uint64_t waited = now - request->submit_cycles;
+        device->stats.wait_cycles += waited;
+        if (waited > device->stats.max_wait_cycles)
+        {
+            device->stats.max_wait_cycles = waited;
+        }
+        device->stats.requests++;
+    }
+    device->stats.commands++;
+
+    slot->requests = requests;
+    device->head_position = command->lba + command->sector_count;
+    device->sequence++;
+    return slot;
+}
+
+/**
+ * @brief Hand prepared commands to the driver until it is busy, every slot
+ *        allowed by the queue depth is in flight, or the queue is empty.
+ *
+ * @param force Dispatch even if the device is plugged.
+ */
+static void block_device_dispatch(block_device_t* device, bool force)
+{
+    bool interrupts = x86_interrupts_enabled();
+    x86_disable_interrupts();
+
+    // Completions raised while a command is being started land here instead
+    // of recursing, so a synchronous driver drains a long queue in a loop.
+    if (device->dispatching)
+    {
+        device->redispatch = true;
+        if (interrupts)
+        {
+            x86_enable_interrupts();
+        }
+        return;
+    }
+    device->dispatching = true;
+
+    for (;;)
+    {
+        block_command_t* slot = device->prepared;
+        if (slot == NULL)
+        {
+            if (device->stats.in_flight >= block_device_depth(device)
+                || device->queue_head == NULL || (device->plugged != 0 && !force))
+            {
+                break;
+            }
+            slot = block_command_prepare(device);
+            if (slot == NULL)
+            {
+                break;
+            }
+        }
+
+        device->prepared = NULL;
+        if (++device->stats.in_flight > device->stats.max_in_flight)
+        {
+            device->stats.max_in_flight = device->stats.in_flight;
+        }
+        device->redispatch = false;
+
+        // Drivers may wait on the hardware, so start with interrupts as the caller had them.
+        if (interrupts)
+        {
+            x86_enable_interrupts();
+        }
+
+        bool started = true;
+        if (device->start != NULL)
+        {
+            started = device->start(device, &slot->request);
+        }
+        else
+        {
+            block_request_complete(&slot->request, block_request_execute(device, &slot->request));
+        }
+
+        x86_disable_interrupts();
+        if (!started)
+        {
+            device->stats.in_flight--;
+            device->prepared = slot;
+            // A kick that arrived meanwhile may mean the hardware is free after all.
+            if (!device->redispatch)
+            {
+                break;
+            }
+        }
+    }
+
+    device->dispatching = false;
+    if (interrupts)
+    {
+        x86_enable_interrupts();
+    }
+}
+
+void block_device_kick(block_device_t* device)
+{
+    block_device_dispatch(device, false);
+}
+
+uint32_t block_device_set_queue_depth(block_device_t* device, uint32_t depth)
+{
+    uint32_t slots = block_device_slot_count(device);
+    device->queue_depth = depth == 0 ? 1 : (depth > slots ? slots : depth);
+    return device->queue_depth;
+}
+
+void block_device_plug(block_device_t* device)
+{
+    device->plugged++;
+}
+
+void block_device_unplug(block_device_t* device)
+{
+    if (device->plugged > 0 && --device->plugged == 0)
+    {
+        block_device_kick(device);
+    }
+}
+
+bool block_request_submit(block_request_t* request)
+{
+    block_device_t* device = request ? request->device : NULL;
+    if (device == NULL)
+    {
+        return false;
+    }
+
+    bool valid = true;
+    if (request->op == BLOCK_REQUEST_FLUSH)
+    {
+        valid = request->sector_count == 0;
+    }
+    else
+    {
+        valid = request->sector_count != 0
+            && request->lba + request->sector_count <= device->sector_count
+            && (request->op == BLOCK_REQUEST_READ || device->write != NULL);
+    }
+
+    if (!valid)
+    {
+        request->status = BLOCK_REQUEST_FAILED;
+        return false;
+    }
+
+    request->status = BLOCK_REQUEST_PENDING;
+    request->next = NULL;
+    request->submit_cycles = x86_read_tsc();
+
+    bool interrupts = x86_interrupts_enabled();
+    x86_disable_interrupts();
+    request->deadline = device->sequence
+        + (request->op == BLOCK_REQUEST_READ ? BLOCK_READ_EXPIRE : BLOCK_WRITE_EXPIRE);
+    if (device->queue_tail != NULL)
+    {
+        device->queue_tail->next = request;
+    }
+    else
+    {
+        device->queue_head = request;
+    }
+    device->queue_tail = request;
+    if (++device->stats.queued > device->stats.max_queued)
+    {
+        device->stats.max_queued = device->stats.queued;
+    }
+    if (interrupts)
+    {
+        x86_enable_interrupts();
+    }
+
+    block_device_kick(device);
+    return true;
+}
+
+void block_request_complete(block_request_t* request, bool success)
+{
+    block_device_t* device = request->device;
+    block_command_t* slot = block_command_slot(device, request->tag);
+
+    bool interrupts = x86_interrupts_enabled();
+    x86_disable_interrupts();
+    block_request_t* requests = slot->requests;
+    slot->requests = NULL;
+    device->stats.in_flight--;
+    request->status = success ? BLOCK_REQUEST_DONE : BLOCK_REQUEST_FAILED;
+    if (interrupts)
+    {
+        x86_enable_interrupts();
+    }
+
+    block_device_kick(device);
+
+    while (requests != NULL)
+    {
+        // A finished request may be reused by its owner at once, so read the link first.
+        block_request_t* next = requests->next;
+        requests->next = NULL;
+        requests->status = success ? BLOCK_REQUEST_DONE : BLOCK_REQUEST_FAILED;
+        if (requests->done != NULL)
+        {
+            requests->done(requests);
+        }
+        requests = next;
+    }
+}
+
+bool block_request_wait(block_request_t* request)
+{
+    block_device_t* device = request->device;
+    bool interrupts = x86_interrupts_enabled();
+
+    for (;;)
+    {
+        // Nothing else starts a plugged queue, and the waiter may hold the plug.
+        if (device->plugged != 0)
+        {
+            block_device_dispatch(device, true);
+        }
+
+        x86_disable_interrupts();
+        if (request->status != BLOCK_REQUEST_PENDING)
+        {
+            break;
+        }
+
+        if (device->poll != NULL)
+        {
+            device->poll(device);
+            if (request->status != BLOCK_REQUEST_PENDING)
+            {
+                break;
+            }
+        }
+
+        // Kernel-mode IRQs never reschedule, so idling here with interrupts
+        // on is safe even inside a syscall or fault handler.
+        x86_wait_for_interrupt();
+    }
+
+    if (interrupts)
+    {
+        x86_enable_interrupts();
+    }
+    return request->status == BLOCK_REQUEST_DONE;
+}
+
+bool block_device_queued_read(block_device_t* device, uint64_t lba, uint32_t sector_count, void* buffer)
+{
+    block_request_t request;
+    block_request_init(&request, device, BLOCK_REQUEST_READ, lba, sector_count, buffer);
+    return block_request_submit(&request) && block_request_wait(&request);
+}
+
+bool block_device_queued_write(block_device_t* device, uint64_t lba, uint32_t sector_count, const void* buffer)
+{
+    block_request_t request;
+    // Writes only read from the buffer; segments are shared with reads.
+    block_request_init(&request, device, BLOCK_REQUEST_WRITE, lba, sector_count, (void*)buffer);
+    return block_request_submit(&request) && block_request_wait(&request);
+}
+
+bool block_device_queued_flush(block_device_t* device)
+{
+    block_request_t request;
+    block_request_init(&request, device, BLOCK_REQUEST_FLUSH, 0, 0, NULL);
+    return block_request_submit(&request) && block_request_wait(&request);
+}
@@ -0,0 +1,680 @@
+/**
+ * @file storage/buffer_cache.c
+ * @brief Block buffer cache: hashed by (device, block), LRU reuse, write-back.
+ */
+
+#include <buffer_cache.h>
+#include <meminit.h>
+#include <memory.h>
+#include <stdio.h>
+#include <stddef.h>
+
+#define BUFFER_CACHE_BUCKETS       128
+#define BUFFER_CACHE_STATS_DEVICES 16 /**< Devices with their own counters. */
+
+typedef struct {
+    const block_device_t* device;
+    buffer_cache_stats_t  stats;
+} buffer_cache_device_stats_t;
+
+/**
+ * @brief One sequential reader of a device.
+ */
+typedef struct {
+    const block_device_t* device;
+    uint64_t              next;      /**< Block after the last one read. */
+    uint64_t              ahead;     /**< Readahead has been issued up to here. */
+    uint32_t              window;    /**< Blocks to keep read ahead of next (0 until the second read). */
+    uint32_t              last_used; /**< Stream clock at the last access. */
+} buffer_cache_stream_t;
+
+static buffer_head_t g_buffers[BUFFER_CACHE_MAX_BUFFERS];
+static buffer_head_t* g_buffer_buckets[BUFFER_CACHE_BUCKETS];
+/** @brief Unreferenced buffers, most recently released first. */
+static buffer_head_t* g_buffer_lru_head;
+static buffer_head_t* g_buffer_lru_tail;
+static buffer_cache_device_stats_t g_buffer_cache_stats[BUFFER_CACHE_STATS_DEVICES];
+/** @brief Buffers being written back by buffer_cache_sync(). */
+static buffer_head_t* g_buffer_sync_list[BUFFER_CACHE_MAX_BUFFERS];
+static buffer_cache_stream_t g_buffer_streams[BUFFER_CACHE_STREAMS];
+static uint32_t g_buffer_stream_clock;
+/** @brief Buffers with reading set; completed reads count until they are settled. */
+static uint32_t g_buffer_reads_in_flight;
+
+void KERNEL_INIT buffer_cache_init(void)
+{
+    memset(g_buffers, 0, sizeof(g_buffers));
+    memset(g_buffer_buckets, 0, sizeof(g_buffer_buckets));
+    memset(g_buffer_cache_stats, 0, sizeof(g_buffer_cache_stats));
+    memset(g_buffer_streams, 0, sizeof(g_buffer_streams));
+    g_buffer_stream_clock = 0;
+    g_buffer_reads_in_flight = 0;
+    g_buffer_lru_head = NULL;
+    g_buffer_lru_tail = NULL;
+}
+
+static uint32_t buffer_cache_hash(const block_device_t* device, uint64_t block)
+{
+    uint32_t hash = (uint32_t)(uintptr_t)device ^ ((uint32_t)block * 2654435761u) ^ (uint32_t)(block >> 32);
+    return (hash ^ (hash >> 16)) % BUFFER_CACHE_BUCKETS;
+}
+
+static bool buffer_cache_supported(const block_device_t* device)
+{
+    return device != NULL && device->read != NULL && device->sector_size != 0
+        && device->sector_size <= BUFFER_CACHE_BLOCK_SIZE
+        && BUFFER_CACHE_BLOCK_SIZE % device->sector_size == 0;
+}
+
+static buffer_cache_stats_t* buffer_cache_stats_for(const block_device_t* device)
+{
+    for (uint32_t i = 0; i < BUFFER_CACHE_STATS_DEVICES; ++i)
+    {
+        if (g_buffer_cache_stats[i].device == device)
+        {
+            return &g_buffer_cache_stats[i].stats;
+        }
+        if (g_buffer_cache_stats[i].device == NULL)
+        {
+            g_buffer_cache_stats[i].device = device;
+            return &g_buffer_cache_stats[i].stats;
+        }
+    }
+
+    // Counters are best effort; devices past the table share a sink.
+    static buffer_cache_stats_t overflow;
+    return &overflow;
+}
+
+static void buffer_cache_lru_remove(buffer_head_t* buffer)
+{
+    if (buffer->lru_prev != NULL)
+    {
+        buffer->lru_prev->lru_next = buffer->lru_next;
+    }
+    else
+    {
+        g_buffer_lru_head = buffer->lru_next;
+    }
+
+    if (buffer->lru_next != NULL)
+    {
+        buffer->lru_next->lru_prev = buffer->lru_prev;
+    }
+    else
+    {
+        g_buffer_lru_tail = buffer->lru_prev;
+    }
+
+    buffer->lru_prev = NULL;
+    buffer->lru_next = NULL;
+}
+
+static void buffer_cache_lru_push(buffer_head_t* buffer)
+{
+    buffer->lru_prev = NULL;
+    buffer->lru_next = g_buffer_lru_head;
+    if (g_buffer_lru_head != NULL)
+    {
+        g_buffer_lru_head->lru_prev = buffer;
+    }
+    else
+    {
+        g_buffer_lru_tail = buffer;
+    }
+    g_buffer_lru_head = buffer;
+}
+
+static void buffer_cache_unhash(buffer_head_t* buffer)
+{
+    buffer_head_t** link = &g_buffer_buckets[buffer_cache_hash(buffer->device, buffer->block)];
+    while (*link != NULL)
+    {
+        if (*link == buffer)
+        {
+            *link = buffer->hash_next;
+            return;
+        }
+        link = &(*link)->hash_next;
+    }
+}
+
+static buffer_head_t* buffer_cache_lookup(const block_device_t* device, uint64_t block)
+{
+    for (buffer_head_t* buffer = g_buffer_buckets[buffer_cache_hash(device, block)];
+         buffer != NULL;
+         buffer = buffer->hash_next)
+    {
+        if (buffer->device == device && buffer->block == block)
+        {
+            return buffer;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Sectors of the device held by a block (fewer for the last, partial block).
+ */
+static uint32_t buffer_cache_block_sectors(const buffer_head_t* buffer, uint64_t* lba)
+{
+    uint32_t per_block = BUFFER_CACHE_BLOCK_SIZE / buffer->device->sector_size;
+    *lba = buffer->block * per_block;
+    uint64_t left = buffer->device->sector_count - *lba;
+    return left < per_block ? (uint32_t)left : per_block;
+}
+
+/**
+ * @brief Pick up the result of a read that was started without waiting.
+ */
+static void buffer_cache_settle(buffer_head_t* buffer)
+{
+    if (buffer->reading && buffer->request.status != BLOCK_REQUEST_PENDING)
+    {
+        buffer->reading = false;
+        buffer->valid = buffer->request.status == BLOCK_REQUEST_DONE;
+        g_buffer_reads_in_flight--;
+    }
+}
+
+/**
+ * @brief Whether another readahead block may be started.
+ *
+ * The in-flight count only drops when a buffer is settled, so settle every
+ * buffer before refusing.
+ */
+static bool buffer_cache_readahead_allowed(void)
+{
+    if (g_buffer_reads_in_flight < BUFFER_CACHE_READS_IN_FLIGHT)
+    {
+        return true;
+    }
+
+    for (uint32_t i = 0; i < BUFFER_CACHE_MAX_BUFFERS; ++i)
+    {
+        if (g_buffers[i].in_use)
+        {
+            buffer_cache_settle(&g_buffers[i]);
+        }
+    }
+    return g_buffer_reads_in_flight < BUFFER_CACHE_READS_IN_FLIGHT;
+}
+
+static void buffer_cache_start_read(buffer_head_t* buffer)
+{
+    uint64_t lba = 0;
+    uint32_t sectors = buffer_cache_block_sectors(buffer, &lba);
+    uint32_t bytes = sectors * buffer->device->sector_size;
+    memset(buffer->data + bytes, 0, BUFFER_CACHE_BLOCK_SIZE - bytes);
+
+    block_request_init(&buffer->request, buffer->device, BLOCK_REQUEST_READ, lba, sectors, buffer->data);
+    buffer->valid = false;
+    buffer->reading = true;
+    g_buffer_reads_in_flight++;
+    buffer_cache_stats_for(buffer->device)->misses++;
+    block_request_submit(&buffer->request);
+}
+
+static void buffer_cache_start_write(buffer_head_t* buffer)
+{
+    uint64_t lba = 0;
+    uint32_t sectors = buffer_cache_block_sectors(buffer, &lba);
+    block_request_init(&buffer->request, buffer->device, BLOCK_REQUEST_WRITE, lba, sectors, buffer->data);
+    block_request_submit(&buffer->request);
+}
+
+/**
+ * @brief Wait for a buffer's write-back and record the outcome.
+ */
+static bool buffer_cache_finish_write(buffer_head_t* buffer)
+{
+    if (!block_request_wait(&buffer->request))
+    {
+        kprintf("BCACHE: write-back of block %u on %s failed\n", (uint32_t)buffer->block, buffer->device->name);
+        return false;
+    }
+
+    buffer->dirty = false;
+    buffer_cache_stats_for(buffer->device)->writebacks++;
+    return true;
+}
+
+/**
+ * @brief Drop an unreferenced, idle buffer from the hash and the LRU list.
+ */
+static void buffer_cache_evict(buffer_head_t* victim)
+{
+    buffer_cache_unhash(victim);
+    buffer_cache_lru_remove(victim);
+    buffer_cache_stats_for(victim->device)->evictions++;
+    if (victim->readahead)
+    {
+        buffer_cache_stats_for(victim->device)->readahead_unused++;
+    }
+}
+
+/**
+ * @brief Take a never-used slot, or reuse the least recently released clean (or cleanable) buffer.
+ *
+ * When every unreferenced buffer is still being read, waits for the one
+ * released longest ago rather than failing.
+ */
+static buffer_head_t* buffer_cache_allocate(void)
+{
+    buffer_head_t* buffer = NULL;
+    for (uint32_t i = 0; i < BUFFER_CACHE_MAX_BUFFERS && buffer == NULL; ++i)
+    {
+        if (!g_buffers[i].in_use)
+        {
+            buffer = &g_buffers[i];
+        }
+    }
+
+    buffer_head_t* oldest_reading = NULL;
+    for (buffer_head_t* victim = g_buffer_lru_tail; buffer == NULL && victim != NULL; victim = victim->lru_prev)
+    {
+        buffer_cache_settle(victim);
+        if (victim->reading)
+        {
+            if (oldest_reading == NULL)
+            {
+                oldest_reading = victim;
+            }
+            continue;
+        }
+
+        if (victim->dirty)
+        {
+            buffer_cache_start_write(victim);
+            if (!buffer_cache_finish_write(victim))
+            {
+                continue;
+            }
+        }
+
+        buffer_cache_evict(victim);
+        buffer = victim;
+    }
+
+    if (buffer == NULL && oldest_reading != NULL)
+    {
+        block_request_wait(&oldest_reading->request);
+        buffer_cache_settle(oldest_reading);
+        buffer_cache_evict(oldest_reading);
+        buffer = oldest_reading;
+    }
+
+    if (buffer == NULL)
+    {
+        return NULL;
+    }
+
+    if (buffer->frame == 0)
+    {
+        // The data must be reachable through the direct map for DMA.
+        uintptr_t frame = pmm_allocate_page();
+        uint8_t* data = frame ? (uint8_t*)phys_to_virt(frame) : NULL;
+        if (data == NULL)
+        {
+            pmm_free_page(frame);
+            return NULL;
+        }
+        buffer->frame = frame;
+        buffer->data = data;
+    }
+
+    buffer->in_use = false;
+    buffer->valid = false;
+    buffer->dirty = false;
+    buffer->reading = false;
+    buffer->readahead = false;
+    buffer->references = 0;
+    buffer->hash_next = NULL;
+    return buffer;
+}
+
+/**
+ * @brief Find a block or give it a buffer (not yet read).
+ */
+static buffer_head_t* buffer_cache_find_or_create(block_device_t* device, uint64_t block, bool* found)
+{
+    buffer_head_t* buffer = buffer_cache_lookup(device, block);
+    *found = buffer != NULL;
+    if (buffer != NULL)
+    {
+        return buffer;
+    }
+
+    buffer = buffer_cache_allocate();
+    if (buffer == NULL)
+    {
+        return NULL;
+    }
+
+    buffer->device = device;
+    buffer->block = block;
+    buffer->in_use = true;
+    uint32_t bucket = buffer_cache_hash(device, block);
+    buffer->hash_next = g_buffer_buckets[bucket];
+    g_buffer_buckets[bucket] = buffer;
+    buffer_cache_lru_push(buffer);
+    return buffer;
+}
+
+static bool buffer_cache_block_valid(const block_device_t* device, uint64_t block)
+{
+    return buffer_cache_supported(device)
+        && block * (BUFFER_CACHE_BLOCK_SIZE / device->sector_size) < device->sector_count;
+}
+
+buffer_head_t* buffer_cache_get(block_device_t* device, uint64_t block)
+{
+    if (!buffer_cache_block_valid(device, block))
+    {
+        return NULL;
+    }
+
+    bool found = false;
+    buffer_head_t* buffer = buffer_cache_find_or_create(device, block, &found);
+    if (buffer == NULL)
+    {
+        kprintf("BCACHE: every buffer is in use, cannot cache block %u of %s\n", (uint32_t)block, device->name);
+        return NULL;
+    }
+
+    if (buffer->references++ == 0)
+    {
+        buffer_cache_lru_remove(buffer);
+    }
+
+    buffer_cache_settle(buffer);
+    if (found && (buffer->valid || buffer->reading))
+    {
+        buffer_cache_stats_for(device)->hits++;
+        if (buffer->readahead)
+        {
+            buffer_cache_stats_for(device)->readahead_hits++;
+        }
+    }
+    else if (!buffer->valid && !buffer->reading)
+    {
+        buffer_cache_start_read(buffer);
+    }
+    buffer->readahead = false;
+
+    if (buffer->reading)
+    {
+        block_request_wait(&buffer->request);
+        buffer_cache_settle(buffer);
+    }
+
+    if (!buffer->valid)
+    {
+        kprintf("BCACHE: failed to read block %u of %s\n", (uint32_t)block, device->name);
+        buffer_cache_release(buffer);
+        return NULL;
+    }
+
+    return buffer;
+}
+
+void buffer_cache_release(buffer_head_t* buffer)
+{
+    if (buffer == NULL || buffer->references == 0)
+    {
+        return;
+    }
+
+    if (--buffer->references == 0)
+    {
+        buffer_cache_lru_push(buffer);
+    }
+}
+
+void buffer_cache_mark_dirty(buffer_head_t* buffer)
+{
+    if (buffer != NULL && buffer->valid)
+    {
+        buffer->dirty = true;
+    }
+}
+
+/**
+ * @brief Start reading one block unless it is cached or already on its way.
+ *
+ * @return false if the block is past the end of the device or no buffer is free.
+ */
+static bool buffer_cache_prefetch_block(block_device_t* device, uint64_t block, bool readahead)
+{
+    if (!buffer_cache_block_valid(device, block))
+    {
+        return false;
+    }
+
+    bool found = false;
+    buffer_head_t* buffer = buffer_cache_find_or_create(device, block, &found);
+    if (buffer == NULL)
+    {
+        return false;
+    }
+
+    buffer_cache_settle(buffer);
+    if (!buffer->valid && !buffer->reading)
+    {
+        buffer_cache_start_read(buffer);
+        if (readahead)
+        {
+            buffer->readahead = true;
+            buffer_cache_stats_for(device)->readahead++;
+        }
+    }
+    return true;
+}
+
+void buffer_cache_prefetch(block_device_t* device, uint64_t offset, uint32_t length)
+{
+    if (length == 0)
+    {
+        return;
+    }
+
+    uint64_t last = (offset + length - 1) / BUFFER_CACHE_BLOCK_SIZE;
+    for (uint64_t block = offset / BUFFER_CACHE_BLOCK_SIZE; block <= last; ++block)
+    {
+        if (!buffer_cache_prefetch_block(device, block, false))
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Match a read of blocks [first, last] to a stream and keep its readahead window filled.
+ */
+static void buffer_cache_readahead(block_device_t* device, uint64_t first, uint64_t last)
+{
+    buffer_cache_stream_t* stream = NULL;
+    buffer_cache_stream_t* oldest = &g_buffer_streams[0];
+    g_buffer_stream_clock++;
+
+    for (uint32_t i = 0; i < BUFFER_CACHE_STREAMS && stream == NULL; ++i)
+    {
+        buffer_cache_stream_t* candidate = &g_buffer_streams[i];
+        // Byte-granular readers often reread the tail of the previous block.
+        if (candidate->device == device && first + 1 >= candidate->next
+            && first <= (candidate->ahead > candidate->next ? candidate->ahead : candidate->next))
+        {
+            stream = candidate;
+        }
+        else if (candidate->last_used < oldest->last_used)
+        {
+            oldest = candidate;
+        }
+    }
+
+    if (stream == NULL)
+    {
+        // Random so far: track it, but read ahead only once it continues.
+        oldest->device = device;
+        oldest->next = last + 1;
+        oldest->ahead = last + 1;
+        oldest->window = 0;
+        oldest->last_used = g_buffer_stream_clock;
+        return;
+    }
+
+    if (stream->window == 0)
+    {
+        stream->window = BUFFER_CACHE_READAHEAD_MIN;
+    }
+    else if (first <= stream->next)
+    {
+        stream->window = stream->window * 2 > BUFFER_CACHE_READAHEAD_MAX
+                       ? BUFFER_CACHE_READAHEAD_MAX
+                       : stream->window * 2;
+    }
+    else
+    {
+        stream->window = stream->window / 2 < BUFFER_CACHE_READAHEAD_MIN
+                       ? BUFFER_CACHE_READAHEAD_MIN
+                       : stream->window / 2;
+    }
+    stream->next = last + 1;
+    stream->last_used = g_buffer_stream_clock;
+
+    uint64_t target = stream->next + stream->window;
+    uint64_t block = stream->ahead > first ? stream->ahead : first;
+    if (block >= target)
+    {
+        return;
+    }
+
+    // The blocks asked for go out in the same plugged batch as the readahead,
+    // so the scheduler can merge them into one command.
+    block_device_plug(device);
+    for (; block < target; ++block)
+    {
+        if (block > last && !buffer_cache_readahead_allowed())
+        {
+            break;
+        }
+        if (!buffer_cache_prefetch_block(device, block, block > last))
+        {
+            break;
+        }
+    }
+    block_device_unplug(device);
+    stream->ahead = block;
+}
+
+bool buffer_cache_read(block_device_t* device, uint64_t offset, uint32_t length, void* destination)
+{
+    if (length != 0 && buffer_cache_supported(device))
+    {
+        buffer_cache_readahead(device, offset / BUFFER_CACHE_BLOCK_SIZE, (offset + length - 1) / BUFFER_CACHE_BLOCK_SIZE);
+    }
+
+    uint8_t* cursor = (uint8_t*)destination;
+    while (length > 0)
+    {
+        uint32_t within = (uint32_t)(offset % BUFFER_CACHE_BLOCK_SIZE);
+        uint32_t chunk = BUFFER_CACHE_BLOCK_SIZE - within;
+        if (chunk > length)
+        {
+            chunk = length;
+        }
+
+        buffer_head_t* buffer = buffer_cache_get(device, offset / BUFFER_CACHE_BLOCK_SIZE);
+        if (buffer == NULL)
+        {
+            return false;
+        }
+        memcpy(cursor, buffer->data + within, chunk);
+        buffer_cache_release(buffer);
+
+        cursor += chunk;
+        offset += chunk;
+        length -= chunk;
+    }
+    return true;
+}
+
+bool buffer_cache_write(block_device_t* device, uint64_t offset, uint32_t length, const void* source)
+{
+    if (device == NULL || device->write == NULL)
+    {
+        return false;
+    }
+
+    const uint8_t* cursor = (const uint8_t*)source;
+    while (length > 0)
+    {
+        uint32_t within = (uint32_t)(offset % BUFFER_CACHE_BLOCK_SIZE);
+        uint32_t chunk = BUFFER_CACHE_BLOCK_SIZE - within;
+        if (chunk > length)
+        {
+            chunk = length;
+        }
+
+        buffer_head_t* buffer = buffer_cache_get(device, offset / BUFFER_CACHE_BLOCK_SIZE);
+        if (buffer == NULL)
+        {
+            return false;
+        }
+        memcpy(buffer->data + within, cursor, chunk);
+        buffer_cache_mark_dirty(buffer);
+        buffer_cache_release(buffer);
+
+        cursor += chunk;
+        offset += chunk;
+        length -= chunk;
+    }
+    return true;
+}
+
+bool buffer_cache_sync(block_device_t* device)
+{
+    if (device == NULL)
+    {
+        bool synced = true;
+        for (size_t i = 0; i < block_device_count(); ++i)
+        {
+            synced = buffer_cache_sync(block_device_get(i)) && synced;
+        }
+        return synced;
+    }
+
+    // Queue every dirty block behind a plug so neighbours merge into one command.
+    uint32_t pending = 0;
+    block_device_plug(device);
+    for (uint32_t i = 0; i < BUFFER_CACHE_MAX_BUFFERS; ++i)
+    {
+        buffer_head_t* buffer = &g_buffers[i];
+        if (buffer->in_use && buffer->device == device && buffer->dirty)
+        {
+            buffer_cache_start_write(buffer);
+            g_buffer_sync_list[pending++] = buffer;
+        }
+    }
+    block_device_unplug(device);
+
+    bool synced = true;
+    for (uint32_t i = 0; i < pending; ++i)
+    {
+        synced = buffer_cache_finish_write(g_buffer_sync_list[i]) && synced;
+    }
+
+    return block_device_flush(device) && synced;
+}
+
+const buffer_cache_stats_t* buffer_cache_get_stats(const block_device_t* device)
+{
+    for (uint32_t i = 0; i < BUFFER_CACHE_STATS_DEVICES && g_buffer_cache_stats[i].device != NULL; ++i)
+    {
+        if (g_buffer_cache_stats[i].device == device)
+        {
+            return &g_buffer_cache_stats[i].stats;
+        }
+    }
+    return NULL;
+}
@@ -4,10 +4,12 @@
  */
 
 #include <ext2.h>
+#include <buffer_cache.h>
 #include <filesystem.h>
 #include <memory.h>
 #include <stdio.h>
 #include <vfs.h>
+#include <kerndef.h>
 
 #define EXT2_SUPERBLOCK_OFFSET 1024
 #define EXT2_SUPERBLOCK_SIZE   1024
@@ -15,6 +17,11 @@
 #define EXT2_MAGIC             0xEF53
 #define EXT2_S_IFMT            0xF000
 #define EXT2_S_IFDIR           0x4000
+#define EXT2_S_IFREG           0x8000
+#define EXT2_DIRECT_BLOCKS     12
+#define EXT2_INDIRECT_BLOCK    12
+#define EXT2_DOUBLE_BLOCK      13
+#define EXT2_TRIPLE_BLOCK      14
 
 typedef struct __attribute__((packed)) {
     uint32_t inodes_count;
@@ -109,6 +116,7 @@ typedef struct {
 typedef struct {
     ext2_fs_t*    fs;
     ext2_inode_t  inode;
+    uint32_t      inode_number;
     uint32_t      position;
 } ext2_file_handle_t;
 
@@ -134,24 +142,42 @@ static bool ext2_lookup_child(ext2_fs_t* fs,
                               const ext2_inode_t* dir_inode,
                               const char* name,
                               size_t name_len,
-                              ext2_inode_t* out_inode);
+                              ext2_inode_t* out_inode,
+                              uint32_t* out_number);
 static bool ext2_resolve_path(ext2_fs_t* fs,
                               const filesystem_mount_t* mount,
                               const char* path,
-                              ext2_inode_t* inode_out);
+                              ext2_inode_t* inode_out,
+                              uint32_t* inode_number_out);
+bool ext2_is_regular_file(const vfs_file_t* file)
+{
+    if (file == NULL || file->ops != &g_ext2_vfs_ops || file->fs_private == NULL)
+    {
+        return false;
+    }
+
+    const ext2_file_handle_t* handle = (const ext2_file_handle_t*)file->fs_private;
+    return (handle->inode.mode & EXT2_S_IFMT) == EXT2_S_IFREG;
+}
+
 static bool ext2_open_file(const filesystem_mount_t* mount,
                            const char* path,
                            vfs_file_t* file);
 static void ext2_close_file(vfs_file_t* file);
+static uint32_t ext2_read_file(vfs_file_t* file,
+                               uint32_t offset,
+                               void* buffer,
+                               uint32_t length);
 
 const vfs_filesystem_ops_t g_ext2_vfs_ops = {
     .fs_name   = "ext2",
     .list_root = ext2_list_root,
     .open      = ext2_open_file,
     .close     = ext2_close_file,
+    .read      = ext2_read_file,
 };
 
-bool ext2_mount(filesystem_mount_t* mount)
+bool KERNEL_INIT ext2_mount(filesystem_mount_t* mount)
 {
     if (mount == NULL || mount->kind != FILESYSTEM_KIND_EXT2
         || mount->device == NULL)
@@ -218,6 +244,7 @@ typedef struct {
     const char*     target;
     size_t          target_len;
     ext2_inode_t*   result_inode;
+    uint32_t        result_number;
     bool            found;
 } ext2_lookup_context_t;
 
@@ -240,6 +267,7 @@ static bool ext2_lookup_consumer(const filesystem_mount_t* mount,
     }
 
     ctx->found = ext2_read_inode(ctx->fs, entry->inode, ctx->result_inode);
+    ctx->result_number = entry->inode;
     return false;
 }
 
@@ -248,7 +276,8 @@ static bool ext2_lookup_child(ext2_fs_t* fs,
                               const ext2_inode_t* dir_inode,
                               const char* name,
                               size_t name_len,
-                              ext2_inode_t* out_inode)
+                              ext2_inode_t* out_inode,
+                              uint32_t* out_number)
 {
     if (dir_inode == NULL || out_inode == NULL || name_len == 0)
     {
@@ -261,21 +290,27 @@ static bool ext2_lookup_child(ext2_fs_t* fs,
     }
 
     ext2_lookup_context_t ctx = {
-        .fs           = fs,
-        .target       = name,
-        .target_len   = name_len,
-        .result_inode = out_inode,
-        .found        = false,
+        .fs            = fs,
+        .target        = name,
+        .target_len    = name_len,
+        .result_inode  = out_inode,
+        .result_number = 0,
+        .found         = false,
     };
 
     ext2_iterate_directory(fs, mount, dir_inode, ext2_lookup_consumer, &ctx);
+    if (ctx.found && out_number != NULL)
+    {
+        *out_number = ctx.result_number;
+    }
     return ctx.found;
 }
 
 static bool ext2_resolve_path(ext2_fs_t* fs,
                               const filesystem_mount_t* mount,
                               const char* path,
-                              ext2_inode_t* inode_out)
+                              ext2_inode_t* inode_out,
+                              uint32_t* inode_number_out)
 {
     if (fs == NULL || path == NULL || inode_out == NULL)
     {
@@ -283,6 +318,7 @@ static bool ext2_resolve_path(ext2_fs_t* fs,
     }
 
     ext2_inode_t current;
+    uint32_t current_number = EXT2_ROOT_INODE;
     if (!ext2_read_inode(fs, EXT2_ROOT_INODE, &current))
     {
         return false;
@@ -297,6 +333,10 @@ static bool ext2_resolve_path(ext2_fs_t* fs,
     if (*cursor == '\0')
     {
         *inode_out = current;
+        if (inode_number_out != NULL)
+        {
+            *inode_number_out = current_number;
+        }
         return true;
     }
 
@@ -310,7 +350,7 @@ static bool ext2_resolve_path(ext2_fs_t* fs,
         }
 
         ext2_inode_t next;
-        if (!ext2_lookup_child(fs, mount, &current, segment, segment_len, &next))
+        if (!ext2_lookup_child(fs, mount, &current, segment, segment_len, &next, &current_number))
         {
             return false;
         }
@@ -324,6 +364,10 @@ static bool ext2_resolve_path(ext2_fs_t* fs,
     }
 
     *inode_out = current;
+    if (inode_number_out != NULL)
+    {
+        *inode_number_out = current_number;
+    }
     return true;
 }
 
@@ -343,7 +387,8 @@ static bool ext2_open_file(const filesystem_mount_t* mount,
     }
 
     ext2_inode_t inode;
-    if (!ext2_resolve_path(fs, mount, path, &inode))
+    uint32_t inode_number = 0;
+    if (!ext2_resolve_path(fs, mount, path, &inode, &inode_number))
     {
         return false;
     }
@@ -356,15 +401,188 @@ static bool ext2_open_file(const filesystem_mount_t* mount,
 
     handle->fs = fs;
     handle->inode = inode;
+    handle->inode_number = inode_number;
     handle->position = 0;
 
     file->fs_private = handle;
     file->size = inode.size;
     file->position = 0;
-    file->inode = 0;
+    file->inode = inode_number;
+    return true;
+}
+
+/**
+ * @brief Read one entry of a block pointer table.
+ */
+static bool ext2_read_block_pointer(ext2_fs_t* fs,
+                                    uint32_t table_block,
+                                    uint32_t index,
+                                    uint32_t* block_out)
+{
+    uint8_t buffer[1024];
+    uint8_t* view = NULL;
+    if (!filesystem_read_bytes(fs->device,
+                               fs->lba_start,
+                               table_block * fs->block_size + index * sizeof(uint32_t),
+                               sizeof(uint32_t),
+                               buffer,
+                               sizeof(buffer),
+                               &view))
+    {
+        return false;
+    }
+
+    memcpy(block_out, view, sizeof(uint32_t));
+    return true;
+}
+
+/**
+ * @brief Map a block index within a file to a filesystem block (0 for a hole).
+ */
+static bool ext2_file_block(ext2_fs_t* fs,
+                            const ext2_inode_t* inode,
+                            uint32_t file_block,
+                            uint32_t* block_out)
+{
+    uint32_t per_block = fs->block_size / sizeof(uint32_t);
+
+    if (file_block < EXT2_DIRECT_BLOCKS)
+    {
+        *block_out = inode->block[file_block];
+        return true;
+    }
+
+    file_block -= EXT2_DIRECT_BLOCKS;
+
+    uint32_t table;
+    uint32_t span;
+    if (file_block < per_block)
+    {
+        table = inode->block[EXT2_INDIRECT_BLOCK];
+        span = 1;
+    }
+    else if (file_block - per_block < per_block * per_block)
+    {
+        file_block -= per_block;
+        table = inode->block[EXT2_DOUBLE_BLOCK];
+        span = per_block;
+    }
+    else
+    {
+        file_block -= per_block + per_block * per_block;
+        table = inode->block[EXT2_TRIPLE_BLOCK];
+        span = per_block * per_block;
+    }
+
+    // span is the number of file blocks covered by one entry at this level
+    while (span != 0)
+    {
+        if (table == 0)
+        {
+            *block_out = 0;
+            return true;
+        }
+
+        if (!ext2_read_block_pointer(fs, table, file_block / span, &table))
+        {
+            return false;
+        }
+
+        file_block %= span;
+        span /= per_block;
+    }
+
+    *block_out = table;
     return true;
 }
 
+static uint32_t ext2_read_file(vfs_file_t* file,
+                               uint32_t offset,
+                               void* buffer,
+                               uint32_t length)
+{
+    if (file == NULL || file->fs_private == NULL || buffer == NULL)
+    {
+        return 0;
+    }
+
+    ext2_file_handle_t* handle = (ext2_file_handle_t*)file->fs_private;
+    ext2_fs_t* fs = handle->fs;
+    if (offset >= handle->inode.size)
+    {
+        return 0;
+    }
+
+    if (length > handle->inode.size - offset)
+    {
+        length = handle->inode.size - offset;
+    }
+
+    if (fs->block_size > 4096)
+    {
+        kprintf("EXT2: block size %u too large to read\n", fs->block_size);
+        return 0;
+    }
+
+    uint8_t block_buffer[4096];
+    uint32_t done = 0;
+    while (done < length)
+    {
+        uint32_t position = offset + done;
+        uint32_t block_offset = position % fs->block_size;
+        uint32_t chunk = fs->block_size - block_offset;
+        if (chunk > length - done)
+        {
+            chunk = length - done;
+        }
+
+        uint32_t block;
+        if (!ext2_file_block(fs, &handle->inode, position / fs->block_size, &block))
+        {
+            break;
+        }
+
+        uint8_t* destination = (uint8_t*)buffer + done;
+        if (block == 0)
+        {
+            memset(destination, 0, chunk);
+        }
+        else if (chunk == fs->block_size)
+        {
+            // Whole blocks go straight into the caller's buffer.
+            if (!filesystem_read_bytes(fs->device,
+                                       fs->lba_start,
+                                       block * fs->block_size,
+                                       fs->block_size,
+                                       destination,
+                                       fs->block_size,
+                                       NULL))
+            {
+                break;
+            }
+        }
+        else
+        {
+            uint8_t* view = NULL;
+            if (!filesystem_read_bytes(fs->device,
+                                       fs->lba_start,
+                                       block * fs->block_size + block_offset,
+                                       chunk,
+                                       block_buffer,
+                                       sizeof(block_buffer),
+                                       &view))
+            {
+                break;
+            }
+            memcpy(destination, view, chunk);
+        }
+
+        done += chunk;
+    }
+
+    return done;
+}
+
 static void ext2_close_file(vfs_file_t* file)
 {
     if (file == NULL || file->fs_private == NULL)
@@ -517,10 +735,25 @@ static bool ext2_iterate_directory(ext2_fs_t* fs,
         return false;
     }
 
+    // Start every directory block behind a plug so the scheduler merges
+    // the contiguous ones; the loop below then finds them in the cache.
+    uint64_t partition_offset = fs->lba_start * fs->device->sector_size;
+    block_device_plug(fs->device);
+    for (int i = 0; i < EXT2_DIRECT_BLOCKS; ++i)
+    {
+        if (inode->block[i] != 0)
+        {
+            buffer_cache_prefetch(fs->device,
+                                  partition_offset + (uint64_t)inode->block[i] * fs->block_size,
+                                  fs->block_size);
+        }
+    }
+    block_device_unplug(fs->device);
+
     uint8_t block_buffer[4096];
     uint8_t* view = NULL;
 
-    for (int i = 0; i < 12; ++i)
+    for (int i = 0; i < EXT2_DIRECT_BLOCKS; ++i)
     {
         uint32_t block = inode->block[i];
         if (block == 0)
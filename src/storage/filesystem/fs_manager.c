@@ -7,10 +7,12 @@
 #include <stdio.h>
 #include <memory.h>
 #include <ext2.h>
+#include <buffer_cache.h>
 #include <vfs.h>
+#include <kerndef.h>
 
-static const char FAT16_SIGNATURE[8] = { 'F', 'A', 'T', '1', '6', ' ', ' ', ' ' };
-static const char ISO9660_MAGIC[5]   = { 'C', 'D', '0', '0', '1' };
+static const char FAT16_SIGNATURE[8] KERNEL_INIT_DATA = { 'F', 'A', 'T', '1', '6', ' ', ' ', ' ' };
+static const char ISO9660_MAGIC[5]   KERNEL_INIT_DATA = { 'C', 'D', '0', '0', '1' };
 
 static filesystem_mount_t g_mounts[FILESYSTEM_MAX_MOUNTS];
 static size_t g_mount_count;
@@ -47,6 +49,23 @@ bool filesystem_read_bytes(block_device_t* device,
         sector_size = 512;
     }
 
+    // Metadata is read over and over (group descriptors, inode tables,
+    // directories), so go through the buffer cache where the device allows.
+    if (BUFFER_CACHE_BLOCK_SIZE % sector_size == 0)
+    {
+        if (byte_length > scratch_size
+            || !buffer_cache_read(device, lba_start * sector_size + byte_offset, byte_length, scratch))
+        {
+            return false;
+        }
+
+        if (view_out != NULL)
+        {
+            *view_out = scratch;
+        }
+        return true;
+    }
+
     uint64_t start_sector = lba_start + (byte_offset / sector_size);
     uint32_t sector_offset = byte_offset % sector_size;
     uint32_t total_bytes = sector_offset + byte_length;
@@ -71,7 +90,7 @@ bool filesystem_read_bytes(block_device_t* device,
     return true;
 }
 
-static filesystem_kind_t filesystem_probe_fat16(block_device_t* device,
+static filesystem_kind_t KERNEL_INIT filesystem_probe_fat16(block_device_t* device,
                                                 uint64_t lba_start,
                                                 uint64_t sector_count)
 {
@@ -105,7 +124,7 @@ static filesystem_kind_t filesystem_probe_fat16(block_device_t* device,
     return FILESYSTEM_KIND_FAT16;
 }
 
-static filesystem_kind_t filesystem_probe_ext2(block_device_t* device,
+static filesystem_kind_t KERNEL_INIT filesystem_probe_ext2(block_device_t* device,
                                                uint64_t lba_start,
                                                uint64_t sector_count)
 {
@@ -127,7 +146,7 @@ static filesystem_kind_t filesystem_probe_ext2(block_device_t* device,
     return FILESYSTEM_KIND_EXT2;
 }
 
-static filesystem_kind_t filesystem_probe_cdfs(block_device_t* device,
+static filesystem_kind_t KERNEL_INIT filesystem_probe_cdfs(block_device_t* device,
                                                uint64_t lba_start,
                                                uint64_t sector_count)
 {
@@ -159,7 +178,7 @@ const char* filesystem_kind_name(filesystem_kind_t kind)
     }
 }
 
-filesystem_kind_t filesystem_probe(block_device_t* device,
+filesystem_kind_t KERNEL_INIT filesystem_probe(block_device_t* device,
                                    uint64_t lba_start,
                                    uint64_t sector_count)
 {
@@ -183,7 +202,7 @@ filesystem_kind_t filesystem_probe(block_device_t* device,
     return filesystem_probe_cdfs(device, lba_start, sector_count);
 }
 
-static void filesystem_format_mount_name(char* dest,
+static void KERNEL_INIT filesystem_format_mount_name(char* dest,
                                          size_t dest_len,
                                          const char* device_name,
                                          uint8_t partition_idx)
@@ -236,7 +255,7 @@ static const vfs_filesystem_ops_t* filesystem_ops_for_kind(filesystem_kind_t kin
     }
 }
 
-bool filesystem_mount_partition(block_device_t* device,
+bool KERNEL_INIT filesystem_mount_partition(block_device_t* device,
                                 uint8_t partition_idx,
                                 uint64_t lba_start,
                                 uint64_t sector_count,
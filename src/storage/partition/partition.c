@@ -6,6 +6,8 @@
 #include <partition.h>
 #include <stdio.h>
 #include <memory.h>
+#include <swap.h>
+#include <kerndef.h>
 
 #define PARTITION_TABLE_ENTRIES 4
 
@@ -31,7 +33,7 @@ static bool partition_read_sector(block_device_t* device,
     return device->read(device, lba, count, buffer);
 }
 
-void partition_scan_device(block_device_t* device)
+void KERNEL_INIT partition_scan_device(block_device_t* device)
 {
     if (device == NULL)
     {
@@ -47,7 +49,17 @@ void partition_scan_device(block_device_t* device)
 
     if (sector[510] != 0x55 || sector[511] != 0xAA)
     {
-        kprintf("PART: %s -> invalid MBR signature\n", device->name);
+        // An unpartitioned image (say, a RAM disk holding a bare ext2 filesystem)
+        // is mounted as a single partition covering the whole device.
+        filesystem_kind_t kind = filesystem_probe(device, 0, device->sector_count);
+        if (kind == FILESYSTEM_KIND_UNKNOWN)
+        {
+            kprintf("PART: %s -> invalid MBR signature\n", device->name);
+            return;
+        }
+
+        kprintf("PART: %s -> no MBR, whole device holds fs=%s\n", device->name, filesystem_kind_name(kind));
+        filesystem_mount_partition(device, 0, 0, device->sector_count, kind);
         return;
     }
 
@@ -64,6 +76,13 @@ void partition_scan_device(block_device_t* device)
             continue;
         }
 
+        // Swap partitions hold no filesystem; hand them to the pager instead.
+        if (entry->type == SWAP_PARTITION_TYPE
+            && swap_probe_partition(device, entry->lba_first, entry->sector_count))
+        {
+            continue;
+        }
+
         partition_info_t part = {
             .index        = i,
             .lba_start    = entry->lba_first,
@@ -46,7 +46,7 @@ typedef struct
 /**
  * @brief Search conventional BIOS memory for the ACPI RSDP structure.
  */
-void* find_rsdp()
+void* KERNEL_INIT find_rsdp()
 {
     for(uint32_t addr = RSDP_SEARCH_START; addr < RSDP_SEARCH_END; addr += RSDP_SEARCH_STEP) {
         rsdp_t* rsdp = (rsdp_t*)addr;
@@ -56,11 +56,16 @@ void* find_rsdp()
                 memset(sig, 0, 9);
                 memcpy(sig, rsdp->Signature, 8);
                 kprintf("Signature: %s Revision: %d, address: 0x%08x\n", sig, rsdp->revision, rsdp->rsdtAddress);
-                vmm_map_physical_to_virtual((uint8_t*)rsdp->rsdtAddress, (uint8_t*)0xe8000000);
-
                 uint32_t vAddress = 0xe8000000;
 
-                uint8_t* ptr = (uint8_t*)((rsdp->rsdtAddress & 0xfff) + vAddress);
+                // Tables normally sit in RAM below the end of the direct map;
+                // otherwise fall back to a single-page window.
+                uint8_t* ptr = phys_to_virt(rsdp->rsdtAddress);
+                if(ptr == NULL)
+                {
+                    vmm_map_physical_to_virtual((uint8_t*)rsdp->rsdtAddress, (uint8_t*)vAddress, CACHE_WRITE_BACK);
+                    ptr = (uint8_t*)((rsdp->rsdtAddress & 0xfff) + vAddress);
+                }
 
                 kprintf("rsdt address: 0x%08x\n", ptr);
 
@@ -73,7 +78,11 @@ void* find_rsdp()
                 {
                     char buffer[5];
                     buffer[4] = 0;
-                    struct ACPISDTHeader* h = (struct ACPISDTHeader*) ((rsdt->PointerToOtherSDT[j] & 0xfff) + vAddress);
+                    struct ACPISDTHeader* h = phys_to_virt(rsdt->PointerToOtherSDT[j]);
+                    if(h == NULL)
+                    {
+                        h = (struct ACPISDTHeader*) ((rsdt->PointerToOtherSDT[j] & 0xfff) + vAddress);
+                    }
                     memcpy(buffer, h->Signature, 4);
                     kprintf("entry[%d] rsdt: %s\n", j, buffer);
                 }
@@ -103,7 +103,7 @@ static gdt_descriptor_t gdt_descriptor = { sizeof(gdt_entries) - 1, gdt_entries}
 /**
  * @brief Populate and load the kernel global descriptor table.
  */
-void gdt_init(void)
+void KERNEL_INIT gdt_init(void)
 {
     gdt_load(&gdt_descriptor, GDT_SELECTOR_CODE, GDT_SELECTOR_DATA);
 }
@@ -87,7 +87,7 @@ void idt_disable_gate(int interrupt)
 /**
  * @brief Load the IDT descriptor into the processor.
  */
-void idt_init(void)
+void KERNEL_INIT idt_init(void)
 {
     idt_load(&idt_descriptor);
 }
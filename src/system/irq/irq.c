@@ -11,10 +11,10 @@
 #include <stdio.h>
 #include <isr.h>
 
-#define PIC_REMAP_OFFSET        0x20 /**< Offset applied when remapping the PIC. */
+#define PIC_REMAP_OFFSET        IRQ_BASE_VECTOR /**< Offset applied when remapping the PIC. */
 
-/** @brief High-level IRQ handler table (one entry per IRQ line). */
-static IRQHandler irq_handlers[16];
+/** @brief High-level IRQ handler table (IRQ_MAX_SHARED entries per IRQ line). */
+static IRQHandler irq_handlers[16][IRQ_MAX_SHARED];
 
 /**
  * @brief Low-level IRQ dispatcher invoked from the ISR stubs.
@@ -28,10 +28,13 @@ static void irq_dispatch(Registers* regs)
     uint8_t pic_isr = pic_read_in_service_register();
     uint8_t pic_irr = pic_read_irq_request_register();
 
-    if (irq_handlers[irq] != NULL)
+    if (irq_handlers[irq][0] != NULL)
     {
-        // handle IRQ
-        irq_handlers[irq](regs);
+        // PCI devices share lines, so every handler checks its own hardware.
+        for (int i = 0; i < IRQ_MAX_SHARED && irq_handlers[irq][i] != NULL; i++)
+        {
+            irq_handlers[irq][i](regs);
+        }
     }
     else
     {
@@ -45,7 +48,7 @@ static void irq_dispatch(Registers* regs)
 /**
  * @brief Initialize the PIC and install IRQ handlers into the IDT.
  */
-void irq_init(void)
+void KERNEL_INIT irq_init(void)
 {
     pic_configure(PIC_REMAP_OFFSET, PIC_REMAP_OFFSET + 8);
 
@@ -63,5 +66,14 @@ void irq_init(void)
  */
 void irq_register_handler(int irq, IRQHandler handler)
 {
-    irq_handlers[irq] = handler;
+    for (int i = 0; i < IRQ_MAX_SHARED; i++)
+    {
+        if (irq_handlers[irq][i] == NULL || irq_handlers[irq][i] == handler)
+        {
+            irq_handlers[irq][i] = handler;
+            return;
+        }
+    }
+
+    kprintf("IRQ: line %d already has %d handlers\n", irq, IRQ_MAX_SHARED);
 }
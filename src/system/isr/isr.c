@@ -57,7 +57,7 @@ void isr_install_gates(void);
 /**
  * @brief Initialize default CPU exception handlers and enable IDT gates.
  */
-void isr_init(void)
+void KERNEL_INIT isr_init(void)
 {
     isr_install_gates();
     for(int i = 0; i < 256; i++)
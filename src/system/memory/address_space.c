@@ -0,0 +1,298 @@
+/**
+ * @file system/memory/address_space.c
+ * @brief Per-process page directories with a shared kernel half.
+ * @copyright Copyright 2025 Chris Nicholson <chris@cnick.org.uk>
+ */
+
+#include <address_space.h>
+#include <meminit.h>
+#include <memory.h>
+#include <x86.h>
+#include <swap.h>
+
+#define ADDRESS_SPACE_DIRECTORY_WINDOW 0xd4000000u /**< Kernel mappings of each space's directory. */
+
+/** @brief Address space table, slot 0 is the kernel (boot) directory. */
+static address_space_t g_address_spaces[ADDRESS_SPACE_MAX];
+/** @brief Address space currently loaded in CR3. */
+static address_space_t* g_current_address_space;
+
+static page_directory_t address_space_master_directory(void)
+{
+    return (page_directory_t) &PageDirectoryVirtualAddress;
+}
+
+void KERNEL_INIT address_space_init(void)
+{
+    memset(g_address_spaces, 0, sizeof(g_address_spaces));
+
+    address_space_t* kernel = &g_address_spaces[0];
+    kernel->in_use = true;
+    kernel->id = 0;
+    kernel->page_directory_physical = (uintptr_t) &PageDirectoryPhysicalAddress;
+    kernel->page_directory = address_space_master_directory();
+
+    g_current_address_space = kernel;
+}
+
+address_space_t* address_space_kernel(void)
+{
+    return &g_address_spaces[0];
+}
+
+address_space_t* address_space_current(void)
+{
+    return g_current_address_space;
+}
+
+address_space_t* address_space_get(uint32_t id)
+{
+    if(id >= ADDRESS_SPACE_MAX || !g_address_spaces[id].in_use)
+    {
+        return NULL;
+    }
+    return &g_address_spaces[id];
+}
+
+void address_space_set_kernel_pde(uint32_t index, uint32_t pde)
+{
+    if(index < KERNEL_PAGE_TABLE_NUMBER || index >= RECURSIVE_PAGE_TABLE_NUMBER)
+    {
+        return;
+    }
+
+    address_space_master_directory()[index] = pde;
+
+    for(uint32_t i = 1; i < ADDRESS_SPACE_MAX; i++)
+    {
+        if(g_address_spaces[i].in_use)
+        {
+            g_address_spaces[i].page_directory[index] = pde;
+        }
+    }
+}
+
+address_space_t* address_space_create(void)
+{
+    address_space_t* space = NULL;
+    for(uint32_t i = 1; i < ADDRESS_SPACE_MAX; i++)
+    {
+        if(!g_address_spaces[i].in_use)
+        {
+            space = &g_address_spaces[i];
+            space->id = i;
+            break;
+        }
+    }
+
+    if(space == NULL)
+    {
+        kprintf("VMM: address space table full\n");
+        return NULL;
+    }
+
+    uintptr_t directory_physical = pmm_allocate_page();
+    if(directory_physical == 0)
+    {
+        return NULL;
+    }
+
+    // Mapping the window may itself add a kernel PDE, so copy the kernel
+    // half from the master directory only once the window is in place.
+    uint8_t* window = (uint8_t*)(ADDRESS_SPACE_DIRECTORY_WINDOW + space->id * PAGE_SIZE_BYTES);
+    if(!vmm_map_kernel_page(directory_physical, window, CACHE_WRITE_BACK))
+    {
+        pmm_free_page(directory_physical);
+        return NULL;
+    }
+
+    page_directory_t pd = (page_directory_t) window;
+    page_directory_t master = address_space_master_directory();
+
+    memset(space->page_table_entries, 0, sizeof(space->page_table_entries));
+
+    memset(pd, 0, KERNEL_PAGE_TABLE_NUMBER * sizeof(uint32_t));
+    for(uint32_t i = KERNEL_PAGE_TABLE_NUMBER; i < RECURSIVE_PAGE_TABLE_NUMBER; i++)
+    {
+        pd[i] = master[i];
+    }
+    pd[RECURSIVE_PAGE_TABLE_NUMBER] = vmm_make_page_directory_entry((void*) directory_physical,
+                                                                    FOUR_KB,
+                                                                    false,
+                                                                    false,
+                                                                    SUPERVISOR,
+                                                                    READ_WRITE,
+                                                                    true);
+
+    space->page_directory_physical = directory_physical;
+    space->page_directory = pd;
+    space->in_use = true;
+    return space;
+}
+
+void address_space_destroy(address_space_t* space)
+{
+    if(space == NULL || !space->in_use || space->id == 0 || space == g_current_address_space)
+    {
+        return;
+    }
+
+    vma_destroy_all(space);
+
+    page_directory_t pd = space->page_directory;
+    for(uint32_t i = 0; i < KERNEL_PAGE_TABLE_NUMBER; i++)
+    {
+        uint32_t pde = pd[i];
+        if((pde & PAGE_PRESENT) == 0)
+        {
+            continue;
+        }
+
+        if(pde & PAGE_LARGE)
+        {
+            uintptr_t frame = pde & ~(PAGE_TABLE_COVERAGE - 1);
+            for(uint32_t j = 0; j < 1024; j++)
+            {
+                pmm_page_release(frame + j * PAGE_SIZE_BYTES);
+            }
+            pd[i] = 0;
+            continue;
+        }
+
+        page_table_t pt = (page_table_t) vmm_temp_map(pde & PAGE_FRAME_MASK);
+        if(pt != NULL)
+        {
+            for(uint32_t j = 0; j < 1024; j++)
+            {
+                if((pt[j] & (PAGE_PRESENT | PAGE_DEVICE)) == PAGE_PRESENT)
+                {
+                    pmm_page_release(pt[j] & PAGE_FRAME_MASK);
+                }
+                else
+                {
+                    swap_entry_free(pt[j]);
+                }
+            }
+            vmm_temp_unmap(pt);
+        }
+
+        pmm_free_page(pde & PAGE_FRAME_MASK);
+        pd[i] = 0;
+    }
+
+    vmm_unmap_virtual((uint8_t*) pd);
+    pmm_free_page(space->page_directory_physical);
+    memset(space, 0, sizeof(*space));
+}
+
+/**
+ * @brief Share one user page table with a child, marking writable pages copy-on-write.
+ */
+static bool address_space_fork_page_table(page_table_t parent_pt, uintptr_t child_pt_physical)
+{
+    page_table_t child_pt = (page_table_t) vmm_temp_map(child_pt_physical);
+    if(child_pt == NULL)
+    {
+        return false;
+    }
+
+    for(uint32_t i = 0; i < 1024; i++)
+    {
+        uint32_t pte = parent_pt[i];
+        if((pte & (PAGE_PRESENT | PAGE_DEVICE)) == PAGE_PRESENT)
+        {
+            if(pte & (PAGE_WRITABLE | PAGE_COPY_ON_WRITE))
+            {
+                pte = (pte & ~PAGE_WRITABLE) | PAGE_COPY_ON_WRITE;
+                parent_pt[i] = pte;
+            }
+            pmm_page_add_reference(pte & PAGE_FRAME_MASK);
+        }
+        else
+        {
+            swap_entry_duplicate(pte);
+        }
+        child_pt[i] = pte;
+    }
+
+    vmm_temp_unmap(child_pt);
+    return true;
+}
+
+address_space_t* address_space_fork(address_space_t* parent)
+{
+    if(parent == NULL || parent != g_current_address_space)
+    {
+        return NULL;
+    }
+
+    address_space_t* child = address_space_create();
+    if(child == NULL)
+    {
+        return NULL;
+    }
+
+    if(!vma_clone(child, parent))
+    {
+        address_space_destroy(child);
+        return NULL;
+    }
+
+    page_directory_t parent_pd = vmm_active_page_directory();
+    for(uint32_t i = 0; i < KERNEL_PAGE_TABLE_NUMBER; i++)
+    {
+        // Huge pages are shared frame by frame, so split them into page tables first.
+        if(!vmm_split_huge_page(i))
+        {
+            address_space_destroy(child);
+            child = NULL;
+            break;
+        }
+
+        uint32_t pde = parent_pd[i];
+        if((pde & PAGE_PRESENT) == 0)
+        {
+            continue;
+        }
+
+        uintptr_t child_pt_physical = pmm_allocate_page();
+        if(child_pt_physical == 0)
+        {
+            address_space_destroy(child);
+            child = NULL;
+            break;
+        }
+
+        // Install the table before filling it so destroy() can unwind a partial fork.
+        child->page_directory[i] = child_pt_physical | (pde & ~PAGE_FRAME_MASK);
+        page_table_t parent_pt = (page_table_t) vmm_page_table_virtual_address(i);
+        if(!address_space_fork_page_table(parent_pt, child_pt_physical))
+        {
+            child->page_directory[i] = 0;
+            pmm_free_page(child_pt_physical);
+            address_space_destroy(child);
+            child = NULL;
+            break;
+        }
+    }
+
+    if(child != NULL)
+    {
+        memcpy(child->page_table_entries, parent->page_table_entries, sizeof(child->page_table_entries));
+    }
+
+    // The parent's writable PTEs were downgraded in place; drop stale TLB entries.
+    x86_load_page_directory((uint32_t) parent->page_directory_physical);
+    return child;
+}
+
+void address_space_switch(address_space_t* space)
+{
+    if(space == NULL || !space->in_use || space == g_current_address_space)
+    {
+        return;
+    }
+
+    g_current_address_space = space;
+    x86_load_page_directory((uint32_t) space->page_directory_physical);
+}
@@ -9,6 +9,14 @@
 #include <multiboot.h>
 
 
+extern uint8_t kernel_init_start;
+extern uint8_t kernel_init_end;
+extern uint8_t kernel_init_physical_start;
+extern uint8_t kernel_init_physical_end;
+extern uint8_t kernel_physical_start;
+extern uint8_t kernel_pmm_physical_start;
+extern uint8_t kernel_pmm_physical_end;
+
 /** @brief Cached Multiboot memory map entries. */
 static multiboot_mmap_entry g_memory_mmap_entries[32];
 /** @brief Number of valid entries currently cached. */
@@ -19,7 +27,7 @@ static uint32_t g_memory_mmap_count;
 /**
  * @brief Cache the Multiboot-supplied memory map for later use.
  */
-void memory_init(multiboot_info* mbi)
+void KERNEL_INIT memory_init(multiboot_info* mbi)
 {
     uint32_t entries = mbi->mmap_length / sizeof(multiboot_mmap_entry);
     if(entries > MAX_MMAP_ENTRIES)
@@ -41,3 +49,39 @@ multiboot_mmap_entry* memory_get_mmap()
 {
     return g_memory_mmap_entries;
 }
+
+void memory_free_init(void)
+{
+    uintptr_t image_start = (uintptr_t)&kernel_physical_start;
+    uintptr_t image_end = (uintptr_t)&kernel_pmm_physical_end;
+
+    // Only the first pmm_bitmap_bytes() of the static bitmap are ever used.
+    uint32_t bitmap_pages = pmm_free_boot_range((uintptr_t)&kernel_pmm_physical_start + pmm_bitmap_bytes(),
+                                                image_end);
+
+    // Everything useful was copied out of the boot information by memory_init()
+    // and multiboot_store_info(); never free it if it overlaps the image.
+    multiboot_info* mbi = multiboot_get_info();
+    uint32_t boot_info_pages = 0;
+    if(mbi->tags_size != 0
+       && (mbi->tags_addr + mbi->tags_size <= image_start || mbi->tags_addr >= image_end))
+    {
+        boot_info_pages = pmm_free_boot_range(mbi->tags_addr, mbi->tags_addr + mbi->tags_size);
+    }
+    mbi->mmap_addr = 0;
+    mbi->tags_addr = 0;
+    mbi->tags_size = 0;
+
+    // Fill the init sections with int3 so a stray call traps instead of
+    // running whatever the frames are reused for.
+    memset(&kernel_init_start, 0xcc, (size_t)(&kernel_init_end - &kernel_init_start));
+    uint32_t init_pages = pmm_free_boot_range((uintptr_t)&kernel_init_physical_start,
+                                              (uintptr_t)&kernel_init_physical_end);
+
+    uint32_t kib_per_page = PAGE_SIZE_BYTES / 1024;
+    kprintf("MEM: freed %u KiB of boot memory (init sections %u KiB, PMM bitmap %u KiB, boot info %u KiB)\n",
+            (init_pages + bitmap_pages + boot_info_pages) * kib_per_page,
+            init_pages * kib_per_page,
+            bitmap_pages * kib_per_page,
+            boot_info_pages * kib_per_page);
+}
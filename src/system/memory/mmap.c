@@ -0,0 +1,131 @@
+/**
+ * @file system/memory/mmap.c
+ * @brief File-backed regions served from the page cache.
+ */
+
+#include <mmap.h>
+#include <address_space.h>
+#include <page_cache.h>
+#include <meminit.h>
+#include <paging.h>
+#include <vma.h>
+#include <ext2.h>
+#include <stdio.h>
+#include <stddef.h>
+
+static bool mmap_file_fault(vma_t* vma, uint32_t address, uint32_t error)
+{
+    if (error & PAGE_FAULT_PRESENT)
+    {
+        return false;
+    }
+
+    vfs_file_t* file = (vfs_file_t*)vma->file;
+    uint32_t page = PAGE_ALIGN_DOWN(address);
+    uint32_t file_offset = vma->offset + (page - vma->start);
+
+    // Whole pages past the end of the file are a bus error, not zeroes.
+    if (file_offset >= file->size)
+    {
+        return false;
+    }
+
+    uintptr_t frame = page_cache_get(file, file_offset / PAGE_SIZE_BYTES);
+    if (frame == 0)
+    {
+        return false;
+    }
+
+    if (!vmm_map_user_page(page, frame, false))
+    {
+        pmm_page_release(frame);
+        return false;
+    }
+    return true;
+}
+
+static void mmap_file_open(vma_t* vma)
+{
+    vfs_file_get((vfs_file_t*)vma->file);
+}
+
+static void mmap_file_close(vma_t* vma)
+{
+    vfs_file_put((vfs_file_t*)vma->file);
+}
+
+static const vma_ops_t g_mmap_file_ops = {
+    "file",
+    mmap_file_fault,
+    mmap_file_open,
+    mmap_file_close,
+};
+
+uint32_t mmap_file(vfs_file_t* file, uint32_t offset, uint32_t length, uint32_t prot, uint32_t flags)
+{
+    address_space_t* space = address_space_current();
+    if (file == NULL || space == NULL || space == address_space_kernel() || length == 0
+        || (offset & (PAGE_SIZE_BYTES - 1)) != 0)
+    {
+        return MMAP_FAILED;
+    }
+
+    if (prot & PROT_WRITE)
+    {
+        kprintf("MMAP: writable file mappings are not supported\n");
+        return MMAP_FAILED;
+    }
+
+    // The page cache reads file contents; directories and devices have none to offer.
+    if (!ext2_is_regular_file(file))
+    {
+        return MMAP_FAILED;
+    }
+
+    uint32_t start = vma_find_free(space, MMAP_BASE, length);
+    if (start == 0)
+    {
+        return MMAP_FAILED;
+    }
+
+    vma_t* vma = vma_map(space, start, length, prot & (VMA_READ | VMA_EXEC), VMA_FILE);
+    if (vma == NULL)
+    {
+        return MMAP_FAILED;
+    }
+
+    vma->ops = &g_mmap_file_ops;
+    vma->file = file;
+    vma->offset = offset;
+    vfs_file_get(file);
+
+    if (flags & MAP_POPULATE)
+    {
+        for (uint32_t page = vma->start; page < vma->end; page += PAGE_SIZE_BYTES)
+        {
+            if (virt_to_phys((void*)page) == 0 && !mmap_file_fault(vma, page, 0))
+            {
+                break;
+            }
+        }
+    }
+
+    return start;
+}
+
+bool mmap_unmap(uint32_t address, uint32_t length)
+{
+    address_space_t* space = address_space_current();
+    vma_t* vma = vma_find(space, address);
+    // Only regions made by mmap_file() go away here; the stack and anything
+    // else the kernel set up for the process stay.
+    if (vma == NULL || vma->kind != VMA_FILE || vma->ops != &g_mmap_file_ops || vma->start != address
+        || vma->end - vma->start != ((length + PAGE_SIZE_BYTES - 1) & ~(PAGE_SIZE_BYTES - 1)))
+    {
+        return false;
+    }
+
+    vmm_unmap_user_range(vma->start, vma->end);
+    vma_unmap(space, vma);
+    return true;
+}
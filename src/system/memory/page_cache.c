@@ -0,0 +1,174 @@
+/**
+ * @file system/memory/page_cache.c
+ * @brief File page cache keyed by (mount, inode, page index).
+ */
+
+#include <page_cache.h>
+#include <meminit.h>
+#include <memory.h>
+#include <paging.h>
+#include <stdio.h>
+#include <stddef.h>
+
+#define PAGE_CACHE_BUCKETS 256
+
+typedef struct page_cache_entry {
+    const filesystem_mount_t*  mount;
+    uint32_t                   inode;
+    uint32_t                   page_index;
+    uintptr_t                  frame;
+    bool                       in_use;
+    struct page_cache_entry*   next;
+} page_cache_entry_t;
+
+static page_cache_entry_t g_page_cache[PAGE_CACHE_MAX_PAGES];
+static page_cache_entry_t* g_page_cache_buckets[PAGE_CACHE_BUCKETS];
+/** @brief Clock hand used to pick an eviction victim. */
+static uint32_t g_page_cache_hand;
+static page_cache_stats_t g_page_cache_stats;
+
+void KERNEL_INIT page_cache_init(void)
+{
+    memset(g_page_cache, 0, sizeof(g_page_cache));
+    memset(g_page_cache_buckets, 0, sizeof(g_page_cache_buckets));
+    memset(&g_page_cache_stats, 0, sizeof(g_page_cache_stats));
+    g_page_cache_hand = 0;
+}
+
+static uint32_t page_cache_hash(const filesystem_mount_t* mount, uint32_t inode, uint32_t page_index)
+{
+    uint32_t hash = (uint32_t)(uintptr_t)mount ^ (inode * 2654435761u) ^ (page_index * 40503u);
+    return (hash ^ (hash >> 16)) % PAGE_CACHE_BUCKETS;
+}
+
+static void page_cache_unlink(page_cache_entry_t* entry)
+{
+    page_cache_entry_t** link = &g_page_cache_buckets[page_cache_hash(entry->mount, entry->inode, entry->page_index)];
+    while (*link != NULL)
+    {
+        if (*link == entry)
+        {
+            *link = entry->next;
+            return;
+        }
+        link = &(*link)->next;
+    }
+}
+
+/**
+ * @brief Find a free slot, evicting a page no address space maps any more.
+ */
+static page_cache_entry_t* page_cache_allocate(void)
+{
+    for (uint32_t scanned = 0; scanned < PAGE_CACHE_MAX_PAGES; ++scanned)
+    {
+        page_cache_entry_t* entry = &g_page_cache[g_page_cache_hand];
+        g_page_cache_hand = (g_page_cache_hand + 1) % PAGE_CACHE_MAX_PAGES;
+
+        if (!entry->in_use)
+        {
+            return entry;
+        }
+
+        // Only the cache's own reference is left.
+        if (pmm_page_reference_count(entry->frame) == 1)
+        {
+            page_cache_unlink(entry);
+            pmm_page_release(entry->frame);
+            memset(entry, 0, sizeof(*entry));
+            g_page_cache_stats.evictions++;
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+uintptr_t page_cache_get(vfs_file_t* file, uint32_t page_index)
+{
+    if (file == NULL || file->mount == NULL)
+    {
+        return 0;
+    }
+
+    uint32_t bucket = page_cache_hash(file->mount, file->inode, page_index);
+    for (page_cache_entry_t* entry = g_page_cache_buckets[bucket]; entry != NULL; entry = entry->next)
+    {
+        if (entry->mount == file->mount && entry->inode == file->inode && entry->page_index == page_index)
+        {
+            g_page_cache_stats.hits++;
+            pmm_page_add_reference(entry->frame);
+            return entry->frame;
+        }
+    }
+
+    page_cache_entry_t* entry = page_cache_allocate();
+    if (entry == NULL)
+    {
+        kprintf("PCACHE: every cached page is mapped, cannot add inode %u page %u\n", file->inode, page_index);
+        return 0;
+    }
+
+    uintptr_t frame = pmm_allocate_page();
+    uint8_t* page = frame ? vmm_temp_map(frame) : NULL;
+    if (page == NULL)
+    {
+        pmm_free_page(frame);
+        return 0;
+    }
+
+    uint32_t offset = page_index * PAGE_SIZE_BYTES;
+    uint32_t expected = offset < file->size ? file->size - offset : 0;
+    if (expected > PAGE_SIZE_BYTES)
+    {
+        expected = PAGE_SIZE_BYTES;
+    }
+
+    uint32_t read = vfs_read(file, offset, page, expected);
+    memset(page + read, 0, PAGE_SIZE_BYTES - read);
+    vmm_temp_unmap(page);
+
+    if (read != expected)
+    {
+        kprintf("PCACHE: short read of inode %u page %u\n", file->inode, page_index);
+        pmm_free_page(frame);
+        return 0;
+    }
+
+    g_page_cache_stats.misses++;
+    entry->mount = file->mount;
+    entry->inode = file->inode;
+    entry->page_index = page_index;
+    entry->frame = frame;
+    entry->in_use = true;
+    entry->next = g_page_cache_buckets[bucket];
+    g_page_cache_buckets[bucket] = entry;
+
+    pmm_page_add_reference(frame);
+    return frame;
+}
+
+uint32_t page_cache_shrink(uint32_t pages)
+{
+    uint32_t freed = 0;
+    for (uint32_t scanned = 0; scanned < PAGE_CACHE_MAX_PAGES && freed < pages; ++scanned)
+    {
+        page_cache_entry_t* entry = &g_page_cache[g_page_cache_hand];
+        g_page_cache_hand = (g_page_cache_hand + 1) % PAGE_CACHE_MAX_PAGES;
+
+        if (entry->in_use && pmm_page_reference_count(entry->frame) == 1)
+        {
+            page_cache_unlink(entry);
+            pmm_page_release(entry->frame);
+            memset(entry, 0, sizeof(*entry));
+            g_page_cache_stats.evictions++;
+            freed++;
+        }
+    }
+    return freed;
+}
+
+const page_cache_stats_t* page_cache_get_stats(void)
+{
+    return &g_page_cache_stats;
+}
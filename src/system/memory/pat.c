@@ -0,0 +1,77 @@
+/**
+ * @file system/memory/pat.c
+ * @brief Page Attribute Table programming.
+ */
+
+#include <pat.h>
+#include <x86.h>
+#include <stdio.h>
+
+#define PAT_MSR              0x277u
+#define PAT_CPUID_FEATURE    (1u << 16) /**< CPUID.1:EDX.PAT */
+
+#define PAT_TYPE_UC          0x00u
+#define PAT_TYPE_WC          0x01u
+#define PAT_TYPE_WT          0x04u
+#define PAT_TYPE_WB          0x06u
+#define PAT_TYPE_UC_MINUS    0x07u
+
+#define PAT_WRITE_COMBINING_INDEX 4
+
+#define PAT_PTE_BIT          0x080u  /**< PAT selector bit in a 4 KiB PTE. */
+#define PAT_LARGE_PDE_BIT    0x1000u /**< PAT selector bit in a 4 MiB PDE. */
+
+static bool g_pat_supported;
+
+void KERNEL_INIT pat_init(void)
+{
+    uint32_t registers[4];
+    x86_cpuid(1, registers);
+    g_pat_supported = (registers[3] & PAT_CPUID_FEATURE) != 0;
+    if (!g_pat_supported)
+    {
+        kprintf("PAT: not supported, write-combining mappings fall back to the MTRR type\n");
+        return;
+    }
+
+    uint64_t pat = x86_read_msr(PAT_MSR);
+    pat &= ~(0xffull << (PAT_WRITE_COMBINING_INDEX * 8));
+    pat |= (uint64_t)PAT_TYPE_WC << (PAT_WRITE_COMBINING_INDEX * 8);
+
+    // Nothing uses index 4 yet, but flush anyway so no stale line outlives the change.
+    x86_flush_caches();
+    x86_write_msr(PAT_MSR, pat);
+    x86_flush_caches();
+    x86_reload_page_directory();
+}
+
+bool pat_supported(void)
+{
+    return g_pat_supported;
+}
+
+uint32_t pat_page_table_flags(enum page_cache_mode_t mode)
+{
+    switch (mode)
+    {
+    case CACHE_WRITE_THROUGH:
+        return PAGE_WRITE_THROUGH;
+    case CACHE_UNCACHED:
+        return PAGE_CACHE_DISABLED | PAGE_WRITE_THROUGH;
+    case CACHE_WRITE_COMBINING:
+        return g_pat_supported ? PAT_PTE_BIT : 0;
+    case CACHE_WRITE_BACK:
+    default:
+        return 0;
+    }
+}
+
+uint32_t pat_large_page_flags(enum page_cache_mode_t mode)
+{
+    uint32_t flags = pat_page_table_flags(mode);
+    if (flags & PAT_PTE_BIT)
+    {
+        flags = (flags & ~PAT_PTE_BIT) | PAT_LARGE_PDE_BIT;
+    }
+    return flags;
+}
@@ -6,11 +6,19 @@
 
 #include <meminit.h>
 #include <memory.h>
+#include <swap.h>
+#include <x86.h>
 
 #define BLOCK_SIZE          PAGE_SIZE_BYTES
 #define PAGE_SIZE           PAGE_SIZE_BYTES
 #define PAGE_SIZE_DWORDS    1024
 #define PAGES_PER_BYTE      8
+#define PMM_REFCOUNT_VIRTUAL_BASE 0xd4800000u /**< Kernel window holding the frame reference counts. */
+#define PMM_LARGE_PAGE_DWORDS     32          /**< Bitmap words covering one 4 MiB run. */
+#define PMM_REFCOUNT_PINNED       0xffffu     /**< Frame is never released (e.g. the zero page). */
+#define PMM_MAX_PAGE_COLORS       256         /**< Upper bound on cache colors tracked. */
+#define PMM_CPUID_CACHE_LEAF      0x4         /**< Intel deterministic cache parameters. */
+#define PMM_CPUID_AMD_CACHE_LEAF  0x8000001du /**< AMD equivalent of leaf 4. */
 
 extern uint32_t kernel_pmm_virtual_start;    // location of pmm bitmap
 extern uint32_t kernel_pmm_physical_end;
@@ -39,6 +47,23 @@ static uint32_t bitmap_size_bytes;
 static uint32_t bitmap_dwords;
 static uint32_t free_pages = 0;
 
+/**
+ * @brief Per-frame reference counts, used for frames shared between address spaces.
+ * NULL until pmm_init_reference_counts() has run; frames handed out before that
+ * belong to the kernel and are never released through the reference count.
+ */
+static uint16_t* pmm_refcounts = NULL;
+
+/** @brief Page colors of the last-level cache (1 when unknown). */
+static uint32_t pmm_page_colors = 1;
+/** @brief Size of the last-level cache in bytes (0 when unknown). */
+static uint32_t pmm_cache_bytes;
+/** @brief Hand out frames whose color matches the virtual page. */
+static bool pmm_coloring_enabled;
+/** @brief Where the search for a frame of each color resumes. */
+static uint32_t pmm_color_cursor[PMM_MAX_PAGE_COLORS];
+static pmm_color_stats_t pmm_color_stats;
+
 /**
  * @brief Mark a page frame as free in the bitmap.
  */
@@ -81,6 +106,117 @@ static uint32_t page_number_from_address(uint32_t address)
     return address >> PAGE_OFFSET_BITS;
 }
 
+/**
+ * @brief Return a page frame previously obtained from pmm_allocate_page.
+ */
+void pmm_free_page(uintptr_t physical_address)
+{
+    if(physical_address == 0)
+    {
+        return;
+    }
+
+    uint32_t page_number = page_number_from_address(physical_address);
+    if(pmm_refcounts != NULL && page_number < pmm_max_blocks)
+    {
+        pmm_refcounts[page_number] = 0;
+    }
+
+    pmm_mark_page_free(page_number);
+}
+
+/**
+ * @brief Number of free page frames.
+ */
+uint32_t pmm_free_page_count(void)
+{
+    return free_pages;
+}
+
+/**
+ * @brief Allocate and map the frame reference-count array.
+ *
+ * Must run after the kernel page directory (and its recursive slot) is live.
+ */
+void KERNEL_INIT pmm_init_reference_counts(void)
+{
+    uint32_t bytes = pmm_max_blocks * sizeof(uint16_t);
+    uint32_t pages = (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint8_t* base = (uint8_t*) PMM_REFCOUNT_VIRTUAL_BASE;
+
+    for(uint32_t i = 0; i < pages; i++)
+    {
+        uintptr_t frame = pmm_allocate_page();
+        if(frame == 0 || !vmm_map_kernel_page(frame, base + i * PAGE_SIZE, CACHE_WRITE_BACK))
+        {
+            kprintf("PMM: unable to allocate reference counts\n");
+            return;
+        }
+    }
+
+    memset(base, 0, pages * PAGE_SIZE);
+    pmm_refcounts = (uint16_t*) base;
+}
+
+/**
+ * @brief Record an additional owner of a page frame.
+ */
+void pmm_page_add_reference(uintptr_t physical_address)
+{
+    uint32_t page_number = page_number_from_address(physical_address);
+    if(pmm_refcounts != NULL && page_number < pmm_max_blocks
+       && pmm_refcounts[page_number] != PMM_REFCOUNT_PINNED)
+    {
+        pmm_refcounts[page_number]++;
+    }
+}
+
+/**
+ * @brief Mark a frame as permanently shared so reference counting never frees it.
+ */
+void pmm_page_pin(uintptr_t physical_address)
+{
+    uint32_t page_number = page_number_from_address(physical_address);
+    if(pmm_refcounts != NULL && page_number < pmm_max_blocks)
+    {
+        pmm_refcounts[page_number] = PMM_REFCOUNT_PINNED;
+    }
+}
+
+/**
+ * @brief Number of owners of a page frame (1 if not tracked).
+ */
+uint32_t pmm_page_reference_count(uintptr_t physical_address)
+{
+    uint32_t page_number = page_number_from_address(physical_address);
+    if(pmm_refcounts == NULL || page_number >= pmm_max_blocks || pmm_refcounts[page_number] == 0)
+    {
+        return 1;
+    }
+    return pmm_refcounts[page_number];
+}
+
+/**
+ * @brief Drop one owner of a page frame, freeing it when the last owner goes.
+ */
+void pmm_page_release(uintptr_t physical_address)
+{
+    uint32_t page_number = page_number_from_address(physical_address);
+    if(pmm_refcounts != NULL && page_number < pmm_max_blocks
+       && pmm_refcounts[page_number] == PMM_REFCOUNT_PINNED)
+    {
+        return;
+    }
+
+    if(pmm_refcounts != NULL && page_number < pmm_max_blocks && pmm_refcounts[page_number] > 1)
+    {
+        pmm_refcounts[page_number]--;
+        return;
+    }
+
+    pmm_free_page(physical_address);
+}
+
 static uint32_t round_up_to_nearest_page_start(uint32_t address)
 {
     if((address & 0xfffff000) != address)
@@ -103,7 +239,7 @@ static uint32_t round_down_to_nearest_page_start(uint32_t address)
  * @param memsize Physical memory size reported by Multiboot (KB).
  * @return Number of free pages discovered.
  */
-uint32_t pmm_init_allocator(uint32_t memsize)
+uint32_t KERNEL_INIT pmm_init_allocator(uint32_t memsize)
 {
     //kprintf("Mem size: 0x%08x\n", memsize * 1024);
     pmm_memory_size = memsize;
@@ -160,16 +296,126 @@ uint32_t pmm_init_allocator(uint32_t memsize)
     {
         pmm_mark_page_reserved(i);
     }
+
+    // The boot information stays readable until memory_free_init() releases it.
+    multiboot_info* mbi = multiboot_get_info();
+    if(mbi->tags_size != 0)
+    {
+        uint32_t first_info_page = page_number_from_address(round_down_to_nearest_page_start(mbi->tags_addr));
+        uint32_t one_past_last_info_page = page_number_from_address(round_up_to_nearest_page_start(mbi->tags_addr + mbi->tags_size));
+        for(uint32_t i = first_info_page; i < one_past_last_info_page && i < pmm_max_blocks; i++)
+        {
+            pmm_mark_page_reserved(i);
+        }
+    }
+
+    // Modules stay reserved for whoever claims them (the RAM disk keeps its image in place).
+    for(uint32_t m = 0; m < mbi->module_count; m++)
+    {
+        uint32_t first_module_page = page_number_from_address(round_down_to_nearest_page_start(mbi->modules[m].start));
+        uint32_t one_past_last_module_page = page_number_from_address(round_up_to_nearest_page_start(mbi->modules[m].end));
+        for(uint32_t i = first_module_page; i < one_past_last_module_page && i < pmm_max_blocks; i++)
+        {
+            pmm_mark_page_reserved(i);
+        }
+    }
  
     return free_pages;
 }
 
 /**
- * @brief Allocate a free 4 KiB page frame.
+ * @brief Hand frames reserved during boot back to the allocator.
  *
- * @return Physical address of the page or 0 if none available.
+ * Only whole frames inside the range that are still reserved are released.
+ * Below 4 MiB they lose their USER alias in the boot mapping first.
+ *
+ * @return Number of frames freed.
  */
-uintptr_t pmm_allocate_page()
+uint32_t pmm_free_boot_range(uintptr_t physical_start, uintptr_t physical_end)
+{
+    uint32_t first_page = page_number_from_address(round_up_to_nearest_page_start(physical_start));
+    uint32_t one_past_last_page = page_number_from_address(round_down_to_nearest_page_start(physical_end));
+    uint32_t freed = 0;
+
+    vmm_revoke_user_low_memory(physical_start, physical_end);
+
+    for(uint32_t page_number = first_page; page_number < one_past_last_page && page_number < pmm_max_blocks; page_number++)
+    {
+        if(page_number != 0 && (pmm_bitmap[page_number >> 5] & (1u << (page_number & 31))) == 0)
+        {
+            pmm_free_page((uintptr_t) page_number << PAGE_OFFSET_BITS);
+            freed++;
+        }
+    }
+    return freed;
+}
+
+/**
+ * @brief Bytes of the static bitmap actually covering installed memory.
+ */
+uint32_t pmm_bitmap_bytes(void)
+{
+    return bitmap_dwords * sizeof(uint32_t);
+}
+
+/**
+ * @brief Allocate 1024 contiguous frames starting on a 4 MiB boundary.
+ *
+ * Each frame gets its own reference count of 1, so the run can later be
+ * split into ordinary 4 KiB pages and released one frame at a time.
+ *
+ * @return Physical address of the run or 0 if no aligned free run exists.
+ */
+uintptr_t pmm_allocate_large_page(void)
+{
+    // Start at 4 MiB: the first run always holds the kernel image.
+    for(uint32_t index = PMM_LARGE_PAGE_DWORDS; index + PMM_LARGE_PAGE_DWORDS <= bitmap_dwords; index += PMM_LARGE_PAGE_DWORDS)
+    {
+        bool all_free = true;
+        for(uint32_t j = 0; j < PMM_LARGE_PAGE_DWORDS; j++)
+        {
+            if(pmm_bitmap[index + j] != 0xffffffff)
+            {
+                all_free = false;
+                break;
+            }
+        }
+
+        if(!all_free)
+        {
+            continue;
+        }
+
+        uint32_t first_page = index * 32;
+        for(uint32_t page_number = first_page; page_number < first_page + PAGE_SIZE_DWORDS; page_number++)
+        {
+            pmm_mark_page_reserved(page_number);
+            if(pmm_refcounts != NULL)
+            {
+                pmm_refcounts[page_number] = 1;
+            }
+        }
+        return (uintptr_t) (first_page << PAGE_OFFSET_BITS);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Return a run obtained from pmm_allocate_large_page.
+ */
+void pmm_free_large_page(uintptr_t physical_address)
+{
+    for(uint32_t i = 0; i < PAGE_SIZE_DWORDS; i++)
+    {
+        pmm_free_page(physical_address + i * PAGE_SIZE);
+    }
+}
+
+/**
+ * @brief Take the first free frame from the bitmap.
+ */
+static uintptr_t pmm_take_free_page(void)
 {
     for(uint32_t index = 0; index < bitmap_dwords; index++)
     {
@@ -182,6 +428,10 @@ uintptr_t pmm_allocate_page()
                 {
                     uint32_t page_number = index * 32 + bit;
                     pmm_mark_page_reserved(page_number);
+                    if(pmm_refcounts != NULL)
+                    {
+                        pmm_refcounts[page_number] = 1;
+                    }
                     uintptr_t page_start = (uintptr_t) (page_number << PAGE_OFFSET_BITS);
                     return page_start;
                 }
@@ -191,3 +441,174 @@ uintptr_t pmm_allocate_page()
 
     return 0;
 }
+
+/**
+ * @brief Allocate a free 4 KiB page frame.
+ *
+ * Never reclaims, so it never waits for a disk: IRQ handlers, kernel-half
+ * faults, page tables, drivers and the block and buffer caches use this.
+ *
+ * @return Physical address of the page or 0 if none available.
+ */
+uintptr_t pmm_allocate_page()
+{
+    return pmm_take_free_page();
+}
+
+/**
+ * @brief Allocate a free 4 KiB page frame, reclaiming if memory is exhausted.
+ *
+ * Reclaim (page cache, then swap) is asked to free a batch of frames before
+ * giving up. Swapping out waits for the disk with interrupts enabled, so
+ * only user page faults (anonymous, copy-on-write, swap-in) may call this,
+ * and only when the fault is not taken inside an IRQ handler.
+ *
+ * @return Physical address of the page or 0 if none available.
+ */
+uintptr_t pmm_allocate_page_reclaim(void)
+{
+    uintptr_t page = pmm_take_free_page();
+    if(page == 0 && swap_reclaim(SWAP_RECLAIM_BATCH) > 0)
+    {
+        page = pmm_take_free_page();
+    }
+    return page;
+}
+
+/**
+ * @brief Bytes covered by one way of the largest cache described by a CPUID cache leaf.
+ *
+ * @param total Receives the full size of that cache.
+ */
+static uint32_t pmm_cache_way_size(uint32_t leaf, uint32_t* total)
+{
+    uint32_t way_size = 0;
+    for(uint32_t index = 0; index < 8; index++)
+    {
+        uint32_t regs[4];
+        x86_cpuid_count(leaf, index, regs);
+
+        uint32_t type = regs[0] & 0x1f;
+        if(type == 0)
+        {
+            break;
+        }
+        if(type == 2)
+        {
+            continue; // instruction cache
+        }
+
+        uint32_t line_size = (regs[1] & 0xfff) + 1;
+        uint32_t partitions = ((regs[1] >> 12) & 0x3ff) + 1;
+        uint32_t sets = regs[2] + 1;
+        uint32_t ways = ((regs[1] >> 22) & 0x3ff) + 1;
+        uint32_t size = line_size * partitions * sets;
+        if(size * ways > *total)
+        {
+            way_size = size;
+            *total = size * ways;
+        }
+    }
+    return way_size;
+}
+
+/**
+ * @brief Work out how many page colors the last-level cache has.
+ *
+ * The color of a frame is the part of its page number that also indexes
+ * the cache sets: one way of the cache divided by the page size.
+ */
+void KERNEL_INIT pmm_init_page_colors(void)
+{
+    uint32_t regs[4];
+    uint32_t way_size = 0;
+
+    x86_cpuid(0, regs);
+    if(regs[0] >= PMM_CPUID_CACHE_LEAF)
+    {
+        way_size = pmm_cache_way_size(PMM_CPUID_CACHE_LEAF, &pmm_cache_bytes);
+    }
+
+    x86_cpuid(0x80000000u, regs);
+    if(way_size == 0 && regs[0] >= PMM_CPUID_AMD_CACHE_LEAF)
+    {
+        way_size = pmm_cache_way_size(PMM_CPUID_AMD_CACHE_LEAF, &pmm_cache_bytes);
+    }
+
+    uint32_t colors = 1;
+    while(colors * 2 <= way_size / PAGE_SIZE && colors * 2 <= PMM_MAX_PAGE_COLORS)
+    {
+        colors *= 2;
+    }
+    pmm_page_colors = colors;
+    kprintf("PMM: %u page colors (last-level cache %u KiB, way %u KiB)\n",
+            colors, pmm_cache_bytes / 1024, way_size / 1024);
+}
+
+uint32_t pmm_page_color_count(void)
+{
+    return pmm_page_colors;
+}
+
+uint32_t pmm_cache_size(void)
+{
+    return pmm_cache_bytes;
+}
+
+void pmm_set_page_coloring(bool enabled)
+{
+    pmm_coloring_enabled = enabled && pmm_page_colors > 1;
+}
+
+/**
+ * @brief Allocate a frame for a user page, matching its cache color when coloring is on.
+ *
+ * Falls back to pmm_allocate_page_reclaim() when no free frame of the
+ * wanted color exists, so the same context rules apply.
+ *
+ * @param virtual_address Address the frame will be mapped at.
+ * @return Physical address of the page or 0 if none available.
+ */
+uintptr_t pmm_allocate_colored_page(uint32_t virtual_address)
+{
+    if(!pmm_coloring_enabled)
+    {
+        return pmm_allocate_page_reclaim();
+    }
+
+    uint32_t color = (virtual_address >> PAGE_OFFSET_BITS) & (pmm_page_colors - 1);
+    uint32_t start = pmm_color_cursor[color];
+    if((start & (pmm_page_colors - 1)) != color || start >= pmm_max_blocks)
+    {
+        start = color;
+    }
+    uint32_t page_number = start;
+    do
+    {
+        if(pmm_bitmap[page_number >> 5] & (1u << (page_number & 31)))
+        {
+            pmm_mark_page_reserved(page_number);
+            if(pmm_refcounts != NULL)
+            {
+                pmm_refcounts[page_number] = 1;
+            }
+            pmm_color_cursor[color] = page_number;
+            pmm_color_stats.colored++;
+            return (uintptr_t) (page_number << PAGE_OFFSET_BITS);
+        }
+
+        page_number += pmm_page_colors;
+        if(page_number >= pmm_max_blocks)
+        {
+            page_number = color;
+        }
+    } while(page_number != start);
+
+    pmm_color_stats.fallbacks++;
+    return pmm_allocate_page_reclaim();
+}
+
+const pmm_color_stats_t* pmm_get_color_stats(void)
+{
+    return &pmm_color_stats;
+}
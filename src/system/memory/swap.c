@@ -0,0 +1,488 @@
+/**
+ * @file system/memory/swap.c
+ * @brief Clock-based reclaim of anonymous pages to a swap partition.
+ */
+
+#include <swap.h>
+#include <address_space.h>
+#include <meminit.h>
+#include <memory.h>
+#include <page_cache.h>
+#include <vma.h>
+#include <x86.h>
+#include <stdio.h>
+#include <stddef.h>
+
+#define SWAP_SIGNATURE             "SWAPSPACE2"
+#define SWAP_SIGNATURE_LENGTH      10
+#define SWAP_HEADER_VERSION        1
+#define SWAP_HEADER_INFO_OFFSET    1024 /**< version, last_page, nr_badpages follow the boot block. */
+#define SWAP_HEADER_BADPAGE_OFFSET 1536 /**< List of unusable slots. */
+#define SWAP_SECTOR_SIZE           512
+#define SWAP_SECTORS_PER_SLOT      (PAGE_SIZE_BYTES / SWAP_SECTOR_SIZE)
+#define SWAP_SLOT_BAD              0xffu /**< Slot listed as bad in the header. */
+#define SWAP_SLOT_MAX_REFERENCES   0xfeu
+#define SWAP_ENTRY_FLAGS           (PAGE_WRITABLE | PAGE_USER | PAGE_COPY_ON_WRITE)
+#define SWAP_ENTRY_SLOT(pte)       ((pte) >> PAGE_OFFSET_BITS)
+
+typedef struct {
+    block_device_t* device;
+    uint64_t        lba_start;
+    uint32_t        slots;     /**< Slots in the area, slot 0 is the header. */
+    uint32_t        cursor;    /**< Next slot tried by the allocator. */
+} swap_area_t;
+
+static swap_area_t g_swap_area;
+/** @brief Number of PTEs referring to each slot (SWAP_SLOT_BAD for unusable slots). */
+static uint8_t g_swap_slots[SWAP_MAX_SLOTS];
+/** @brief Landing buffer for clustered swap-in reads (and the header at probe time). */
+static uint8_t g_swap_cluster[SWAP_CLUSTER_PAGES * PAGE_SIZE_BYTES];
+static swap_stats_t g_swap_stats;
+/** @brief Set while reclaim runs so allocations made by reclaim itself cannot recurse. */
+static bool g_swap_reclaiming;
+/** @brief Clock hand: address space slot and user address the next scan starts at. */
+static uint32_t g_swap_clock_space = 1;
+static uint32_t g_swap_clock_address;
+
+bool KERNEL_INIT swap_probe_partition(block_device_t* device, uint64_t lba_start, uint64_t sector_count)
+{
+    if (device == NULL || device->read == NULL || device->sector_size != SWAP_SECTOR_SIZE)
+    {
+        return false;
+    }
+
+    uint8_t* header = g_swap_cluster;
+    if (!device->read(device, lba_start, SWAP_SECTORS_PER_SLOT, header))
+    {
+        kprintf("SWAP: %s -> unable to read swap header\n", device->name);
+        return false;
+    }
+
+    if (memcmp(header + PAGE_SIZE_BYTES - SWAP_SIGNATURE_LENGTH, SWAP_SIGNATURE, SWAP_SIGNATURE_LENGTH) != 0)
+    {
+        kprintf("SWAP: %s lba=%llu -> no swap signature\n", device->name, (unsigned long long)lba_start);
+        return false;
+    }
+
+    const uint32_t* info = (const uint32_t*)(header + SWAP_HEADER_INFO_OFFSET);
+    if (info[0] != SWAP_HEADER_VERSION)
+    {
+        kprintf("SWAP: %s -> unsupported swap header version %u\n", device->name, info[0]);
+        return false;
+    }
+
+    if (g_swap_area.device != NULL)
+    {
+        kprintf("SWAP: %s -> ignored, a swap area is already active\n", device->name);
+        return true;
+    }
+
+    if (device->write == NULL)
+    {
+        kprintf("SWAP: %s -> device is read-only\n", device->name);
+        return false;
+    }
+
+    uint64_t slots = sector_count / SWAP_SECTORS_PER_SLOT;
+    if (info[1] != 0 && (uint64_t)info[1] + 1 < slots)
+    {
+        slots = (uint64_t)info[1] + 1;
+    }
+    if (slots > SWAP_MAX_SLOTS)
+    {
+        slots = SWAP_MAX_SLOTS;
+    }
+    if (slots < 2)
+    {
+        return false;
+    }
+
+    memset(g_swap_slots, 0, sizeof(g_swap_slots));
+    g_swap_slots[0] = SWAP_SLOT_BAD;
+
+    uint32_t usable = (uint32_t)slots - 1;
+    const uint32_t* bad = (const uint32_t*)(header + SWAP_HEADER_BADPAGE_OFFSET);
+    uint32_t bad_count = info[2];
+    uint32_t bad_limit = (PAGE_SIZE_BYTES - SWAP_SIGNATURE_LENGTH - SWAP_HEADER_BADPAGE_OFFSET) / sizeof(uint32_t);
+    for (uint32_t i = 0; i < bad_count && i < bad_limit; ++i)
+    {
+        if (bad[i] != 0 && bad[i] < slots && g_swap_slots[bad[i]] != SWAP_SLOT_BAD)
+        {
+            g_swap_slots[bad[i]] = SWAP_SLOT_BAD;
+            usable--;
+        }
+    }
+
+    g_swap_area.device = device;
+    g_swap_area.lba_start = lba_start;
+    g_swap_area.slots = (uint32_t)slots;
+    g_swap_area.cursor = 1;
+    g_swap_stats.slots_total = usable;
+    g_swap_stats.slots_used = 0;
+
+    kprintf("SWAP: %s lba=%llu using %u pages (%u KiB)\n",
+            device->name,
+            (unsigned long long)lba_start,
+            usable,
+            usable * (PAGE_SIZE_BYTES / 1024));
+    return true;
+}
+
+bool swap_enabled(void)
+{
+    return g_swap_area.device != NULL;
+}
+
+/**
+ * @brief Take the next free slot after the cursor.
+ *
+ * Allocating in order keeps pages evicted together next to each other on
+ * disk, which is what makes clustered swap-in worthwhile.
+ *
+ * @return Slot number or 0 if swap is full.
+ */
+static uint32_t swap_slot_allocate(void)
+{
+    for (uint32_t tried = 0; tried < g_swap_area.slots; ++tried)
+    {
+        uint32_t slot = g_swap_area.cursor;
+        g_swap_area.cursor = (slot + 1 < g_swap_area.slots) ? slot + 1 : 1;
+
+        if (g_swap_slots[slot] == 0)
+        {
+            g_swap_slots[slot] = 1;
+            g_swap_stats.slots_used++;
+            return slot;
+        }
+    }
+    return 0;
+}
+
+static void swap_slot_put(uint32_t slot)
+{
+    if (slot == 0 || slot >= g_swap_area.slots
+        || g_swap_slots[slot] == 0 || g_swap_slots[slot] == SWAP_SLOT_BAD)
+    {
+        return;
+    }
+
+    if (--g_swap_slots[slot] == 0)
+    {
+        g_swap_stats.slots_used--;
+    }
+}
+
+void swap_entry_duplicate(uint32_t pte)
+{
+    uint32_t slot = SWAP_ENTRY_SLOT(pte);
+    if (swap_is_entry(pte) && slot != 0 && slot < g_swap_area.slots
+        && g_swap_slots[slot] != 0 && g_swap_slots[slot] < SWAP_SLOT_MAX_REFERENCES)
+    {
+        g_swap_slots[slot]++;
+    }
+}
+
+void swap_entry_free(uint32_t pte)
+{
+    if (swap_is_entry(pte))
+    {
+        swap_slot_put(SWAP_ENTRY_SLOT(pte));
+    }
+}
+
+static bool swap_write_slot(uint32_t slot, const void* page)
+{
+    block_device_t* device = g_swap_area.device;
+    return device->write(device,
+                         g_swap_area.lba_start + (uint64_t)slot * SWAP_SECTORS_PER_SLOT,
+                         SWAP_SECTORS_PER_SLOT,
+                         page);
+}
+
+static bool swap_read_slots(uint32_t first, uint32_t count, void* buffer)
+{
+    block_device_t* device = g_swap_area.device;
+    return device->read(device,
+                        g_swap_area.lba_start + (uint64_t)first * SWAP_SECTORS_PER_SLOT,
+                        count * SWAP_SECTORS_PER_SLOT,
+                        buffer);
+}
+
+/**
+ * @brief Write one private anonymous frame to swap and turn its PTE into a swap entry.
+ */
+static bool swap_out_page(uint32_t* pte, uintptr_t frame)
+{
+    uint32_t slot = swap_slot_allocate();
+    if (slot == 0)
+    {
+        return false;
+    }
+
+    void* page = vmm_temp_map(frame);
+    if (page == NULL)
+    {
+        swap_slot_put(slot);
+        return false;
+    }
+
+    bool written = swap_write_slot(slot, page);
+    vmm_temp_unmap(page);
+    if (!written)
+    {
+        kprintf("SWAP: write of slot %u failed\n", slot);
+        swap_slot_put(slot);
+        return false;
+    }
+
+    *pte = (slot << PAGE_OFFSET_BITS) | PAGE_SWAPPED | (*pte & SWAP_ENTRY_FLAGS);
+    pmm_page_release(frame);
+    g_swap_stats.pages_out++;
+    return true;
+}
+
+/**
+ * @brief Advance the clock hand through one user page table of an address space.
+ *
+ * @param index  PTE to start at; left at the PTE to resume from (1024 once the table is done).
+ * @param wanted Frames still wanted.
+ * @param failed Set if swap is full or a write failed.
+ * @return Frames released.
+ */
+static uint32_t swap_scan_table(address_space_t* space, uint32_t directory_entry,
+                                uint32_t* index, uint32_t wanted, bool* failed)
+{
+    uint32_t pde = space->page_directory[directory_entry];
+    if ((pde & (PAGE_PRESENT | PAGE_LARGE)) != PAGE_PRESENT)
+    {
+        *index = 1024;
+        return 0;
+    }
+
+    page_table_t pt = (page_table_t) vmm_temp_map(pde & PAGE_FRAME_MASK);
+    if (pt == NULL)
+    {
+        *index = 1024;
+        return 0;
+    }
+
+    bool active = (space == address_space_current());
+    uint32_t freed = 0;
+    for (; *index < 1024 && freed < wanted; ++*index)
+    {
+        uint32_t pte = pt[*index];
+        void* address = (void*)(directory_entry * PAGE_TABLE_COVERAGE + *index * PAGE_SIZE_BYTES);
+        if ((pte & (PAGE_PRESENT | PAGE_USER | PAGE_DEVICE)) != (PAGE_PRESENT | PAGE_USER))
+        {
+            continue;
+        }
+
+        g_swap_stats.scanned++;
+        if (pte & PAGE_ACCESSED)
+        {
+            // Second chance: the page survives until the hand comes round again.
+            pt[*index] = pte & ~PAGE_ACCESSED;
+            if (active)
+            {
+                x86_invalidate_page(address);
+            }
+            continue;
+        }
+
+        // Shared frames, the zero page and file pages (the page cache holds
+        // a reference) are left alone; only private anonymous memory swaps.
+        uintptr_t frame = pte & PAGE_FRAME_MASK;
+        if (pmm_page_reference_count(frame) != 1)
+        {
+            continue;
+        }
+
+        vma_t* vma = vma_find(space, (uint32_t) address);
+        if (vma == NULL || (vma->kind != VMA_ANONYMOUS && vma->kind != VMA_STACK))
+        {
+            continue;
+        }
+
+        if (!swap_out_page(&pt[*index], frame))
+        {
+            *failed = true;
+            break;
+        }
+        if (active)
+        {
+            x86_invalidate_page(address);
+        }
+        freed++;
+    }
+
+    vmm_temp_unmap(pt);
+    return freed;
+}
+
+static uint32_t swap_clock(uint32_t wanted)
+{
+    // Two full revolutions: the first may do nothing but clear accessed bits.
+    uint32_t budget = 2 * ADDRESS_SPACE_MAX * KERNEL_PAGE_TABLE_NUMBER;
+    uint32_t freed = 0;
+    bool failed = false;
+
+    while (freed < wanted && !failed && budget > 0)
+    {
+        address_space_t* space = address_space_get(g_swap_clock_space);
+        uint32_t directory_entry = PAGE_DIRECTORY_INDEX(g_swap_clock_address);
+        uint32_t index = PAGE_TABLE_INDEX(g_swap_clock_address);
+
+        if (space == NULL || space == address_space_kernel())
+        {
+            budget = budget > KERNEL_PAGE_TABLE_NUMBER ? budget - KERNEL_PAGE_TABLE_NUMBER : 0;
+            directory_entry = KERNEL_PAGE_TABLE_NUMBER - 1;
+            index = 1024;
+        }
+        else
+        {
+            budget--;
+            freed += swap_scan_table(space, directory_entry, &index, wanted - freed, &failed);
+        }
+
+        if (index < 1024)
+        {
+            g_swap_clock_address = directory_entry * PAGE_TABLE_COVERAGE + index * PAGE_SIZE_BYTES;
+        }
+        else if (directory_entry + 1 < KERNEL_PAGE_TABLE_NUMBER)
+        {
+            g_swap_clock_address = (directory_entry + 1) * PAGE_TABLE_COVERAGE;
+        }
+        else
+        {
+            g_swap_clock_address = 0;
+            g_swap_clock_space = (g_swap_clock_space + 1) % ADDRESS_SPACE_MAX;
+        }
+    }
+
+    return freed;
+}
+
+uint32_t swap_reclaim(uint32_t pages)
+{
+    if (g_swap_reclaiming || pages == 0)
+    {
+        return 0;
+    }
+
+    g_swap_reclaiming = true;
+
+    // Clean file pages cost nothing to drop, so they go first.
+    uint32_t freed = page_cache_shrink(pages);
+    if (freed < pages && swap_enabled())
+    {
+        freed += swap_clock(pages - freed);
+    }
+
+    g_swap_reclaiming = false;
+    return freed;
+}
+
+/**
+ * @brief Copy a page from the cluster buffer into a frame and map it in place of a swap entry.
+ *
+ * @return false (with the frame freed) if the frame could not be mapped for the copy.
+ */
+static bool swap_install(page_table_t pt, uint32_t directory_entry, uint32_t index,
+                         uintptr_t frame, const uint8_t* source)
+{
+    uint32_t pte = pt[index];
+    void* page = vmm_temp_map(frame);
+    if (page == NULL)
+    {
+        pmm_free_page(frame);
+        return false;
+    }
+    memcpy(page, source, PAGE_SIZE_BYTES);
+    vmm_temp_unmap(page);
+
+    pt[index] = frame | PAGE_PRESENT | (pte & SWAP_ENTRY_FLAGS);
+    swap_slot_put(SWAP_ENTRY_SLOT(pte));
+    x86_invalidate_page((void*)(directory_entry * PAGE_TABLE_COVERAGE + index * PAGE_SIZE_BYTES));
+    return true;
+}
+
+bool swap_fault(uint32_t address)
+{
+    uint32_t directory_entry = PAGE_DIRECTORY_INDEX(address);
+    page_directory_t pd = vmm_active_page_directory();
+    if (!swap_enabled() || (pd[directory_entry] & (PAGE_PRESENT | PAGE_LARGE)) != PAGE_PRESENT)
+    {
+        return false;
+    }
+
+    page_table_t pt = (page_table_t) vmm_page_table_virtual_address(directory_entry);
+    uint32_t index = PAGE_TABLE_INDEX(address);
+    if (!swap_is_entry(pt[index]))
+    {
+        return false;
+    }
+
+    // Allocate before reading: reclaim never touches swap entries, but it
+    // must not run while the cluster buffer holds data still to be copied.
+    uintptr_t frame = pmm_allocate_colored_page(address);
+    if (frame == 0)
+    {
+        return false;
+    }
+
+    uint32_t slot = SWAP_ENTRY_SLOT(pt[index]);
+    uint32_t first = slot & ~(SWAP_CLUSTER_PAGES - 1);
+    uint32_t count = g_swap_area.slots - first;
+    if (count > SWAP_CLUSTER_PAGES)
+    {
+        count = SWAP_CLUSTER_PAGES;
+    }
+
+    if (!swap_read_slots(first, count, g_swap_cluster))
+    {
+        kprintf("SWAP: read of slots %u-%u failed\n", first, first + count - 1);
+        pmm_free_page(frame);
+        return false;
+    }
+    g_swap_stats.cluster_reads++;
+
+    if (!swap_install(pt, directory_entry, index, frame, g_swap_cluster + (slot - first) * PAGE_SIZE_BYTES))
+    {
+        return false;
+    }
+    g_swap_stats.pages_in++;
+
+    // Neighbouring PTEs whose slots came in with the same read are restored
+    // too, as long as that does not itself force reclaim.
+    uint32_t low = index >= SWAP_CLUSTER_PAGES ? index - SWAP_CLUSTER_PAGES + 1 : 0;
+    uint32_t high = index + SWAP_CLUSTER_PAGES <= 1024 ? index + SWAP_CLUSTER_PAGES : 1024;
+    for (uint32_t i = low; i < high; ++i)
+    {
+        uint32_t pte = pt[i];
+        uint32_t neighbour = SWAP_ENTRY_SLOT(pte);
+        if (!swap_is_entry(pte) || neighbour < first || neighbour >= first + count)
+        {
+            continue;
+        }
+
+        if (pmm_free_page_count() <= SWAP_CLUSTER_PAGES)
+        {
+            break;
+        }
+
+        uintptr_t extra = pmm_allocate_colored_page(directory_entry * PAGE_TABLE_COVERAGE + i * PAGE_SIZE_BYTES);
+        if (extra == 0
+            || !swap_install(pt, directory_entry, i, extra, g_swap_cluster + (neighbour - first) * PAGE_SIZE_BYTES))
+        {
+            break;
+        }
+        g_swap_stats.prefetched++;
+    }
+
+    return true;
+}
+
+const swap_stats_t* swap_get_stats(void)
+{
+    return &g_swap_stats;
+}
@@ -0,0 +1,448 @@
+/**
+ * @file system/memory/vma.c
+ * @brief Per-address-space region tree (AVL) and the default fault routines.
+ */
+
+#include <vma.h>
+#include <address_space.h>
+#include <meminit.h>
+#include <memory.h>
+#include <paging.h>
+#include <stddef.h>
+
+/** @brief Region pool shared by every address space. */
+static vma_t g_vmas[VMA_MAX];
+/** @brief Unused pool entries, chained through `right`. */
+static vma_t* g_vma_free_list;
+
+static bool vma_anonymous_fault(vma_t* vma, uint32_t address, uint32_t error)
+{
+    return vmm_fault_anonymous(vma, address, error);
+}
+
+static bool vma_device_fault(vma_t* vma, uint32_t address, uint32_t error)
+{
+    (void)error;
+    uint32_t page = PAGE_ALIGN_DOWN(address);
+    return vmm_map_user_device_page(page,
+                                    vma->physical + (page - vma->start),
+                                    (vma->prot & VMA_WRITE) != 0,
+                                    vma->cache_mode);
+}
+
+static bool vma_file_fault(vma_t* vma, uint32_t address, uint32_t error)
+{
+    (void)vma;
+    (void)address;
+    (void)error;
+    // No pager has been attached to this region.
+    return false;
+}
+
+static const vma_ops_t g_vma_ops[] = {
+    [VMA_ANONYMOUS] = { "anonymous", vma_anonymous_fault, NULL, NULL },
+    [VMA_FILE]      = { "file",      vma_file_fault,      NULL, NULL },
+    [VMA_DEVICE]    = { "device",    vma_device_fault,    NULL, NULL },
+    [VMA_STACK]     = { "stack",     vma_anonymous_fault, NULL, NULL },
+};
+
+void KERNEL_INIT vma_init(void)
+{
+    memset(g_vmas, 0, sizeof(g_vmas));
+    g_vma_free_list = NULL;
+    for (uint32_t i = VMA_MAX; i > 0; --i)
+    {
+        g_vmas[i - 1].right = g_vma_free_list;
+        g_vma_free_list = &g_vmas[i - 1];
+    }
+}
+
+static vma_t* vma_allocate(void)
+{
+    vma_t* vma = g_vma_free_list;
+    if (vma == NULL)
+    {
+        kprintf("VMM: region pool exhausted\n");
+        return NULL;
+    }
+
+    g_vma_free_list = vma->right;
+    memset(vma, 0, sizeof(*vma));
+    vma->in_use = true;
+    vma->height = 1;
+    return vma;
+}
+
+static void vma_free(vma_t* vma)
+{
+    memset(vma, 0, sizeof(*vma));
+    vma->right = g_vma_free_list;
+    g_vma_free_list = vma;
+}
+
+static int32_t vma_height(const vma_t* node)
+{
+    return node ? node->height : 0;
+}
+
+static void vma_update_height(vma_t* node)
+{
+    int32_t left = vma_height(node->left);
+    int32_t right = vma_height(node->right);
+    node->height = (left > right ? left : right) + 1;
+}
+
+static vma_t* vma_rotate_right(vma_t* node)
+{
+    vma_t* pivot = node->left;
+    node->left = pivot->right;
+    pivot->right = node;
+    vma_update_height(node);
+    vma_update_height(pivot);
+    return pivot;
+}
+
+static vma_t* vma_rotate_left(vma_t* node)
+{
+    vma_t* pivot = node->right;
+    node->right = pivot->left;
+    pivot->left = node;
+    vma_update_height(node);
+    vma_update_height(pivot);
+    return pivot;
+}
+
+static vma_t* vma_rebalance(vma_t* node)
+{
+    vma_update_height(node);
+    int32_t balance = vma_height(node->left) - vma_height(node->right);
+
+    if (balance > 1)
+    {
+        if (vma_height(node->left->left) < vma_height(node->left->right))
+        {
+            node->left = vma_rotate_left(node->left);
+        }
+        return vma_rotate_right(node);
+    }
+
+    if (balance < -1)
+    {
+        if (vma_height(node->right->right) < vma_height(node->right->left))
+        {
+            node->right = vma_rotate_right(node->right);
+        }
+        return vma_rotate_left(node);
+    }
+
+    return node;
+}
+
+static vma_t* vma_insert_node(vma_t* root, vma_t* vma)
+{
+    if (root == NULL)
+    {
+        return vma;
+    }
+
+    if (vma->start < root->start)
+    {
+        root->left = vma_insert_node(root->left, vma);
+    }
+    else
+    {
+        root->right = vma_insert_node(root->right, vma);
+    }
+    return vma_rebalance(root);
+}
+
+static vma_t* vma_remove_minimum(vma_t* root, vma_t** minimum)
+{
+    if (root->left == NULL)
+    {
+        *minimum = root;
+        return root->right;
+    }
+
+    root->left = vma_remove_minimum(root->left, minimum);
+    return vma_rebalance(root);
+}
+
+static vma_t* vma_remove_node(vma_t* root, const vma_t* vma)
+{
+    if (root == NULL)
+    {
+        return NULL;
+    }
+
+    if (vma->start < root->start)
+    {
+        root->left = vma_remove_node(root->left, vma);
+    }
+    else if (vma->start > root->start)
+    {
+        root->right = vma_remove_node(root->right, vma);
+    }
+    else
+    {
+        if (root->left == NULL || root->right == NULL)
+        {
+            return root->left ? root->left : root->right;
+        }
+
+        vma_t* successor = NULL;
+        vma_t* right = vma_remove_minimum(root->right, &successor);
+        successor->left = root->left;
+        successor->right = right;
+        root = successor;
+    }
+    return vma_rebalance(root);
+}
+
+/**
+ * @brief Lowest region whose start is above an address.
+ */
+static vma_t* vma_find_above(struct address_space* space, uint32_t address)
+{
+    vma_t* node = space->vma_root;
+    vma_t* best = NULL;
+    while (node != NULL)
+    {
+        if (node->start > address)
+        {
+            best = node;
+            node = node->left;
+        }
+        else
+        {
+            node = node->right;
+        }
+    }
+    return best;
+}
+
+static bool vma_overlaps(struct address_space* space, uint32_t start, uint32_t end)
+{
+    if (vma_find(space, start) != NULL)
+    {
+        return true;
+    }
+
+    vma_t* above = vma_find_above(space, start);
+    return above != NULL && above->start < end;
+}
+
+vma_t* vma_map(struct address_space* space, uint32_t start, uint32_t length, uint32_t prot, vma_kind_t kind)
+{
+    uint32_t end = start + ((length + PAGE_SIZE_BYTES - 1) & ~(PAGE_SIZE_BYTES - 1));
+
+    if (space == NULL || length == 0 || (start & (PAGE_SIZE_BYTES - 1)) != 0
+        || end <= start || end > KERNEL_VIRTUAL_BASE)
+    {
+        return NULL;
+    }
+
+    if (vma_overlaps(space, start, end))
+    {
+        kprintf("VMM: region 0x%08x-0x%08x overlaps an existing mapping\n", start, end);
+        return NULL;
+    }
+
+    vma_t* vma = vma_allocate();
+    if (vma == NULL)
+    {
+        return NULL;
+    }
+
+    vma->start = start;
+    vma->end = end;
+    vma->prot = prot;
+    vma->kind = kind;
+    vma->ops = &g_vma_ops[kind];
+    if (kind == VMA_DEVICE)
+    {
+        vma->cache_mode = CACHE_UNCACHED;
+    }
+    else if (kind == VMA_STACK)
+    {
+        vma->grow_limit = end > VMA_STACK_GROW_LIMIT ? end - VMA_STACK_GROW_LIMIT : 0;
+    }
+
+    space->vma_root = vma_insert_node(space->vma_root, vma);
+    space->vma_count++;
+    return vma;
+}
+
+void vma_unmap(struct address_space* space, vma_t* vma)
+{
+    if (space == NULL || vma == NULL || !vma->in_use)
+    {
+        return;
+    }
+
+    if (vma->ops->close != NULL)
+    {
+        vma->ops->close(vma);
+    }
+
+    space->vma_root = vma_remove_node(space->vma_root, vma);
+    space->vma_count--;
+    vma_free(vma);
+}
+
+uint32_t vma_find_free(struct address_space* space, uint32_t base, uint32_t length)
+{
+    // Leave room below the top of the user half for the stack to grow into.
+    const uint32_t limit = KERNEL_VIRTUAL_BASE - VMA_STACK_GROW_LIMIT;
+    uint32_t size = (length + PAGE_SIZE_BYTES - 1) & ~(PAGE_SIZE_BYTES - 1);
+    uint32_t candidate = PAGE_ALIGN_DOWN(base + PAGE_SIZE_BYTES - 1);
+
+    if (space == NULL || size == 0 || size > limit)
+    {
+        return 0;
+    }
+
+    while (candidate != 0 && candidate <= limit - size)
+    {
+        vma_t* vma = vma_find(space, candidate);
+        if (vma != NULL)
+        {
+            candidate = vma->end;
+            continue;
+        }
+
+        vma_t* above = vma_find_above(space, candidate);
+        if (above == NULL || above->start - candidate >= size)
+        {
+            return candidate;
+        }
+        candidate = above->end;
+    }
+
+    return 0;
+}
+
+vma_t* vma_find(struct address_space* space, uint32_t address)
+{
+    vma_t* node = space ? space->vma_root : NULL;
+    while (node != NULL)
+    {
+        if (address < node->start)
+        {
+            node = node->left;
+        }
+        else if (address >= node->end)
+        {
+            node = node->right;
+        }
+        else
+        {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+vma_t* vma_find_for_fault(struct address_space* space, uint32_t address)
+{
+    vma_t* vma = vma_find(space, address);
+    if (vma != NULL || space == NULL)
+    {
+        return vma;
+    }
+
+    // The gap below a stack belongs to nobody else, so moving its start down
+    // keeps the tree ordered.
+    vma = vma_find_above(space, address);
+    if (vma != NULL && vma->kind == VMA_STACK && address >= vma->grow_limit)
+    {
+        vma->start = PAGE_ALIGN_DOWN(address);
+        return vma;
+    }
+    return NULL;
+}
+
+bool vma_access_permitted(const vma_t* vma, uint32_t error)
+{
+    if (error & PAGE_FAULT_WRITE)
+    {
+        return (vma->prot & VMA_WRITE) != 0;
+    }
+    return (vma->prot & (VMA_READ | VMA_EXEC)) != 0;
+}
+
+bool vma_range_permitted(struct address_space* space, uint32_t start, uint32_t length, bool write)
+{
+    if (start >= KERNEL_VIRTUAL_BASE || length > KERNEL_VIRTUAL_BASE - start)
+    {
+        return false;
+    }
+
+    uint32_t end = start + length;
+    uint32_t error = write ? PAGE_FAULT_WRITE : 0;
+    for (uint32_t address = start; address < end;)
+    {
+        vma_t* vma = vma_find_for_fault(space, address);
+        if (vma == NULL || !vma_access_permitted(vma, error))
+        {
+            return false;
+        }
+        address = vma->end;
+    }
+    return true;
+}
+
+static bool vma_clone_tree(struct address_space* destination, const vma_t* node)
+{
+    if (node == NULL)
+    {
+        return true;
+    }
+
+    vma_t* copy = vma_allocate();
+    if (copy == NULL)
+    {
+        return false;
+    }
+
+    *copy = *node;
+    copy->left = NULL;
+    copy->right = NULL;
+    copy->height = 1;
+    if (copy->ops->open != NULL)
+    {
+        copy->ops->open(copy);
+    }
+    destination->vma_root = vma_insert_node(destination->vma_root, copy);
+    destination->vma_count++;
+
+    return vma_clone_tree(destination, node->left) && vma_clone_tree(destination, node->right);
+}
+
+bool vma_clone(struct address_space* destination, const struct address_space* source)
+{
+    return vma_clone_tree(destination, source->vma_root);
+}
+
+static void vma_free_tree(vma_t* node)
+{
+    if (node == NULL)
+    {
+        return;
+    }
+
+    vma_free_tree(node->left);
+    vma_free_tree(node->right);
+    if (node->ops->close != NULL)
+    {
+        node->ops->close(node);
+    }
+    vma_free(node);
+}
+
+void vma_destroy_all(struct address_space* space)
+{
+    vma_free_tree(space->vma_root);
+    space->vma_root = NULL;
+    space->vma_count = 0;
+}
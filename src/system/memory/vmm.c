@@ -10,11 +10,41 @@
 #include <memory.h>
 #include <isr.h>
 #include <x86.h>
+#include <address_space.h>
+#include <pat.h>
+#include <process.h>
+#include <vma.h>
+#include <swap.h>
 
+#define VMM_TEMP_MAP_BASE  0xd4400000u /**< Window used by vmm_temp_map. */
+#define VMM_TEMP_MAP_SLOTS 32
 
-#define KERNEL_PAGE_TABLE_NUMBER 768 /**< Kernel virtual address PDE index. */
-#define PAGE_OFFSET_BITS 12
-#define PAGE_SIZE_BYTES 4096
+#define VMM_DEFAULT_FAULT_AROUND_PAGES 16
+#define VMM_HUGE_PAGE_FLAGS (PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER | PAGE_LARGE)
+#define VMM_COLLAPSE_TABLES_PER_PASS 8 /**< Page tables the promotion pass inspects per call. */
+#define VMM_COLLAPSE_MIN_PRIVATE 512   /**< Private pages a table needs before it is promoted. */
+#define VMM_USER_ZERO_PAGE_FLAGS (PAGE_PRESENT | PAGE_USER | PAGE_COPY_ON_WRITE)
+#define VMM_PAGE_TABLE_POOL_SIZE 8 /**< Pre-zeroed frames kept for new page tables. */
+
+/** @brief Bitmap of temporary mapping slots currently in use. */
+static uint32_t vmm_temp_map_slots;
+/** @brief Shared read-only frame backing never-written user pages. */
+static uintptr_t vmm_zero_page;
+/** @brief Size of the aligned fault-around window in pages (power of two, 1 disables). */
+static uint32_t vmm_fault_around_pages = VMM_DEFAULT_FAULT_AROUND_PAGES;
+/** @brief Page fault counters. */
+static vmm_fault_stats_t vmm_fault_stats;
+/** @brief Back aligned 4 MiB anonymous blocks with PSE pages. */
+static bool vmm_huge_pages_enabled = true;
+/** @brief Next user PDE the promotion pass will inspect. */
+static uint32_t vmm_collapse_cursor;
+/** @brief One past the highest physical address reachable through the direct map. */
+static uintptr_t vmm_direct_map_end = PAGE_TABLE_COVERAGE;
+/** @brief Zero-filled frames ready to become page tables without a memset in the fault path. */
+static uintptr_t vmm_page_table_pool[VMM_PAGE_TABLE_POOL_SIZE];
+static uint32_t vmm_page_table_pool_count;
+
+static uintptr_t vmm_allocate_zeroed_frame(void);
 
 /**
  * @brief Construct a page directory entry.
@@ -85,7 +115,7 @@ void* vmm_page_table_virtual_address(uint16_t page_table_number)
 /**
  * @brief Create the initial kernel page directory and identity mappings.
  */
-page_directory_t vmm_initialize_kernel_page_directory()
+page_directory_t KERNEL_INIT vmm_initialize_kernel_page_directory()
 {
     page_directory_t pd = (page_directory_t) &PageDirectoryVirtualAddress;
     uint32_t pde = vmm_make_page_directory_entry((void*) &PageDirectoryPhysicalAddress, 
@@ -96,16 +126,17 @@ page_directory_t vmm_initialize_kernel_page_directory()
                                              READ_WRITE, 
                                              true);
 
-    pd[1023] = pde;
+    pd[RECURSIVE_PAGE_TABLE_NUMBER] = pde;
 
     void* page_table_physical_address = (void*)pmm_allocate_page();
-    pd[KERNEL_PAGE_TABLE_NUMBER] = vmm_make_page_directory_entry((void*) page_table_physical_address, 
+    address_space_set_kernel_pde(KERNEL_PAGE_TABLE_NUMBER,
+                                 vmm_make_page_directory_entry((void*) page_table_physical_address, 
                                                              FOUR_KB, 
                                                              false, 
                                                              false, 
                                                              USER, 
                                                              READ_WRITE, 
-                                                             true);
+                                                             true));
                                                              
     page_table_t pt = (page_table_t) vmm_page_table_virtual_address(KERNEL_PAGE_TABLE_NUMBER);
     for(uint16_t i = 0; i < 1024; i++)
@@ -123,6 +154,254 @@ page_directory_t vmm_initialize_kernel_page_directory()
     return pd;
 }
 
+/**
+ * @brief Make part of the boot mapping of physical 0-4 MiB supervisor-only.
+ *
+ * That page table is mapped USER because the first user program runs from
+ * the kernel image. Frames from it that go back to the allocator must not
+ * stay reachable from ring 3 once they hold other processes' data.
+ */
+void vmm_revoke_user_low_memory(uintptr_t physical_start, uintptr_t physical_end)
+{
+    page_table_t pt = (page_table_t) vmm_page_table_virtual_address(KERNEL_PAGE_TABLE_NUMBER);
+    uint32_t end = physical_end < PAGE_TABLE_COVERAGE ? physical_end : PAGE_TABLE_COVERAGE;
+
+    for(uintptr_t physical = PAGE_ALIGN_DOWN(physical_start); physical < end; physical += PAGE_SIZE_BYTES)
+    {
+        pt[physical >> PAGE_OFFSET_BITS] &= ~PAGE_USER;
+        x86_invalidate_page((void*) (DIRECT_MAP_BASE + physical));
+    }
+}
+
+/**
+ * @brief Extend the linear map of physical memory with 4 MiB pages.
+ *
+ * The boot page table already maps the first 4 MiB at DIRECT_MAP_BASE; the
+ * rest of RAM up to DIRECT_MAP_MAX_BYTES is added as large supervisor pages.
+ * The map stops early at the first kernel PDE that is already in use.
+ *
+ * @param memory_bytes Amount of physical memory installed.
+ */
+void KERNEL_INIT vmm_initialize_direct_map(uint32_t memory_bytes)
+{
+    page_directory_t pd = vmm_active_page_directory();
+    uint32_t end = memory_bytes > DIRECT_MAP_MAX_BYTES ? DIRECT_MAP_MAX_BYTES : memory_bytes;
+    end = (end + PAGE_TABLE_COVERAGE - 1) & ~(PAGE_TABLE_COVERAGE - 1);
+
+    uintptr_t physical = PAGE_TABLE_COVERAGE;
+    for(; physical < end; physical += PAGE_TABLE_COVERAGE)
+    {
+        uint32_t directory_entry = PAGE_DIRECTORY_INDEX(DIRECT_MAP_BASE + physical);
+        if(get_present_from_pde(pd[directory_entry]))
+        {
+            break;
+        }
+        address_space_set_kernel_pde(directory_entry, physical | PAGE_LARGE | PAGE_WRITABLE | PAGE_PRESENT);
+    }
+
+    vmm_direct_map_end = physical;
+    x86_reload_page_directory();
+    kprintf("VMM: direct map of physical 0x00000000-0x%08x at 0x%08x\n", vmm_direct_map_end, DIRECT_MAP_BASE);
+}
+
+void* phys_to_virt(uintptr_t physical_address)
+{
+    if(physical_address >= vmm_direct_map_end)
+    {
+        return NULL;
+    }
+    return (void*)(DIRECT_MAP_BASE + physical_address);
+}
+
+uintptr_t virt_to_phys(const void* virtual_address)
+{
+    uint32_t address = (uint32_t) virtual_address;
+    if(address >= DIRECT_MAP_BASE && address - DIRECT_MAP_BASE < vmm_direct_map_end)
+    {
+        return address - DIRECT_MAP_BASE;
+    }
+
+    uint32_t pde = vmm_active_page_directory()[PAGE_DIRECTORY_INDEX(address)];
+    if(!get_present_from_pde(pde))
+    {
+        return 0;
+    }
+    if(pde & PAGE_LARGE)
+    {
+        return (pde & ~(PAGE_TABLE_COVERAGE - 1)) | (address & (PAGE_TABLE_COVERAGE - 1));
+    }
+
+    uint32_t pte = ((page_table_t) vmm_page_table_virtual_address(PAGE_DIRECTORY_INDEX(address)))[PAGE_TABLE_INDEX(address)];
+    if(!get_present_from_pte(pte))
+    {
+        return 0;
+    }
+    return (pte & PAGE_FRAME_MASK) | (address & ~PAGE_FRAME_MASK);
+}
+
+/**
+ * @brief Recursive-mapping view of the active page directory.
+ */
+page_directory_t vmm_active_page_directory(void)
+{
+    return (page_directory_t) vmm_page_table_virtual_address(RECURSIVE_PAGE_TABLE_NUMBER);
+}
+
+/**
+ * @brief Take a frame for a new page table, preferably a pre-zeroed one from the pool.
+ *
+ * @param zeroed Set when the frame is already zero-filled.
+ */
+static uintptr_t vmm_take_page_table_frame(bool* zeroed)
+{
+    if(vmm_page_table_pool_count > 0)
+    {
+        *zeroed = true;
+        vmm_fault_stats.page_table_pool_hits++;
+        return vmm_page_table_pool[--vmm_page_table_pool_count];
+    }
+
+    *zeroed = false;
+    vmm_fault_stats.page_table_pool_misses++;
+    return pmm_allocate_page();
+}
+
+/**
+ * @brief Top the page-table pool back up.
+ *
+ * Called on the way out of each system call, away from the fault path, so
+ * the zeroing cost is not paid while a fault is being serviced.
+ */
+void vmm_refill_page_table_pool(void)
+{
+    while(vmm_page_table_pool_count < VMM_PAGE_TABLE_POOL_SIZE)
+    {
+        uintptr_t frame = vmm_allocate_zeroed_frame();
+        if(frame == 0)
+        {
+            return;
+        }
+        vmm_page_table_pool[vmm_page_table_pool_count++] = frame;
+    }
+}
+
+/**
+ * @brief Look up (and optionally create) the page table covering a PDE slot.
+ *
+ * User page tables are private to the active address space; kernel page
+ * tables are installed in every address space so the kernel half stays shared.
+ *
+ * @return Recursive-mapping address of the table, or NULL if it is absent,
+ *         a 4 MiB mapping, or could not be allocated.
+ */
+static page_table_t vmm_get_page_table(uint32_t directory_entry, bool create)
+{
+    page_directory_t pd = vmm_active_page_directory();
+    page_table_t pt = (page_table_t) vmm_page_table_virtual_address(directory_entry);
+
+    if(get_present_from_pde(pd[directory_entry]))
+    {
+        return (pd[directory_entry] & PAGE_LARGE) ? NULL : pt;
+    }
+
+    if(!create)
+    {
+        return NULL;
+    }
+
+    bool zeroed = false;
+    uintptr_t new_page = vmm_take_page_table_frame(&zeroed);
+    if(new_page == 0)
+    {
+        return NULL;
+    }
+
+    bool user = directory_entry < KERNEL_PAGE_TABLE_NUMBER;
+    uint32_t pde = vmm_make_page_directory_entry((void*) new_page, 
+                    FOUR_KB, 
+                    false, 
+                    false, 
+                    user ? USER : SUPERVISOR, 
+                    READ_WRITE, 
+                    true);
+
+    if(user)
+    {
+        pd[directory_entry] = pde;
+        address_space_current()->page_table_entries[directory_entry] = 0;
+    }
+    else
+    {
+        address_space_set_kernel_pde(directory_entry, pde);
+    }
+
+    x86_invalidate_page(pt);
+    if(!zeroed)
+    {
+        memset(pt, 0, PAGE_SIZE_BYTES);
+    }
+    return pt;
+}
+
+/**
+ * @brief Unlink an emptied user page table and recycle its frame.
+ *
+ * The live count is only a hint: the table is checked to be all zero
+ * before it goes, so a miscount can never drop a mapping.
+ */
+static void vmm_release_page_table(uint32_t directory_entry)
+{
+    page_directory_t pd = vmm_active_page_directory();
+    page_table_t pt = (page_table_t) vmm_page_table_virtual_address(directory_entry);
+
+    for(uint32_t i = 0; i < 1024; i++)
+    {
+        if(pt[i] != 0)
+        {
+            return;
+        }
+    }
+
+    uintptr_t frame = pd[directory_entry] & PAGE_FRAME_MASK;
+    pd[directory_entry] = 0;
+    x86_invalidate_page(pt);
+    vmm_fault_stats.page_tables_reclaimed++;
+
+    // The frame is known to be zero, so it can go straight back to the pool.
+    if(vmm_page_table_pool_count < VMM_PAGE_TABLE_POOL_SIZE)
+    {
+        vmm_page_table_pool[vmm_page_table_pool_count++] = frame;
+    }
+    else
+    {
+        pmm_free_page(frame);
+    }
+}
+
+/**
+ * @brief Write a user PTE of the active address space, keeping its table's live count.
+ *
+ * Clearing the last non-empty entry releases the page table, so callers
+ * must look the table up again before touching it afterwards.
+ */
+static void vmm_set_user_pte(page_table_t pt, uint32_t address, uint32_t pte)
+{
+    uint32_t directory_entry = PAGE_DIRECTORY_INDEX(address);
+    uint32_t index = PAGE_TABLE_INDEX(address);
+    uint16_t* live = &address_space_current()->page_table_entries[directory_entry];
+    uint32_t old = pt[index];
+
+    pt[index] = pte;
+    if(old == 0 && pte != 0)
+    {
+        (*live)++;
+    }
+    else if(old != 0 && pte == 0 && *live > 0 && --(*live) == 0)
+    {
+        vmm_release_page_table(directory_entry);
+    }
+}
+
 /**
  * @brief Count the number of present page-directory entries.
  */
@@ -142,51 +421,594 @@ uint32_t vmm_count_present_pages(page_directory_t pd)
 }
 
 /**
- * @brief Demand-map page fault handler.
+ * @brief Lazily allocate the shared, permanently zero-filled frame.
  */
-void vmm_page_fault_handler(Registers* regs)
+static uintptr_t vmm_get_zero_page(void)
 {
-    
+    if(vmm_zero_page == 0)
+    {
+        uintptr_t frame = pmm_allocate_page();
+        void* page = frame ? vmm_temp_map(frame) : NULL;
+        if(page == NULL)
+        {
+            pmm_free_page(frame);
+            return 0;
+        }
+        memset(page, 0, PAGE_SIZE_BYTES);
+        vmm_temp_unmap(page);
 
-    uint32_t cr2 = x86_read_cr2();
+        pmm_page_pin(frame);
+        vmm_zero_page = frame;
+    }
+    return vmm_zero_page;
+}
 
-   
+/**
+ * @brief Zero-fill a freshly allocated frame.
+ *
+ * @return The frame, or 0 (with the frame freed) if it could not be mapped.
+ */
+static uintptr_t vmm_zero_frame(uintptr_t frame)
+{
+    if(frame == 0)
+    {
+        return 0;
+    }
 
-    page_directory_t pd = (page_directory_t) &PageDirectoryVirtualAddress;
+    void* page = vmm_temp_map(frame);
+    if(page == NULL)
+    {
+        pmm_free_page(frame);
+        return 0;
+    }
+    memset(page, 0, PAGE_SIZE_BYTES);
+    vmm_temp_unmap(page);
+    return frame;
+}
+
+/**
+ * @brief Allocate a zero-filled frame (page tables and other kernel uses).
+ */
+static uintptr_t vmm_allocate_zeroed_frame(void)
+{
+    return vmm_zero_frame(pmm_allocate_page());
+}
 
-    // do i have a page directory entry for the memory requested?
-    uint32_t directory_entry = cr2 >> 22;
-    page_table_t pt;
+/**
+ * @brief Allocate a zero-filled frame for the user page at an address, honouring page coloring.
+ */
+static uintptr_t vmm_allocate_zeroed_user_frame(uint32_t address)
+{
+    return vmm_zero_frame(pmm_allocate_colored_page(address));
+}
+
+/**
+ * @brief Map the shared zero page read-only at the neighbours of a read fault.
+ *
+ * Populates the never-touched PTEs of the aligned fault-around window that
+ * contains the faulting page, without leaving the current page table or the
+ * region [region_start, region_end).
+ */
+static void vmm_fault_around(page_table_t pt, uint32_t address, uintptr_t zero_page,
+                             uint32_t region_start, uint32_t region_end)
+{
+    if(vmm_fault_around_pages <= 1)
+    {
+        return;
+    }
 
-    if(!get_present_from_pde(pd[directory_entry]))
+    uint32_t table_base = address & ~(PAGE_TABLE_COVERAGE - 1);
+    uint32_t first = PAGE_TABLE_INDEX(address) & ~(vmm_fault_around_pages - 1);
+    uint32_t last = first + vmm_fault_around_pages;
+    if(last > 1024)
     {
-        
-        // allocate a memory block for the required pde
-        uintptr_t new_page = pmm_allocate_page();
-        uint32_t pde = vmm_make_page_directory_entry((void*) new_page, 
-                        FOUR_KB, 
-                        false, 
-                        false, 
-                        SUPERVISOR, 
-                        READ_WRITE, 
-                        true);
+        last = 1024;
+    }
+    if(table_base + first * PAGE_SIZE_BYTES < region_start)
+    {
+        first = PAGE_TABLE_INDEX(region_start);
+    }
+    if(region_end - table_base < last * PAGE_SIZE_BYTES)
+    {
+        last = (region_end - table_base) / PAGE_SIZE_BYTES;
+    }
 
-        pd[directory_entry] = pde;
+    for(uint32_t i = first; i < last; i++)
+    {
+        if(pt[i] == 0)
+        {
+            vmm_set_user_pte(pt, table_base + i * PAGE_SIZE_BYTES, zero_page | VMM_USER_ZERO_PAGE_FLAGS);
+            vmm_fault_stats.fault_around_pages++;
+        }
+    }
+}
 
-        pt = (page_table_t) vmm_page_table_virtual_address(directory_entry);
-        memset(pt, 0, PAGE_SIZE_BYTES);
+/**
+ * @brief Populate a never-touched user page.
+ *
+ * Reads are backed by the shared zero page (plus fault-around); writes get
+ * a private zero-filled frame straight away.
+ */
+static bool vmm_map_anonymous_page(page_table_t pt, uint32_t address, bool write,
+                                   uint32_t region_start, uint32_t region_end)
+{
+    if(!write)
+    {
+        uintptr_t zero_page = vmm_get_zero_page();
+        if(zero_page == 0)
+        {
+            return false;
+        }
+        vmm_set_user_pte(pt, address, zero_page | VMM_USER_ZERO_PAGE_FLAGS);
+        vmm_fault_stats.zero_page_maps++;
+        vmm_fault_around(pt, address, zero_page, region_start, region_end);
+        return true;
+    }
+
+    uintptr_t frame = vmm_allocate_zeroed_user_frame(address);
+    if(frame == 0)
+    {
+        return false;
+    }
+    vmm_set_user_pte(pt, address, frame | PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER);
+    vmm_fault_stats.anonymous_pages++;
+    return true;
+}
+
+/**
+ * @brief Resolve a write fault on a copy-on-write page.
+ *
+ * The last owner simply regains write access; otherwise the page is copied
+ * into a fresh frame and the shared frame loses one reference. The zero page
+ * is never copied, the writer just receives a fresh zero-filled frame.
+ *
+ * @return true if the fault was a copy-on-write fault and has been resolved.
+ */
+static bool vmm_handle_copy_on_write(uint32_t address)
+{
+    page_table_t pt = vmm_get_page_table(PAGE_DIRECTORY_INDEX(address), false);
+    if(pt == NULL)
+    {
+        return false;
+    }
+
+    uint32_t* pte = &pt[PAGE_TABLE_INDEX(address)];
+    if((*pte & (PAGE_PRESENT | PAGE_COPY_ON_WRITE)) != (PAGE_PRESENT | PAGE_COPY_ON_WRITE))
+    {
+        return false;
+    }
+
+    uintptr_t frame = *pte & PAGE_FRAME_MASK;
+    uint32_t flags = (*pte & ~(PAGE_FRAME_MASK | PAGE_COPY_ON_WRITE)) | PAGE_WRITABLE;
+    uint8_t* page = (uint8_t*) PAGE_ALIGN_DOWN(address);
+
+    if(frame == vmm_zero_page)
+    {
+        frame = vmm_allocate_zeroed_user_frame(address);
+        if(frame == 0)
+        {
+            return false;
+        }
+        vmm_fault_stats.anonymous_pages++;
+    }
+    else if(pmm_page_reference_count(frame) > 1)
+    {
+        uintptr_t copy = pmm_allocate_colored_page(address);
+        if(copy == 0)
+        {
+            return false;
+        }
+
+        void* destination = vmm_temp_map(copy);
+        if(destination == NULL)
+        {
+            pmm_free_page(copy);
+            return false;
+        }
+        memcpy(destination, page, PAGE_SIZE_BYTES);
+        vmm_temp_unmap(destination);
+
+        pmm_page_release(frame);
+        frame = copy;
+        vmm_fault_stats.cow_copies++;
     }
     else
     {
-        pt = (page_table_t) vmm_page_table_virtual_address(directory_entry);
+        vmm_fault_stats.cow_reuses++;
     }
 
-    uint32_t table_entry = (cr2 >> 12) & 0x3ff;
+    *pte = frame | flags;
+    x86_invalidate_page(page);
+    return true;
+}
 
-    if(!get_present_from_pte(pt[table_entry]))
+/**
+ * @brief Whether a 4 MiB block of a region may be backed by one PSE page.
+ */
+static bool vmm_huge_page_eligible(const vma_t* vma, uint32_t block)
+{
+    return vmm_huge_pages_enabled
+        && (vma->kind == VMA_ANONYMOUS || vma->kind == VMA_STACK)
+        && (vma->prot & VMA_WRITE)
+        && block >= vma->start
+        && vma->end - block >= PAGE_TABLE_COVERAGE;
+}
+
+/**
+ * @brief Allocate a zero-filled, 4 MiB aligned run of frames.
+ */
+static uintptr_t vmm_allocate_zeroed_huge_page(void)
+{
+    uintptr_t frame = pmm_allocate_large_page();
+    if(frame == 0)
+    {
+        return 0;
+    }
+
+    for(uint32_t offset = 0; offset < PAGE_TABLE_COVERAGE; offset += PAGE_SIZE_BYTES)
+    {
+        void* page = vmm_temp_map(frame + offset);
+        if(page == NULL)
+        {
+            pmm_free_large_page(frame);
+            return 0;
+        }
+        memset(page, 0, PAGE_SIZE_BYTES);
+        vmm_temp_unmap(page);
+    }
+    return frame;
+}
+
+/**
+ * @brief Populate a whole untouched 4 MiB block with one PSE page.
+ *
+ * Only called for write faults.
+ *
+ * @return false if the block cannot take a huge page (the caller falls back to 4 KiB pages).
+ */
+static bool vmm_map_huge_page(const vma_t* vma, uint32_t address)
+{
+    uint32_t block = address & ~(PAGE_TABLE_COVERAGE - 1);
+    uint32_t directory_entry = PAGE_DIRECTORY_INDEX(address);
+    page_directory_t pd = vmm_active_page_directory();
+
+    if(get_present_from_pde(pd[directory_entry]) || !vmm_huge_page_eligible(vma, block))
     {
+        return false;
+    }
 
+    uintptr_t frame = vmm_allocate_zeroed_huge_page();
+    if(frame == 0)
+    {
+        vmm_fault_stats.huge_page_fallbacks++;
+        return false;
+    }
+
+    pd[directory_entry] = frame | VMM_HUGE_PAGE_FLAGS;
+    x86_invalidate_page((void*) block);
+    vmm_fault_stats.huge_page_faults++;
+    return true;
+}
+
+bool vmm_fault_anonymous(const vma_t* vma, uint32_t address, uint32_t error)
+{
+    bool write = (error & PAGE_FAULT_WRITE) != 0;
+
+    if(error & PAGE_FAULT_PRESENT)
+    {
+        return write && vmm_handle_copy_on_write(address);
+    }
+
+    if(swap_fault(address))
+    {
+        return true;
+    }
+
+    // A read of an untouched block is served by the shared zero page; only a
+    // write is worth a whole zeroed 4 MiB run. Blocks populated by reads are
+    // left to the promotion pass.
+    if(write && vmm_map_huge_page(vma, address))
+    {
+        return true;
+    }
+
+    page_table_t pt = vmm_get_page_table(PAGE_DIRECTORY_INDEX(address), true);
+    if(pt == NULL)
+    {
+        return false;
+    }
+
+    if(!vmm_map_anonymous_page(pt, address, write, vma->start, vma->end))
+    {
+        kprintf("VMM: out of memory mapping 0x%08x\n", address);
+        return false;
+    }
+
+    x86_invalidate_page((void*) PAGE_ALIGN_DOWN(address));
+    return true;
+}
+
+bool vmm_split_huge_page(uint32_t directory_entry)
+{
+    page_directory_t pd = vmm_active_page_directory();
+    uint32_t pde = pd[directory_entry];
+    if(directory_entry >= KERNEL_PAGE_TABLE_NUMBER || (pde & (PAGE_PRESENT | PAGE_LARGE)) != (PAGE_PRESENT | PAGE_LARGE))
+    {
+        return true;
+    }
+
+    uintptr_t table_physical = pmm_allocate_page();
+    page_table_t table = table_physical ? (page_table_t) vmm_temp_map(table_physical) : NULL;
+    if(table == NULL)
+    {
+        pmm_free_page(table_physical);
+        return false;
+    }
+
+    uintptr_t frame = pde & ~(PAGE_TABLE_COVERAGE - 1);
+    uint32_t flags = pde & (PAGE_WRITABLE | PAGE_USER | PAGE_ACCESSED | PAGE_DIRTY);
+    for(uint32_t i = 0; i < 1024; i++)
+    {
+        table[i] = (frame + i * PAGE_SIZE_BYTES) | flags | PAGE_PRESENT;
+    }
+    vmm_temp_unmap(table);
+
+    pd[directory_entry] = table_physical | PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
+    address_space_current()->page_table_entries[directory_entry] = 1024;
+    x86_reload_page_directory();
+    vmm_fault_stats.huge_page_splits++;
+    return true;
+}
+
+/**
+ * @brief Try to replace one fully populated user page table with a PSE page.
+ *
+ * Every PTE must be a private writable page or the zero page, at least
+ * VMM_COLLAPSE_MIN_PRIVATE of them private, and the block must lie in a
+ * single eligible region.
+ */
+static bool vmm_collapse_page_table(address_space_t* space, uint32_t directory_entry)
+{
+    page_directory_t pd = vmm_active_page_directory();
+    uint32_t pde = pd[directory_entry];
+    if(!get_present_from_pde(pde) || (pde & PAGE_LARGE))
+    {
+        return false;
+    }
+
+    uint32_t block = directory_entry * PAGE_TABLE_COVERAGE;
+    vma_t* vma = vma_find(space, block);
+    if(vma == NULL || !vmm_huge_page_eligible(vma, block))
+    {
+        return false;
+    }
+
+    page_table_t pt = (page_table_t) vmm_page_table_virtual_address(directory_entry);
+    uint32_t private_pages = 0;
+    for(uint32_t i = 0; i < 1024; i++)
+    {
+        uint32_t pte = pt[i];
+        uintptr_t frame = pte & PAGE_FRAME_MASK;
+        if(!get_present_from_pte(pte) || (pte & PAGE_DEVICE))
+        {
+            return false;
+        }
+        if(frame == vmm_zero_page)
+        {
+            continue;
+        }
+        if(!(pte & PAGE_WRITABLE) || pmm_page_reference_count(frame) != 1)
+        {
+            return false;
+        }
+        private_pages++;
+    }
+
+    // Mostly read-only zero pages: a 4 MiB run would cost far more than it saves.
+    if(private_pages < VMM_COLLAPSE_MIN_PRIVATE)
+    {
+        return false;
+    }
+
+    uintptr_t huge = pmm_allocate_large_page();
+    if(huge == 0)
+    {
+        vmm_fault_stats.huge_page_fallbacks++;
+        return false;
+    }
+
+    for(uint32_t i = 0; i < 1024; i++)
+    {
+        void* destination = vmm_temp_map(huge + i * PAGE_SIZE_BYTES);
+        if(destination == NULL)
+        {
+            pmm_free_large_page(huge);
+            return false;
+        }
+        memcpy(destination, (void*)(block + i * PAGE_SIZE_BYTES), PAGE_SIZE_BYTES);
+        vmm_temp_unmap(destination);
+    }
+
+    for(uint32_t i = 0; i < 1024; i++)
+    {
+        pmm_page_release(pt[i] & PAGE_FRAME_MASK);
+    }
+    pd[directory_entry] = huge | VMM_HUGE_PAGE_FLAGS;
+    space->page_table_entries[directory_entry] = 0;
+    pmm_free_page(pde & PAGE_FRAME_MASK);
+    x86_reload_page_directory();
+    vmm_fault_stats.huge_page_promotions++;
+    return true;
+}
+
+void vmm_collapse_huge_pages(void)
+{
+    address_space_t* space = address_space_current();
+    if(!vmm_huge_pages_enabled || space == NULL || space == address_space_kernel() || space->vma_root == NULL)
+    {
+        return;
+    }
+
+    for(uint32_t scanned = 0; scanned < VMM_COLLAPSE_TABLES_PER_PASS; scanned++)
+    {
+        uint32_t directory_entry = vmm_collapse_cursor;
+        vmm_collapse_cursor = (vmm_collapse_cursor + 1) % KERNEL_PAGE_TABLE_NUMBER;
+        if(vmm_collapse_page_table(space, directory_entry))
+        {
+            // one 4 MiB copy per pass is plenty of work for a system call
+            return;
+        }
+    }
+}
+
+void vmm_set_huge_pages_enabled(bool enabled)
+{
+    vmm_huge_pages_enabled = enabled;
+}
+
+bool vmm_map_user_page(uint32_t address, uintptr_t frame, bool writable)
+{
+    page_table_t pt = vmm_get_page_table(PAGE_DIRECTORY_INDEX(address), true);
+    if(pt == NULL)
+    {
+        return false;
+    }
+
+    vmm_set_user_pte(pt, address, (frame & PAGE_FRAME_MASK) | PAGE_PRESENT | PAGE_USER
+                                  | (writable ? PAGE_WRITABLE : 0));
+    x86_invalidate_page((void*) PAGE_ALIGN_DOWN(address));
+    return true;
+}
+
+void vmm_unmap_user_range(uint32_t start, uint32_t end)
+{
+    uint32_t address = PAGE_ALIGN_DOWN(start);
+    while(address < end && address < KERNEL_VIRTUAL_BASE)
+    {
+        uint32_t directory_entry = PAGE_DIRECTORY_INDEX(address);
+        if(!vmm_split_huge_page(directory_entry))
+        {
+            kprintf("VMM: cannot split huge page at 0x%08x for unmap\n", address);
+            return;
+        }
+
+        page_table_t pt = vmm_get_page_table(directory_entry, false);
+        if(pt == NULL)
+        {
+            address = (directory_entry + 1) * PAGE_TABLE_COVERAGE;
+            continue;
+        }
+
+        uint32_t pte = pt[PAGE_TABLE_INDEX(address)];
+        if(get_present_from_pte(pte))
+        {
+            if(!(pte & PAGE_DEVICE))
+            {
+                pmm_page_release(pte & PAGE_FRAME_MASK);
+            }
+            vmm_set_user_pte(pt, address, 0);
+            x86_invalidate_page((void*) address);
+        }
+        else if(swap_is_entry(pte))
+        {
+            swap_entry_free(pte);
+            vmm_set_user_pte(pt, address, 0);
+        }
+        address += PAGE_SIZE_BYTES;
+    }
+}
+
+bool vmm_map_user_device_page(uint32_t address, uintptr_t physical, bool writable, enum page_cache_mode_t cache_mode)
+{
+    page_table_t pt = vmm_get_page_table(PAGE_DIRECTORY_INDEX(address), true);
+    if(pt == NULL)
+    {
+        return false;
+    }
+
+    vmm_set_user_pte(pt, address, (physical & PAGE_FRAME_MASK) | PAGE_PRESENT | PAGE_USER
+                                  | pat_page_table_flags(cache_mode) | PAGE_DEVICE
+                                  | (writable ? PAGE_WRITABLE : 0));
+    x86_invalidate_page((void*) PAGE_ALIGN_DOWN(address));
+    return true;
+}
+
+/**
+ * @brief Report an access the VMM refuses to resolve.
+ *
+ * Faults raised from user mode terminate the process SIGSEGV-style; the
+ * kernel has no fixup tables, so its own bad accesses are fatal.
+ */
+static void vmm_bad_access(Registers* regs, uint32_t address, const char* reason)
+{
+    if(regs->error & PAGE_FAULT_USER)
+    {
+        process_t* process = process_current();
+        kprintf("VMM: pid %u segmentation fault at 0x%08x eip=0x%08x (%s)\n",
+                process ? process->pid : 0, address, regs->eip, reason);
+        process_kill_current(regs, PROCESS_SIGNAL_SEGV);
+        return;
+    }
+
+    kprintf("VMM: kernel fault at 0x%08x eip=0x%08x error=%x (%s)\n", address, regs->eip, regs->error, reason);
+    x86_panic();
+}
+
+/**
+ * @brief Page fault handler.
+ *
+ * User-half addresses are looked up in the active space's region tree and
+ * handed to the region's fault routine. The kernel half stays demand-paged
+ * for kernel-mode accesses only.
+ */
+void vmm_page_fault_handler(Registers* regs)
+{
+    uint32_t cr2 = x86_read_cr2();
+
+    vmm_fault_stats.faults++;
+
+    if(cr2 < KERNEL_VIRTUAL_BASE)
+    {
+        vma_t* vma = vma_find_for_fault(address_space_current(), cr2);
+        if(vma == NULL)
+        {
+            vmm_bad_access(regs, cr2, "no region");
+        }
+        else if(!vma_access_permitted(vma, regs->error))
+        {
+            vmm_bad_access(regs, cr2, "protection");
+        }
+        else if(!vma->ops->fault(vma, cr2, regs->error))
+        {
+            vmm_bad_access(regs, cr2, vma->ops->name);
+        }
+        return;
+    }
+
+    if(regs->error & (PAGE_FAULT_USER | PAGE_FAULT_PRESENT))
+    {
+        vmm_bad_access(regs, cr2, "kernel page");
+        return;
+    }
+
+    // do i have a page table for the memory requested?
+    page_table_t pt = vmm_get_page_table(PAGE_DIRECTORY_INDEX(cr2), true);
+    if(pt == NULL)
+    {
+        kprintf("VMM: no page table for fault at 0x%08x\n", cr2);
+        x86_panic();
+    }
+
+    uint32_t table_entry = PAGE_TABLE_INDEX(cr2);
+
+    if(!get_present_from_pte(pt[table_entry]))
+    {
         uintptr_t new_page = pmm_allocate_page();
+        if(new_page == 0)
+        {
+            kprintf("VMM: out of memory mapping 0x%08x\n", cr2);
+            x86_panic();
+        }
     
         pt[table_entry] = vmm_make_page_table_entry((void*)new_page, 
                         false, 
@@ -196,51 +1018,51 @@ void vmm_page_fault_handler(Registers* regs)
                         READ_WRITE, 
                         true);
     }
-    x86_reload_page_directory();
+    x86_invalidate_page((void*) PAGE_ALIGN_DOWN(cr2));
     //kprintf("In handler 0x%08x\n", cr2);
 }
 
+void vmm_set_fault_around_pages(uint32_t pages)
+{
+    // keep the window a power of two so it can be aligned with a mask
+    uint32_t window = 1;
+    while(window * 2 <= pages && window * 2 <= 1024)
+    {
+        window *= 2;
+    }
+    vmm_fault_around_pages = window;
+}
+
+const vmm_fault_stats_t* vmm_get_fault_stats(void)
+{
+    return &vmm_fault_stats;
+}
+
+void vmm_reset_fault_stats(void)
+{
+    memset(&vmm_fault_stats, 0, sizeof(vmm_fault_stats));
+}
+
 /**
  * @brief Establish a 4 KiB mapping between a physical and virtual address.
  */
-bool vmm_map_physical_to_virtual(uint8_t* physical_address, uint8_t* virtual_address)
+bool vmm_map_physical_to_virtual(uint8_t* physical_address, uint8_t* virtual_address, enum page_cache_mode_t cache_mode)
 {
-    page_directory_t pd = (page_directory_t) &PageDirectoryVirtualAddress;
-    
     // This procedure will map a physical address to a virtual address
     // Step 1 - Check is the requested virtual address is available
-    // Step 1.1 see if there is a page directory for the request virtual address
+    // Step 1.1 see if there is a page table for the request virtual address
 
-    uint32_t directory_entry = (uint32_t)virtual_address >> 22;
-    page_table_t pt;
-    bool mapped_new_entry = false;
+    page_directory_t pd = vmm_active_page_directory();
+    uint32_t directory_entry = PAGE_DIRECTORY_INDEX(virtual_address);
+    bool mapped_new_entry = !get_present_from_pde(pd[directory_entry]);
 
-    if(!get_present_from_pde(pd[directory_entry]))
+    page_table_t pt = vmm_get_page_table(directory_entry, true);
+    if(pt == NULL)
     {
-        uintptr_t new_page = pmm_allocate_page();
-        if(new_page == 0)
-        {
-            return false;
-        }
-        uint32_t pde = vmm_make_page_directory_entry((void*) new_page, 
-                                FOUR_KB, 
-                                false, 
-                                false, 
-                                SUPERVISOR, 
-                                READ_WRITE, 
-                                true);
-
-        pd[directory_entry] = pde;
-        pt = (page_table_t) vmm_page_table_virtual_address(directory_entry);
-        memset(pt, 0, PAGE_SIZE_BYTES);
-        mapped_new_entry = true;
-    }
-    else
-    {
-        pt = (page_table_t) vmm_page_table_virtual_address(directory_entry);
+        return false;
     }
 
-    uint32_t table_entry = ((uint32_t)virtual_address >> 12) & 0x3ff;
+    uint32_t table_entry = PAGE_TABLE_INDEX(virtual_address);
     
     if(!get_present_from_pte(pt[table_entry]))
     {
@@ -250,24 +1072,123 @@ bool vmm_map_physical_to_virtual(uint8_t* physical_address, uint8_t* virtual_add
                         false, 
                         SUPERVISOR, 
                         READ_WRITE, 
-                        true);
+                        true) | pat_page_table_flags(cache_mode);
+        x86_invalidate_page(virtual_address);
         mapped_new_entry = true;
     }
-    //x86_reload_page_directory();
-
 
     return mapped_new_entry;
 
 }
 
+/**
+ * @brief Remove a 4 KiB mapping from the active address space.
+ *
+ * @return Physical address that was mapped, or 0 if nothing was mapped.
+ */
+uintptr_t vmm_unmap_virtual(uint8_t* virtual_address)
+{
+    page_table_t pt = vmm_get_page_table(PAGE_DIRECTORY_INDEX(virtual_address), false);
+    if(pt == NULL)
+    {
+        return 0;
+    }
+
+    uint32_t table_entry = PAGE_TABLE_INDEX(virtual_address);
+    uint32_t pte = pt[table_entry];
+    if(!get_present_from_pte(pte))
+    {
+        return 0;
+    }
+
+    pt[table_entry] = 0;
+    x86_invalidate_page(virtual_address);
+    return pte & PAGE_FRAME_MASK;
+}
 
 /**
- * @brief Map a contiguous region using 4 MiB pages.
+ * @brief Map a physical frame at a kernel virtual address, replacing any previous mapping.
  */
-bool vmm_map_4mb_physical_to_virtual(uint8_t* physical_address, uint8_t* virtual_address, size_t size)
+bool vmm_map_kernel_page(uintptr_t physical_address, uint8_t* virtual_address, enum page_cache_mode_t cache_mode)
 {
-    page_directory_t pd = (page_directory_t) &PageDirectoryVirtualAddress;
+    page_table_t pt = vmm_get_page_table(PAGE_DIRECTORY_INDEX(virtual_address), true);
+    if(pt == NULL)
+    {
+        return false;
+    }
+
+    pt[PAGE_TABLE_INDEX(virtual_address)] = vmm_make_page_table_entry((void*) physical_address,
+                        false,
+                        false,
+                        false,
+                        SUPERVISOR,
+                        READ_WRITE,
+                        true) | pat_page_table_flags(cache_mode);
+    x86_invalidate_page(virtual_address);
+    return true;
+}
 
+/**
+ * @brief Map a physical frame into a short-lived kernel window.
+ *
+ * Used to edit frames such as the page directory and page tables of an
+ * inactive address space. Frames inside the direct map are returned from it
+ * without touching any page table; only highmem needs a slot.
+ *
+ * @return Kernel virtual address of the frame, or NULL if no slot is free.
+ */
+void* vmm_temp_map(uintptr_t physical_address)
+{
+    void* direct = phys_to_virt(physical_address);
+    if(direct != NULL)
+    {
+        return direct;
+    }
+
+
+    for(uint32_t slot = 0; slot < VMM_TEMP_MAP_SLOTS; slot++)
+    {
+        if((vmm_temp_map_slots & (1u << slot)) == 0)
+        {
+            uint8_t* virtual_address = (uint8_t*)(VMM_TEMP_MAP_BASE + slot * PAGE_SIZE_BYTES);
+            if(!vmm_map_kernel_page(PAGE_ALIGN_DOWN(physical_address), virtual_address, CACHE_WRITE_BACK))
+            {
+                return NULL;
+            }
+            vmm_temp_map_slots |= (1u << slot);
+            return virtual_address + (physical_address & ~PAGE_FRAME_MASK);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Release a window obtained from vmm_temp_map.
+ */
+void vmm_temp_unmap(void* virtual_address)
+{
+    if((uint32_t) virtual_address < VMM_TEMP_MAP_BASE)
+    {
+        return;
+    }
+
+    uint32_t slot = (PAGE_ALIGN_DOWN(virtual_address) - VMM_TEMP_MAP_BASE) / PAGE_SIZE_BYTES;
+    if(slot >= VMM_TEMP_MAP_SLOTS)
+    {
+        return;
+    }
+
+    vmm_unmap_virtual((uint8_t*) PAGE_ALIGN_DOWN(virtual_address));
+    vmm_temp_map_slots &= ~(1u << slot);
+}
+
+
+/**
+ * @brief Map a contiguous region using 4 MiB pages.
+ */
+bool vmm_map_4mb_physical_to_virtual(uint8_t* physical_address, uint8_t* virtual_address, size_t size, enum page_cache_mode_t cache_mode)
+{
     uint32_t directory_entry = (uint32_t)virtual_address / 1024 / 4096;
 
     int entries_required = size / 4;
@@ -278,13 +1199,13 @@ bool vmm_map_4mb_physical_to_virtual(uint8_t* physical_address, uint8_t* virtual
     {
         uint32_t entry = (uint32_t)physical_address + (0x400000 * i);
         entry &= 0xffc00000;
-        entry |= 0x83;
+        entry |= 0x83 | pat_large_page_flags(cache_mode);
     
-        pd[directory_entry + i] = entry;
+        address_space_set_kernel_pde(directory_entry + i, entry);
 
     }    
 
     x86_reload_page_directory();
 
     return true;
-}
+}
\ No newline at end of file
@@ -8,6 +8,7 @@
 #include <memory.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <kerndef.h>
 
 #define ALIGN_UP(value, align) (((value) + ((align) - 1)) & ~((align) - 1))
 #define KERNEL_VIRTUAL_BASE 0xC0000000u
@@ -23,12 +24,27 @@ static uint32_t virtual_to_physical(uintptr_t address)
     return (uint32_t)address;
 }
 
-void multiboot_store_info(void* multiboot_header)
+/**
+ * @brief Copy a boot loader string, which will not outlive the boot information.
+ */
+static void multiboot_copy_string(char* dest, size_t dest_len, const char* src)
+{
+    size_t i = 0;
+    for(; i + 1 < dest_len && src[i] != '\0'; i++)
+    {
+        dest[i] = src[i];
+    }
+    dest[i] = '\0';
+}
+
+void KERNEL_INIT multiboot_store_info(void* multiboot_header)
 {
     memset(&g_multiboot_info, 0, sizeof(g_multiboot_info));
 
     uintptr_t base = (uintptr_t) multiboot_header;
     uint32_t total_size = *((uint32_t*) base);
+    g_multiboot_info.tags_addr = virtual_to_physical(base);
+    g_multiboot_info.tags_size = total_size;
     uintptr_t tag_ptr = base + 8;
 
     while(tag_ptr < (base + total_size))
@@ -67,6 +83,26 @@ void multiboot_store_info(void* multiboot_header)
                 break;
             }
 
+            case MULTIBOOT_TAG_TYPE_CMDLINE:
+            {
+                multiboot_tag_string* cmdline = (multiboot_tag_string*) tag;
+                multiboot_copy_string(g_multiboot_info.cmdline, sizeof(g_multiboot_info.cmdline), cmdline->string);
+                break;
+            }
+
+            case MULTIBOOT_TAG_TYPE_MODULE:
+            {
+                multiboot_tag_module* module = (multiboot_tag_module*) tag;
+                if(g_multiboot_info.module_count < MULTIBOOT_MAX_MODULES && module->mod_end > module->mod_start)
+                {
+                    multiboot_module* entry = &g_multiboot_info.modules[g_multiboot_info.module_count++];
+                    entry->start = module->mod_start;
+                    entry->end = module->mod_end;
+                    multiboot_copy_string(entry->cmdline, sizeof(entry->cmdline), module->cmdline);
+                }
+                break;
+            }
+
             case MULTIBOOT_TAG_TYPE_END:
                 return;
 
@@ -0,0 +1,237 @@
+/**
+ * @file system/process/process.c
+ * @brief User process table and round-robin context switching.
+ */
+
+#include <process.h>
+#include <gdt.h>
+#include <memory.h>
+#include <x86.h>
+#include <stdio.h>
+#include <stddef.h>
+
+#define PROCESS_USER_EFLAGS 0x202 /**< IF set, reserved bit 1 set. */
+
+static process_t g_processes[PROCESS_MAX];
+static process_t* g_current_process;
+static uint32_t g_next_pid = 1;
+
+void KERNEL_INIT process_init(void)
+{
+    memset(g_processes, 0, sizeof(g_processes));
+    g_current_process = NULL;
+    g_next_pid = 1;
+}
+
+static process_t* process_allocate(void)
+{
+    for (uint32_t i = 0; i < PROCESS_MAX; ++i)
+    {
+        if (g_processes[i].state == PROCESS_UNUSED)
+        {
+            memset(&g_processes[i], 0, sizeof(g_processes[i]));
+            g_processes[i].pid = g_next_pid++;
+            return &g_processes[i];
+        }
+    }
+
+    kprintf("PROC: process table full\n");
+    return NULL;
+}
+
+process_t* process_create(uint32_t entry, uint32_t stack_top)
+{
+    process_t* process = process_allocate();
+    if (process == NULL)
+    {
+        return NULL;
+    }
+
+    process->address_space = address_space_create();
+    if (process->address_space == NULL)
+    {
+        process->state = PROCESS_UNUSED;
+        return NULL;
+    }
+
+    if (vma_map(process->address_space,
+                stack_top - PROCESS_STACK_INITIAL_SIZE,
+                PROCESS_STACK_INITIAL_SIZE,
+                VMA_READ | VMA_WRITE,
+                VMA_STACK) == NULL)
+    {
+        address_space_destroy(process->address_space);
+        process->state = PROCESS_UNUSED;
+        return NULL;
+    }
+
+    process->parent_pid = g_current_process ? g_current_process->pid : 0;
+    process->context.eip = entry;
+    process->context.esp = stack_top;
+    process->context.cs = GDT_SELECTOR_USER_CODE;
+    process->context.ss = GDT_SELECTOR_USER_DATA;
+    process->context.ds = GDT_SELECTOR_USER_DATA;
+    process->context.eflags = PROCESS_USER_EFLAGS;
+    process->state = PROCESS_READY;
+    return process;
+}
+
+process_t* process_fork(const Registers* regs)
+{
+    if (g_current_process == NULL || regs == NULL)
+    {
+        return NULL;
+    }
+
+    process_t* child = process_allocate();
+    if (child == NULL)
+    {
+        return NULL;
+    }
+
+    child->address_space = address_space_fork(g_current_process->address_space);
+    if (child->address_space == NULL)
+    {
+        child->state = PROCESS_UNUSED;
+        return NULL;
+    }
+
+    for (uint32_t fd = 0; fd < PROCESS_MAX_FILES; ++fd)
+    {
+        child->files[fd] = g_current_process->files[fd];
+        vfs_file_get(child->files[fd]);
+    }
+
+    child->parent_pid = g_current_process->pid;
+    child->context = *regs;
+    child->context.eax = 0;
+    child->state = PROCESS_READY;
+    return child;
+}
+
+process_t* process_current(void)
+{
+    return g_current_process;
+}
+
+void process_activate(process_t* process)
+{
+    if (process == NULL)
+    {
+        return;
+    }
+
+    if (g_current_process != NULL && g_current_process->state == PROCESS_RUNNING)
+    {
+        g_current_process->state = PROCESS_READY;
+    }
+
+    g_current_process = process;
+    process->state = PROCESS_RUNNING;
+    address_space_switch(process->address_space);
+}
+
+static process_t* process_pick_next(void)
+{
+    uint32_t start = g_current_process ? (uint32_t)(g_current_process - g_processes) : 0;
+
+    for (uint32_t i = 1; i <= PROCESS_MAX; ++i)
+    {
+        process_t* candidate = &g_processes[(start + i) % PROCESS_MAX];
+        if (candidate->state == PROCESS_READY)
+        {
+            return candidate;
+        }
+    }
+
+    return NULL;
+}
+
+void process_schedule(Registers* regs)
+{
+    if (g_current_process == NULL || (regs->cs & 0x3) != 0x3)
+    {
+        return;
+    }
+
+    process_t* next = process_pick_next();
+    if (next == NULL || next == g_current_process)
+    {
+        return;
+    }
+
+    g_current_process->context = *regs;
+    *regs = next->context;
+    process_activate(next);
+}
+
+void process_kill_current(Registers* regs, uint32_t signal)
+{
+    process_t* victim = g_current_process;
+    if (victim == NULL)
+    {
+        return;
+    }
+
+    kprintf("PROC: pid %u killed by signal %u\n", victim->pid, signal);
+    victim->state = PROCESS_UNUSED;
+
+    process_t* next = process_pick_next();
+    if (next == NULL)
+    {
+        kprintf("PROC: no runnable processes\n");
+        x86_panic();
+    }
+
+    *regs = next->context;
+    process_activate(next);
+
+    for (uint32_t fd = 0; fd < PROCESS_MAX_FILES; ++fd)
+    {
+        process_close_file(victim, fd);
+    }
+
+    // The victim's directory is no longer loaded, so it can be torn down now.
+    address_space_destroy(victim->address_space);
+    memset(victim, 0, sizeof(*victim));
+}
+
+int32_t process_install_file(process_t* process, vfs_file_t* file)
+{
+    if (process == NULL || file == NULL)
+    {
+        return -1;
+    }
+
+    for (uint32_t fd = PROCESS_FIRST_FILE; fd < PROCESS_MAX_FILES; ++fd)
+    {
+        if (process->files[fd] == NULL)
+        {
+            process->files[fd] = file;
+            return (int32_t)fd;
+        }
+    }
+    return -1;
+}
+
+vfs_file_t* process_get_file(process_t* process, uint32_t fd)
+{
+    if (process == NULL || fd >= PROCESS_MAX_FILES)
+    {
+        return NULL;
+    }
+    return process->files[fd];
+}
+
+bool process_close_file(process_t* process, uint32_t fd)
+{
+    vfs_file_t* file = process_get_file(process, fd);
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    process->files[fd] = NULL;
+    vfs_file_put(file);
+    return true;
+}
@@ -13,7 +13,7 @@
 /**
  * @brief Initialize COM1 (0x3F8) for 115200 8-N-1 operation.
  */
-void serial_init(void)
+void KERNEL_INIT serial_init(void)
 {
     x86_outb(COM1 +1, 0x00);
     x86_outb(COM1 +3, 0x80);
@@ -11,6 +11,13 @@
 #include <memory.h>
 #include <vfs.h>
 #include <kerndef.h>
+#include <process.h>
+#include <mmap.h>
+#include <meminit.h>
+#include <vma.h>
+#include <address_space.h>
+
+#define SYSCALL_PATH_MAX 256 /**< Longest path accepted by open, including the terminator. */
 
 extern void KERNEL_CDECL x86_ISR128(void);
 
@@ -20,6 +27,7 @@ typedef struct {
 } syscall_entry_t;
 
 static syscall_entry_t g_syscalls[SYSCALL_MAX];
+static Registers* g_syscall_frame;
 
 static uint32_t syscall_unimplemented(uint32_t arg0,
                                       uint32_t arg1,
@@ -45,7 +53,50 @@ static void syscall_isr_handler(Registers* regs)
     }
 
     syscall_handler_t handler = g_syscalls[number].handler;
+    g_syscall_frame = regs;
     regs->eax = handler(regs->ebx, regs->ecx, regs->edx, regs->esi, regs->edi);
+    g_syscall_frame = NULL;
+
+    // Kept out of the timer IRQ: promotion can copy 4 MiB with interrupts off.
+    vmm_collapse_huge_pages();
+    vmm_refill_page_table_pool();
+}
+
+/**
+ * @brief Whether the current process may access [address, address + length).
+ */
+static bool syscall_user_range_ok(uint32_t address, uint32_t length, bool write)
+{
+    return vma_range_permitted(address_space_current(), address, length, write);
+}
+
+/**
+ * @brief Copy a NUL-terminated path out of user memory, checking each page before reading it.
+ *
+ * @return false if the string crosses into memory the process cannot read or is too long.
+ */
+static bool syscall_copy_path_from_user(char* destination, uint32_t source)
+{
+    for (uint32_t i = 0; i < SYSCALL_PATH_MAX; ++i)
+    {
+        uint32_t address = source + i;
+        if ((i == 0 || (address & (PAGE_SIZE_BYTES - 1)) == 0) && !syscall_user_range_ok(address, 1, false))
+        {
+            return false;
+        }
+
+        destination[i] = *(const char*)address;
+        if (destination[i] == '\0')
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+Registers* syscall_current_frame(void)
+{
+    return g_syscall_frame;
 }
 
 bool syscall_register(uint32_t number,
@@ -70,7 +121,7 @@ static uint32_t sys_write(uint32_t fd,
 {
     (void)unused3;
     (void)unused4;
-    if (buffer_ptr == 0 || count == 0)
+    if (buffer_ptr == 0 || count == 0 || !syscall_user_range_ok(buffer_ptr, count, false))
     {
         return (uint32_t)-1;
     }
@@ -93,6 +144,123 @@ static uint32_t sys_write(uint32_t fd,
     return (uint32_t)-1;
 }
 
+static uint32_t sys_fork(uint32_t unused0,
+                         uint32_t unused1,
+                         uint32_t unused2,
+                         uint32_t unused3,
+                         uint32_t unused4)
+{
+    (void)unused0;
+    (void)unused1;
+    (void)unused2;
+    (void)unused3;
+    (void)unused4;
+
+    process_t* child = process_fork(syscall_current_frame());
+    if (child == NULL)
+    {
+        return (uint32_t)-1;
+    }
+
+    return child->pid;
+}
+
+static uint32_t sys_open(uint32_t path_ptr,
+                         uint32_t flags,
+                         uint32_t unused2,
+                         uint32_t unused3,
+                         uint32_t unused4)
+{
+    (void)unused2;
+    (void)unused3;
+    (void)unused4;
+
+    // Only read-only access is supported.
+    if (path_ptr == 0 || flags != 0)
+    {
+        return (uint32_t)-1;
+    }
+
+    char path[SYSCALL_PATH_MAX];
+    if (!syscall_copy_path_from_user(path, path_ptr))
+    {
+        return (uint32_t)-1;
+    }
+
+    vfs_file_t* file = vfs_file_open(path);
+    if (file == NULL)
+    {
+        return (uint32_t)-1;
+    }
+
+    int32_t fd = process_install_file(process_current(), file);
+    if (fd < 0)
+    {
+        vfs_file_put(file);
+    }
+    return (uint32_t)fd;
+}
+
+static uint32_t sys_close(uint32_t fd,
+                          uint32_t unused1,
+                          uint32_t unused2,
+                          uint32_t unused3,
+                          uint32_t unused4)
+{
+    (void)unused1;
+    (void)unused2;
+    (void)unused3;
+    (void)unused4;
+    return process_close_file(process_current(), fd) ? 0 : (uint32_t)-1;
+}
+
+static uint32_t sys_read(uint32_t fd,
+                         uint32_t buffer_ptr,
+                         uint32_t count,
+                         uint32_t unused3,
+                         uint32_t unused4)
+{
+    (void)unused3;
+    (void)unused4;
+
+    vfs_file_t* file = process_get_file(process_current(), fd);
+    if (file == NULL || buffer_ptr == 0 || !syscall_user_range_ok(buffer_ptr, count, true))
+    {
+        return (uint32_t)-1;
+    }
+
+    uint32_t read = vfs_read(file, file->position, (void*)buffer_ptr, count);
+    file->position += read;
+    return read;
+}
+
+static uint32_t sys_mmap(uint32_t fd,
+                         uint32_t offset,
+                         uint32_t length,
+                         uint32_t prot,
+                         uint32_t flags)
+{
+    vfs_file_t* file = process_get_file(process_current(), fd);
+    if (file == NULL)
+    {
+        return MMAP_FAILED;
+    }
+
+    return mmap_file(file, offset, length, prot, flags);
+}
+
+static uint32_t sys_munmap(uint32_t address,
+                           uint32_t length,
+                           uint32_t unused2,
+                           uint32_t unused3,
+                           uint32_t unused4)
+{
+    (void)unused2;
+    (void)unused3;
+    (void)unused4;
+    return mmap_unmap(address, length) ? 0 : (uint32_t)-1;
+}
+
 static uint32_t sys_vfs_list(uint32_t dirfd,
                              uint32_t dirp,
                              uint32_t count,
@@ -108,7 +276,7 @@ static uint32_t sys_vfs_list(uint32_t dirfd,
     return 0;
 }
 
-void syscall_init(void)
+void KERNEL_INIT syscall_init(void)
 {
     memset(g_syscalls, 0, sizeof(g_syscalls));
 
@@ -125,7 +293,13 @@ void syscall_init(void)
         g_syscalls[i].name = "unimplemented";
     }
 
+    syscall_register(SYSCALL_NR_FORK, sys_fork, "fork");
+    syscall_register(SYSCALL_NR_READ, sys_read, "read");
     syscall_register(SYSCALL_NR_WRITE, sys_write, "write");
+    syscall_register(SYSCALL_NR_OPEN, sys_open, "open");
+    syscall_register(SYSCALL_NR_CLOSE, sys_close, "close");
+    syscall_register(SYSCALL_NR_MMAP, sys_mmap, "mmap");
+    syscall_register(SYSCALL_NR_MUNMAP, sys_munmap, "munmap");
     syscall_register(SYSCALL_NR_GETDENTS, sys_vfs_list, "getdents");
 
     kprintf("Syscall: initialized vector 0x%02x with %u slots\n",
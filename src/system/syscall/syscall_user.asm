@@ -1,6 +1,7 @@
 [bits 32]
 
 global usermode_syscall
+global usermode_syscall5
 
 ; uint32_t usermode_syscall(uint32_t eax, uint32_t ebx, uint32_t ecx, uint32_t edx);
 usermode_syscall:
@@ -11,6 +12,7 @@ usermode_syscall:
     ;   [esp+16] = edx
     push ebp
     mov ebp, esp
+    push ebx              ; ebx is callee-saved in cdecl
 
     mov eax, [ebp + 8]
     mov ebx, [ebp + 12]
@@ -18,6 +20,31 @@ usermode_syscall:
     mov edx, [ebp + 20]
     int 0x80
 
+    pop ebx
+    mov esp, ebp
+    pop ebp
+    ret
+
+; uint32_t usermode_syscall5(uint32_t eax, uint32_t ebx, uint32_t ecx,
+;                            uint32_t edx, uint32_t esi, uint32_t edi);
+usermode_syscall5:
+    push ebp
+    mov ebp, esp
+    push ebx              ; ebx, esi and edi are callee-saved in cdecl
+    push esi
+    push edi
+
+    mov eax, [ebp + 8]
+    mov ebx, [ebp + 12]
+    mov ecx, [ebp + 16]
+    mov edx, [ebp + 20]
+    mov esi, [ebp + 24]
+    mov edi, [ebp + 28]
+    int 0x80
+
+    pop edi
+    pop esi
+    pop ebx
     mov esp, ebp
     pop ebp
     ret
@@ -9,8 +9,44 @@ extern uint32_t usermode_syscall(uint32_t eax,
                                  uint32_t ebx,
                                  uint32_t ecx,
                                  uint32_t edx);
+extern uint32_t usermode_syscall5(uint32_t eax,
+                                  uint32_t ebx,
+                                  uint32_t ecx,
+                                  uint32_t edx,
+                                  uint32_t esi,
+                                  uint32_t edi);
 
 uint32_t syscall_write(uint32_t fd, const void* buffer, uint32_t count)
 {
     return usermode_syscall(SYSCALL_NR_WRITE, fd, (uint32_t)buffer, count);
 }
+
+uint32_t syscall_fork(void)
+{
+    return usermode_syscall(SYSCALL_NR_FORK, 0, 0, 0);
+}
+
+uint32_t syscall_open(const char* path, uint32_t flags)
+{
+    return usermode_syscall(SYSCALL_NR_OPEN, (uint32_t)path, flags, 0);
+}
+
+uint32_t syscall_close(uint32_t fd)
+{
+    return usermode_syscall(SYSCALL_NR_CLOSE, fd, 0, 0);
+}
+
+uint32_t syscall_read(uint32_t fd, void* buffer, uint32_t count)
+{
+    return usermode_syscall(SYSCALL_NR_READ, fd, (uint32_t)buffer, count);
+}
+
+uint32_t syscall_mmap(uint32_t fd, uint32_t offset, uint32_t length, uint32_t prot, uint32_t flags)
+{
+    return usermode_syscall5(SYSCALL_NR_MMAP, fd, offset, length, prot, flags);
+}
+
+uint32_t syscall_munmap(uint32_t address, uint32_t length)
+{
+    return usermode_syscall(SYSCALL_NR_MUNMAP, address, length, 0);
+}
@@ -6,6 +6,7 @@
 #include <tss.h>
 #include <gdt.h>
 #include <memory.h>
+#include <kerndef.h>
 
 typedef struct __attribute__((packed)) {
     uint32_t prev_tss;
@@ -44,7 +45,7 @@ void tss_set_kernel_stack(uint32_t kernel_stack_top)
     g_tss.esp0 = kernel_stack_top;
 }
 
-void tss_init(uint32_t kernel_stack_top)
+void KERNEL_INIT tss_init(uint32_t kernel_stack_top)
 {
     memset(&g_tss, 0, sizeof(g_tss));
     g_tss.ss0 = GDT_SELECTOR_DATA;
@@ -10,9 +10,9 @@ extern uint32_t syscall_write(uint32_t fd, const void* buffer, uint32_t count);
 
 void user_program_start(void)
 {
-    const char* msg = "Hello from user mode via syscall write!\n";
-    uint32_t len = 42;
-    syscall_write(1, msg, len);
+    // On the stack: write() only accepts buffers inside the process's own regions.
+    const char msg[] = "Hello from user mode via syscall write!\n";
+    syscall_write(1, msg, sizeof(msg));
 
     for (;;)
     {
@@ -4,12 +4,15 @@
  */
 
 #include <usermode.h>
+#include <process.h>
+#include <paging.h>
+#include <stdio.h>
 #include <stdint.h>
 #include <stddef.h>
 
-extern void usermode_trampoline(uint32_t entry, uint32_t stack_top);
+#define USERMODE_STACK_TOP KERNEL_VIRTUAL_BASE /**< Stack grows down from the top of the user half. */
 
-static uint8_t g_user_stack[8192] __attribute__((aligned(16)));
+extern void usermode_trampoline(uint32_t entry, uint32_t stack_top);
 
 void usermode_enter(void (*entry)(void))
 {
@@ -18,6 +21,13 @@ void usermode_enter(void (*entry)(void))
         return;
     }
 
-    uint32_t user_stack = (uint32_t)(g_user_stack + sizeof(g_user_stack));
-    usermode_trampoline((uint32_t)entry, user_stack);
+    process_t* process = process_create((uint32_t)entry, USERMODE_STACK_TOP);
+    if (process == NULL)
+    {
+        kprintf("USER: unable to create initial process\n");
+        return;
+    }
+
+    process_activate(process);
+    usermode_trampoline(process->context.eip, process->context.esp);
 }
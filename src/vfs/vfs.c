@@ -6,6 +6,7 @@
 #include <vfs.h>
 #include <stdio.h>
 #include <memory.h>
+#include <kerndef.h>
 
 typedef struct {
     filesystem_mount_t*            mount;
@@ -14,10 +15,12 @@ typedef struct {
 
 static vfs_mount_entry_t g_vfs_mounts[FILESYSTEM_MAX_MOUNTS];
 static size_t g_vfs_mount_count;
+static vfs_file_t g_vfs_open_files[VFS_MAX_OPEN_FILES];
 
-void vfs_init(void)
+void KERNEL_INIT vfs_init(void)
 {
     memset(g_vfs_mounts, 0, sizeof(g_vfs_mounts));
+    memset(g_vfs_open_files, 0, sizeof(g_vfs_open_files));
     g_vfs_mount_count = 0;
 }
 
@@ -149,6 +152,95 @@ void vfs_close(vfs_file_t* file)
     memset(file, 0, sizeof(*file));
 }
 
+uint32_t vfs_read(vfs_file_t* file,
+                  uint32_t offset,
+                  void* buffer,
+                  uint32_t length)
+{
+    if (file == NULL || buffer == NULL || file->ops == NULL || file->ops->read == NULL)
+    {
+        return 0;
+    }
+
+    if (offset >= file->size)
+    {
+        return 0;
+    }
+
+    if (length > file->size - offset)
+    {
+        length = file->size - offset;
+    }
+
+    return file->ops->read(file, offset, buffer, length);
+}
+
+vfs_file_t* vfs_file_open(const char* path)
+{
+    if (path == NULL)
+    {
+        return NULL;
+    }
+
+    while (*path == '/')
+    {
+        ++path;
+    }
+
+    char mount_name[FILESYSTEM_MOUNT_MAX_NAME];
+    size_t name_len = 0;
+    while (path[name_len] != '\0' && path[name_len] != '/')
+    {
+        if (name_len + 1 >= sizeof(mount_name))
+        {
+            return NULL;
+        }
+        mount_name[name_len] = path[name_len];
+        ++name_len;
+    }
+    mount_name[name_len] = '\0';
+
+    for (size_t i = 0; i < VFS_MAX_OPEN_FILES; ++i)
+    {
+        vfs_file_t* file = &g_vfs_open_files[i];
+        if (file->references != 0)
+        {
+            continue;
+        }
+
+        if (!vfs_open(mount_name, path + name_len, file))
+        {
+            return NULL;
+        }
+        file->references = 1;
+        return file;
+    }
+
+    kprintf("VFS: open file table full\n");
+    return NULL;
+}
+
+void vfs_file_get(vfs_file_t* file)
+{
+    if (file != NULL)
+    {
+        file->references++;
+    }
+}
+
+void vfs_file_put(vfs_file_t* file)
+{
+    if (file == NULL || file->references == 0)
+    {
+        return;
+    }
+
+    if (--file->references == 0)
+    {
+        vfs_close(file);
+    }
+}
+
 static bool vfs_log_dir_entry(const char* name,
                               uint32_t inode,
                               uint8_t type,